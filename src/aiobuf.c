@@ -0,0 +1,225 @@
+/*
+* Copyright (c) 2012-2013 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <aio.h>
+
+#include "util.h"
+#include "endiantools.h"
+#include "aiobuf.h"
+
+// Space is reserved on disk in chunks of this size ahead of the writes.
+#define AIOBUF_PREALLOC (64*1024*1024)
+
+static void preallocate(sparkey_aiobuf *buf, uint64_t end) {
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+  if (end <= buf->prealloc_end) {
+    return;
+  }
+  uint64_t len = end - buf->prealloc_end + AIOBUF_PREALLOC;
+  // Best effort only, not all file systems support it.
+  if (fallocate(buf->fd, FALLOC_FL_KEEP_SIZE, buf->prealloc_end, len) == 0) {
+    buf->prealloc_end += len;
+  }
+#else
+  (void) buf;
+  (void) end;
+#endif
+}
+
+static void set_direct(sparkey_aiobuf *buf, int enabled) {
+#if defined(O_DIRECT)
+  int flags = fcntl(buf->fd, F_GETFL);
+  if (flags < 0) {
+    buf->direct = 0;
+    return;
+  }
+  flags = enabled ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+  // Falls back to regular buffered writes on file systems without direct io, such as tmpfs.
+  buf->direct = fcntl(buf->fd, F_SETFL, flags) == 0 && enabled;
+#elif defined(F_NOCACHE)
+  buf->direct = fcntl(buf->fd, F_NOCACHE, enabled) == 0 && enabled;
+#else
+  (void) enabled;
+  buf->direct = 0;
+#endif
+}
+
+sparkey_returncode aiobuf_init(sparkey_aiobuf *buf, int fd, uint64_t file_pos, size_t size) {
+  sparkey_returncode returncode;
+  memset(buf, 0, sizeof(sparkey_aiobuf));
+  buf->fd = fd;
+  buf->size = size;
+  buf->base = file_pos & ~((uint64_t) AIOBUF_ALIGNMENT - 1);
+  buf->used = file_pos - buf->base;
+  buf->prealloc_end = file_pos;
+
+  for (int i = 0; i < 2; i++) {
+    void *p;
+    if (posix_memalign(&p, AIOBUF_ALIGNMENT, size) != 0) {
+      returncode = SPARKEY_INTERNAL_ERROR;
+      goto free_bufs;
+    }
+    buf->bufs[i] = p;
+  }
+  void *head;
+  if (posix_memalign(&head, AIOBUF_ALIGNMENT, AIOBUF_ALIGNMENT) != 0) {
+    returncode = SPARKEY_INTERNAL_ERROR;
+    goto free_bufs;
+  }
+  buf->head = head;
+
+  // Read back what's already in the file before switching to direct io,
+  // since these reads are not aligned.
+  TRY(pread_full(fd, buf->bufs[0], buf->used, buf->base), free_bufs);
+  if (buf->base > 0) {
+    TRY(pread_full(fd, buf->head, AIOBUF_ALIGNMENT, 0), free_bufs);
+    buf->head_valid = 1;
+  }
+
+  set_direct(buf, 1);
+  return SPARKEY_SUCCESS;
+
+free_bufs:
+  free(buf->bufs[0]);
+  free(buf->bufs[1]);
+  free(buf->head);
+  buf->bufs[0] = NULL;
+  buf->bufs[1] = NULL;
+  buf->head = NULL;
+  return returncode;
+}
+
+static sparkey_returncode wait_inflight(sparkey_aiobuf *buf) {
+  if (!buf->inflight) {
+    return SPARKEY_SUCCESS;
+  }
+  const struct aiocb *list[1] = { &buf->cb };
+  int e;
+  while ((e = aio_error(&buf->cb)) == EINPROGRESS) {
+    aio_suspend(list, 1, NULL);
+  }
+  buf->inflight = 0;
+  ssize_t written = aio_return(&buf->cb);
+  if (e != 0) {
+    return sparkey_write_returncode(e);
+  }
+  if ((size_t) written < buf->cb.aio_nbytes) {
+    // Complete short writes synchronously.
+    return pwrite_full(buf->fd, (uint8_t *) buf->cb.aio_buf + written, buf->cb.aio_nbytes - written, buf->cb.aio_offset + written);
+  }
+  return SPARKEY_SUCCESS;
+}
+
+static sparkey_returncode submit(sparkey_aiobuf *buf) {
+  RETHROW(wait_inflight(buf));
+  uint8_t *data = buf->bufs[buf->active];
+  preallocate(buf, buf->base + buf->size);
+  if (buf->base == 0) {
+    memcpy(buf->head, data, AIOBUF_ALIGNMENT);
+    buf->head_valid = 1;
+  }
+
+  memset(&buf->cb, 0, sizeof(struct aiocb));
+  buf->cb.aio_fildes = buf->fd;
+  buf->cb.aio_buf = data;
+  buf->cb.aio_nbytes = buf->size;
+  buf->cb.aio_offset = buf->base;
+  if (aio_write(&buf->cb) == 0) {
+    buf->inflight = 1;
+  } else {
+    RETHROW(pwrite_full(buf->fd, data, buf->size, buf->base));
+  }
+
+  buf->active ^= 1;
+  buf->base += buf->size;
+  buf->used = 0;
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode aiobuf_add(sparkey_aiobuf *buf, const uint8_t *data, ptrdiff_t len) {
+  while (len > 0) {
+    size_t n = buf->size - buf->used;
+    if ((size_t) len < n) {
+      n = len;
+    }
+    memcpy(buf->bufs[buf->active] + buf->used, data, n);
+    buf->used += n;
+    data += n;
+    len -= n;
+    if (buf->used == buf->size) {
+      RETHROW(submit(buf));
+    }
+  }
+  return SPARKEY_SUCCESS;
+}
+
+static sparkey_returncode truncate_to(sparkey_aiobuf *buf, uint64_t end) {
+  if (ftruncate(buf->fd, end) < 0) {
+    return sparkey_write_returncode(errno);
+  }
+  buf->prealloc_end = end;
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode aiobuf_flush(sparkey_aiobuf *buf) {
+  RETHROW(wait_inflight(buf));
+  if (buf->used > 0) {
+    uint8_t *data = buf->bufs[buf->active];
+    size_t padded = (buf->used + AIOBUF_ALIGNMENT - 1) & ~((size_t) AIOBUF_ALIGNMENT - 1);
+    memset(data + buf->used, 0, padded - buf->used);
+    RETHROW(pwrite_full(buf->fd, data, padded, buf->base));
+  }
+  // Cut off the padding of the last block. This also releases the preallocated space.
+  return truncate_to(buf, buf->base + buf->used);
+}
+
+sparkey_returncode aiobuf_write_head(sparkey_aiobuf *buf, const uint8_t *head, size_t head_len) {
+  if (buf->base == 0) {
+    // The head block is still being filled, so it's written from the active buffer.
+    uint8_t *data = buf->bufs[buf->active];
+    memcpy(data, head, head_len);
+    RETHROW(pwrite_full(buf->fd, data, AIOBUF_ALIGNMENT, 0));
+    if (buf->used < AIOBUF_ALIGNMENT) {
+      return truncate_to(buf, buf->used);
+    }
+    return SPARKEY_SUCCESS;
+  }
+  memcpy(buf->head, head, head_len);
+  return pwrite_full(buf->fd, buf->head, AIOBUF_ALIGNMENT, 0);
+}
+
+uint64_t aiobuf_position(sparkey_aiobuf *buf) {
+  return buf->base + buf->used;
+}
+
+sparkey_returncode aiobuf_close(sparkey_aiobuf *buf) {
+  sparkey_returncode returncode = wait_inflight(buf);
+  set_direct(buf, 0);
+  free(buf->bufs[0]);
+  free(buf->bufs[1]);
+  free(buf->head);
+  buf->bufs[0] = NULL;
+  buf->bufs[1] = NULL;
+  buf->head = NULL;
+  return returncode;
+}
+
@@ -0,0 +1,100 @@
+/*
+* Copyright (c) 2012-2013 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#ifndef AIOBUF_H_INCLUDED
+#define AIOBUF_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <aio.h>
+
+#include "sparkey.h"
+
+/**
+ * Alignment of file offsets, lengths and memory for direct io.
+ */
+#define AIOBUF_ALIGNMENT (4096)
+
+/**
+ * A double buffered file writer for direct io.
+ *
+ * Data is collected in one aligned buffer while the other one is being
+ * written to the file in the background. The buffer being filled always maps
+ * to the file range starting at base, which is aligned, so partial blocks at
+ * the end of the file are kept in memory and rewritten when they grow.
+ */
+typedef struct {
+  int fd;
+  int direct;
+
+  uint8_t *bufs[2];
+  int active;
+  size_t size;
+  size_t used;
+  uint64_t base;
+
+  struct aiocb cb;
+  int inflight;
+
+  uint8_t *head;
+  int head_valid;
+
+  uint64_t prealloc_end;
+} sparkey_aiobuf;
+
+/**
+ * Starts writing to fd at file_pos, using direct io if the file system supports it.
+ * The bytes between the previous aligned offset and file_pos are read back from
+ * the file, so fd must be open for both reading and writing.
+ * @param buf the buffer to initialize
+ * @param fd a file descriptor open for reading and writing
+ * @param file_pos the offset where the next byte will be written
+ * @param size the size of each of the two buffers. Must be a multiple of AIOBUF_ALIGNMENT.
+ * @returns SPARKEY_SUCCESS if all goes well, otherwise a sparkey error code.
+ */
+sparkey_returncode aiobuf_init(sparkey_aiobuf *buf, int fd, uint64_t file_pos, size_t size);
+
+/**
+ * Appends data, submitting full buffers for writing in the background.
+ */
+sparkey_returncode aiobuf_add(sparkey_aiobuf *buf, const uint8_t *data, ptrdiff_t len);
+
+/**
+ * Waits for background writes and writes the partial buffer to disk.
+ * The file is truncated to the logical end of the data.
+ */
+sparkey_returncode aiobuf_flush(sparkey_aiobuf *buf);
+
+/**
+ * Replaces the first head_len bytes of the file.
+ * Data added since the last aiobuf_flush may be written along with it.
+ * @param head the new content of the start of the file.
+ * @param head_len the size of head. Must not exceed AIOBUF_ALIGNMENT.
+ */
+sparkey_returncode aiobuf_write_head(sparkey_aiobuf *buf, const uint8_t *head, size_t head_len);
+
+/**
+ * @returns the offset in the file of the next byte to be added.
+ */
+uint64_t aiobuf_position(sparkey_aiobuf *buf);
+
+/**
+ * Waits for background writes, switches the file descriptor back to buffered io
+ * and releases all memory. Anything added since the last aiobuf_flush is discarded.
+ */
+sparkey_returncode aiobuf_close(sparkey_aiobuf *buf);
+
+#endif
+
@@ -0,0 +1,283 @@
+/*
+* Copyright (c) 2012-2013 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "sparkey.h"
+#include "sparkey-internal.h"
+#include "analyze.h"
+#include "hashheader.h"
+#include "util.h"
+
+#define CACHE_LINE_SIZE (64)
+#define PAGE_SIZE (4096)
+
+static void histogram_add(sparkey_histogram *histogram, int bucket, uint64_t value) {
+  histogram->count++;
+  histogram->sum += value;
+  if (value > histogram->max) {
+    histogram->max = value;
+  }
+  histogram->buckets[bucket]++;
+}
+
+void histogram_add_linear(sparkey_histogram *histogram, uint64_t value) {
+  histogram_add(histogram, value < HISTOGRAM_BUCKETS - 1 ? (int) value : HISTOGRAM_BUCKETS - 1, value);
+}
+
+void histogram_add_log2(sparkey_histogram *histogram, uint64_t value) {
+  int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+  histogram_add(histogram, bucket < HISTOGRAM_BUCKETS - 1 ? bucket : HISTOGRAM_BUCKETS - 1, value);
+}
+
+static void histogram_merge(sparkey_histogram *dst, const sparkey_histogram *src) {
+  dst->count += src->count;
+  dst->sum += src->sum;
+  if (src->max > dst->max) {
+    dst->max = src->max;
+  }
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    dst->buckets[i] += src->buckets[i];
+  }
+}
+
+typedef struct {
+  sparkey_hashreader *reader;
+  sparkey_analysis analysis;
+} index_scan;
+
+static void * scan_index(void *arg) {
+  index_scan *scan = arg;
+  sparkey_hashheader *header = &scan->reader->header;
+  sparkey_analysis *analysis = &scan->analysis;
+  uint8_t *hashtable = scan->reader->data + header->header_size;
+  uint64_t slot_size = header->hash_size + header->address_size;
+
+  for (uint64_t slot = 0; slot < header->hash_capacity; slot++) {
+    uint64_t pos = slot * slot_size;
+    if (read_addr(hashtable, pos + header->hash_size, header->address_size) == 0) {
+      continue;
+    }
+    uint64_t hash = header->hash_algorithm.read_hash(hashtable, pos);
+    histogram_add_linear(&analysis->displacement, get_displacement(header->hash_capacity, slot, hash));
+
+    // A lookup of this key reads every slot from its wanted slot up to this one.
+    uint64_t start = header->header_size + (hash % header->hash_capacity) * slot_size;
+    uint64_t end = header->header_size + pos + slot_size - 1;
+    if (start > end) {
+      // Wrapped around the end of the table
+      analysis->probes_crossing_lines++;
+      analysis->probes_crossing_pages++;
+      continue;
+    }
+    if (start / CACHE_LINE_SIZE != end / CACHE_LINE_SIZE) {
+      analysis->probes_crossing_lines++;
+    }
+    if (start / PAGE_SIZE != end / PAGE_SIZE) {
+      analysis->probes_crossing_pages++;
+    }
+  }
+  return NULL;
+}
+
+typedef struct {
+  uint64_t position;
+  uint64_t stored_size;
+  uint64_t uncompressed_size;
+  uint64_t entries;
+} block_stat;
+
+typedef struct {
+  sparkey_logreader *log;
+  uint64_t start;
+  uint64_t end;
+  sparkey_analysis analysis;
+  sparkey_returncode returncode;
+
+  // The last two blocks seen. Blocks are added to the histograms one block late,
+  // so that an entry whose header was split off into the previous block is still counted there.
+  block_stat prev;
+  block_stat cur;
+} log_scan;
+
+static void add_block(log_scan *scan, block_stat *block) {
+  if (block->position == 0) {
+    return;
+  }
+  histogram_add_log2(&scan->analysis.block_stored_size, block->stored_size);
+  histogram_add_log2(&scan->analysis.block_uncompressed_size, block->uncompressed_size);
+  histogram_add_log2(&scan->analysis.block_entries, block->entries);
+}
+
+static void observe_block(log_scan *scan, sparkey_logiter *iter) {
+  if (iter->block_position == scan->cur.position) {
+    return;
+  }
+  add_block(scan, &scan->prev);
+  scan->prev = scan->cur;
+  scan->cur.position = iter->block_position;
+  scan->cur.stored_size = iter->next_block_position - iter->block_position;
+  scan->cur.uncompressed_size = iter->block_len;
+  scan->cur.entries = 0;
+}
+
+static void count_entry(log_scan *scan, sparkey_logiter *iter) {
+  if (iter->entry_block_position == scan->cur.position) {
+    scan->cur.entries++;
+  } else if (iter->entry_block_position == scan->prev.position) {
+    scan->prev.entries++;
+  }
+}
+
+static sparkey_returncode scan_range(log_scan *scan, sparkey_logiter *iter) {
+  sparkey_logreader *log = scan->log;
+  sparkey_analysis *analysis = &scan->analysis;
+  int blocks = log->header.compression_type != SPARKEY_COMPRESSION_NONE;
+  while (1) {
+    RETHROW(sparkey_logiter_next(iter, log));
+    if (iter->state != SPARKEY_ITER_ACTIVE) {
+      break;
+    }
+    if (blocks) {
+      observe_block(scan, iter);
+      count_entry(scan, iter);
+    }
+    histogram_add_log2(&analysis->key_size, iter->keylen);
+    if (iter->type == SPARKEY_ENTRY_PUT) {
+      analysis->puts++;
+      histogram_add_log2(&analysis->value_size, iter->valuelen);
+    } else {
+      analysis->deletes++;
+    }
+    if (!blocks) {
+      continue;
+    }
+
+    // Read the entry a block at a time to see which blocks it spans.
+    uint8_t *buf;
+    uint64_t len;
+    do {
+      RETHROW(sparkey_logiter_keychunk(iter, log, iter->keylen, &buf, &len));
+      observe_block(scan, iter);
+    } while (len > 0);
+    if (iter->type == SPARKEY_ENTRY_PUT) {
+      do {
+        RETHROW(sparkey_logiter_valuechunk(iter, log, iter->valuelen, &buf, &len));
+        observe_block(scan, iter);
+      } while (len > 0);
+    }
+    if (iter->block_position != iter->entry_block_position) {
+      analysis->split_entries++;
+    }
+  }
+  add_block(scan, &scan->prev);
+  add_block(scan, &scan->cur);
+  return SPARKEY_SUCCESS;
+}
+
+static void * scan_log(void *arg) {
+  log_scan *scan = arg;
+  sparkey_logiter *iter;
+  scan->returncode = sparkey_logiter_create_range(&iter, scan->log, scan->start, scan->end);
+  if (scan->returncode == SPARKEY_SUCCESS) {
+    scan->returncode = scan_range(scan, iter);
+    sparkey_logiter_close(&iter);
+  }
+  return NULL;
+}
+
+static void merge(sparkey_analysis *dst, const sparkey_analysis *src) {
+  histogram_merge(&dst->displacement, &src->displacement);
+  dst->probes_crossing_lines += src->probes_crossing_lines;
+  dst->probes_crossing_pages += src->probes_crossing_pages;
+  dst->puts += src->puts;
+  dst->deletes += src->deletes;
+  histogram_merge(&dst->block_stored_size, &src->block_stored_size);
+  histogram_merge(&dst->block_uncompressed_size, &src->block_uncompressed_size);
+  histogram_merge(&dst->block_entries, &src->block_entries);
+  dst->split_entries += src->split_entries;
+  histogram_merge(&dst->key_size, &src->key_size);
+  histogram_merge(&dst->value_size, &src->value_size);
+}
+
+sparkey_returncode sparkey_analyze(sparkey_analysis *analysis, const char *hash_filename, const char *log_filename, int num_threads) {
+  sparkey_hashreader *reader;
+  RETHROW(sparkey_hash_open(&reader, hash_filename, log_filename));
+
+  memset(analysis, 0, sizeof(sparkey_analysis));
+  analysis->capacity = reader->header.hash_capacity;
+  analysis->slot_size = reader->header.hash_size + reader->header.address_size;
+  analysis->data_size = reader->log.header.data_end - reader->log.header.header_size;
+  analysis->garbage_size = reader->header.garbage_size;
+
+  sparkey_returncode returncode;
+  if (num_threads < 1) {
+    num_threads = 1;
+  }
+  int num_ranges = num_threads;
+  uint64_t *boundaries = malloc((num_ranges + 1) * sizeof(uint64_t));
+  log_scan *scans = calloc(num_ranges, sizeof(log_scan));
+  pthread_t *threads = calloc(num_ranges, sizeof(pthread_t));
+  int *started = calloc(num_ranges, sizeof(int));
+  if (boundaries == NULL || scans == NULL || threads == NULL || started == NULL) {
+    returncode = SPARKEY_INTERNAL_ERROR;
+    goto cleanup;
+  }
+  TRY(sparkey_logreader_partition(&reader->log, boundaries, &num_ranges), cleanup);
+
+  index_scan index;
+  memset(&index, 0, sizeof(index));
+  index.reader = reader;
+  pthread_t index_thread;
+  int index_started = pthread_create(&index_thread, NULL, scan_index, &index) == 0;
+  if (!index_started) {
+    scan_index(&index);
+  }
+
+  for (int i = 0; i < num_ranges; i++) {
+    scans[i].log = &reader->log;
+    scans[i].start = boundaries[i];
+    scans[i].end = boundaries[i + 1];
+    started[i] = pthread_create(&threads[i], NULL, scan_log, &scans[i]) == 0;
+    if (!started[i]) {
+      scan_log(&scans[i]);
+    }
+  }
+
+  returncode = SPARKEY_SUCCESS;
+  for (int i = 0; i < num_ranges; i++) {
+    if (started[i]) {
+      pthread_join(threads[i], NULL);
+    }
+    if (returncode == SPARKEY_SUCCESS) {
+      returncode = scans[i].returncode;
+    }
+    merge(analysis, &scans[i].analysis);
+  }
+  if (index_started) {
+    pthread_join(index_thread, NULL);
+  }
+  merge(analysis, &index.analysis);
+
+cleanup:
+  free(boundaries);
+  free(scans);
+  free(threads);
+  free(started);
+  sparkey_hash_close(&reader);
+  return returncode;
+}
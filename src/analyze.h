@@ -0,0 +1,78 @@
+/*
+* Copyright (c) 2012-2013 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#ifndef SPARKEY_ANALYZE_H_INCLUDED
+#define SPARKEY_ANALYZE_H_INCLUDED
+
+#include <stdint.h>
+
+#include "sparkey.h"
+
+#define HISTOGRAM_BUCKETS (64)
+
+/*
+ * A histogram either counts values one bucket per value (linear),
+ * with the last bucket holding everything larger, or one bucket per power of two (log2),
+ * where bucket 0 holds zeros and bucket k holds values in [2^(k-1), 2^k).
+ */
+typedef struct {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[HISTOGRAM_BUCKETS];
+} sparkey_histogram;
+
+typedef struct {
+  // Hash table
+  uint64_t capacity;
+  uint64_t slot_size;
+  /** Displacement of every used slot, linear. */
+  sparkey_histogram displacement;
+  /** Number of lookups of stored keys whose probe sequence spans more than one cache line or page. */
+  uint64_t probes_crossing_lines;
+  uint64_t probes_crossing_pages;
+
+  // Log
+  uint64_t puts;
+  uint64_t deletes;
+  uint64_t data_size;
+  uint64_t garbage_size;
+  /** Stored size of every compression block, including its length prefix and checksum, log2. */
+  sparkey_histogram block_stored_size;
+  /** Uncompressed size of every compression block, log2. */
+  sparkey_histogram block_uncompressed_size;
+  /** Number of entries that start in every compression block, log2. */
+  sparkey_histogram block_entries;
+  /** Number of entries whose key or value continues in a following block. */
+  uint64_t split_entries;
+  sparkey_histogram key_size;
+  sparkey_histogram value_size;
+} sparkey_analysis;
+
+void histogram_add_linear(sparkey_histogram *histogram, uint64_t value);
+void histogram_add_log2(sparkey_histogram *histogram, uint64_t value);
+
+/**
+ * Scans a hash table and its log. The log is split into ranges that are scanned by num_threads threads,
+ * while another thread scans the hash table.
+ * @param analysis set to the results.
+ * @param hash_filename a sparkey hash table.
+ * @param log_filename the log of the hash table.
+ * @param num_threads the number of threads that scan the log.
+ * @returns SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_analyze(sparkey_analysis *analysis, const char *hash_filename, const char *log_filename, int num_threads);
+
+#endif
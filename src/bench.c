@@ -38,7 +38,10 @@ static void rm_rec(const char *dir) {
     struct dirent *d;
     while ((d = readdir(tmpd))) {
       char subdir[100];
-      sprintf(subdir, "%s/%s", dir, d->d_name);
+      int len = snprintf(subdir, sizeof subdir, "%s/%s", dir, d->d_name);
+      if (len < 0 || (size_t) len >= sizeof subdir) {
+        continue;
+      }
       if(strcmp(d->d_name, ".") &&
          strcmp(d->d_name, "..")) {
         if (d->d_type == DT_DIR) {
@@ -78,7 +81,10 @@ static size_t file_size_rec(const char *dir) {
       struct dirent *d;
       while ((d = readdir(tmpd))) {
         char subdir[100];
-        sprintf(subdir, "%s/%s", dir, d->d_name);
+        int len = snprintf(subdir, sizeof subdir, "%s/%s", dir, d->d_name);
+        if (len < 0 || (size_t) len >= sizeof subdir) {
+          continue;
+        }
         if(strcmp(d->d_name, ".") &&
            strcmp(d->d_name, "..")) {
           sum += file_size_rec(subdir);
@@ -131,16 +137,554 @@ static void timesub(struct timeval *tv1, struct timeval *tv2)
 	tv1->tv_sec = tv2->tv_sec - tv1->tv_sec;
 }
 
+#include <stdint.h>
+#include <time.h>
+
+static uint64_t nanotime()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Latency histogram in nanoseconds, log-linear like HdrHistogram:
+ * values below LATENCY_SUB_COUNT are exact, larger values keep
+ * LATENCY_SUB_BITS significant bits, i.e. are within ~3%. */
+#define LATENCY_SUB_BITS 5
+#define LATENCY_SUB_COUNT (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB_COUNT)
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[LATENCY_BUCKETS];
+} latency;
+
+static int latency_bucket(uint64_t ns) {
+  if (ns < LATENCY_SUB_COUNT) {
+    return (int) ns;
+  }
+  int shift = 63 - __builtin_clzll(ns) - LATENCY_SUB_BITS;
+  return ((shift + 1) << LATENCY_SUB_BITS) + (int) ((ns >> shift) & (LATENCY_SUB_COUNT - 1));
+}
+
+/* Highest value that falls into the bucket */
+static uint64_t latency_bucket_max(int bucket) {
+  if (bucket < LATENCY_SUB_COUNT) {
+    return bucket;
+  }
+  int shift = (bucket >> LATENCY_SUB_BITS) - 1;
+  uint64_t sub = bucket & (LATENCY_SUB_COUNT - 1);
+  return ((LATENCY_SUB_COUNT + sub + 1) << shift) - 1;
+}
+
+static void latency_add(latency *h, uint64_t ns) {
+  h->count++;
+  h->sum += ns;
+  if (ns > h->max) {
+    h->max = ns;
+  }
+  h->buckets[latency_bucket(ns)]++;
+}
+
+static void latency_merge(latency *dst, const latency *src) {
+  dst->count += src->count;
+  dst->sum += src->sum;
+  if (src->max > dst->max) {
+    dst->max = src->max;
+  }
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    dst->buckets[i] += src->buckets[i];
+  }
+}
+
+static uint64_t latency_percentile(const latency *h, double percentile) {
+  uint64_t wanted = (uint64_t) (h->count * percentile / 100.0 + 0.5);
+  if (wanted == 0) {
+    wanted = 1;
+  }
+  uint64_t seen = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= wanted) {
+      uint64_t value = latency_bucket_max(i);
+      return value < h->max ? value : h->max;
+    }
+  }
+  return h->max;
+}
+
+static void latency_print(const char *phase, const latency *h) {
+  printf("    %s latency (ns):  p50 %llu  p90 %llu  p99 %llu  p99.9 %llu  max %llu\n", phase,
+         (unsigned long long) latency_percentile(h, 50.0),
+         (unsigned long long) latency_percentile(h, 90.0),
+         (unsigned long long) latency_percentile(h, 99.0),
+         (unsigned long long) latency_percentile(h, 99.9),
+         (unsigned long long) h->max);
+}
+
+/* Workload, see usage. Keys and values are derived from their index and the
+ * seed, so lookups can regenerate and verify them. Indexes >= n are misses. */
+
+#include <math.h>
+
+typedef enum {
+  POPULARITY_UNIFORM,
+  POPULARITY_ZIPF,
+  POPULARITY_HOTSPOT
+} workload_popularity;
+
+typedef enum {
+  SIZE_NATURAL,
+  SIZE_FIXED,
+  SIZE_UNIFORM,
+  SIZE_EXPONENTIAL
+} workload_size_type;
+
+typedef struct {
+  workload_size_type type;
+  int min;
+  int max;
+  double mean;
+} workload_size;
+
+#define STRUCTURED_KEY_LEN 13
+#define BINARY_KEY_LEN 8
+
+typedef struct {
+  uint64_t seed;
+  workload_popularity popularity;
+  double zipf_theta;
+  double hot_fraction;
+  double hot_probability;
+  workload_size keysize;
+  workload_size valuesize;
+  double miss_ratio;
+  int binary_keys;
+  // Set for candidates with integer_keys
+  int integer_keys;
+
+  // Derived from the number of elements, see workload_prepare
+  int n;
+  double zipf_zetan;
+  double zipf_eta;
+  uint64_t scatter;
+} workload;
+
+static workload wl = {
+  1, POPULARITY_UNIFORM, 0.99, 0.2, 0.8,
+  {SIZE_NATURAL, 0, 0, 0.0}, {SIZE_NATURAL, 0, 0, 0.0}, 0.0, 0, 0,
+  0, 0.0, 0.0, 1
+};
+
+/* Per thread generator state and key/value buffers */
+typedef struct {
+  uint64_t rng;
+  uint8_t *key;
+  uint64_t keylen;
+  uint8_t *value;
+  uint64_t valuelen;
+} workload_gen;
+
+/* splitmix64 finalizer, a bijection */
+static uint64_t mix64(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static uint64_t workload_random(workload_gen *gen) {
+  gen->rng += 0x9e3779b97f4a7c15ULL;
+  return mix64(gen->rng);
+}
+
+/* Uniform in [0, 1) */
+static double workload_random_double(workload_gen *gen) {
+  return (workload_random(gen) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int size_max(const workload_size *size, int natural) {
+  switch (size->type) {
+  case SIZE_NATURAL: return natural;
+  case SIZE_FIXED: return size->min;
+  default: return size->max;
+  }
+}
+
+/* Size of element i, deterministic for a given salt */
+static int size_of(const workload_size *size, uint64_t i, uint64_t salt, int natural) {
+  uint64_t r = mix64(wl.seed ^ salt ^ mix64(i));
+  switch (size->type) {
+  case SIZE_NATURAL: return natural;
+  case SIZE_FIXED: return size->min;
+  case SIZE_UNIFORM: return size->min + (int) (r % (uint64_t) (size->max - size->min + 1));
+  case SIZE_EXPONENTIAL: {
+    double u = ((r >> 11) + 1) * (1.0 / 9007199254740993.0);
+    int s = (int) (-log(u) * size->mean);
+    return s > size->max ? size->max : s;
+  }
+  }
+  return natural;
+}
+
+static void workload_gen_init(workload_gen *gen, uint64_t stream) {
+  gen->rng = mix64(wl.seed + stream);
+  gen->key = malloc(size_max(&wl.keysize, STRUCTURED_KEY_LEN) + 32);
+  gen->value = malloc(size_max(&wl.valuesize, 32) + 32);
+  if (gen->key == NULL || gen->value == NULL) {
+    printf("Failed to allocate workload buffers\n");
+    exit(1);
+  }
+}
+
+static void workload_gen_free(workload_gen *gen) {
+  free(gen->key);
+  free(gen->value);
+}
+
+/* Fill gen->key with key i. Keys are unique: integer keys are the index,
+ * structured keys start with its decimal form, binary keys with a bijective
+ * mix of it. */
+static void workload_key(workload_gen *gen, uint64_t i) {
+  if (wl.integer_keys) {
+    uint32_t x = (uint32_t) i;
+    memcpy(gen->key, &x, sizeof(x));
+    gen->keylen = sizeof(x);
+    return;
+  }
+  int natural = wl.binary_keys ? BINARY_KEY_LEN : STRUCTURED_KEY_LEN;
+  int len = size_of(&wl.keysize, i, 0x6b6579, natural);
+  int prefix;
+  if (wl.binary_keys) {
+    uint64_t x = mix64(i ^ wl.seed);
+    memcpy(gen->key, &x, sizeof(x));
+    prefix = sizeof(x);
+  } else {
+    prefix = sprintf((char *) gen->key, "key_%09llu", (unsigned long long) i);
+  }
+  if (len < prefix) {
+    len = prefix;
+  }
+  uint64_t r = mix64(i + wl.seed);
+  for (int j = prefix; j < len; j++) {
+    if (j % 8 == 0) {
+      r = mix64(r);
+    }
+    uint8_t c = (uint8_t) (r >> (8 * (j % 8)));
+    gen->key[j] = wl.binary_keys ? c : (uint8_t) ('a' + c % 26);
+  }
+  gen->keylen = len;
+}
+
+/* Fill gen->value with the value of key i */
+static void workload_value(workload_gen *gen, uint64_t i) {
+  int natural = sprintf((char *) gen->value, "value_%llu", (unsigned long long) i);
+  int len = size_of(&wl.valuesize, i, 0x76616c, natural);
+  uint64_t r = mix64(i ^ 0x76616c);
+  for (int j = natural; j < len; j++) {
+    if (j % 8 == 0) {
+      r = mix64(r);
+    }
+    gen->value[j] = (uint8_t) ('a' + (r >> (8 * (j % 8))) % 26);
+  }
+  gen->valuelen = len;
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b) {
+  while (b != 0) {
+    uint64_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+/* Precompute popularity constants for n elements */
+static void workload_prepare(int n) {
+  if (wl.n == n) {
+    return;
+  }
+  wl.n = n;
+  // Spread popular ranks over the log with i * scatter mod n.
+  wl.scatter = (mix64(wl.seed) % n) | 1;
+  while (gcd(wl.scatter, n) != 1) {
+    wl.scatter += 2;
+  }
+  if (wl.popularity == POPULARITY_ZIPF) {
+    // Gray et al., "Quickly generating billion-record synthetic databases"
+    double zetan = 0.0;
+    for (int i = 1; i <= n; i++) {
+      zetan += 1.0 / pow(i, wl.zipf_theta);
+    }
+    double zeta2 = 1.0 + 1.0 / pow(2.0, wl.zipf_theta);
+    wl.zipf_zetan = zetan;
+    wl.zipf_eta = (1.0 - pow(2.0 / n, 1.0 - wl.zipf_theta)) / (1.0 - zeta2 / zetan);
+  }
+}
+
+/* Next index to look up, >= wl.n for misses */
+static uint64_t workload_next(workload_gen *gen) {
+  uint64_t n = wl.n;
+  if (wl.miss_ratio > 0.0 && workload_random_double(gen) < wl.miss_ratio) {
+    return n + workload_random(gen) % n;
+  }
+  uint64_t rank;
+  switch (wl.popularity) {
+  case POPULARITY_ZIPF: {
+    double u = workload_random_double(gen);
+    double uz = u * wl.zipf_zetan;
+    if (uz < 1.0) {
+      rank = 0;
+    } else if (uz < 1.0 + pow(0.5, wl.zipf_theta)) {
+      rank = 1;
+    } else {
+      rank = (uint64_t) (n * pow(wl.zipf_eta * u - wl.zipf_eta + 1.0, 1.0 / (1.0 - wl.zipf_theta)));
+      if (rank >= n) {
+        rank = n - 1;
+      }
+    }
+    break;
+  }
+  case POPULARITY_HOTSPOT: {
+    uint64_t hot = (uint64_t) (n * wl.hot_fraction);
+    if (hot == 0) {
+      hot = 1;
+    }
+    if (hot >= n || workload_random_double(gen) < wl.hot_probability) {
+      rank = workload_random(gen) % hot;
+    } else {
+      rank = hot + workload_random(gen) % (n - hot);
+    }
+    break;
+  }
+  default:
+    return workload_random(gen) % n;
+  }
+  return rank * wl.scatter % n;
+}
+
+static int parse_size(const char *arg, workload_size *size) {
+  char *end;
+  if (strncmp(arg, "exp:", 4) == 0) {
+    size->type = SIZE_EXPONENTIAL;
+    size->mean = strtod(arg + 4, &end);
+    size->min = 0;
+    size->max = (int) (16 * size->mean);
+    return *end == 0 && size->mean > 0.0;
+  }
+  size->min = (int) strtol(arg, &end, 10);
+  size->max = size->min;
+  size->type = SIZE_FIXED;
+  if (*end == '-') {
+    size->type = SIZE_UNIFORM;
+    size->max = (int) strtol(end + 1, &end, 10);
+  }
+  return *end == 0 && size->min >= 0 && size->max >= size->min;
+}
+
+static int parse_popularity(const char *arg) {
+  char *end = NULL;
+  if (strcmp(arg, "uniform") == 0) {
+    wl.popularity = POPULARITY_UNIFORM;
+    return 1;
+  }
+  if (strncmp(arg, "zipf", 4) == 0) {
+    wl.popularity = POPULARITY_ZIPF;
+    if (arg[4] == 0) {
+      return 1;
+    }
+    wl.zipf_theta = strtod(arg + 5, &end);
+    return arg[4] == ':' && *end == 0 && wl.zipf_theta > 0.0 && wl.zipf_theta < 1.0;
+  }
+  if (strncmp(arg, "hotspot", 7) == 0) {
+    wl.popularity = POPULARITY_HOTSPOT;
+    if (arg[7] == 0) {
+      return 1;
+    }
+    wl.hot_fraction = strtod(arg + 8, &end);
+    if (arg[7] != ':' || *end != ':') {
+      return 0;
+    }
+    wl.hot_probability = strtod(end + 1, &end);
+    return *end == 0 && wl.hot_fraction > 0.0 && wl.hot_fraction <= 1.0 &&
+      wl.hot_probability >= 0.0 && wl.hot_probability <= 1.0;
+  }
+  return 0;
+}
+
+static void print_size(const char *what, const workload_size *size) {
+  switch (size->type) {
+  case SIZE_NATURAL: printf("  %s size: natural\n", what); break;
+  case SIZE_FIXED: printf("  %s size: %d\n", what, size->min); break;
+  case SIZE_UNIFORM: printf("  %s size: uniform %d-%d\n", what, size->min, size->max); break;
+  case SIZE_EXPONENTIAL: printf("  %s size: exponential, mean %.0f, max %d\n", what, size->mean, size->max); break;
+  }
+}
+
+static void workload_print() {
+  printf("Workload (seed %llu):\n", (unsigned long long) wl.seed);
+  switch (wl.popularity) {
+  case POPULARITY_UNIFORM: printf("  popularity: uniform\n"); break;
+  case POPULARITY_ZIPF: printf("  popularity: zipf, theta %.2f\n", wl.zipf_theta); break;
+  case POPULARITY_HOTSPOT: printf("  popularity: hotspot, %.0f%% of lookups on %.0f%% of keys\n",
+                                  100.0 * wl.hot_probability, 100.0 * wl.hot_fraction); break;
+  }
+  printf("  keys: %s\n", wl.binary_keys ? "random binary" : "structured");
+  print_size("key", &wl.keysize);
+  print_size("value", &wl.valuesize);
+  printf("  miss ratio: %.2f\n\n", wl.miss_ratio);
+}
+
+#include "sparkey.h"
+
 typedef struct {
+  // Short name for -c and the results
+  char *id;
   char *name;
-  void (*create)(int n);
-  void (*randomaccess)(int n, int lookups);
+  void (*create)(int n, latency *puts);
+  void (*randomaccess)(int n, int lookups, latency *gets);
   const char** (*files)();
+  // Size of the data, NULL for the size of the files
+  size_t (*datasize)();
+  // Use 32 bit integer keys rather than the keys of the workload
+  int integer_keys;
+  // Checksum verification of Sparkey readers, applied in every scenario
+  sparkey_verify_mode verify;
 } candidate;
 
-/* Sparkey stuff */
+/* Machine readable results, see -o. One JSON object per line and phase,
+ * which is also what compare mode parses. */
 
-#include "sparkey.h"
+static FILE *results;
+static int num_results;
+
+static void results_open(const char *filename) {
+  results = fopen(filename, "w");
+  if (results == NULL) {
+    printf("Could not open %s: %s\n", filename, strerror(errno));
+    exit(1);
+  }
+  fprintf(results, "{\n  \"workload\": {\"seed\": %llu, \"popularity\": %d, \"zipf_theta\": %.2f, "
+          "\"hot_fraction\": %.2f, \"hot_probability\": %.2f, \"miss_ratio\": %.2f, \"binary_keys\": %d},\n"
+          "  \"results\": [\n",
+          (unsigned long long) wl.seed, wl.popularity, wl.zipf_theta, wl.hot_fraction,
+          wl.hot_probability, wl.miss_ratio, wl.binary_keys);
+}
+
+static void results_close() {
+  if (results == NULL) {
+    return;
+  }
+  fprintf(results, "\n  ]\n}\n");
+  fclose(results);
+}
+
+static void results_add(candidate *c, int n, int lookups, int threads, const char *phase, const latency *h, float throughput) {
+  if (results == NULL) {
+    return;
+  }
+  fprintf(results, "%s    {\"id\": \"%s\", \"candidate\": \"%s\", \"elements\": %d, \"lookups\": %d, "
+          "\"threads\": %d, \"phase\": \"%s\", \"ops\": %llu, \"throughput\": %.2f, \"mean_ns\": %llu, "
+          "\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}",
+          num_results ? ",\n" : "", c->id, c->name, n, lookups, threads, phase,
+          (unsigned long long) h->count, throughput,
+          (unsigned long long) (h->count ? h->sum / h->count : 0),
+          (unsigned long long) latency_percentile(h, 50.0),
+          (unsigned long long) latency_percentile(h, 90.0),
+          (unsigned long long) latency_percentile(h, 99.0),
+          (unsigned long long) latency_percentile(h, 99.9),
+          (unsigned long long) h->max);
+  num_results++;
+  fflush(results);
+}
+
+/* Compare mode: match results by candidate, size, threads and phase */
+
+typedef struct {
+  char id[64];
+  int elements;
+  int lookups;
+  int threads;
+  char phase[32];
+  double throughput;
+  unsigned long long p99;
+} result_row;
+
+static int results_read(const char *filename, result_row **rows) {
+  FILE *f = fopen(filename, "r");
+  if (f == NULL) {
+    printf("Could not open %s: %s\n", filename, strerror(errno));
+    exit(1);
+  }
+  char line[1024];
+  int count = 0;
+  int allocated = 0;
+  *rows = NULL;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    result_row row;
+    if (sscanf(line, " {\"id\": \"%63[^\"]\", \"candidate\": \"%*[^\"]\", \"elements\": %d, \"lookups\": %d, "
+               "\"threads\": %d, \"phase\": \"%31[^\"]\", \"ops\": %*u, \"throughput\": %lf, \"mean_ns\": %*u, "
+               "\"p50_ns\": %*u, \"p90_ns\": %*u, \"p99_ns\": %llu",
+               row.id, &row.elements, &row.lookups, &row.threads, row.phase, &row.throughput, &row.p99) != 7) {
+      continue;
+    }
+    if (count == allocated) {
+      allocated = allocated ? 2 * allocated : 64;
+      *rows = realloc(*rows, allocated * sizeof(result_row));
+      if (*rows == NULL) {
+        printf("Failed to allocate results\n");
+        exit(1);
+      }
+    }
+    (*rows)[count++] = row;
+  }
+  fclose(f);
+  return count;
+}
+
+static double change(double from, double to) {
+  return from > 0.0 ? 100.0 * (to - from) / from : 0.0;
+}
+
+/* Returns the number of regressions: throughput down or p99 up by more than threshold percent */
+static int compare(const char *base_filename, const char *new_filename, double threshold) {
+  result_row *base, *cur;
+  int num_base = results_read(base_filename, &base);
+  int num_cur = results_read(new_filename, &cur);
+  int regressions = 0;
+
+  printf("Comparing %s (%d results) to %s (%d results), threshold %.1f%%\n",
+         base_filename, num_base, new_filename, num_cur, threshold);
+  for (int i = 0; i < num_cur; i++) {
+    result_row *c = &cur[i];
+    result_row *b = NULL;
+    for (int j = 0; j < num_base; j++) {
+      if (!strcmp(base[j].id, c->id) && base[j].elements == c->elements && base[j].lookups == c->lookups &&
+          base[j].threads == c->threads && !strcmp(base[j].phase, c->phase)) {
+        b = &base[j];
+        break;
+      }
+    }
+    printf("  %-18s %10d %3d threads %-12s", c->id, c->elements, c->threads, c->phase);
+    if (b == NULL) {
+      printf("  not in %s\n", base_filename);
+      continue;
+    }
+    double throughput = change(b->throughput, c->throughput);
+    double p99 = change(b->p99, c->p99);
+    int regression = throughput < -threshold || p99 > threshold;
+    printf("  throughput %12.2f -> %12.2f (%+6.1f%%)  p99 %8llu -> %8llu ns (%+6.1f%%)%s\n",
+           b->throughput, c->throughput, throughput, b->p99, c->p99, p99, regression ? "  REGRESSION" : "");
+    regressions += regression;
+  }
+  printf("%d regressions\n", regressions);
+  free(base);
+  free(cur);
+  return regressions;
+}
+
+/* Sparkey stuff */
 
 static void _sparkey_assert(const char *file, int line, sparkey_returncode i) {
   if (i != SPARKEY_SUCCESS) {
@@ -152,59 +696,169 @@ static void _sparkey_assert(const char *file, int line, sparkey_returncode i) {
 #define sparkey_assert(i) _sparkey_assert(__FILE__, __LINE__, i)
 
 
-static void sparkey_create(int n, sparkey_compression_type compression_type, int block_size) {
+static void sparkey_create(int n, latency *puts, sparkey_compression_type compression_type, int block_size, int checksums) {
   sparkey_logwriter *mywriter;
   sparkey_assert(sparkey_logwriter_create(&mywriter, "test.spl", compression_type, block_size));
+  if (checksums) {
+    sparkey_assert(sparkey_logwriter_set_checksums(mywriter, 1));
+  }
+  workload_gen gen;
+  workload_gen_init(&gen, 0);
   for (int i = 0; i < n; i++) {
-    char mykey[100];
-    char myvalue[100];
-    sprintf(mykey, "key_%09d", i);
-    sprintf(myvalue, "value_%d", i);
-    sparkey_assert(sparkey_logwriter_put(mywriter, strlen(mykey), (uint8_t*)mykey, strlen(myvalue), (uint8_t*)myvalue));
+    workload_key(&gen, i);
+    workload_value(&gen, i);
+    uint64_t t = nanotime();
+    sparkey_assert(sparkey_logwriter_put(mywriter, gen.keylen, gen.key, gen.valuelen, gen.value));
+    latency_add(puts, nanotime() - t);
   }
+  workload_gen_free(&gen);
   sparkey_assert(sparkey_logwriter_close(&mywriter));
   sparkey_assert(sparkey_hash_write("test.spi", "test.spl", 0));
 }
 
-static void sparkey_randomaccess(int n, int lookups) {
+static void sparkey_lookup(sparkey_hashreader *myreader, sparkey_logiter *myiter, uint8_t *valuebuf, workload_gen *gen, latency *gets) {
+  sparkey_logreader *logreader = sparkey_hash_getreader(myreader);
+  uint64_t r = workload_next(gen);
+  workload_key(gen, r);
+  uint64_t t = nanotime();
+  sparkey_assert(sparkey_hash_get(myreader, gen->key, gen->keylen, myiter));
+  if (r >= (uint64_t) wl.n) {
+    latency_add(gets, nanotime() - t);
+    if (sparkey_logiter_state(myiter) == SPARKEY_ITER_ACTIVE) {
+      printf("Found missing key: %llu\n", (unsigned long long) r);
+      exit(1);
+    }
+    return;
+  }
+  if (sparkey_logiter_state(myiter) != SPARKEY_ITER_ACTIVE) {
+    printf("Failed to lookup key: %llu\n", (unsigned long long) r);
+    exit(1);
+  }
+
+  uint64_t wanted_valuelen = sparkey_logiter_valuelen(myiter);
+  uint64_t actual_valuelen;
+  sparkey_assert(sparkey_logiter_fill_value(myiter, logreader, wanted_valuelen, valuebuf, &actual_valuelen));
+  latency_add(gets, nanotime() - t);
+  workload_value(gen, r);
+  if (actual_valuelen != gen->valuelen || memcmp(gen->value, valuebuf, actual_valuelen)) {
+    printf("Did not get the expected value for key: %llu\n", (unsigned long long) r);
+    exit(1);
+  }
+}
+
+static void sparkey_randomaccess_verify(int n, int lookups, latency *gets, sparkey_verify_mode verify) {
   sparkey_hashreader *myreader;
   sparkey_logiter *myiter;
   sparkey_assert(sparkey_hash_open(&myreader, "test.spi", "test.spl"));
   sparkey_logreader *logreader = sparkey_hash_getreader(myreader);
+  sparkey_assert(sparkey_logreader_set_verify(logreader, verify));
   sparkey_assert(sparkey_logiter_create(&myiter, logreader));
+  sparkey_assert(sparkey_logiter_set_access_pattern(myiter, logreader, SPARKEY_ACCESS_RANDOM));
 
   uint8_t *valuebuf = malloc(sparkey_logreader_maxvaluelen(logreader));
 
+  workload_gen gen;
+  workload_gen_init(&gen, 0);
+  workload_prepare(n);
   for (int i = 0; i < lookups; i++) {
-    char mykey[100];
-    char myvalue[100];
-    int r = rand() % n;
-    sprintf(mykey, "key_%09d", r);
-    sprintf(myvalue, "value_%d", r);
-    sparkey_assert(sparkey_hash_get(myreader, (uint8_t*)mykey, strlen(mykey), myiter));
-    if (sparkey_logiter_state(myiter) != SPARKEY_ITER_ACTIVE) {
-      printf("Failed to lookup key: %s\n", mykey);
-      exit(1);
+    sparkey_lookup(myreader, myiter, valuebuf, &gen, gets);
+  }
+  workload_gen_free(&gen);
+  free(valuebuf);
+  sparkey_logiter_close(&myiter);
+  sparkey_hash_close(&myreader);
+}
+
+static void sparkey_randomaccess(int n, int lookups, latency *gets) {
+  sparkey_randomaccess_verify(n, lookups, gets, SPARKEY_VERIFY_ALWAYS);
+}
+
+static void sparkey_randomaccess_verify_off(int n, int lookups, latency *gets) {
+  sparkey_randomaccess_verify(n, lookups, gets, SPARKEY_VERIFY_OFF);
+}
+
+static void sparkey_randomaccess_verify_first_access(int n, int lookups, latency *gets) {
+  sparkey_randomaccess_verify(n, lookups, gets, SPARKEY_VERIFY_FIRST_ACCESS);
+}
+
+static void sparkey_create_uncompressed(int n, latency *puts) {
+  sparkey_create(n, puts, SPARKEY_COMPRESSION_NONE, 0, 0);
+}
+
+static void sparkey_create_compressed(int n, latency *puts) {
+  sparkey_create(n, puts, SPARKEY_COMPRESSION_SNAPPY, 1024, 0);
+}
+
+static void sparkey_create_checksummed(int n, latency *puts) {
+  sparkey_create(n, puts, SPARKEY_COMPRESSION_SNAPPY, 1024, 1);
+}
+
+/* Durability modes, flushing every FLUSH_INTERVAL puts */
+
+#include <pthread.h>
+
+#define FLUSH_INTERVAL 1000
+#define GROUP_COMMIT_THREADS 4
+
+typedef struct {
+  sparkey_logwriter *writer;
+  int start;
+  int end;
+  latency puts;
+} durable_range;
+
+static void *sparkey_put_durable(void *arg) {
+  durable_range *range = arg;
+  workload_gen gen;
+  workload_gen_init(&gen, 0);
+  for (int i = range->start; i < range->end; i++) {
+    workload_key(&gen, i);
+    workload_value(&gen, i);
+    uint64_t t = nanotime();
+    sparkey_assert(sparkey_logwriter_put(range->writer, gen.keylen, gen.key, gen.valuelen, gen.value));
+    if ((i - range->start) % FLUSH_INTERVAL == FLUSH_INTERVAL - 1) {
+      sparkey_assert(sparkey_logwriter_flush(range->writer));
     }
+    latency_add(&range->puts, nanotime() - t);
+  }
+  workload_gen_free(&gen);
+  return NULL;
+}
 
-    uint64_t wanted_valuelen = sparkey_logiter_valuelen(myiter);
-    uint64_t actual_valuelen;
-    sparkey_assert(sparkey_logiter_fill_value(myiter, logreader, wanted_valuelen, valuebuf, &actual_valuelen));
-    if (actual_valuelen != strlen(myvalue) || memcmp(myvalue, valuebuf, actual_valuelen)) {
-      printf("Did not get the expected value for key: %s\n", mykey);
+static void sparkey_create_durable(int n, latency *puts, sparkey_durability durability, int num_threads) {
+  sparkey_logwriter *mywriter;
+  sparkey_assert(sparkey_logwriter_create(&mywriter, "test.spl", SPARKEY_COMPRESSION_NONE, 0));
+  sparkey_assert(sparkey_logwriter_set_durability(mywriter, durability));
+  pthread_t threads[GROUP_COMMIT_THREADS];
+  durable_range ranges[GROUP_COMMIT_THREADS];
+  for (int t = 0; t < num_threads; t++) {
+    ranges[t].writer = mywriter;
+    ranges[t].start = (int) ((int64_t) n * t / num_threads);
+    ranges[t].end = (int) ((int64_t) n * (t + 1) / num_threads);
+    memset(&ranges[t].puts, 0, sizeof(latency));
+    if (pthread_create(&threads[t], NULL, sparkey_put_durable, &ranges[t]) != 0) {
+      printf("Failed to create thread\n");
       exit(1);
     }
   }
-  sparkey_logiter_close(&myiter);
-  sparkey_hash_close(&myreader);
+  for (int t = 0; t < num_threads; t++) {
+    pthread_join(threads[t], NULL);
+    latency_merge(puts, &ranges[t].puts);
+  }
+  sparkey_assert(sparkey_logwriter_close(&mywriter));
+  sparkey_assert(sparkey_hash_write("test.spi", "test.spl", 0));
 }
 
-static void sparkey_create_uncompressed(int n) {
-  sparkey_create(n, SPARKEY_COMPRESSION_NONE, 0);
+static void sparkey_create_nosync(int n, latency *puts) {
+  sparkey_create_durable(n, puts, SPARKEY_DURABILITY_NONE, 1);
 }
 
-static void sparkey_create_compressed(int n) {
-  sparkey_create(n, SPARKEY_COMPRESSION_SNAPPY, 1024);
+static void sparkey_create_fdatasync(int n, latency *puts) {
+  sparkey_create_durable(n, puts, SPARKEY_DURABILITY_FDATASYNC, 1);
+}
+
+static void sparkey_create_group_commit(int n, latency *puts) {
+  sparkey_create_durable(n, puts, SPARKEY_DURABILITY_GROUP_COMMIT, GROUP_COMMIT_THREADS);
 }
 
 static const char* sparkey_list[] = {"test.spi", "test.spl", NULL};
@@ -214,20 +868,460 @@ static const char** sparkey_files() {
 }
 
 static candidate sparkey_candidate_uncompressed = {
-  "Sparkey uncompressed", &sparkey_create_uncompressed, &sparkey_randomaccess, &sparkey_files
+  "uncompressed", "Sparkey uncompressed", &sparkey_create_uncompressed, &sparkey_randomaccess, &sparkey_files, NULL, 0, SPARKEY_VERIFY_ALWAYS
 };
 
 static candidate sparkey_candidate_compressed = {
-  "Sparkey compressed(1024)", &sparkey_create_compressed, &sparkey_randomaccess, &sparkey_files
+  "snappy", "Sparkey compressed(1024)", &sparkey_create_compressed, &sparkey_randomaccess, &sparkey_files, NULL, 0, SPARKEY_VERIFY_ALWAYS
+};
+
+static candidate sparkey_candidate_checksums_off = {
+  "crc-verify-off", "Sparkey compressed(1024) crc32c, verify off", &sparkey_create_checksummed, &sparkey_randomaccess_verify_off, &sparkey_files, NULL, 0, SPARKEY_VERIFY_OFF
+};
+
+static candidate sparkey_candidate_checksums_first_access = {
+  "crc-verify-first", "Sparkey compressed(1024) crc32c, verify first access", &sparkey_create_checksummed, &sparkey_randomaccess_verify_first_access, &sparkey_files, NULL, 0, SPARKEY_VERIFY_FIRST_ACCESS
 };
 
+static candidate sparkey_candidate_checksums_always = {
+  "crc-verify-always", "Sparkey compressed(1024) crc32c, verify always", &sparkey_create_checksummed, &sparkey_randomaccess, &sparkey_files, NULL, 0, SPARKEY_VERIFY_ALWAYS
+};
+
+static candidate sparkey_candidate_nosync = {
+  "flush-nosync", "Sparkey flush(1000) no sync", &sparkey_create_nosync, &sparkey_randomaccess, &sparkey_files, NULL, 0, SPARKEY_VERIFY_ALWAYS
+};
+
+static candidate sparkey_candidate_fdatasync = {
+  "flush-fdatasync", "Sparkey flush(1000) fdatasync", &sparkey_create_fdatasync, &sparkey_randomaccess, &sparkey_files, NULL, 0, SPARKEY_VERIFY_ALWAYS
+};
+
+static candidate sparkey_candidate_group_commit = {
+  "flush-group-commit", "Sparkey flush(1000) group commit, 4 threads", &sparkey_create_group_commit, &sparkey_randomaccess, &sparkey_files, NULL, 0, SPARKEY_VERIFY_ALWAYS
+};
+
+static candidate sparkey_candidate_integer = {
+  "int", "Sparkey uncompressed, integer keys", &sparkey_create_uncompressed, &sparkey_randomaccess, &sparkey_files, NULL, 1, SPARKEY_VERIFY_ALWAYS
+};
+
+static candidate sparkey_candidate_integer_compressed = {
+  "int-snappy", "Sparkey compressed(1024), integer keys", &sparkey_create_compressed, &sparkey_randomaccess, &sparkey_files, NULL, 1, SPARKEY_VERIFY_ALWAYS
+};
+
+/* LMDB stuff */
+
+#ifdef HAVE_LMDB
+#include <lmdb.h>
+
+static void _mdb_assert(const char *file, int line, int i) {
+  if (i != MDB_SUCCESS) {
+    printf("%s:%d: assertion failed: %s\n", file, line, mdb_strerror(i));
+    exit(i);
+  }
+}
+
+#define mdb_assert(i) _mdb_assert(__FILE__, __LINE__, i)
+
+#define MDB_COMMIT_INTERVAL 1000
+
+static size_t dsize;
+
+static void mdb_create(int n, latency *puts) {
+  MDB_env *env;
+  MDB_txn *txn;
+  MDB_dbi dbi;
+  MDB_cursor *mc;
+  MDB_val key, val;
+  MDB_stat ms;
+  MDB_envinfo info;
+  size_t entry_size = size_max(&wl.keysize, STRUCTURED_KEY_LEN) + size_max(&wl.valuesize, 32) + 64;
+  // Structured and integer keys are created in order
+  unsigned int put_flags = wl.binary_keys && !wl.integer_keys ? 0 : MDB_APPEND;
+  workload_gen gen;
+
+  workload_gen_init(&gen, 0);
+  mdb_assert(mdb_env_create(&env));
+  mdb_assert(mdb_env_set_mapsize(env, n * entry_size * 2));	/* fudge */
+  mdb_assert(mdb_env_open(env, "test.mdb", MDB_NOSYNC|MDB_WRITEMAP|MDB_NOSUBDIR, 0664));
+  mdb_assert(mdb_txn_begin(env, NULL, 0, &txn));
+  mdb_assert(mdb_dbi_open(txn, NULL, wl.integer_keys ? MDB_INTEGERKEY : 0, &dbi));
+  mdb_assert(mdb_cursor_open(txn, dbi, &mc));
+  for (int i = 0; i < n; i++) {
+    workload_key(&gen, i);
+    workload_value(&gen, i);
+    key.mv_data = gen.key;
+    key.mv_size = gen.keylen;
+    val.mv_data = gen.value;
+    val.mv_size = gen.valuelen;
+    uint64_t t = nanotime();
+    mdb_assert(mdb_cursor_put(mc, &key, &val, put_flags));
+    if (i % MDB_COMMIT_INTERVAL == MDB_COMMIT_INTERVAL - 1) {
+      mdb_assert(mdb_txn_commit(txn));
+      mdb_assert(mdb_txn_begin(env, NULL, 0, &txn));
+      mdb_assert(mdb_cursor_open(txn, dbi, &mc));
+    }
+    latency_add(puts, nanotime() - t);
+  }
+  mdb_assert(mdb_txn_commit(txn));
+  mdb_env_stat(env, &ms);
+  mdb_env_info(env, &info);
+  dsize = ms.ms_psize * info.me_last_pgno;
+  mdb_env_close(env);
+  workload_gen_free(&gen);
+}
+
+static void mdb_randomaccess(int n, int lookups, latency *gets) {
+  MDB_env *env;
+  MDB_txn *txn;
+  MDB_dbi dbi;
+  MDB_cursor *mc;
+  MDB_val key, val;
+  workload_gen gen;
+
+  workload_gen_init(&gen, 0);
+  workload_prepare(n);
+  mdb_assert(mdb_env_create(&env));
+  mdb_assert(mdb_env_open(env, "test.mdb", MDB_RDONLY|MDB_NOSUBDIR, 0664));
+  mdb_assert(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+  mdb_assert(mdb_dbi_open(txn, NULL, wl.integer_keys ? MDB_INTEGERKEY : 0, &dbi));
+  mdb_assert(mdb_cursor_open(txn, dbi, &mc));
+
+  for (int i = 0; i < lookups; i++) {
+    uint64_t r = workload_next(&gen);
+    workload_key(&gen, r);
+    key.mv_data = gen.key;
+    key.mv_size = gen.keylen;
+    uint64_t t = nanotime();
+    int rc = mdb_cursor_get(mc, &key, &val, MDB_SET);
+    latency_add(gets, nanotime() - t);
+    if (r >= (uint64_t) n) {
+      if (rc != MDB_NOTFOUND) {
+        printf("Found missing key: %llu\n", (unsigned long long) r);
+        exit(1);
+      }
+      continue;
+    }
+    mdb_assert(rc);
+    workload_value(&gen, r);
+    if (val.mv_size != gen.valuelen || memcmp(gen.value, val.mv_data, val.mv_size)) {
+      printf("Did not get the expected value for key: %llu\n", (unsigned long long) r);
+      exit(1);
+    }
+  }
+  mdb_cursor_close(mc);
+  mdb_txn_abort(txn);
+  mdb_env_close(env);
+  workload_gen_free(&gen);
+}
+
+static size_t mdb_datasize() {
+  return dsize;
+}
+
+static const char* mdb_list[] = {"test.mdb", "test.mdb-lock", NULL};
+
+static const char** mdb_files() {
+  return mdb_list;
+}
+
+static candidate mdb_candidate = {
+  "lmdb", "LMDB", &mdb_create, &mdb_randomaccess, &mdb_files, &mdb_datasize, 0, SPARKEY_VERIFY_ALWAYS
+};
+
+static candidate mdb_candidate_integer = {
+  "lmdb-int", "LMDB, integer keys", &mdb_create, &mdb_randomaccess, &mdb_files, &mdb_datasize, 1, SPARKEY_VERIFY_ALWAYS
+};
+#endif
+
+/* Candidates selectable with -c */
+
+static candidate *candidates[] = {
+  &sparkey_candidate_uncompressed,
+  &sparkey_candidate_compressed,
+  &sparkey_candidate_integer,
+  &sparkey_candidate_integer_compressed,
+  &sparkey_candidate_checksums_off,
+  &sparkey_candidate_checksums_first_access,
+  &sparkey_candidate_checksums_always,
+  &sparkey_candidate_nosync,
+  &sparkey_candidate_fdatasync,
+  &sparkey_candidate_group_commit,
+#ifdef HAVE_LMDB
+  &mdb_candidate,
+  &mdb_candidate_integer,
+#endif
+  NULL
+};
+
+static candidate *find_candidate(const char *id) {
+  for (int i = 0; candidates[i] != NULL; i++) {
+    if (!strcmp(candidates[i]->id, id)) {
+      return candidates[i];
+    }
+  }
+  return NULL;
+}
+
+/* Scaling and cold cache scenarios open test.spi and test.spl directly */
+static int is_sparkey(candidate *c) {
+  return c->files == &sparkey_files;
+}
+
+/* Startup cost of opening many small shards */
+
+#define STARTUP_DIR "startup"
+
+static void startup_filenames(int i, char *hash_filename, char *log_filename) {
+  sprintf(hash_filename, STARTUP_DIR "/%05d.spi", i);
+  sprintf(log_filename, STARTUP_DIR "/%05d.spl", i);
+}
+
+void test_startup(int num_files) {
+  struct timeval t1_wall, t2_wall;
+  struct timeval t1_cpu[2], t2_cpu[2];
+  float f;
+
+  printf("Testing opening %d small hash and log files\n", num_files);
+  rm_rec(STARTUP_DIR);
+  errno_assert(mkdir(STARTUP_DIR, 0755));
+  for (int i = 0; i < num_files; i++) {
+    char hash_filename[100];
+    char log_filename[100];
+    startup_filenames(i, hash_filename, log_filename);
+    sparkey_logwriter *mywriter;
+    sparkey_assert(sparkey_logwriter_create(&mywriter, log_filename, SPARKEY_COMPRESSION_NONE, 0));
+    for (int j = 0; j < 10; j++) {
+      char mykey[100];
+      char myvalue[100];
+      sprintf(mykey, "key_%09d", j);
+      sprintf(myvalue, "value_%d", j);
+      sparkey_assert(sparkey_logwriter_put(mywriter, strlen(mykey), (uint8_t*)mykey, strlen(myvalue), (uint8_t*)myvalue));
+    }
+    sparkey_assert(sparkey_logwriter_close(&mywriter));
+    sparkey_assert(sparkey_hash_write(hash_filename, log_filename, 0));
+  }
+
+  wall(&t1_wall);
+  cpu(t1_cpu);
+
+  for (int i = 0; i < num_files; i++) {
+    char hash_filename[100];
+    char log_filename[100];
+    startup_filenames(i, hash_filename, log_filename);
+    sparkey_hashreader *myreader;
+    sparkey_assert(sparkey_hash_open(&myreader, hash_filename, log_filename));
+    sparkey_hash_close(&myreader);
+  }
+
+  wall(&t2_wall);
+  cpu(t2_cpu);
+  timesub(&t1_wall, &t2_wall);
+  timesub(&t1_cpu[0], &t2_cpu[0]);
+  timesub(&t1_cpu[1], &t2_cpu[1]);
+
+  printf("    open time (wall):         %d.%06d\n", (int)t1_wall.tv_sec, (int)t1_wall.tv_usec);
+  printf("    open time (ucpu):         %d.%06d\n", (int)t1_cpu[0].tv_sec, (int)t1_cpu[0].tv_usec);
+  printf("    open time (scpu):         %d.%06d\n", (int)t1_cpu[1].tv_sec, (int)t1_cpu[1].tv_usec);
+  f = t1_wall.tv_sec + 1e-6 * t1_wall.tv_usec;
+  printf("    throughput (opens/sec):   %2.2f\n", (float) num_files / f);
+  rm_rec(STARTUP_DIR);
+
+  printf("\n");
+}
+
+/* Lookup scaling, with 1..max_threads threads sharing one reader */
+
+typedef struct {
+  sparkey_hashreader *reader;
+  pthread_barrier_t *start;
+  int n;
+  int lookups;
+  workload_gen gen;
+  latency gets;
+} lookup_thread;
+
+static void *sparkey_lookup_thread(void *arg) {
+  lookup_thread *lt = arg;
+  sparkey_logreader *logreader = sparkey_hash_getreader(lt->reader);
+  sparkey_logiter *myiter;
+  sparkey_assert(sparkey_logiter_create(&myiter, logreader));
+  sparkey_assert(sparkey_logiter_set_access_pattern(myiter, logreader, SPARKEY_ACCESS_RANDOM));
+  uint8_t *valuebuf = malloc(sparkey_logreader_maxvaluelen(logreader));
+
+  pthread_barrier_wait(lt->start);
+  for (int i = 0; i < lt->lookups; i++) {
+    sparkey_lookup(lt->reader, myiter, valuebuf, &lt->gen, &lt->gets);
+  }
+  free(valuebuf);
+  sparkey_logiter_close(&myiter);
+  return NULL;
+}
+
+static void test_scaling_threads(candidate *c, sparkey_hashreader *myreader, int n, int lookups, int num_threads) {
+  pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+  lookup_thread *lts = malloc(num_threads * sizeof(lookup_thread));
+  static latency gets;
+  pthread_barrier_t start;
+  uint64_t t1, t2;
+
+  memset(&gets, 0, sizeof(gets));
+  if (threads == NULL || lts == NULL || pthread_barrier_init(&start, NULL, num_threads + 1) != 0) {
+    printf("Failed to set up %d threads\n", num_threads);
+    exit(1);
+  }
+  for (int t = 0; t < num_threads; t++) {
+    memset(&lts[t], 0, sizeof(lookup_thread));
+    lts[t].reader = myreader;
+    lts[t].start = &start;
+    lts[t].n = n;
+    lts[t].lookups = lookups;
+    workload_gen_init(&lts[t].gen, t + 1);
+    if (pthread_create(&threads[t], NULL, sparkey_lookup_thread, &lts[t]) != 0) {
+      printf("Failed to create thread\n");
+      exit(1);
+    }
+  }
+  pthread_barrier_wait(&start);
+  t1 = nanotime();
+  for (int t = 0; t < num_threads; t++) {
+    pthread_join(threads[t], NULL);
+    latency_merge(&gets, &lts[t].gets);
+    workload_gen_free(&lts[t].gen);
+  }
+  t2 = nanotime();
+  pthread_barrier_destroy(&start);
+
+  float f = (float) gets.count / ((t2 - t1) * 1e-9);
+  printf("    %3d threads, throughput (lookups/sec): %2.2f  per thread: %2.2f\n", num_threads, f, f / num_threads);
+  latency_print("lookup", &gets);
+  results_add(c, n, lookups, num_threads, "lookup", &gets, f);
+  free(lts);
+  free(threads);
+}
+
+void test_scaling(candidate *c, int n, int lookups, int max_threads) {
+  static latency puts;
+
+  printf("Testing %d random lookups per thread on %d elements, 1 to %d threads sharing a reader\n", lookups, n, max_threads);
+  printf("  Candidate: %s\n", c->name);
+  rm_all_rec(c->files());
+  memset(&puts, 0, sizeof(puts));
+  c->create(n, &puts);
+
+  sparkey_hashreader *myreader;
+  sparkey_assert(sparkey_hash_open(&myreader, "test.spi", "test.spl"));
+  sparkey_assert(sparkey_logreader_set_verify(sparkey_hash_getreader(myreader), c->verify));
+  workload_prepare(n);
+  for (int num_threads = 1; ; num_threads *= 2) {
+    if (num_threads > max_threads) {
+      num_threads = max_threads;
+    }
+    test_scaling_threads(c, myreader, n, lookups, num_threads);
+    if (num_threads == max_threads) {
+      break;
+    }
+  }
+  sparkey_hash_close(&myreader);
+  rm_all_rec(c->files());
+
+  printf("\n");
+}
+
+/* Cold cache: lookups right after evicting the files from the page cache */
+
+#include <fcntl.h>
+
+#define COLD_INTERVALS 10
+
+static void evict_files(const char** files) {
+  for (int i = 0; files[i] != NULL; i++) {
+    int fd = open(files[i], O_RDONLY);
+    errno_assert(fd < 0);
+    // Only clean pages can be dropped
+    errno_assert(fdatasync(fd));
+    errno = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    errno_assert(errno);
+    close(fd);
+  }
+}
+
+static void faults(long *minflt, long *majflt) {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  *minflt = ru.ru_minflt;
+  *majflt = ru.ru_majflt;
+}
+
+void test_cold(candidate *c, int n, int lookups) {
+  static latency puts, gets;
+  long minflt1, majflt1, minflt2, majflt2;
+  uint64_t t1, t2, t3;
+
+  printf("Testing %d random lookups on %d elements with a cold page cache\n", lookups, n);
+  printf("  Candidate: %s\n", c->name);
+  rm_all_rec(c->files());
+  memset(&puts, 0, sizeof(puts));
+  memset(&gets, 0, sizeof(gets));
+  c->create(n, &puts);
+  evict_files(c->files());
+
+  faults(&minflt1, &majflt1);
+  t1 = nanotime();
+  sparkey_hashreader *myreader;
+  sparkey_logiter *myiter;
+  sparkey_assert(sparkey_hash_open(&myreader, "test.spi", "test.spl"));
+  t2 = nanotime();
+  sparkey_logreader *logreader = sparkey_hash_getreader(myreader);
+  sparkey_assert(sparkey_logreader_set_verify(logreader, c->verify));
+  sparkey_assert(sparkey_logiter_create(&myiter, logreader));
+  sparkey_assert(sparkey_logiter_set_access_pattern(myiter, logreader, SPARKEY_ACCESS_RANDOM));
+  uint8_t *valuebuf = malloc(sparkey_logreader_maxvaluelen(logreader));
+  workload_gen gen;
+  workload_gen_init(&gen, 0);
+  workload_prepare(n);
+  sparkey_lookup(myreader, myiter, valuebuf, &gen, &gets);
+  t3 = nanotime();
+  faults(&minflt2, &majflt2);
+
+  printf("    open time (ns):           %llu\n", (unsigned long long) (t2 - t1));
+  printf("    first lookup (ns):        %llu\n", (unsigned long long) (t3 - t2));
+  printf("    faults (minor/major):     %ld/%ld\n", minflt2 - minflt1, majflt2 - majflt1);
+
+  for (int interval = 0; interval < COLD_INTERVALS; interval++) {
+    int start = (int) ((int64_t) lookups * interval / COLD_INTERVALS);
+    int end = (int) ((int64_t) lookups * (interval + 1) / COLD_INTERVALS);
+    faults(&minflt1, &majflt1);
+    t1 = nanotime();
+    for (int i = start; i < end; i++) {
+      sparkey_lookup(myreader, myiter, valuebuf, &gen, &gets);
+    }
+    t2 = nanotime();
+    faults(&minflt2, &majflt2);
+    printf("    lookups %9d-%-9d  throughput (lookups/sec): %12.2f  faults (minor/major): %ld/%ld\n",
+           start, end, (end - start) / ((t2 - t1) * 1e-9), minflt2 - minflt1, majflt2 - majflt1);
+  }
+  latency_print("lookup", &gets);
+  results_add(c, n, lookups, 1, "cold_lookup", &gets, (float) lookups / ((t2 - t3) * 1e-9));
+
+  workload_gen_free(&gen);
+  free(valuebuf);
+  sparkey_logiter_close(&myiter);
+  sparkey_hash_close(&myreader);
+  rm_all_rec(c->files());
+
+  printf("\n");
+}
+
 /* main */
 
 void test(candidate *c, int n, int lookups) {
   struct timeval t1_wall, t2_wall, t3_wall;
   struct timeval t1_cpu[2], t2_cpu[2], t3_cpu[2];
+  static latency puts, gets;
   float f;
 
+  memset(&puts, 0, sizeof(puts));
+  memset(&gets, 0, sizeof(gets));
+
   printf("Testing bulk insert of %d elements and %d random lookups\n", n, lookups);
 
   printf("  Candidate: %s\n", c->name);
@@ -236,7 +1330,7 @@ void test(candidate *c, int n, int lookups) {
   wall(&t1_wall);
   cpu(t1_cpu);
 
-  c->create(n);
+  c->create(n, &puts);
 
   wall(&t2_wall);
   cpu(t2_cpu);
@@ -254,9 +1348,14 @@ void test(candidate *c, int n, int lookups) {
     f += t1_cpu[1].tv_sec + 1e-6 * t1_cpu[1].tv_usec;
   }
   printf("    throughput (puts/cpusec): %2.2f\n", (float) n / f);
-  printf("    file size:                %zu\n", total_file_size(c->files()));
+  latency_print("put", &puts);
+  results_add(c, n, lookups, 1, "create", &puts, (float) n / f);
+  printf("    file size:                %zu\n", c->datasize ? c->datasize() : total_file_size(c->files()));
+
+  wall(&t2_wall);
+  cpu(t2_cpu);
 
-  c->randomaccess(n, lookups);
+  c->randomaccess(n, lookups, &gets);
 
   wall(&t3_wall);
   cpu(t3_cpu);
@@ -270,23 +1369,226 @@ void test(candidate *c, int n, int lookups) {
   f =  t2_cpu[0].tv_sec + 1e-6 * t2_cpu[0].tv_usec;
   f += t2_cpu[1].tv_sec + 1e-6 * t2_cpu[1].tv_usec;
   printf("    throughput (lookups/cpusec): %2.2f\n", (float) lookups / f);
+  latency_print("lookup", &gets);
+  results_add(c, n, lookups, 1, "lookup", &gets, (float) lookups / f);
   rm_all_rec(c->files());
 
   printf("\n");
 }
 
-int main() {
-  test(&sparkey_candidate_uncompressed, 1000, 1*1000*1000);
-  test(&sparkey_candidate_uncompressed, 1000*1000, 1*1000*1000);
-  test(&sparkey_candidate_uncompressed, 10*1000*1000, 1*1000*1000);
-  test(&sparkey_candidate_uncompressed, 100*1000*1000, 1*1000*1000);
+#define MAX_SIZES 32
+
+static void usage() {
+  printf("Usage: bench [options]\n"
+         "       bench -C base.json new.json [-r percent]\n"
+         "Scenarios:\n"
+         "  -c ids          comma separated candidates, or all (default: uncompressed,snappy)\n"
+         "  -n sizes        comma separated numbers of elements (default: 1000,1000000,10000000,100000000)\n"
+         "  -l lookups      number of lookups, per thread for scaling (default: 1000000)\n"
+         "  -S scenarios    comma separated scenarios (default: bulk):\n"
+         "                  bulk      bulk insert followed by random lookups\n"
+         "                  scaling   lookups from 1 to -t threads sharing a reader\n"
+         "                  cold      lookups after evicting the files from the page cache\n"
+         "                  startup   opening 10000 small hash and log files\n"
+         "  -o file         write results as JSON to file\n"
+         "  -t threads      max number of lookup threads (default: number of CPUs)\n"
+         "Workload:\n"
+         "  -p popularity   key popularity of lookups: uniform (default), zipf[:theta]\n"
+         "                  (default theta 0.99) or hotspot[:fraction:probability]\n"
+         "                  (default 0.2:0.8, 80%% of lookups on 20%% of keys)\n"
+         "  -k size         key size: N, MIN-MAX (uniform) or exp:MEAN\n"
+         "  -v size         value size: N, MIN-MAX (uniform) or exp:MEAN\n"
+         "  -m ratio        fraction of lookups for keys that don't exist (default 0)\n"
+         "  -b              random binary keys instead of structured key_%%09d keys\n"
+         "  -s seed         seed of the workload (default 1)\n"
+         "Compare:\n"
+         "  -C base.json    compare the results in new.json to base.json, exit with 1 on regressions\n"
+         "  -r percent      throughput decrease or p99 increase that is a regression (default 5)\n"
+         "Candidates:\n");
+  for (int i = 0; candidates[i] != NULL; i++) {
+    printf("  %-18s %s\n", candidates[i]->id, candidates[i]->name);
+  }
+  exit(1);
+}
+
+static int parse_candidates(char *arg, candidate **selected) {
+  int count = 0;
+  if (!strcmp(arg, "all")) {
+    while (candidates[count] != NULL) {
+      selected[count] = candidates[count];
+      count++;
+    }
+    return count;
+  }
+  for (char *id = strtok(arg, ","); id != NULL; id = strtok(NULL, ",")) {
+    // selected has room for every registered candidate
+    if (count == (int) (sizeof(candidates) / sizeof(candidates[0]) - 1)) {
+      usage();
+    }
+    selected[count] = find_candidate(id);
+    if (selected[count] == NULL) {
+      printf("Unknown candidate: %s\n", id);
+      usage();
+    }
+    count++;
+  }
+  return count;
+}
 
-  test(&sparkey_candidate_compressed, 1000, 1*1000*1000);
-  test(&sparkey_candidate_compressed, 1000*1000, 1*1000*1000);
-  test(&sparkey_candidate_compressed, 10*1000*1000, 1*1000*1000);
-  test(&sparkey_candidate_compressed, 100*1000*1000, 1*1000*1000);
+static int parse_sizes(char *arg, int *sizes) {
+  int count = 0;
+  for (char *size = strtok(arg, ","); size != NULL; size = strtok(NULL, ",")) {
+    if (count == MAX_SIZES || (sizes[count] = atoi(size)) < 1) {
+      usage();
+    }
+    count++;
+  }
+  return count;
+}
 
+static int has_scenario(const char *scenarios, const char *scenario) {
+  size_t len = strlen(scenario);
+  for (const char *p = scenarios; (p = strstr(p, scenario)) != NULL; p += len) {
+    if ((p == scenarios || p[-1] == ',') && (p[len] == 0 || p[len] == ',')) {
+      return 1;
+    }
+  }
   return 0;
 }
 
+static int parse_scenarios(const char *arg) {
+  static const char *known[] = {"bulk", "scaling", "cold", "startup"};
+  size_t start = 0;
+  while (1) {
+    size_t len = strcspn(arg + start, ",");
+    int found = 0;
+    for (size_t i = 0; i < sizeof(known) / sizeof(known[0]); i++) {
+      found |= strlen(known[i]) == len && !strncmp(known[i], arg + start, len);
+    }
+    if (!found) {
+      return 0;
+    }
+    if (arg[start + len] == 0) {
+      return 1;
+    }
+    start += len + 1;
+  }
+}
+
+int main(int argc, char * const *argv) {
+  int max_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  candidate *selected[sizeof(candidates) / sizeof(candidates[0])] = {
+    &sparkey_candidate_uncompressed, &sparkey_candidate_compressed
+  };
+  int num_selected = 2;
+  int sizes[MAX_SIZES] = {1000, 1000*1000, 10*1000*1000, 100*1000*1000};
+  int num_sizes = 4;
+  int lookups = 1*1000*1000;
+  const char *scenarios = "bulk";
+  const char *output = NULL;
+  const char *compare_base = NULL;
+  double threshold = 5.0;
+  int opt;
+  while ((opt = getopt(argc, argv, "c:n:l:S:o:t:p:k:v:m:bs:C:r:")) != -1) {
+    switch (opt) {
+    case 'c':
+      num_selected = parse_candidates(optarg, selected);
+      break;
+    case 'n':
+      num_sizes = parse_sizes(optarg, sizes);
+      break;
+    case 'l':
+      lookups = atoi(optarg);
+      if (lookups < 1) {
+        usage();
+      }
+      break;
+    case 'S':
+      if (!parse_scenarios(optarg)) {
+        usage();
+      }
+      scenarios = optarg;
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    case 't':
+      max_threads = atoi(optarg);
+      if (max_threads < 1) {
+        usage();
+      }
+      break;
+    case 'p':
+      if (!parse_popularity(optarg)) {
+        usage();
+      }
+      break;
+    case 'k':
+      if (!parse_size(optarg, &wl.keysize)) {
+        usage();
+      }
+      break;
+    case 'v':
+      if (!parse_size(optarg, &wl.valuesize)) {
+        usage();
+      }
+      break;
+    case 'm':
+      wl.miss_ratio = atof(optarg);
+      if (wl.miss_ratio < 0.0 || wl.miss_ratio > 1.0) {
+        usage();
+      }
+      break;
+    case 'b':
+      wl.binary_keys = 1;
+      break;
+    case 's':
+      wl.seed = strtoull(optarg, NULL, 10);
+      break;
+    case 'C':
+      compare_base = optarg;
+      break;
+    case 'r':
+      threshold = atof(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (compare_base != NULL) {
+    if (optind != argc - 1) {
+      usage();
+    }
+    return compare(compare_base, argv[optind], threshold) ? 1 : 0;
+  }
+  if (optind != argc) {
+    usage();
+  }
+  if (output != NULL) {
+    results_open(output);
+  }
+  workload_print();
+
+  for (int i = 0; i < num_selected; i++) {
+    candidate *c = selected[i];
+    wl.integer_keys = c->integer_keys;
+    for (int j = 0; j < num_sizes; j++) {
+      if (has_scenario(scenarios, "bulk")) {
+        test(c, sizes[j], lookups);
+      }
+      if (has_scenario(scenarios, "scaling") && is_sparkey(c)) {
+        test_scaling(c, sizes[j], lookups, max_threads);
+      }
+      if (has_scenario(scenarios, "cold") && is_sparkey(c)) {
+        test_cold(c, sizes[j], lookups);
+      }
+    }
+  }
+  wl.integer_keys = 0;
+  if (has_scenario(scenarios, "startup")) {
+    test_startup(10*1000);
+  }
 
+  results_close();
+  return 0;
+}
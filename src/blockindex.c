@@ -0,0 +1,257 @@
+/*
+* Copyright (c) 2012-2013 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "sparkey.h"
+#include "sparkey-internal.h"
+#include "blockindex.h"
+#include "endiantools.h"
+#include "util.h"
+#include "vlq.h"
+
+#define MAGIC_VALUE_BLOCKINDEX (0x2f6e81b3)
+
+void blockindex_encode_header(uint8_t *buf, uint32_t file_identifier) {
+  write_little_endian32(buf, BLOCKINDEX_MAGIC_NUMBER);
+  write_little_endian32(buf + 4, BLOCKINDEX_MAJOR_VERSION);
+  write_little_endian32(buf + 8, BLOCKINDEX_MINOR_VERSION);
+  write_little_endian32(buf + 12, file_identifier);
+}
+
+void blockindex_encode_record(uint8_t *buf, const sparkey_block_info *info) {
+  write_little_endian64(buf, info->offset);
+  write_little_endian32(buf + 8, info->compressed_size);
+  write_little_endian32(buf + 12, info->entry_count);
+  write_little_endian64(buf + 16, info->first_entry);
+}
+
+void blockindex_decode_record(const uint8_t *buf, sparkey_block_info *info) {
+  info->offset = read_little_endian64(buf, 0);
+  info->compressed_size = read_little_endian32(buf, 8);
+  info->entry_count = read_little_endian32(buf, 12);
+  info->first_entry = read_little_endian64(buf, 16);
+}
+
+sparkey_returncode blockindex_check_header(const uint8_t *data, uint64_t len, uint32_t file_identifier) {
+  if (len < BLOCKINDEX_HEADER_SIZE) {
+    return SPARKEY_BLOCKINDEX_CORRUPT;
+  }
+  if (read_little_endian32(data, 0) != BLOCKINDEX_MAGIC_NUMBER ||
+      read_little_endian32(data, 4) != BLOCKINDEX_MAJOR_VERSION ||
+      read_little_endian32(data, 8) > BLOCKINDEX_MINOR_VERSION) {
+    return SPARKEY_BLOCKINDEX_CORRUPT;
+  }
+  if (read_little_endian32(data, 12) != file_identifier) {
+    return SPARKEY_FILE_IDENTIFIER_MISMATCH;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+static inline uint64_t record_offset(sparkey_blockindex *index, uint64_t block) {
+  return read_little_endian64(index->data, BLOCKINDEX_HEADER_SIZE + block * BLOCKINDEX_RECORD_SIZE);
+}
+
+static inline uint64_t record_first_entry(sparkey_blockindex *index, uint64_t block) {
+  return read_little_endian64(index->data, BLOCKINDEX_HEADER_SIZE + block * BLOCKINDEX_RECORD_SIZE + 16);
+}
+
+static inline uint32_t record_entry_count(sparkey_blockindex *index, uint64_t block) {
+  return read_little_endian32(index->data, BLOCKINDEX_HEADER_SIZE + block * BLOCKINDEX_RECORD_SIZE + 12);
+}
+
+/**
+ * @returns the first block in [0, num_records) with an offset of at least position.
+ */
+static uint64_t find_block(sparkey_blockindex *index, uint64_t num_records, uint64_t position) {
+  uint64_t lo = 0;
+  uint64_t hi = num_records;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (record_offset(index, mid) < position) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static sparkey_returncode assert_index_open(sparkey_blockindex *index) {
+  if (index->open_status != MAGIC_VALUE_BLOCKINDEX) {
+    return SPARKEY_LOG_CLOSED;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode sparkey_blockindex_open(sparkey_blockindex **index_ref, const char *filename, sparkey_logreader *log) {
+  RETHROW(correct_endian_platform());
+  if (log->header.compression_type == SPARKEY_COMPRESSION_NONE) {
+    return SPARKEY_INVALID_COMPRESSION_TYPE;
+  }
+
+  sparkey_returncode returncode;
+  sparkey_blockindex *index = malloc(sizeof(sparkey_blockindex));
+  if (index == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+
+  index->fd = open(filename, O_RDONLY);
+  if (index->fd < 0) {
+    returncode = sparkey_open_returncode(errno);
+    goto free_index;
+  }
+
+  struct stat s;
+  if (fstat(index->fd, &s) < 0) {
+    returncode = sparkey_open_returncode(errno);
+    goto close_fd;
+  }
+  index->data_len = s.st_size;
+  if (index->data_len < BLOCKINDEX_HEADER_SIZE) {
+    returncode = SPARKEY_BLOCKINDEX_CORRUPT;
+    goto close_fd;
+  }
+
+  index->data = mmap(NULL, index->data_len, PROT_READ, MAP_SHARED, index->fd, 0);
+  if (index->data == MAP_FAILED) {
+    returncode = SPARKEY_MMAP_FAILED;
+    goto close_fd;
+  }
+  TRY(blockindex_check_header(index->data, index->data_len, log->header.file_identifier), unmap);
+
+  // A partially written record or records of blocks that never made it into the log are ignored.
+  uint64_t num_records = (index->data_len - BLOCKINDEX_HEADER_SIZE) / BLOCKINDEX_RECORD_SIZE;
+  index->num_blocks = find_block(index, num_records, log->header.data_end);
+  // The blocks must cover the log data exactly, an index that fell behind the log is not usable.
+  uint64_t end = log->header.header_size;
+  if (index->num_blocks > 0) {
+    sparkey_block_info info;
+    uint8_t vlq[10];
+    blockindex_decode_record(&index->data[BLOCKINDEX_HEADER_SIZE + (index->num_blocks - 1) * BLOCKINDEX_RECORD_SIZE], &info);
+    end = info.offset + write_vlq(vlq, info.compressed_size) + info.compressed_size + logheader_checksum_size(&log->header);
+    if (record_offset(index, 0) != log->header.header_size) {
+      end = 0;
+    }
+  }
+  if (end != log->header.data_end) {
+    returncode = SPARKEY_BLOCKINDEX_CORRUPT;
+    goto unmap;
+  }
+
+  index->open_status = MAGIC_VALUE_BLOCKINDEX;
+  *index_ref = index;
+  return SPARKEY_SUCCESS;
+
+unmap:
+  munmap(index->data, index->data_len);
+close_fd:
+  close(index->fd);
+free_index:
+  free(index);
+  return returncode;
+}
+
+void sparkey_blockindex_close(sparkey_blockindex **index_ref) {
+  if (index_ref == NULL) {
+    return;
+  }
+  sparkey_blockindex *index = *index_ref;
+  if (index == NULL) {
+    return;
+  }
+  if (index->open_status != MAGIC_VALUE_BLOCKINDEX) {
+    return;
+  }
+  index->open_status = 0;
+  munmap(index->data, index->data_len);
+  close(index->fd);
+  free(index);
+  *index_ref = NULL;
+}
+
+uint64_t sparkey_blockindex_numblocks(sparkey_blockindex *index) {
+  return index->num_blocks;
+}
+
+sparkey_returncode sparkey_blockindex_get(sparkey_blockindex *index, uint64_t block, sparkey_block_info *info) {
+  RETHROW(assert_index_open(index));
+  if (block >= index->num_blocks) {
+    return SPARKEY_INVALID_LOG_RANGE;
+  }
+  blockindex_decode_record(&index->data[BLOCKINDEX_HEADER_SIZE + block * BLOCKINDEX_RECORD_SIZE], info);
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode sparkey_logiter_seek_entry(sparkey_logiter *iter, sparkey_logreader *log, sparkey_blockindex *index, uint64_t entry) {
+  RETHROW(assert_index_open(index));
+
+  // Find the last block where the first entry is at most the wanted one.
+  // Blocks that only hold the rest of a split entry share the first entry of the block after them.
+  uint64_t lo = 0;
+  uint64_t hi = index->num_blocks;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (record_first_entry(index, mid) <= entry) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == 0) {
+    return SPARKEY_INVALID_LOG_RANGE;
+  }
+  uint64_t block = lo - 1;
+  uint64_t first_entry = record_first_entry(index, block);
+  if (entry >= first_entry + record_entry_count(index, block)) {
+    return SPARKEY_INVALID_LOG_RANGE;
+  }
+  RETHROW(sparkey_logiter_seek(iter, log, record_offset(index, block)));
+  return sparkey_logiter_skip(iter, log, entry - first_entry);
+}
+
+sparkey_returncode sparkey_blockindex_partition(sparkey_blockindex *index, sparkey_logreader *log, uint64_t *boundaries, int *num_ranges) {
+  RETHROW(assert_index_open(index));
+  if (*num_ranges < 1) {
+    return SPARKEY_INVALID_ARGUMENT;
+  }
+  uint64_t start = log->header.header_size;
+  uint64_t size = log->header.data_end - start;
+  int wanted = *num_ranges;
+  int n = 1;
+  boundaries[0] = start;
+  for (int i = 1; i < wanted; i++) {
+    uint64_t block = find_block(index, index->num_blocks, start + size * i / wanted);
+    // A range can't start with the rest of a split entry
+    while (block < index->num_blocks && record_entry_count(index, block) == 0) {
+      block++;
+    }
+    if (block >= index->num_blocks) {
+      break;
+    }
+    uint64_t offset = record_offset(index, block);
+    if (offset > boundaries[n - 1]) {
+      boundaries[n++] = offset;
+    }
+  }
+  boundaries[n] = log->header.data_end;
+  *num_ranges = n;
+  return SPARKEY_SUCCESS;
+}
@@ -0,0 +1,65 @@
+/*
+* Copyright (c) 2012-2013 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#ifndef SPARKEY_BLOCKINDEX_H_INCLUDED
+#define SPARKEY_BLOCKINDEX_H_INCLUDED
+
+#include <stdint.h>
+
+#include "sparkey.h"
+
+/*
+ * A block index (.spb) lists the compression blocks of a log:
+ * a 16 byte header followed by one 24 byte record per block, in file order.
+ * The index may contain records for blocks past the data_end of the log if the writer crashed,
+ * readers ignore those.
+ */
+#define BLOCKINDEX_MAGIC_NUMBER (0x5b10c4d1)
+#define BLOCKINDEX_MAJOR_VERSION (1)
+#define BLOCKINDEX_MINOR_VERSION (0)
+#define BLOCKINDEX_HEADER_SIZE (16)
+#define BLOCKINDEX_RECORD_SIZE (24)
+
+/**
+ * Encodes a block index header.
+ * @param buf destination, must have room for BLOCKINDEX_HEADER_SIZE bytes.
+ * @param file_identifier the file identifier of the log.
+ */
+void blockindex_encode_header(uint8_t *buf, uint32_t file_identifier);
+
+/**
+ * Encodes the record of a block.
+ * @param buf destination, must have room for BLOCKINDEX_RECORD_SIZE bytes.
+ * @param info the block to describe.
+ */
+void blockindex_encode_record(uint8_t *buf, const sparkey_block_info *info);
+
+/**
+ * Decodes the record of a block.
+ * @param buf a record.
+ * @param info set to the block described by the record.
+ */
+void blockindex_decode_record(const uint8_t *buf, sparkey_block_info *info);
+
+/**
+ * Checks that the file starts with a block index header for the given log.
+ * @param data the start of the file.
+ * @param len the size of the file.
+ * @param file_identifier the file identifier of the log.
+ * @returns SPARKEY_SUCCESS if the header is valid.
+ */
+sparkey_returncode blockindex_check_header(const uint8_t *data, uint64_t len, uint32_t file_identifier);
+
+#endif
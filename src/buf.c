@@ -75,3 +75,22 @@ sparkey_returncode buf_add(sparkey_buf *buf, int fd, const uint8_t *data, ptrdif
   return SPARKEY_SUCCESS;
 }
 
+sparkey_returncode buf_append(sparkey_buf *buf, const uint8_t *data, ptrdiff_t len) {
+  uint64_t used = buf_used(buf);
+  uint64_t size = buf_size(buf);
+  if (size - used < (uint64_t) len) {
+    while (size - used < (uint64_t) len) {
+      size = 2 * size + 1;
+    }
+    uint8_t *start = realloc(buf->start, size);
+    if (start == NULL) {
+      return SPARKEY_INTERNAL_ERROR;
+    }
+    buf->start = start;
+    buf->cur = start + used;
+    buf->end = start + size;
+  }
+  memcpy(buf->cur, data, len);
+  buf->cur += len;
+  return SPARKEY_SUCCESS;
+}
@@ -44,5 +44,10 @@ sparkey_returncode buf_flushfile(sparkey_buf *buf, int fd);
 
 sparkey_returncode buf_add(sparkey_buf *buf, int fd, const uint8_t *data, ptrdiff_t len);
 
+/**
+ * Adds data to the buffer, growing it if it's too small.
+ */
+sparkey_returncode buf_append(sparkey_buf *buf, const uint8_t *data, ptrdiff_t len);
+
 #endif
 
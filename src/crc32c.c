@@ -0,0 +1,129 @@
+/*
+* Copyright (c) 2012-2013 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#include <pthread.h>
+#include <string.h>
+
+#include "crc32c.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CRC32C_SSE42 1
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_ARM 1
+#endif
+
+// Reflected Castagnoli polynomial.
+#define CRC32C_POLY (0x82f63b78)
+
+static uint32_t table[8][256];
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+static void init_table(void) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int j = 0; j < 8; j++) {
+      crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+    }
+    table[0][i] = crc;
+  }
+  for (uint32_t i = 0; i < 256; i++) {
+    for (int k = 1; k < 8; k++) {
+      table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+    }
+  }
+}
+
+uint32_t crc32c_sw(uint32_t crc, const uint8_t *data, size_t len) {
+  pthread_once(&table_once, init_table);
+  crc = ~crc;
+  // Slicing-by-8: one table lookup per byte, but eight independent ones per step.
+  while (len >= 8) {
+    uint32_t lo = crc ^ ((uint32_t) data[0] | (uint32_t) data[1] << 8 | (uint32_t) data[2] << 16 | (uint32_t) data[3] << 24);
+    uint32_t hi = (uint32_t) data[4] | (uint32_t) data[5] << 8 | (uint32_t) data[6] << 16 | (uint32_t) data[7] << 24;
+    crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^ table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24] ^
+          table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^ table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+    data += 8;
+    len -= 8;
+  }
+  while (len > 0) {
+    crc = table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    len--;
+  }
+  return ~crc;
+}
+
+#if defined(CRC32C_SSE42)
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *data, size_t len) {
+  uint64_t crc64 = ~crc;
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, data, 8);
+    crc64 = __builtin_ia32_crc32di(crc64, word);
+    data += 8;
+    len -= 8;
+  }
+  uint32_t crc32 = crc64;
+  while (len > 0) {
+    crc32 = __builtin_ia32_crc32qi(crc32, *data++);
+    len--;
+  }
+  return ~crc32;
+}
+
+typedef uint32_t (*crc32c_fn)(uint32_t crc, const uint8_t *data, size_t len);
+
+static crc32c_fn impl = crc32c_sw;
+static pthread_once_t impl_once = PTHREAD_ONCE_INIT;
+
+static void init_impl(void) {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2")) {
+    impl = crc32c_hw;
+  }
+}
+
+uint32_t crc32c(uint32_t crc, const uint8_t *data, size_t len) {
+  pthread_once(&impl_once, init_impl);
+  return impl(crc, data, len);
+}
+
+#elif defined(CRC32C_ARM)
+
+uint32_t crc32c(uint32_t crc, const uint8_t *data, size_t len) {
+  crc = ~crc;
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, data, 8);
+    crc = __crc32cd(crc, word);
+    data += 8;
+    len -= 8;
+  }
+  while (len > 0) {
+    crc = __crc32cb(crc, *data++);
+    len--;
+  }
+  return ~crc;
+}
+
+#else
+
+uint32_t crc32c(uint32_t crc, const uint8_t *data, size_t len) {
+  return crc32c_sw(crc, data, len);
+}
+
+#endif
@@ -0,0 +1,37 @@
+/*
+* Copyright (c) 2012-2013 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#ifndef SPARKEY_CRC32C_H_INCLUDED
+#define SPARKEY_CRC32C_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Computes the CRC32C (Castagnoli) checksum of a buffer, using the crc32
+ * instruction when the cpu has one.
+ * @param crc checksum of the preceding data, 0 to start a new checksum.
+ * @param data the data to checksum.
+ * @param len the number of bytes in data.
+ * @returns the checksum of everything up to and including data.
+ */
+uint32_t crc32c(uint32_t crc, const uint8_t *data, size_t len);
+
+/**
+ * Same as crc32c, but always uses the table driven implementation.
+ */
+uint32_t crc32c_sw(uint32_t crc, const uint8_t *data, size_t len);
+
+#endif
@@ -62,6 +62,41 @@ sparkey_returncode write_full(int fd, uint8_t *buf, size_t count) {
   return _write_full(fd, buf, count % block_size);
 }
 
+sparkey_returncode pwrite_full(int fd, const uint8_t *buf, size_t count, uint64_t offset) {
+  while (count > 0) {
+    ssize_t actual = pwrite(fd, buf, count, offset);
+    if (actual < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return sparkey_write_returncode(errno);
+    }
+    buf += actual;
+    count -= actual;
+    offset += actual;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode pread_full(int fd, uint8_t *buf, size_t count, uint64_t offset) {
+  while (count > 0) {
+    ssize_t actual = pread(fd, buf, count, offset);
+    if (actual < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return sparkey_open_returncode(errno);
+    }
+    if (actual == 0) {
+      return SPARKEY_UNEXPECTED_EOF;
+    }
+    buf += actual;
+    count -= actual;
+    offset += actual;
+  }
+  return SPARKEY_SUCCESS;
+}
+
 void write_little_endian32(uint8_t *buf, uint32_t value) {
   buf[0] = (value >> 0) & 0xFF;
   buf[1] = (value >> 8) & 0xFF;
@@ -37,6 +37,26 @@ typedef union {
  */
 sparkey_returncode write_full(int fd, uint8_t *buf, size_t count);
 
+/**
+ * Writes count bytes of buf to a file at a specific offset, without moving the file position.
+ * @param fd file descriptor of a file to write to.
+ * @param buf bytes to write to file.
+ * @param count number of bytes to write.
+ * @param offset the position in the file to write to.
+ * @returns SPARKEY_SUCCESS if all goes well, otherwise a sparkey error code.
+ */
+sparkey_returncode pwrite_full(int fd, const uint8_t *buf, size_t count, uint64_t offset);
+
+/**
+ * Reads count bytes from a file at a specific offset, without moving the file position.
+ * @param fd file descriptor of a file to read from.
+ * @param buf destination of the data. Must be at least count long.
+ * @param count number of bytes to read.
+ * @param offset the position in the file to read from.
+ * @returns SPARKEY_SUCCESS if all goes well, SPARKEY_UNEXPECTED_EOF if the file is too short.
+ */
+sparkey_returncode pread_full(int fd, uint8_t *buf, size_t count, uint64_t offset);
+
 /**
  * Write a 32 bit value to buf in little endian.
  * @param buf buf to write to. Must be at least 4 bytes long.
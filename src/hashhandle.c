@@ -0,0 +1,297 @@
+/*
+* Copyright (c) 2012-2013 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "sparkey.h"
+#include "sparkey-internal.h"
+#include "util.h"
+
+#define MAGIC_VALUE_HASHHANDLE (0x4e1d7a2b)
+
+// How often the watcher closes replaced versions that are no longer pinned.
+#define RECLAIM_INTERVAL_MS (100)
+
+// The slot a thread used last, so that a thread keeps pinning through the same cache line.
+static __thread int slot_hint;
+
+static sparkey_returncode assert_handle_open(sparkey_hash_handle *handle) {
+  if (handle->open_status != MAGIC_VALUE_HASHHANDLE) {
+    return SPARKEY_HASH_CLOSED;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+static sparkey_returncode open_version(sparkey_hash_handle *handle, sparkey_hashreader **reader_ref) {
+  if (handle->log_filename == NULL) {
+    return sparkey_hash_open_pack(reader_ref, handle->hash_filename);
+  }
+  return sparkey_hash_open(reader_ref, handle->hash_filename, handle->log_filename);
+}
+
+static int is_pinned(sparkey_hash_handle *handle, sparkey_hashreader *reader) {
+  for (int i = 0; i < HASH_HANDLE_SLOTS; i++) {
+    if (__atomic_load_n(&handle->slots[i].reader, __ATOMIC_SEQ_CST) == reader) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Closes the retired versions that no thread has pinned. Must be called with lock held.
+ */
+static void reclaim(sparkey_hash_handle *handle) {
+  int kept = 0;
+  for (int i = 0; i < handle->num_retired; i++) {
+    sparkey_hashreader *reader = handle->retired[i];
+    if (is_pinned(handle, reader)) {
+      handle->retired[kept++] = reader;
+    } else {
+      sparkey_hash_close(&reader);
+    }
+  }
+  handle->num_retired = kept;
+}
+
+sparkey_returncode sparkey_hash_handle_open(sparkey_hash_handle **handle_ref, const char *hash_filename, const char *log_filename) {
+  sparkey_hash_handle *handle;
+  if (posix_memalign((void **) &handle, 64, sizeof(sparkey_hash_handle)) != 0) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  memset(handle->slots, 0, sizeof(handle->slots));
+  handle->retired = NULL;
+  handle->num_retired = 0;
+  handle->watching = 0;
+  handle->inotify_fd = -1;
+
+  sparkey_returncode returncode;
+  handle->hash_filename = strdup(hash_filename);
+  handle->log_filename = log_filename == NULL ? NULL : strdup(log_filename);
+  if (handle->hash_filename == NULL || (log_filename != NULL && handle->log_filename == NULL)) {
+    returncode = SPARKEY_INTERNAL_ERROR;
+    goto free_handle;
+  }
+  TRY(open_version(handle, &handle->current), free_handle);
+  if (pthread_mutex_init(&handle->lock, NULL) != 0) {
+    sparkey_hash_close(&handle->current);
+    returncode = SPARKEY_INTERNAL_ERROR;
+    goto free_handle;
+  }
+
+  handle->open_status = MAGIC_VALUE_HASHHANDLE;
+  *handle_ref = handle;
+  return SPARKEY_SUCCESS;
+
+free_handle:
+  free(handle->hash_filename);
+  free(handle->log_filename);
+  free(handle);
+  return returncode;
+}
+
+sparkey_returncode sparkey_hash_handle_pin(sparkey_hash_handle *handle, sparkey_hashreader **reader_ref, int *pin) {
+  RETHROW(assert_handle_open(handle));
+  sparkey_hashreader *reader = __atomic_load_n(&handle->current, __ATOMIC_SEQ_CST);
+  for (int i = 0; i < HASH_HANDLE_SLOTS; i++) {
+    int slot = (slot_hint + i) % HASH_HANDLE_SLOTS;
+    sparkey_hashreader *expected = NULL;
+    if (!__atomic_compare_exchange_n(&handle->slots[slot].reader, &expected, reader, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+      continue;
+    }
+    // A reload may have retired the reader before the slot was published,
+    // so it's only safe to use once it's still current after publishing.
+    sparkey_hashreader *current;
+    while ((current = __atomic_load_n(&handle->current, __ATOMIC_SEQ_CST)) != reader) {
+      reader = current;
+      __atomic_store_n(&handle->slots[slot].reader, reader, __ATOMIC_SEQ_CST);
+    }
+    slot_hint = slot;
+    *reader_ref = reader;
+    *pin = slot;
+    return SPARKEY_SUCCESS;
+  }
+  return SPARKEY_TOO_MANY_PINS;
+}
+
+void sparkey_hash_handle_unpin(sparkey_hash_handle *handle, int pin) {
+  __atomic_store_n(&handle->slots[pin].reader, NULL, __ATOMIC_RELEASE);
+}
+
+sparkey_returncode sparkey_hash_handle_reload(sparkey_hash_handle *handle) {
+  RETHROW(assert_handle_open(handle));
+
+  sparkey_returncode returncode;
+  pthread_mutex_lock(&handle->lock);
+  sparkey_hashreader *reader;
+  TRY(open_version(handle, &reader), unlock);
+  sparkey_hashreader **retired = realloc(handle->retired, (handle->num_retired + 1) * sizeof(sparkey_hashreader *));
+  if (retired == NULL) {
+    sparkey_hash_close(&reader);
+    returncode = SPARKEY_INTERNAL_ERROR;
+    goto unlock;
+  }
+  handle->retired = retired;
+  handle->retired[handle->num_retired++] = __atomic_exchange_n(&handle->current, reader, __ATOMIC_SEQ_CST);
+  reclaim(handle);
+  returncode = SPARKEY_SUCCESS;
+
+unlock:
+  pthread_mutex_unlock(&handle->lock);
+  return returncode;
+}
+
+#ifdef __linux__
+static void * watch_loop(void *arg) {
+  sparkey_hash_handle *handle = arg;
+  const char *slash = strrchr(handle->hash_filename, '/');
+  const char *name = slash == NULL ? handle->hash_filename : slash + 1;
+
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  struct pollfd fds[2];
+  fds[0].fd = handle->inotify_fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = handle->stop_fds[0];
+  fds[1].events = POLLIN;
+  while (1) {
+    int n = poll(fds, 2, RECLAIM_INTERVAL_MS);
+    if (n < 0 && errno != EINTR) {
+      break;
+    }
+    if (n > 0 && (fds[1].revents & POLLIN)) {
+      break;
+    }
+    int changed = 0;
+    if (n > 0 && (fds[0].revents & POLLIN)) {
+      ssize_t len = read(handle->inotify_fd, buf, sizeof(buf));
+      for (char *p = buf; len > 0 && p < buf + len; ) {
+        struct inotify_event *event = (struct inotify_event *) p;
+        if (event->len > 0 && strcmp(event->name, name) == 0) {
+          changed = 1;
+        }
+        p += sizeof(struct inotify_event) + event->len;
+      }
+    }
+    if (changed) {
+      // If the new version can't be opened, the current one stays published.
+      sparkey_hash_handle_reload(handle);
+    } else {
+      pthread_mutex_lock(&handle->lock);
+      reclaim(handle);
+      pthread_mutex_unlock(&handle->lock);
+    }
+  }
+  return NULL;
+}
+
+sparkey_returncode sparkey_hash_handle_watch(sparkey_hash_handle *handle) {
+  RETHROW(assert_handle_open(handle));
+  if (handle->watching) {
+    return SPARKEY_SUCCESS;
+  }
+
+  sparkey_returncode returncode;
+  const char *slash = strrchr(handle->hash_filename, '/');
+  char *dir = slash == NULL ? strdup(".") : strndup(handle->hash_filename, slash - handle->hash_filename + 1);
+  if (dir == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  handle->inotify_fd = inotify_init1(IN_CLOEXEC);
+  if (handle->inotify_fd < 0) {
+    returncode = sparkey_open_returncode(errno);
+    goto free_dir;
+  }
+  // sparkey_hash_write closes a newly created file, sparkey_pack renames one into place.
+  if (inotify_add_watch(handle->inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    returncode = sparkey_open_returncode(errno);
+    goto close_inotify;
+  }
+  if (pipe(handle->stop_fds) < 0) {
+    returncode = sparkey_open_returncode(errno);
+    goto close_inotify;
+  }
+  if (pthread_create(&handle->watcher, NULL, watch_loop, handle) != 0) {
+    returncode = SPARKEY_INTERNAL_ERROR;
+    goto close_pipe;
+  }
+  handle->watching = 1;
+  free(dir);
+  return SPARKEY_SUCCESS;
+
+close_pipe:
+  close(handle->stop_fds[0]);
+  close(handle->stop_fds[1]);
+close_inotify:
+  close(handle->inotify_fd);
+  handle->inotify_fd = -1;
+free_dir:
+  free(dir);
+  return returncode;
+}
+
+static void stop_watching(sparkey_hash_handle *handle) {
+  if (!handle->watching) {
+    return;
+  }
+  uint8_t stop = 1;
+  if (write(handle->stop_fds[1], &stop, 1) == 1) {
+    pthread_join(handle->watcher, NULL);
+  }
+  close(handle->stop_fds[0]);
+  close(handle->stop_fds[1]);
+  close(handle->inotify_fd);
+  handle->watching = 0;
+}
+#else
+sparkey_returncode sparkey_hash_handle_watch(sparkey_hash_handle *handle) {
+  RETHROW(assert_handle_open(handle));
+  return SPARKEY_INTERNAL_ERROR;
+}
+
+static void stop_watching(sparkey_hash_handle *handle) {
+  (void) handle;
+}
+#endif
+
+void sparkey_hash_handle_close(sparkey_hash_handle **handle_ref) {
+  if (handle_ref == NULL) {
+    return;
+  }
+  sparkey_hash_handle *handle = *handle_ref;
+  if (handle == NULL || handle->open_status != MAGIC_VALUE_HASHHANDLE) {
+    return;
+  }
+  stop_watching(handle);
+  handle->open_status = 0;
+
+  for (int i = 0; i < handle->num_retired; i++) {
+    sparkey_hash_close(&handle->retired[i]);
+  }
+  free(handle->retired);
+  sparkey_hash_close(&handle->current);
+  pthread_mutex_destroy(&handle->lock);
+  free(handle->hash_filename);
+  free(handle->log_filename);
+  free(handle);
+  *handle_ref = NULL;
+}
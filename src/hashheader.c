@@ -17,6 +17,8 @@
 #include <inttypes.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #include "hashheader.h"
 #include "endiantools.h"
@@ -33,24 +35,27 @@ void print_hashheader(sparkey_hashheader *header) {
   printf("Data size: %"PRIu64", Garbage size: %"PRIu64"\n", header->data_end, header->garbage_size);
 }
 
-static sparkey_returncode hashheader_version0(sparkey_hashheader *header, FILE *fp) {
-  RETHROW(fread_little_endian32(fp, &header->file_identifier));
-  RETHROW(fread_little_endian32(fp, &header->hash_seed));
-  RETHROW(fread_little_endian64(fp, &header->data_end));
-  RETHROW(fread_little_endian64(fp, &header->max_key_len));
-  RETHROW(fread_little_endian64(fp, &header->max_value_len));
-  RETHROW(fread_little_endian64(fp, &header->num_puts));
-  RETHROW(fread_little_endian64(fp, &header->garbage_size));
-  RETHROW(fread_little_endian64(fp, &header->num_entries));
-
-  RETHROW(fread_little_endian32(fp, &header->address_size));
-  RETHROW(fread_little_endian32(fp, &header->hash_size));
-  RETHROW(fread_little_endian64(fp, &header->hash_capacity));
-  RETHROW(fread_little_endian64(fp, &header->max_displacement));
-  RETHROW(fread_little_endian32(fp, &header->entry_block_bits));
+static sparkey_returncode hashheader_version0(sparkey_hashheader *header, const uint8_t *buf, uint64_t len) {
+  if (len < HASH_HEADER_SIZE) {
+    return SPARKEY_UNEXPECTED_EOF;
+  }
+  header->file_identifier = read_little_endian32(buf, 12);
+  header->hash_seed = read_little_endian32(buf, 16);
+  header->data_end = read_little_endian64(buf, 20);
+  header->max_key_len = read_little_endian64(buf, 28);
+  header->max_value_len = read_little_endian64(buf, 36);
+  header->num_puts = read_little_endian64(buf, 44);
+  header->garbage_size = read_little_endian64(buf, 52);
+  header->num_entries = read_little_endian64(buf, 60);
+
+  header->address_size = read_little_endian32(buf, 68);
+  header->hash_size = read_little_endian32(buf, 72);
+  header->hash_capacity = read_little_endian64(buf, 76);
+  header->max_displacement = read_little_endian64(buf, 84);
+  header->entry_block_bits = read_little_endian32(buf, 92);
   header->entry_block_bitmask = (1 << header->entry_block_bits) - 1;
-  RETHROW(fread_little_endian64(fp, &header->hash_collisions));
-  RETHROW(fread_little_endian64(fp, &header->total_displacement));
+  header->hash_collisions = read_little_endian64(buf, 96);
+  header->total_displacement = read_little_endian64(buf, 104);
   header->header_size = HASH_HEADER_SIZE;
 
   header->hash_algorithm = sparkey_get_hash_algorithm(header->hash_size);
@@ -72,41 +77,52 @@ static sparkey_returncode hashheader_version0(sparkey_hashheader *header, FILE *
 }
 
 
-typedef sparkey_returncode (*loader)(sparkey_hashheader *header, FILE *fp);
+typedef sparkey_returncode (*loader)(sparkey_hashheader *header, const uint8_t *buf, uint64_t len);
 
 static loader loaders[2] = { hashheader_version0, hashheader_version0 };
 
+sparkey_returncode sparkey_load_hashheader_mem(sparkey_hashheader *header, const uint8_t *data, uint64_t len) {
+  if (len < 12) {
+    return SPARKEY_UNEXPECTED_EOF;
+  }
+  if (read_little_endian32(data, 0) != HASH_MAGIC_NUMBER) {
+    return SPARKEY_WRONG_HASH_MAGIC_NUMBER;
+  }
+  header->major_version = read_little_endian32(data, 4);
+  if (header->major_version != HASH_MAJOR_VERSION) {
+    return SPARKEY_WRONG_HASH_MAJOR_VERSION;
+  }
+  header->minor_version = read_little_endian32(data, 8);
+  if (header->minor_version > HASH_MINOR_VERSION) {
+    return SPARKEY_UNSUPPORTED_HASH_MINOR_VERSION;
+  }
+  loader l = loaders[header->minor_version];
+  if (l == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  return (*l)(header, data, len);
+}
+
+sparkey_returncode sparkey_load_hashheader_fd(sparkey_hashheader *header, int fd) {
+  uint8_t buf[HASH_HEADER_SIZE];
+  ssize_t len;
+  do {
+    len = pread(fd, buf, sizeof(buf), 0);
+  } while (len < 0 && errno == EINTR);
+  if (len < 0) {
+    return sparkey_open_returncode(errno);
+  }
+  return sparkey_load_hashheader_mem(header, buf, len);
+}
+
 sparkey_returncode sparkey_load_hashheader(sparkey_hashheader *header, const char *filename) {
-	FILE *fp = fopen(filename, "r");
-	if (fp == NULL) {
-		return sparkey_open_returncode(errno);
-	}
-
-	uint32_t tmp;
-	RETHROW(fread_little_endian32(fp, &tmp));
-	if (tmp != HASH_MAGIC_NUMBER) {
-		fclose(fp);
-		return SPARKEY_WRONG_HASH_MAGIC_NUMBER;
-	}
-	RETHROW(fread_little_endian32(fp, &header->major_version));
-	if (header->major_version != HASH_MAJOR_VERSION) {
-		fclose(fp);
-		return SPARKEY_WRONG_HASH_MAJOR_VERSION;
-	}
-	RETHROW(fread_little_endian32(fp, &header->minor_version));
-	if (header->minor_version > HASH_MINOR_VERSION) {
-		fclose(fp);
-		return SPARKEY_UNSUPPORTED_HASH_MINOR_VERSION;
-	}
-	int version = header->minor_version;
-	loader l = loaders[version];
-	if (l == NULL) {
-		fclose(fp);
-		return SPARKEY_INTERNAL_ERROR;
-	}
-	sparkey_returncode x = (*l)(header, fp);
-	fclose(fp);
-	return x;
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return sparkey_open_returncode(errno);
+  }
+  sparkey_returncode returncode = sparkey_load_hashheader_fd(header, fd);
+  close(fd);
+  return returncode;
 }
 
 sparkey_returncode write_hashheader(int fd, sparkey_hashheader *header) {
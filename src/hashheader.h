@@ -60,6 +60,23 @@ typedef struct {
  */
 sparkey_returncode sparkey_load_hashheader(sparkey_hashheader *header, const char *filename);
 
+/**
+ * Same as sparkey_load_hashheader, but reads from an open file.
+ * @param header header struct to fill
+ * @param fd an open hash file.
+ * @returns an error code if it could not load the file.
+ */
+sparkey_returncode sparkey_load_hashheader_fd(sparkey_hashheader *header, int fd);
+
+/**
+ * Same as sparkey_load_hashheader, but reads from memory.
+ * @param header header struct to fill
+ * @param data the start of a hash file.
+ * @param len the number of bytes available at data.
+ * @returns an error code if it could not load the header.
+ */
+sparkey_returncode sparkey_load_hashheader_mem(sparkey_hashheader *header, const uint8_t *data, uint64_t len);
+
 /**
  * Dumps a human readable representation of the header to stdout
  * @param header an initialized header struct
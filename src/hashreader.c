@@ -22,6 +22,8 @@
 
 #include "hashheader.h"
 #include "hashiter.h"
+#include "pack.h"
+#include "probes.h"
 #include "util.h"
 #include "endiantools.h"
 #include "sparkey.h"
@@ -29,70 +31,221 @@
 
 #define MAGIC_VALUE_HASHREADER (0x75103df9)
 
-sparkey_returncode sparkey_hash_open(sparkey_hashreader **reader_ref, const char *hash_filename, const char *log_filename) {
-  RETHROW(correct_endian_platform());
-
-  sparkey_returncode returncode;
-
-  sparkey_hashreader *reader = malloc(sizeof(sparkey_hashreader));
-  if (reader == NULL) {
-    return SPARKEY_INTERNAL_ERROR;
-  }
-
-  TRY(sparkey_load_hashheader(&reader->header, hash_filename), free_reader);
-  TRY(sparkey_logreader_open_noalloc(&reader->log, log_filename), free_reader);
+/**
+ * Checks that the hash header matches the log, and computes the size of the hash data.
+ */
+static sparkey_returncode check_log(sparkey_hashreader *reader) {
   if (reader->header.file_identifier != reader->log.header.file_identifier) {
-    returncode = SPARKEY_FILE_IDENTIFIER_MISMATCH;
-    goto close_reader;
+    return SPARKEY_FILE_IDENTIFIER_MISMATCH;
   }
   if (reader->header.data_end > reader->log.header.data_end) {
-    returncode = SPARKEY_HASH_HEADER_CORRUPT;
-    goto close_reader;
+    return SPARKEY_HASH_HEADER_CORRUPT;
   }
   if (reader->header.max_key_len > reader->log.header.max_key_len) {
-    returncode = SPARKEY_HASH_HEADER_CORRUPT;
-    goto close_reader;
+    return SPARKEY_HASH_HEADER_CORRUPT;
   }
   if (reader->header.max_value_len > reader->log.header.max_value_len) {
-    returncode = SPARKEY_HASH_HEADER_CORRUPT;
-    goto close_reader;
+    return SPARKEY_HASH_HEADER_CORRUPT;
   }
+  reader->data_len = reader->header.header_size + reader->header.hash_capacity * (reader->header.hash_size + reader->header.address_size);
+  return SPARKEY_SUCCESS;
+}
 
-  reader->fd = open(hash_filename, O_RDONLY);
-  if (reader->fd < 0) {
-    int e = errno;
-    returncode = sparkey_open_returncode(e);
-    goto close_reader;
+static void hash_close_nodealloc(sparkey_hashreader *reader) {
+  sparkey_logreader_close_nodealloc(&reader->log);
+
+  reader->open_status = 0;
+  if (reader->data != NULL && reader->mapped) {
+    munmap(reader->data, reader->data_len);
   }
+  reader->data = NULL;
+  if (reader->fd >= 0) {
+    close(reader->fd);
+  }
+  reader->fd = -1;
+  if (reader->pack_data != NULL) {
+    munmap(reader->pack_data, reader->pack_len);
+  }
+  reader->pack_data = NULL;
+}
 
-  reader->data_len = reader->header.header_size + reader->header.hash_capacity * (reader->header.hash_size + reader->header.address_size);
+static sparkey_hashreader * alloc_reader() {
+  sparkey_hashreader *reader = malloc(sizeof(sparkey_hashreader));
+  if (reader == NULL) {
+    return NULL;
+  }
+  reader->open_status = 0;
+  reader->fd = -1;
+  reader->data = NULL;
+  reader->mapped = 0;
+  reader->pack_data = NULL;
+  return reader;
+}
+
+/**
+ * Opens a hashreader from open files. Takes ownership of both descriptors, also when it fails.
+ */
+static sparkey_returncode hash_open_fd(sparkey_hashreader **reader_ref, int hash_fd, int log_fd) {
+  sparkey_returncode returncode;
+
+  sparkey_hashreader *reader = alloc_reader();
+  if (reader == NULL) {
+    close(hash_fd);
+    close(log_fd);
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  reader->fd = hash_fd;
+
+  returncode = sparkey_load_hashheader_fd(&reader->header, hash_fd);
+  if (returncode != SPARKEY_SUCCESS) {
+    close(hash_fd);
+    close(log_fd);
+    goto free_reader;
+  }
+  returncode = sparkey_logreader_open_fd_noalloc(&reader->log, log_fd);
+  if (returncode != SPARKEY_SUCCESS) {
+    close(hash_fd);
+    goto free_reader;
+  }
+  TRY(check_log(reader), close_reader);
 
   struct stat s;
-  stat(hash_filename, &s);
+  if (fstat(hash_fd, &s) < 0) {
+    returncode = sparkey_open_returncode(errno);
+    goto close_reader;
+  }
   if (reader->data_len > (uint64_t) s.st_size) {
     returncode = SPARKEY_HASH_TOO_SMALL;
     goto close_reader;
   }
 
-  reader->data = mmap(NULL, reader->data_len, PROT_READ, MAP_SHARED, reader->fd, 0);
+  reader->data = mmap(NULL, reader->data_len, PROT_READ, MAP_SHARED, hash_fd, 0);
   if (reader->data == MAP_FAILED) {
+    reader->data = NULL;
     returncode = SPARKEY_MMAP_FAILED;
     goto close_reader;
   }
+  reader->mapped = 1;
 
   *reader_ref = reader;
   reader->open_status = MAGIC_VALUE_HASHREADER;
   return SPARKEY_SUCCESS;
 
 close_reader:
-  sparkey_hash_close(&reader);
+  hash_close_nodealloc(reader);
+free_reader:
+  free(reader);
   return returncode;
+}
+
+sparkey_returncode sparkey_hash_open(sparkey_hashreader **reader_ref, const char *hash_filename, const char *log_filename) {
+  RETHROW(correct_endian_platform());
+  int hash_fd = open(hash_filename, O_RDONLY);
+  if (hash_fd < 0) {
+    return sparkey_open_returncode(errno);
+  }
+  int log_fd = open(log_filename, O_RDONLY);
+  if (log_fd < 0) {
+    int e = errno;
+    close(hash_fd);
+    return sparkey_open_returncode(e);
+  }
+  return hash_open_fd(reader_ref, hash_fd, log_fd);
+}
 
+sparkey_returncode sparkey_hash_open_fd(sparkey_hashreader **reader_ref, int hash_fd, int log_fd) {
+  RETHROW(correct_endian_platform());
+  // The reader keeps its own descriptors, so the caller is free to close theirs.
+  int hash_dup = dup(hash_fd);
+  if (hash_dup < 0) {
+    return sparkey_open_returncode(errno);
+  }
+  int log_dup = dup(log_fd);
+  if (log_dup < 0) {
+    int e = errno;
+    close(hash_dup);
+    return sparkey_open_returncode(e);
+  }
+  return hash_open_fd(reader_ref, hash_dup, log_dup);
+}
+
+sparkey_returncode sparkey_hash_open_mem(sparkey_hashreader **reader_ref, const uint8_t *hash_data, uint64_t hash_len, const uint8_t *log_data, uint64_t log_len) {
+  RETHROW(correct_endian_platform());
+
+  sparkey_returncode returncode;
+
+  sparkey_hashreader *reader = alloc_reader();
+  if (reader == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+
+  TRY(sparkey_load_hashheader_mem(&reader->header, hash_data, hash_len), free_reader);
+  TRY(sparkey_logreader_open_mem_noalloc(&reader->log, log_data, log_len), free_reader);
+  TRY(check_log(reader), close_reader);
+  if (reader->data_len > hash_len) {
+    returncode = SPARKEY_HASH_TOO_SMALL;
+    goto close_reader;
+  }
+  reader->data = (uint8_t *) hash_data;
+
+  *reader_ref = reader;
+  reader->open_status = MAGIC_VALUE_HASHREADER;
+  return SPARKEY_SUCCESS;
+
+close_reader:
+  hash_close_nodealloc(reader);
 free_reader:
   free(reader);
   return returncode;
 }
 
+sparkey_returncode sparkey_hash_open_pack(sparkey_hashreader **reader_ref, const char *pack_filename) {
+  RETHROW(correct_endian_platform());
+  int fd = open(pack_filename, O_RDONLY);
+  if (fd < 0) {
+    return sparkey_open_returncode(errno);
+  }
+
+  sparkey_returncode returncode;
+  struct stat s;
+  if (fstat(fd, &s) < 0) {
+    returncode = sparkey_open_returncode(errno);
+    goto close_fd;
+  }
+  uint8_t buf[PACK_HEADER_SIZE];
+  if ((uint64_t) s.st_size < PACK_HEADER_SIZE) {
+    returncode = SPARKEY_PACK_CORRUPT;
+    goto close_fd;
+  }
+  TRY(pread_full(fd, buf, PACK_HEADER_SIZE, 0), close_fd);
+  sparkey_packheader header;
+  TRY(pack_decode_header(&header, buf, s.st_size), close_fd);
+
+  // One mapping serves both sections, it stays valid after the descriptor is closed.
+  uint8_t *data = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return SPARKEY_MMAP_FAILED;
+  }
+  returncode = sparkey_hash_open_mem(reader_ref, data + header.hash_offset, header.hash_len, data + header.log_offset, header.log_len);
+  if (returncode != SPARKEY_SUCCESS) {
+    munmap(data, s.st_size);
+    return returncode;
+  }
+  if ((*reader_ref)->header.file_identifier != header.file_identifier) {
+    sparkey_hash_close(reader_ref);
+    munmap(data, s.st_size);
+    return SPARKEY_FILE_IDENTIFIER_MISMATCH;
+  }
+  (*reader_ref)->pack_data = data;
+  (*reader_ref)->pack_len = s.st_size;
+  return SPARKEY_SUCCESS;
+
+close_fd:
+  close(fd);
+  return returncode;
+}
+
 void sparkey_hash_close(sparkey_hashreader **reader_ref) {
   if (reader_ref == NULL) {
     return;
@@ -105,15 +258,7 @@ void sparkey_hash_close(sparkey_hashreader **reader_ref) {
   if (reader->open_status != MAGIC_VALUE_HASHREADER) {
     return;
   }
-  sparkey_logreader_close_nodealloc(&reader->log);
-
-  reader->open_status = 0;
-  if (reader->data != NULL) {
-    munmap(reader->data, reader->data_len);
-    reader->data = NULL;
-  }
-  close(reader->fd);
-  reader->fd = -1;
+  hash_close_nodealloc(reader);
   free(reader);
   *reader_ref = NULL;
 }
@@ -125,9 +270,44 @@ static sparkey_returncode assert_reader_open(sparkey_hashreader *reader) {
   return SPARKEY_SUCCESS;
 }
 
+uint64_t sparkey_hash_keyhash(sparkey_hashreader *reader, const uint8_t *key, uint64_t keylen) {
+  return reader->header.hash_algorithm.hash(key, keylen, reader->header.hash_seed);
+}
+
+sparkey_returncode sparkey_hash_stats(sparkey_hashreader *reader, sparkey_reader_stats *stats) {
+  RETHROW(assert_reader_open(reader));
+#ifdef SPARKEY_STATS
+  stats_sum(reader->log.stats, stats);
+  return SPARKEY_SUCCESS;
+#else
+  (void) stats;
+  return SPARKEY_STATS_DISABLED;
+#endif
+}
+
 sparkey_returncode sparkey_hash_get(sparkey_hashreader *reader, const uint8_t *key, uint64_t keylen, sparkey_logiter *iter) {
   RETHROW(assert_reader_open(reader));
-  uint64_t hash = reader->header.hash_algorithm.hash(key, keylen, reader->header.hash_seed);
+  return sparkey_hash_get_hashed(reader, key, keylen, sparkey_hash_keyhash(reader, key, keylen), iter);
+}
+
+static inline void lookup_done(sparkey_hashreader *reader, uint64_t displacement, int hit) {
+  SPARKEY_PROBE2(hash_get__exit, hit, displacement + 1);
+#ifdef SPARKEY_STATS
+  sparkey_reader_stats *counters = &stats_slot(reader->log.stats)->counters;
+  uint64_t bucket = displacement < SPARKEY_PROBE_HISTOGRAM_SIZE - 1 ? displacement : SPARKEY_PROBE_HISTOGRAM_SIZE - 1;
+  __atomic_fetch_add(&counters->lookups, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&counters->probe_lengths[bucket], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(hit ? &counters->hits : &counters->misses, 1, __ATOMIC_RELAXED);
+#else
+  (void) reader;
+  (void) displacement;
+  (void) hit;
+#endif
+}
+
+sparkey_returncode sparkey_hash_get_hashed(sparkey_hashreader *reader, const uint8_t *key, uint64_t keylen, uint64_t hash, sparkey_logiter *iter) {
+  RETHROW(assert_reader_open(reader));
+  SPARKEY_PROBE1(hash_get__entry, keylen);
   uint64_t wanted_slot = hash % reader->header.hash_capacity;
 
   int slot_size = reader->header.address_size + reader->header.hash_size;
@@ -142,6 +322,7 @@ sparkey_returncode sparkey_hash_get(sparkey_hashreader *reader, const uint8_t *k
     uint64_t hash2 = reader->header.hash_algorithm.read_hash(hashtable, pos);
     uint64_t position2 = read_addr(hashtable, pos + reader->header.hash_size, reader->header.address_size);
     if (position2 == 0) {
+      lookup_done(reader, displacement, 0);
       iter->state = SPARKEY_ITER_INVALID;
       return SPARKEY_SUCCESS;
     }
@@ -170,12 +351,15 @@ sparkey_returncode sparkey_hash_get(sparkey_hashreader *reader, const uint8_t *k
           pos2 += len2;
         }
         if (equals) {
+          lookup_done(reader, displacement, 1);
           return SPARKEY_SUCCESS;
         }
       }
+      STATS_ADD(reader->log.stats, hash_collisions, 1);
     }
     uint64_t other_displacement = get_displacement(reader->header.hash_capacity, slot, hash2);
     if (displacement > other_displacement) {
+      lookup_done(reader, displacement, 0);
       iter->state = SPARKEY_ITER_INVALID;
       return SPARKEY_SUCCESS;
     }
@@ -205,7 +389,7 @@ sparkey_returncode sparkey_logiter_hashnext(sparkey_logiter *iter, sparkey_hashr
     if (iter->type != SPARKEY_ENTRY_PUT) {
       continue;
     }
-    uint64_t position = (iter->entry_block_position << reader->header.entry_block_bits) | iter->entry_count;
+    uint64_t position = (iter->entry_position << reader->header.entry_block_bits) | iter->entry_index;
 
     uint64_t key_hash = sparkey_iter_hash(&reader->header, iter, &reader->log);
     uint64_t wanted_slot = key_hash % reader->header.hash_capacity;
@@ -30,6 +30,7 @@
 #include "util.h"
 #include "hashheader.h"
 #include "hashiter.h"
+#include "probes.h"
 
 static uint32_t int_log2(uint32_t x) {
   uint32_t count = 0;
@@ -351,12 +352,17 @@ free:
 }
 
 sparkey_returncode sparkey_hash_write(const char *hash_filename, const char *log_filename, int hash_size) {
+  return sparkey_hash_write_seeded(hash_filename, log_filename, hash_size, NULL);
+}
+
+sparkey_returncode sparkey_hash_write_seeded(const char *hash_filename, const char *log_filename, int hash_size, const uint32_t *seed) {
   sparkey_logheader log_header;
   sparkey_logreader *log;
   sparkey_logiter *iter = NULL;
   sparkey_logiter *ra_iter = NULL;
 
   RETHROW(sparkey_load_logheader(&log_header, log_filename));
+  SPARKEY_PROBE1(hash_write__start, log_header.data_end);
 
   RETHROW(sparkey_logreader_open(&log, log_filename));
   sparkey_returncode returncode = SPARKEY_SUCCESS;
@@ -374,7 +380,8 @@ sparkey_returncode sparkey_hash_write(const char *hash_filename, const char *log
   if (returncode == SPARKEY_SUCCESS &&
       old_header.file_identifier == log_header.file_identifier &&
       old_header.major_version == HASH_MAJOR_VERSION &&
-      old_header.minor_version == HASH_MINOR_VERSION) {
+      old_header.minor_version == HASH_MINOR_VERSION &&
+      (seed == NULL || old_header.hash_seed == *seed)) {
     // Prepare to copy stuff from old header
     cap = ((log_header.num_puts - old_header.num_puts) + old_header.num_entries) * 1.3;
     start = old_header.data_end;
@@ -389,7 +396,11 @@ sparkey_returncode sparkey_hash_write(const char *hash_filename, const char *log
   } else {
     cap = log_header.num_puts * 1.3;
     start = log_header.header_size;
-    TRY(rand32(&hash_seed), close_iter);
+    if (seed != NULL) {
+      hash_seed = *seed;
+    } else {
+      TRY(rand32(&hash_seed), close_iter);
+    }
     hash_header.garbage_size = 0;
     copy_old = 0;
     returncode = SPARKEY_SUCCESS;
@@ -446,6 +457,7 @@ sparkey_returncode sparkey_hash_write(const char *hash_filename, const char *log
 
   if (copy_old) {
     TRY(fill_hash(hashtable, hash_filename, &old_header, &hash_header), free_hashtable);
+    SPARKEY_PROBE1(hash_write__copied, hash_header.num_entries);
     TRY(sparkey_logiter_seek(iter, log, start), free_hashtable);
   }
 
@@ -464,8 +476,8 @@ sparkey_returncode sparkey_hash_write(const char *hash_filename, const char *log
       break;
     }
 
-    uint64_t iter_block_start = iter->block_position;
-    uint64_t iter_entry_count = iter->entry_count;
+    uint64_t iter_block_start = iter->entry_position;
+    uint64_t iter_entry_count = iter->entry_index;
 
     uint64_t key_hash = sparkey_iter_hash(&hash_header, iter, log);
     uint64_t wanted_slot = key_hash % hash_header.hash_capacity;
@@ -481,6 +493,7 @@ sparkey_returncode sparkey_hash_write(const char *hash_filename, const char *log
     }
   }
 normal_exit:
+  SPARKEY_PROBE1(hash_write__inserted, hash_header.num_entries);
 
   calculate_max_displacement(&hash_header, hashtable);
 
@@ -514,6 +527,7 @@ close_iter:
 close_reader:
   sparkey_logreader_close(&log);
 
+  SPARKEY_PROBE1(hash_write__done, returncode);
   return returncode;
 }
 
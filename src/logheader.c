@@ -17,6 +17,8 @@
 #include <inttypes.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "logheader.h"
 #include "endiantools.h"
@@ -33,21 +35,32 @@ void print_logheader(sparkey_logheader *header) {
   printf("Compression: %s, block size: %d\n",
       compression_types[header->compression_type],
       header->compression_block_size);
+  if (header->flags & LOG_FLAG_FRONT_CODED) {
+    printf("Front coded keys, restart interval: %d\n", header->restart_interval);
+  }
+  if (header->flags & LOG_FLAG_CHECKSUMS) {
+    printf("Block checksums: crc32c\n");
+  }
 }
 
-static sparkey_returncode logheader_version0(sparkey_logheader *header, FILE *fp) {
-  RETHROW(fread_little_endian32(fp, &header->file_identifier));
-  RETHROW(fread_little_endian64(fp, &header->num_puts));
-  RETHROW(fread_little_endian64(fp, &header->num_deletes));
-  RETHROW(fread_little_endian64(fp, &header->data_end));
-  RETHROW(fread_little_endian64(fp, &header->max_key_len));
-  RETHROW(fread_little_endian64(fp, &header->max_value_len));
-  RETHROW(fread_little_endian64(fp, &header->delete_size));
-  RETHROW(fread_little_endian32(fp, &header->compression_type));
-  RETHROW(fread_little_endian32(fp, &header->compression_block_size));
-  RETHROW(fread_little_endian64(fp, &header->put_size));
-  RETHROW(fread_little_endian32(fp, &header->max_entries_per_block));
+static sparkey_returncode logheader_version0(sparkey_logheader *header, const uint8_t *buf, uint64_t len) {
+  if (len < LOG_HEADER_SIZE) {
+    return SPARKEY_UNEXPECTED_EOF;
+  }
+  header->file_identifier = read_little_endian32(buf, 12);
+  header->num_puts = read_little_endian64(buf, 16);
+  header->num_deletes = read_little_endian64(buf, 24);
+  header->data_end = read_little_endian64(buf, 32);
+  header->max_key_len = read_little_endian64(buf, 40);
+  header->max_value_len = read_little_endian64(buf, 48);
+  header->delete_size = read_little_endian64(buf, 56);
+  header->compression_type = read_little_endian32(buf, 64);
+  header->compression_block_size = read_little_endian32(buf, 68);
+  header->put_size = read_little_endian64(buf, 72);
+  header->max_entries_per_block = read_little_endian32(buf, 80);
   header->header_size = LOG_HEADER_SIZE;
+  header->flags = 0;
+  header->restart_interval = 0;
 
   // Some basic consistency checks
   if (header->data_end < header->header_size) {
@@ -66,59 +79,113 @@ static sparkey_returncode logheader_version0(sparkey_logheader *header, FILE *fp
 }
 
 
-typedef sparkey_returncode (*loader)(sparkey_logheader *header, FILE *fp);
-
-static loader loaders[1] = { logheader_version0 };
+static sparkey_returncode logheader_version1(sparkey_logheader *header, const uint8_t *buf, uint64_t len) {
+  RETHROW(logheader_version0(header, buf, len));
+  if (len < LOG_HEADER_SIZE_1) {
+    return SPARKEY_UNEXPECTED_EOF;
+  }
+  header->flags = read_little_endian32(buf, 84);
+  header->restart_interval = read_little_endian32(buf, 88);
+  header->header_size = LOG_HEADER_SIZE_1;
 
-sparkey_returncode sparkey_load_logheader(sparkey_logheader *header, const char *filename) {
-  FILE *fp = fopen(filename, "r");
-  if (fp == NULL) {
-    return sparkey_open_returncode(errno);
+  if (header->data_end < header->header_size) {
+    return SPARKEY_LOG_HEADER_CORRUPT;
   }
+  if (header->flags & ~(LOG_FLAG_FRONT_CODED | LOG_FLAG_CHECKSUMS)) {
+    return SPARKEY_LOG_HEADER_CORRUPT;
+  }
+  if (header->flags & LOG_FLAG_FRONT_CODED) {
+    if (header->compression_type != SPARKEY_COMPRESSION_SNAPPY || header->restart_interval == 0) {
+      return SPARKEY_LOG_HEADER_CORRUPT;
+    }
+  }
+  return SPARKEY_SUCCESS;
+}
 
-  uint32_t tmp;
-  RETHROW(fread_little_endian32(fp, &tmp));
-  if (tmp != LOG_MAGIC_NUMBER) {
-    fclose(fp);
+typedef sparkey_returncode (*loader)(sparkey_logheader *header, const uint8_t *buf, uint64_t len);
+
+static loader loaders[2] = { logheader_version0, logheader_version1 };
+
+sparkey_returncode sparkey_load_logheader_mem(sparkey_logheader *header, const uint8_t *data, uint64_t len) {
+  if (len < 12) {
+    return SPARKEY_UNEXPECTED_EOF;
+  }
+  if (read_little_endian32(data, 0) != LOG_MAGIC_NUMBER) {
     return SPARKEY_WRONG_LOG_MAGIC_NUMBER;
   }
-  RETHROW(fread_little_endian32(fp, &header->major_version));
+  header->major_version = read_little_endian32(data, 4);
   if (header->major_version != LOG_MAJOR_VERSION) {
-    fclose(fp);
     return SPARKEY_WRONG_LOG_MAJOR_VERSION;
   }
-  RETHROW(fread_little_endian32(fp, &header->minor_version));
+  header->minor_version = read_little_endian32(data, 8);
   if (header->minor_version > LOG_MINOR_VERSION) {
-    fclose(fp);
     return SPARKEY_UNSUPPORTED_LOG_MINOR_VERSION;
   }
-  int version = header->minor_version;
-  loader l = loaders[version];
+  loader l = loaders[header->minor_version];
   if (l == NULL) {
-    fclose(fp);
     return SPARKEY_INTERNAL_ERROR;
   }
-  sparkey_returncode x = (*l)(header, fp);
-  fclose(fp);
-  return x;
+  return (*l)(header, data, len);
 }
 
-sparkey_returncode write_logheader(int fd, sparkey_logheader *header) {
-  RETHROW(fwrite_little_endian32(fd, LOG_MAGIC_NUMBER));
-  RETHROW(fwrite_little_endian32(fd, LOG_MAJOR_VERSION));
-  RETHROW(fwrite_little_endian32(fd, LOG_MINOR_VERSION));
-  RETHROW(fwrite_little_endian32(fd, header->file_identifier));
-  RETHROW(fwrite_little_endian64(fd, header->num_puts));
-  RETHROW(fwrite_little_endian64(fd, header->num_deletes));
-  RETHROW(fwrite_little_endian64(fd, header->data_end));
-  RETHROW(fwrite_little_endian64(fd, header->max_key_len));
-  RETHROW(fwrite_little_endian64(fd, header->max_value_len));
-  RETHROW(fwrite_little_endian64(fd, header->delete_size));
-  RETHROW(fwrite_little_endian32(fd, header->compression_type));
-  RETHROW(fwrite_little_endian32(fd, header->compression_block_size));
-  RETHROW(fwrite_little_endian64(fd, header->put_size));
-  RETHROW(fwrite_little_endian32(fd, header->max_entries_per_block));
-  return SPARKEY_SUCCESS;
+sparkey_returncode sparkey_load_logheader_fd(sparkey_logheader *header, int fd) {
+  uint8_t buf[LOG_MAX_HEADER_SIZE];
+  ssize_t len;
+  do {
+    len = pread(fd, buf, sizeof(buf), 0);
+  } while (len < 0 && errno == EINTR);
+  if (len < 0) {
+    return sparkey_open_returncode(errno);
+  }
+  return sparkey_load_logheader_mem(header, buf, len);
 }
 
+sparkey_returncode sparkey_load_logheader(sparkey_logheader *header, const char *filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return sparkey_open_returncode(errno);
+  }
+  sparkey_returncode returncode = sparkey_load_logheader_fd(header, fd);
+  close(fd);
+  return returncode;
+}
 
+uint64_t logheader_max_block_size(sparkey_logheader *header) {
+  uint64_t size = header->compression_block_size;
+  if (header->flags & LOG_FLAG_FRONT_CODED) {
+    // One restart point per restart_interval entries, plus the first entry, plus the count.
+    size += 4 * (size / header->restart_interval + 2);
+  }
+  return size;
+}
+
+uint64_t logheader_checksum_size(sparkey_logheader *header) {
+  return (header->flags & LOG_FLAG_CHECKSUMS) ? LOG_CHECKSUM_SIZE : 0;
+}
+
+void encode_logheader(uint8_t *buf, sparkey_logheader *header) {
+  write_little_endian32(&buf[0], LOG_MAGIC_NUMBER);
+  write_little_endian32(&buf[4], LOG_MAJOR_VERSION);
+  write_little_endian32(&buf[8], header->minor_version);
+  write_little_endian32(&buf[12], header->file_identifier);
+  write_little_endian64(&buf[16], header->num_puts);
+  write_little_endian64(&buf[24], header->num_deletes);
+  write_little_endian64(&buf[32], header->data_end);
+  write_little_endian64(&buf[40], header->max_key_len);
+  write_little_endian64(&buf[48], header->max_value_len);
+  write_little_endian64(&buf[56], header->delete_size);
+  write_little_endian32(&buf[64], header->compression_type);
+  write_little_endian32(&buf[68], header->compression_block_size);
+  write_little_endian64(&buf[72], header->put_size);
+  write_little_endian32(&buf[80], header->max_entries_per_block);
+  if (header->minor_version >= 1) {
+    write_little_endian32(&buf[84], header->flags);
+    write_little_endian32(&buf[88], header->restart_interval);
+  }
+}
+
+sparkey_returncode write_logheader(int fd, sparkey_logheader *header) {
+  uint8_t buf[LOG_MAX_HEADER_SIZE];
+  encode_logheader(buf, header);
+  return write_full(fd, buf, header->header_size);
+}
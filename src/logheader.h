@@ -22,8 +22,34 @@
 
 #define LOG_MAGIC_NUMBER (0x49b39c95)
 #define LOG_MAJOR_VERSION (1)
-#define LOG_MINOR_VERSION (0)
+#define LOG_MINOR_VERSION (1)
 #define LOG_HEADER_SIZE (84)
+#define LOG_HEADER_SIZE_1 (92)
+#define LOG_MAX_HEADER_SIZE LOG_HEADER_SIZE_1
+
+/**
+ * Keys are front coded: each entry only stores the part of the key
+ * that differs from the previous one. Requires minor version 1.
+ */
+#define LOG_FLAG_FRONT_CODED (1)
+
+/**
+ * Each compressed block is followed by a little endian CRC32C of its compressed data.
+ * Uncompressed logs instead have a checkpoint between entries after every LOG_CHECKPOINT_INTERVAL bytes
+ * and at each flush, see LOG_CHECKPOINT_MARKER.
+ * Requires minor version 1.
+ */
+#define LOG_FLAG_CHECKSUMS (2)
+#define LOG_CHECKSUM_SIZE (4)
+
+/**
+ * A checkpoint starts with these two bytes, a non-canonical encoding of 0 that never starts an entry,
+ * followed by a vlq of the number of bytes it covers and the little endian CRC32C of those bytes.
+ * The covered bytes are the entries between the previous checkpoint, or the start of the data, and this one.
+ */
+#define LOG_CHECKPOINT_MARKER_0 (0x80)
+#define LOG_CHECKPOINT_MARKER_1 (0x00)
+#define LOG_CHECKPOINT_INTERVAL (4096)
 
 typedef struct {
   uint32_t major_version;
@@ -40,6 +66,8 @@ typedef struct {
   uint64_t put_size;
   uint32_t header_size;
   uint32_t max_entries_per_block;
+  uint32_t flags;
+  uint32_t restart_interval;
 } sparkey_logheader;
 
 /**
@@ -50,12 +78,50 @@ typedef struct {
  */
 sparkey_returncode sparkey_load_logheader(sparkey_logheader *header, const char *filename);
 
+/**
+ * Same as sparkey_load_logheader, but reads from an open file.
+ * @param header header struct to fill
+ * @param fd an open log file.
+ * @returns an error code if it could not load the file.
+ */
+sparkey_returncode sparkey_load_logheader_fd(sparkey_logheader *header, int fd);
+
+/**
+ * Same as sparkey_load_logheader, but reads from memory.
+ * @param header header struct to fill
+ * @param data the start of a log.
+ * @param len the number of bytes available at data.
+ * @returns an error code if it could not load the header.
+ */
+sparkey_returncode sparkey_load_logheader_mem(sparkey_logheader *header, const uint8_t *data, uint64_t len);
+
 /**
  * Dumps a human readable representation of the header to stdout
  * @param header an initialized header struct
  */
 void print_logheader(sparkey_logheader *header);
 
+/**
+ * Front coded blocks end with a trailer of restart points, which is not included in the block size.
+ * @param header an initialized header struct
+ * @returns the largest possible size of an uncompressed block, including the trailer.
+ */
+uint64_t logheader_max_block_size(sparkey_logheader *header);
+
+/**
+ * @param header an initialized header struct
+ * @returns the number of bytes that follow the compressed data of each block, 0 for logs without checksums.
+ */
+uint64_t logheader_checksum_size(sparkey_logheader *header);
+
+/**
+ * Serializes a header to the on disk format.
+ * The minor version and the size of the header are taken from header.
+ * @param buf destination, must be at least header_size bytes long
+ * @param header the header to serialize
+ */
+void encode_logheader(uint8_t *buf, sparkey_logheader *header);
+
 /**
  * Writes a header to the current position in the file
  * @param fd a file descripter pointing to a file open for writing
@@ -13,6 +13,9 @@
 * License for the specific language governing permissions and limitations under
 * the License.
 */
+#ifdef __linux__
+#define _GNU_SOURCE // for mremap
+#endif
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
@@ -28,10 +31,19 @@
 #include "logheader.h"
 #include "endiantools.h"
 #include "util.h"
+#include "vlq.h"
+#include "crc32c.h"
+#include "probes.h"
 
 #define MAGIC_VALUE_LOGITER (0xd765c8cc)
 #define MAGIC_VALUE_LOGREADER (0xe93356c4)
 
+// How far ahead of a sequential iterator data is read in advance, and how much is released behind it at a time.
+#define SEQUENTIAL_WINDOW (1024*1024)
+
+// Number of recently verified block positions remembered by each iterator, as a power of two.
+#define VERIFIED_BITS (10)
+
 static inline uint64_t min64(uint64_t a, uint64_t b) {
   if (a < b) {
     return a;
@@ -39,56 +51,92 @@ static inline uint64_t min64(uint64_t a, uint64_t b) {
   return b;
 }
 
-static inline uint64_t read_vlq(uint8_t * array, uint64_t *position) {
-  uint64_t res = 0;
-  uint64_t shift = 0;
-  uint64_t tmp, tmp2;
-  while (1) {
-    tmp = array[(*position)++];
-    tmp2 = tmp & 0x7f;
-    if (tmp == tmp2) {
-      return res | tmp << shift;
+#ifdef SPARKEY_STATS
+static int next_stats_slot;
+static __thread int thread_stats_slot = -1;
+
+sparkey_stats_slot * stats_slot(sparkey_stats_slot *slots) {
+  if (thread_stats_slot < 0) {
+    thread_stats_slot = __atomic_fetch_add(&next_stats_slot, 1, __ATOMIC_RELAXED) % STATS_SLOTS;
+  }
+  return &slots[thread_stats_slot];
+}
+
+void stats_sum(sparkey_stats_slot *slots, sparkey_reader_stats *stats) {
+  // All counters are uint64_t, so they can be summed as an array.
+  uint64_t *sum = (uint64_t *) stats;
+  memset(stats, 0, sizeof(sparkey_reader_stats));
+  for (int i = 0; i < STATS_SLOTS; i++) {
+    uint64_t *counters = (uint64_t *) &slots[i].counters;
+    for (size_t j = 0; j < sizeof(sparkey_reader_stats) / sizeof(uint64_t); j++) {
+      sum[j] += __atomic_load_n(&counters[j], __ATOMIC_RELAXED);
     }
-    res |= tmp2 << shift;
-    shift += 7;
   }
-  return res;
+}
+#endif
+
+static void init_reader(sparkey_logreader *log) {
+  log->generation = 0;
+  log->verify = SPARKEY_VERIFY_ALWAYS;
+#ifdef SPARKEY_STATS
+  memset(log->stats, 0, sizeof(log->stats));
+#endif
+  log->open_status = MAGIC_VALUE_LOGREADER;
 }
 
 sparkey_returncode sparkey_logreader_open_noalloc(sparkey_logreader *log, const char *filename) {
-  int fd = 0;
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return sparkey_open_returncode(errno);
+  }
+  return sparkey_logreader_open_fd_noalloc(log, fd);
+}
+
+sparkey_returncode sparkey_logreader_open_fd_noalloc(sparkey_logreader *log, int fd) {
   sparkey_returncode returncode;
-  TRY(sparkey_load_logheader(&log->header, filename), cleanup);
+  TRY(sparkey_load_logheader_fd(&log->header, fd), cleanup);
   log->data_len = log->header.data_end;
 
   struct stat s;
-  stat(filename, &s);
-  if (log->data_len > (uint64_t) s.st_size) {
-    returncode = SPARKEY_LOG_TOO_SMALL;
+  if (fstat(fd, &s) < 0) {
+    returncode = sparkey_open_returncode(errno);
     goto cleanup;
   }
-
-  fd = open(filename, O_RDONLY);
-  if (fd < 0) {
-    returncode = sparkey_open_returncode(errno);
+  if (log->data_len > (uint64_t) s.st_size) {
+    returncode = SPARKEY_LOG_TOO_SMALL;
     goto cleanup;
   }
-  log->fd = fd;
 
   log->data = mmap(NULL, log->data_len, PROT_READ, MAP_SHARED, fd, 0);
   if (log->data == MAP_FAILED) {
     returncode = SPARKEY_MMAP_FAILED;
     goto cleanup;
   }
+  log->fd = fd;
+  log->mapped = 1;
 
-  log->open_status = MAGIC_VALUE_LOGREADER;
+  init_reader(log);
   return SPARKEY_SUCCESS;
 
 cleanup:
-  if (fd > 0) close(fd);
+  close(fd);
   return returncode;
 }
 
+sparkey_returncode sparkey_logreader_open_mem_noalloc(sparkey_logreader *log, const uint8_t *data, uint64_t len) {
+  RETHROW(sparkey_load_logheader_mem(&log->header, data, len));
+  log->data_len = log->header.data_end;
+  if (log->data_len > len) {
+    return SPARKEY_LOG_TOO_SMALL;
+  }
+  log->fd = -1;
+  log->data = (uint8_t *) data;
+  log->mapped = 0;
+
+  init_reader(log);
+  return SPARKEY_SUCCESS;
+}
+
 sparkey_returncode sparkey_logreader_open(sparkey_logreader **log_ref, const char *filename) {
   RETHROW(correct_endian_platform());
 
@@ -108,6 +156,50 @@ cleanup:
   return returncode;
 }
 
+sparkey_returncode sparkey_logreader_open_fd(sparkey_logreader **log_ref, int fd) {
+  RETHROW(correct_endian_platform());
+
+  sparkey_logreader *log = malloc(sizeof(sparkey_logreader));
+  if (log == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+
+  sparkey_returncode returncode;
+  // The reader keeps its own descriptor, so the caller is free to close theirs.
+  int dupfd = dup(fd);
+  if (dupfd < 0) {
+    returncode = sparkey_open_returncode(errno);
+    goto cleanup;
+  }
+  TRY(sparkey_logreader_open_fd_noalloc(log, dupfd), cleanup);
+
+  *log_ref = log;
+  return SPARKEY_SUCCESS;
+
+cleanup:
+  free(log);
+  return returncode;
+}
+
+sparkey_returncode sparkey_logreader_open_mem(sparkey_logreader **log_ref, const uint8_t *data, uint64_t len) {
+  RETHROW(correct_endian_platform());
+
+  sparkey_logreader *log = malloc(sizeof(sparkey_logreader));
+  if (log == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+
+  sparkey_returncode returncode;
+  TRY(sparkey_logreader_open_mem_noalloc(log, data, len), cleanup);
+
+  *log_ref = log;
+  return SPARKEY_SUCCESS;
+
+cleanup:
+  free(log);
+  return returncode;
+}
+
 void sparkey_logreader_close_nodealloc(sparkey_logreader *log) {
   if (log == NULL) {
     return;
@@ -116,11 +208,13 @@ void sparkey_logreader_close_nodealloc(sparkey_logreader *log) {
     return;
   }
   log->open_status = 0;
-  if (log->data != NULL) {
+  if (log->data != NULL && log->mapped) {
     munmap(log->data, log->data_len);
-    log->data = NULL;
   }
-  close(log->fd);
+  log->data = NULL;
+  if (log->fd >= 0) {
+    close(log->fd);
+  }
   log->fd = -1;
 }
 
@@ -154,6 +248,16 @@ static sparkey_returncode assert_iter_open(sparkey_logiter *iter, sparkey_logrea
 
 sparkey_returncode sparkey_logiter_create(sparkey_logiter **iter_ref, sparkey_logreader *log) {
   RETHROW(assert_log_open(log));
+  RETHROW(sparkey_logiter_create_range(iter_ref, log, log->header.header_size, log->header.data_end));
+  (*iter_ref)->follow = 1;
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode sparkey_logiter_create_range(sparkey_logiter **iter_ref, sparkey_logreader *log, uint64_t start, uint64_t end) {
+  RETHROW(assert_log_open(log));
+  if (start < log->header.header_size || start > end || end > log->header.data_end) {
+    return SPARKEY_INVALID_LOG_RANGE;
+  }
 
   sparkey_logiter *iter = malloc(sizeof(sparkey_logiter));
   if (iter == NULL) {
@@ -163,10 +267,23 @@ sparkey_returncode sparkey_logiter_create(sparkey_logiter **iter_ref, sparkey_lo
   iter->open_status = MAGIC_VALUE_LOGITER;
   iter->file_identifier = log->header.file_identifier;
   iter->block_position = 0;
-  iter->next_block_position = log->header.header_size;
+  iter->next_block_position = start;
+  iter->start = start;
+  iter->end = end;
+  iter->follow = 0;
+  iter->generation = log->generation;
+  iter->access_pattern = SPARKEY_ACCESS_NORMAL;
+  iter->advised_until = start;
+  iter->released_until = start;
   iter->block_offset = 0;
   iter->block_len = 0;
   iter->state = SPARKEY_ITER_NEW;
+  iter->restarts = NULL;
+  iter->restart_count = 0;
+  iter->verified = NULL;
+  iter->checkpoint_start = 0;
+  iter->checkpoint_end = 0;
+  memset(&iter->key_buf, 0, sizeof(sparkey_buf));
 
   switch (log->header.compression_type) {
   case SPARKEY_COMPRESSION_NONE:
@@ -174,7 +291,7 @@ sparkey_returncode sparkey_logiter_create(sparkey_logiter **iter_ref, sparkey_lo
     break;
   case SPARKEY_COMPRESSION_SNAPPY:
     iter->compression_buf_allocated = 1;
-    iter->compression_buf = malloc(log->header.compression_block_size);
+    iter->compression_buf = malloc(logheader_max_block_size(&log->header));
     if (iter->compression_buf == NULL) {
       free(iter);
       return SPARKEY_INTERNAL_ERROR;
@@ -205,10 +322,268 @@ void sparkey_logiter_close(sparkey_logiter **iter_ref) {
   if (iter->compression_buf_allocated) {
     free(iter->compression_buf);
   }
+  buf_close(&iter->key_buf);
+  free(iter->verified);
   free(iter);
   *iter_ref = NULL;
 }
 
+/**
+ * Applies advice to the pages of the log map that overlap [start, end).
+ * If inner is set, only pages that are completely inside the range are included.
+ */
+static int advise(sparkey_logreader *log, uint64_t start, uint64_t end, int advice, int inner) {
+  if (!log->mapped) {
+    // Memory owned by the caller is left alone
+    return 0;
+  }
+  uint64_t page_size = sysconf(_SC_PAGESIZE);
+  end = min64(end, log->data_len);
+  if (inner) {
+    start = (start + page_size - 1) / page_size * page_size;
+    end = end / page_size * page_size;
+  } else {
+    start = start / page_size * page_size;
+    end = (end + page_size - 1) / page_size * page_size;
+    end = min64(end, (log->data_len + page_size - 1) / page_size * page_size);
+  }
+  if (start >= end) {
+    return 0;
+  }
+  return madvise(log->data + start, end - start, advice);
+}
+
+sparkey_returncode sparkey_logiter_set_access_pattern(sparkey_logiter *iter, sparkey_logreader *log, sparkey_access_pattern pattern) {
+  RETHROW(assert_iter_open(iter, log));
+  int advice;
+  switch (pattern) {
+  case SPARKEY_ACCESS_NORMAL: advice = MADV_NORMAL; break;
+  case SPARKEY_ACCESS_SEQUENTIAL: advice = MADV_SEQUENTIAL; break;
+  case SPARKEY_ACCESS_RANDOM: advice = MADV_RANDOM; break;
+  default: return SPARKEY_INVALID_ARGUMENT;
+  }
+  // Failures are ignored, since this is only a hint.
+  advise(log, iter->start, iter->end, advice, 0);
+  iter->access_pattern = pattern;
+  iter->advised_until = iter->start;
+  iter->released_until = iter->start;
+  return SPARKEY_SUCCESS;
+}
+
+/**
+ * Keeps a window ahead of a sequential iterator paged in, and releases what it has passed.
+ * Failures are ignored, since this is only a hint.
+ */
+static void advise_sequential(sparkey_logiter *iter, sparkey_logreader *log) {
+  uint64_t position = iter->block_position;
+  if (position < iter->released_until || position >= iter->end) {
+    // The iterator moved backwards, or is done
+    iter->advised_until = position;
+    iter->released_until = position;
+    return;
+  }
+  if (iter->advised_until < position + SEQUENTIAL_WINDOW / 2) {
+    uint64_t until = min64(position + SEQUENTIAL_WINDOW, iter->end);
+    advise(log, position > iter->advised_until ? position : iter->advised_until, until, MADV_WILLNEED, 0);
+    iter->advised_until = until;
+  }
+  if (position - iter->released_until >= SEQUENTIAL_WINDOW) {
+    advise(log, iter->released_until, position, MADV_DONTNEED, 1);
+    iter->released_until = position;
+  }
+}
+
+sparkey_returncode sparkey_logreader_refresh(sparkey_logreader *log) {
+  RETHROW(assert_log_open(log));
+  if (log->fd < 0) {
+    return SPARKEY_INVALID_ARGUMENT;
+  }
+  sparkey_logheader header;
+  RETHROW(sparkey_load_logheader_fd(&header, log->fd));
+  if (header.file_identifier != log->header.file_identifier) {
+    return SPARKEY_FILE_IDENTIFIER_MISMATCH;
+  }
+  if (header.data_end < log->header.data_end ||
+      header.header_size != log->header.header_size ||
+      header.minor_version != log->header.minor_version ||
+      header.flags != log->header.flags ||
+      header.restart_interval != log->header.restart_interval ||
+      header.compression_type != log->header.compression_type ||
+      header.compression_block_size != log->header.compression_block_size) {
+    return SPARKEY_LOG_HEADER_CORRUPT;
+  }
+  if (header.data_end == log->header.data_end) {
+    return SPARKEY_SUCCESS;
+  }
+
+  struct stat s;
+  if (fstat(log->fd, &s) < 0) {
+    return sparkey_open_returncode(errno);
+  }
+  if (header.data_end > (uint64_t) s.st_size) {
+    return SPARKEY_LOG_TOO_SMALL;
+  }
+
+#ifdef MREMAP_MAYMOVE
+  uint8_t *data = mremap(log->data, log->data_len, header.data_end, MREMAP_MAYMOVE);
+#else
+  uint8_t *data = mmap(NULL, header.data_end, PROT_READ, MAP_SHARED, log->fd, 0);
+  if (data != MAP_FAILED) {
+    munmap(log->data, log->data_len);
+  }
+#endif
+  if (data == MAP_FAILED) {
+    return SPARKEY_MMAP_FAILED;
+  }
+  log->data = data;
+  log->data_len = header.data_end;
+  log->header = header;
+  log->generation++;
+  return SPARKEY_SUCCESS;
+}
+
+/**
+ * Catches up with a refresh of the logreader: extends the range of following iterators,
+ * and moves pointers into the log data to the new map.
+ */
+static void follow_log(sparkey_logiter *iter, sparkey_logreader *log) {
+  if (iter->generation == log->generation) {
+    return;
+  }
+  iter->generation = log->generation;
+  if (iter->follow) {
+    iter->end = log->header.data_end;
+  }
+  // An uncompressed log is a single block that grows along with the log
+  if (log->header.compression_type == SPARKEY_COMPRESSION_NONE && iter->block_position != 0) {
+    iter->compression_buf = &log->data[iter->block_position];
+    iter->block_len = iter->end - iter->block_position;
+    iter->next_block_position = iter->end;
+  }
+}
+
+/**
+ * Reads a length without going past end.
+ * @returns 0 if the length doesn't end before end.
+ */
+static int peek_vlq(const uint8_t *array, uint64_t *position, uint64_t end, uint64_t *value) {
+  uint64_t res = 0;
+  for (int shift = 0; shift < 64 && *position < end; shift += 7) {
+    uint8_t b = array[(*position)++];
+    res |= (uint64_t) (b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      *value = res;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Checks the data of a block against its checksum.
+ * @param position identifies the block for SPARKEY_VERIFY_FIRST_ACCESS.
+ */
+static sparkey_returncode verify_block(sparkey_logiter *iter, sparkey_logreader *log, uint64_t position, const uint8_t *data, size_t len, uint32_t checksum) {
+  uint64_t *slot = NULL;
+  switch (log->verify) {
+  case SPARKEY_VERIFY_OFF:
+    return SPARKEY_SUCCESS;
+  case SPARKEY_VERIFY_FIRST_ACCESS:
+    if (iter->verified == NULL) {
+      iter->verified = calloc(1 << VERIFIED_BITS, sizeof(uint64_t));
+      if (iter->verified == NULL) {
+        return SPARKEY_INTERNAL_ERROR;
+      }
+    }
+    // Block positions are never 0, so empty slots never match.
+    slot = &iter->verified[(position * 0x9e3779b97f4a7c15ULL) >> (64 - VERIFIED_BITS)];
+    if (*slot == position) {
+      return SPARKEY_SUCCESS;
+    }
+    break;
+  default:
+    break;
+  }
+  if (crc32c(0, data, len) != checksum) {
+    return SPARKEY_CHECKSUM_MISMATCH;
+  }
+  if (slot != NULL) {
+    *slot = position;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+static int has_checkpoints(sparkey_logreader *log) {
+  return log->header.compression_type == SPARKEY_COMPRESSION_NONE && (log->header.flags & LOG_FLAG_CHECKSUMS);
+}
+
+static int is_checkpoint(const uint8_t *data, uint64_t pos, uint64_t end) {
+  return end - pos >= 2 && data[pos] == LOG_CHECKPOINT_MARKER_0 && data[pos + 1] == LOG_CHECKPOINT_MARKER_1;
+}
+
+/**
+ * Reads the checkpoint at pos and moves pos past it.
+ * @returns 0 if the checkpoint doesn't end before end.
+ */
+static int read_checkpoint(const uint8_t *data, uint64_t *pos, uint64_t end, uint64_t *len, uint32_t *checksum) {
+  uint64_t p = *pos + 2;
+  if (!peek_vlq(data, &p, end, len) || end - p < LOG_CHECKSUM_SIZE) {
+    return 0;
+  }
+  *checksum = read_little_endian32(data, p);
+  *pos = p + LOG_CHECKSUM_SIZE;
+  return 1;
+}
+
+/**
+ * Moves an iterator of an uncompressed log past the checkpoints at its position.
+ */
+static sparkey_returncode skip_checkpoints(sparkey_logiter *iter) {
+  while (is_checkpoint(iter->compression_buf, iter->block_offset, iter->block_len)) {
+    uint64_t len;
+    uint32_t checksum;
+    if (!read_checkpoint(iter->compression_buf, &iter->block_offset, iter->block_len, &len, &checksum)) {
+      return SPARKEY_CHECKSUM_MISMATCH;
+    }
+  }
+  return SPARKEY_SUCCESS;
+}
+
+/**
+ * Finds the checkpoint that follows the entry at position in an uncompressed log,
+ * and checks the data it covers, unless the iterator already did.
+ * The writer puts a checkpoint before each flush, so every entry is followed by one.
+ */
+static sparkey_returncode verify_checkpoint(sparkey_logiter *iter, sparkey_logreader *log, uint64_t position) {
+  if (log->verify == SPARKEY_VERIFY_OFF || (position >= iter->checkpoint_start && position < iter->checkpoint_end)) {
+    return SPARKEY_SUCCESS;
+  }
+  uint64_t end = log->header.data_end;
+  uint64_t pos = position;
+  while (!is_checkpoint(log->data, pos, end)) {
+    uint64_t a, b;
+    if (!peek_vlq(log->data, &pos, end, &a) || !peek_vlq(log->data, &pos, end, &b)) {
+      return SPARKEY_CHECKSUM_MISMATCH;
+    }
+    uint64_t len = a == 0 ? b : a - 1 + b;
+    if (len > end - pos) {
+      return SPARKEY_CHECKSUM_MISMATCH;
+    }
+    pos += len;
+  }
+  uint64_t checkpoint = pos;
+  uint64_t len;
+  uint32_t checksum;
+  if (!read_checkpoint(log->data, &pos, end, &len, &checksum) ||
+      len > checkpoint - log->header.header_size || checkpoint - len > position) {
+    return SPARKEY_CHECKSUM_MISMATCH;
+  }
+  RETHROW(verify_block(iter, log, checkpoint, &log->data[checkpoint - len], len, checksum));
+  iter->checkpoint_start = checkpoint - len;
+  iter->checkpoint_end = checkpoint;
+  return SPARKEY_SUCCESS;
+}
+
 static sparkey_returncode seekblock(sparkey_logiter *iter, sparkey_logreader *log, uint64_t position) {
   iter->block_offset = 0;
   if (iter->block_position == position) {
@@ -217,18 +592,21 @@ static sparkey_returncode seekblock(sparkey_logiter *iter, sparkey_logreader *lo
   if (log->header.compression_type == SPARKEY_COMPRESSION_NONE) {
     iter->compression_buf = &log->data[position];
     iter->block_position = position;
-    iter->next_block_position = log->header.data_end;
-    iter->block_len = log->data_len - position;
+    iter->next_block_position = iter->end;
+    iter->block_len = iter->end - position;
     return SPARKEY_SUCCESS;
   }
   if (log->header.compression_type == SPARKEY_COMPRESSION_SNAPPY) {
     uint64_t pos = position;
     // TODO: assert that size_t >= uint64_t
     size_t compressed_size = read_vlq(log->data, &pos);
-    uint64_t next_pos = pos + compressed_size;
+    uint64_t next_pos = pos + compressed_size + logheader_checksum_size(&log->header);
     const char *input = (char *) &log->data[pos];
+    if (log->header.flags & LOG_FLAG_CHECKSUMS) {
+      RETHROW(verify_block(iter, log, position, &log->data[pos], compressed_size, read_little_endian32(log->data, pos + compressed_size)));
+    }
 
-    size_t uncompressed_size = log->header.compression_block_size;
+    size_t uncompressed_size = logheader_max_block_size(&log->header);
     snappy_status status = snappy_uncompress(input, compressed_size, (char *) iter->compression_buf, &uncompressed_size);
     switch (status) {
     case SNAPPY_OK: break;
@@ -239,6 +617,22 @@ static sparkey_returncode seekblock(sparkey_logiter *iter, sparkey_logreader *lo
     default:
       return SPARKEY_INTERNAL_ERROR;
     }
+    if (log->header.flags & LOG_FLAG_FRONT_CODED) {
+      // Strip the restart point trailer
+      if (uncompressed_size < 4) {
+        return SPARKEY_INTERNAL_ERROR;
+      }
+      uint32_t restart_count = read_little_endian32(iter->compression_buf, uncompressed_size - 4);
+      if (restart_count > (uncompressed_size - 4) / 4) {
+        return SPARKEY_INTERNAL_ERROR;
+      }
+      uncompressed_size -= 4 + 4 * (uint64_t) restart_count;
+      iter->restarts = &iter->compression_buf[uncompressed_size];
+      iter->restart_count = restart_count;
+    }
+    SPARKEY_PROBE3(block__decompress, position, compressed_size, uncompressed_size);
+    STATS_ADD(log->stats, blocks_decompressed, 1);
+    STATS_ADD(log->stats, bytes_decompressed, uncompressed_size);
     iter->block_position = position;
     iter->next_block_position = next_pos;
     iter->block_len = uncompressed_size;
@@ -248,24 +642,125 @@ static sparkey_returncode seekblock(sparkey_logiter *iter, sparkey_logreader *lo
   return SPARKEY_INTERNAL_ERROR;
 }
 
+sparkey_returncode sparkey_logreader_set_verify(sparkey_logreader *log, sparkey_verify_mode mode) {
+  RETHROW(assert_log_open(log));
+  switch (mode) {
+  case SPARKEY_VERIFY_OFF:
+  case SPARKEY_VERIFY_FIRST_ACCESS:
+  case SPARKEY_VERIFY_ALWAYS:
+    log->verify = mode;
+    return SPARKEY_SUCCESS;
+  default:
+    return SPARKEY_INVALID_ARGUMENT;
+  }
+}
+
 sparkey_returncode sparkey_logiter_seek(sparkey_logiter *iter, sparkey_logreader *log, uint64_t position) {
   RETHROW(assert_iter_open(iter, log));
-  if (position == log->header.data_end) {
+  follow_log(iter, log);
+  if (position == iter->end) {
+    // Stay at the end, so that iteration can continue if the log grows
+    iter->block_position = 0;
+    iter->block_offset = 0;
+    iter->block_len = 0;
+    iter->next_block_position = position;
     iter->state = SPARKEY_ITER_CLOSED;
     return SPARKEY_SUCCESS;
   }
+  if (position > iter->end) {
+    return SPARKEY_INVALID_LOG_RANGE;
+  }
   RETHROW(seekblock(iter, log, position));
   iter->entry_count = -1;
   iter->state = SPARKEY_ITER_NEW;
   return SPARKEY_SUCCESS;
 }
 
+/**
+ * Walks the entry lengths of an uncompressed log and places a boundary at the first entry after each target.
+ */
+static void partition_entries(sparkey_logreader *log, uint64_t *boundaries, int *num_ranges) {
+  uint64_t size = log->header.data_end - log->header.header_size;
+  int wanted = *num_ranges;
+  int n = 1;
+  uint64_t pos = log->header.header_size;
+  while (n < wanted && pos < log->header.data_end) {
+    uint64_t target = log->header.header_size + size * n / wanted;
+    if (pos >= target && pos > boundaries[n - 1]) {
+      boundaries[n++] = pos;
+      continue;
+    }
+    if (has_checkpoints(log) && is_checkpoint(log->data, pos, log->header.data_end)) {
+      uint64_t len;
+      uint32_t checksum;
+      if (!read_checkpoint(log->data, &pos, log->header.data_end, &len, &checksum)) {
+        break;
+      }
+      continue;
+    }
+    uint64_t a = read_vlq(log->data, &pos);
+    uint64_t b = read_vlq(log->data, &pos);
+    pos += a == 0 ? b : a - 1 + b;
+  }
+  boundaries[n] = log->header.data_end;
+  *num_ranges = n;
+}
+
+/**
+ * Walks the block lengths of a compressed log and places a boundary at the first block after each target.
+ * A block can only start a range if the block before it was not filled up,
+ * since a full block may have been followed by the rest of a split entry.
+ */
+static sparkey_returncode partition_blocks(sparkey_logreader *log, uint64_t *boundaries, int *num_ranges) {
+  sparkey_logiter *iter;
+  RETHROW(sparkey_logiter_create(&iter, log));
+  sparkey_returncode returncode = SPARKEY_SUCCESS;
+
+  uint64_t size = log->header.data_end - log->header.header_size;
+  int wanted = *num_ranges;
+  int n = 1;
+  uint64_t prev = 0;
+  uint64_t pos = log->header.header_size;
+  while (n < wanted && pos < log->header.data_end) {
+    uint64_t target = log->header.header_size + size * n / wanted;
+    if (pos >= target && pos > boundaries[n - 1] && prev != 0) {
+      TRY(seekblock(iter, log, prev), cleanup);
+      if (iter->block_len < log->header.compression_block_size) {
+        boundaries[n++] = pos;
+        continue;
+      }
+    }
+    prev = pos;
+    uint64_t compressed_size = read_vlq(log->data, &pos);
+    pos += compressed_size + logheader_checksum_size(&log->header);
+  }
+  boundaries[n] = log->header.data_end;
+  *num_ranges = n;
+
+cleanup:
+  sparkey_logiter_close(&iter);
+  return returncode;
+}
+
+sparkey_returncode sparkey_logreader_partition(sparkey_logreader *log, uint64_t *boundaries, int *num_ranges) {
+  RETHROW(assert_log_open(log));
+  if (*num_ranges < 1) {
+    return SPARKEY_INVALID_ARGUMENT;
+  }
+  boundaries[0] = log->header.header_size;
+  if (log->header.compression_type == SPARKEY_COMPRESSION_NONE) {
+    partition_entries(log, boundaries, num_ranges);
+    return SPARKEY_SUCCESS;
+  }
+  return partition_blocks(log, boundaries, num_ranges);
+}
+
 static sparkey_returncode ensure_available(sparkey_logiter *iter, sparkey_logreader *log) {
   if (iter->block_offset < iter->block_len) {
     return SPARKEY_SUCCESS;
   }
 
-  if (iter->next_block_position >= log->header.data_end) {
+  if (iter->next_block_position >= iter->end) {
     iter->block_position = 0;
     iter->block_offset = 0;
     iter->block_len = 0;
@@ -287,14 +782,49 @@ static sparkey_returncode skip(sparkey_logiter *iter, sparkey_logreader *log, ui
   return SPARKEY_SUCCESS;
 }
 
-sparkey_returncode sparkey_logiter_next(sparkey_logiter *iter, sparkey_logreader *log) {
+/**
+ * Reads the shared prefix length and the key suffix of a front coded entry,
+ * and combines them with the previous key into key_buf.
+ */
+static sparkey_returncode read_front_coded_key(sparkey_logiter *iter, sparkey_logreader *log) {
+  uint64_t shared = read_vlq(iter->compression_buf, &iter->block_offset);
+  if (shared > buf_used(&iter->key_buf) || shared > iter->keylen) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  iter->key_buf.cur = iter->key_buf.start + shared;
+  uint64_t len = iter->keylen - shared;
+  while (len > 0) {
+    RETHROW(ensure_available(iter, log));
+    uint64_t m = min64(len, iter->block_len - iter->block_offset);
+    if (m == 0) {
+      return SPARKEY_INTERNAL_ERROR;
+    }
+    RETHROW(buf_append(&iter->key_buf, &iter->compression_buf[iter->block_offset], m));
+    iter->block_offset += m;
+    len -= m;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+/**
+ * Moves to the next entry, the part of sparkey_logiter_next that is repeated for each entry of a batch.
+ */
+static sparkey_returncode next_entry(sparkey_logiter *iter, sparkey_logreader *log) {
   if (iter->state == SPARKEY_ITER_CLOSED) {
-    return SPARKEY_SUCCESS;
+    if (!iter->follow || iter->block_len != 0 || iter->next_block_position >= iter->end) {
+      return SPARKEY_SUCCESS;
+    }
+    // The log has grown since the iterator reached the end
+    iter->state = SPARKEY_ITER_NEW;
   }
+  int front_coded = log->header.flags & LOG_FLAG_FRONT_CODED;
   uint64_t key_remaining = 0;
   uint64_t value_remaining = 0;
   if (iter->state == SPARKEY_ITER_ACTIVE) {
-    key_remaining = iter->key_remaining;
+    // Front coded keys have already been read from the block
+    if (!front_coded) {
+      key_remaining = iter->key_remaining;
+    }
     value_remaining = iter->value_remaining;
   }
 
@@ -304,11 +834,13 @@ sparkey_returncode sparkey_logiter_next(sparkey_logiter *iter, sparkey_logreader
   iter->keylen = 0;
   iter->valuelen = 0;
 
-  RETHROW(assert_iter_open(iter, log));
   RETHROW(skip(iter, log, key_remaining));
   RETHROW(skip(iter, log, value_remaining));
 
   RETHROW(ensure_available(iter, log));
+  if (has_checkpoints(log)) {
+    RETHROW(skip_checkpoints(iter));
+  }
   if (iter->block_len - iter->block_offset == 0) {
     // Reached end of data
     iter->state = SPARKEY_ITER_CLOSED;
@@ -321,12 +853,21 @@ sparkey_returncode sparkey_logiter_next(sparkey_logiter *iter, sparkey_logreader
   	iter->block_offset = 0;
     iter->compression_buf = &log->data[iter->block_position];
     iter->entry_count = -1;
+    if (has_checkpoints(log)) {
+      RETHROW(verify_checkpoint(iter, log, iter->block_position));
+    }
+  }
+
+  if (iter->access_pattern == SPARKEY_ACCESS_SEQUENTIAL) {
+    advise_sequential(iter, log);
   }
 
   iter->entry_count++;
+  iter->entry_position = iter->block_position;
+  iter->entry_index = iter->entry_count;
 
-  uint64_t a = read_vlq(iter->compression_buf, &iter->block_offset);
-  uint64_t b = read_vlq(iter->compression_buf, &iter->block_offset);
+  uint64_t a, b;
+  read_vlq_pair(iter->compression_buf, &iter->block_offset, iter->block_len, &a, &b);
   if (a == 0) {
     iter->keylen = iter->key_remaining = b;
     iter->valuelen = iter->value_remaining = 0;
@@ -336,6 +877,9 @@ sparkey_returncode sparkey_logiter_next(sparkey_logiter *iter, sparkey_logreader
     iter->valuelen = iter->value_remaining = b;
     iter->type = SPARKEY_ENTRY_PUT;
   }
+  if (front_coded) {
+    RETHROW(read_front_coded_key(iter, log));
+  }
 
   iter->entry_block_position = iter->block_position;
   iter->entry_block_offset = iter->block_offset;
@@ -345,10 +889,157 @@ sparkey_returncode sparkey_logiter_next(sparkey_logiter *iter, sparkey_logreader
   return SPARKEY_SUCCESS;
 }
 
+sparkey_returncode sparkey_logiter_next(sparkey_logiter *iter, sparkey_logreader *log) {
+  RETHROW(assert_iter_open(iter, log));
+  follow_log(iter, log);
+  return next_entry(iter, log);
+}
+
+/**
+ * @returns whether the entry after the current one is entirely within the current block,
+ * so that moving to it and reading it does not replace the decoded block.
+ */
+static int next_in_block(sparkey_logiter *iter, sparkey_logreader *log) {
+  uint64_t pos = iter->block_offset;
+  if (iter->state == SPARKEY_ITER_ACTIVE) {
+    pos += iter->value_remaining;
+    if (!(log->header.flags & LOG_FLAG_FRONT_CODED)) {
+      pos += iter->key_remaining;
+    }
+  }
+  uint64_t a, b, shared = 0;
+  if (!peek_vlq(iter->compression_buf, &pos, iter->block_len, &a) ||
+      !peek_vlq(iter->compression_buf, &pos, iter->block_len, &b)) {
+    return 0;
+  }
+  uint64_t len = a == 0 ? b : a - 1 + b;
+  if ((log->header.flags & LOG_FLAG_FRONT_CODED) && !peek_vlq(iter->compression_buf, &pos, iter->block_len, &shared)) {
+    return 0;
+  }
+  return shared <= len && len - shared <= iter->block_len - pos;
+}
+
+/**
+ * @returns whether what remains of the current entry is within the current block.
+ */
+static int entry_in_block(sparkey_logiter *iter, sparkey_logreader *log) {
+  uint64_t len = iter->value_remaining;
+  if (!(log->header.flags & LOG_FLAG_FRONT_CODED)) {
+    len += iter->key_remaining;
+  }
+  return len <= iter->block_len - iter->block_offset;
+}
+
+/**
+ * Copies what remains of the key or value of the current entry, which may continue in the following blocks.
+ */
+static sparkey_returncode copy_remaining(sparkey_logiter *iter, sparkey_logreader *log, uint64_t *var, sparkey_buf *dst) {
+  while (*var > 0) {
+    RETHROW(ensure_available(iter, log));
+    uint64_t m = min64(*var, iter->block_len - iter->block_offset);
+    if (m == 0) {
+      return SPARKEY_INTERNAL_ERROR;
+    }
+    RETHROW(buf_append(dst, &iter->compression_buf[iter->block_offset], m));
+    iter->block_offset += m;
+    *var -= m;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+/**
+ * Hands a batch to the callback, after pointing the views of copied entries into the copy buffer.
+ */
+static sparkey_returncode emit_batch(sparkey_entry_view *views, int64_t *copied, int n, sparkey_buf *copies, sparkey_batch_callback callback, void *ctx) {
+  for (int i = 0; i < n; i++) {
+    if (copied[2 * i] >= 0) {
+      views[i].key = copies->start + copied[2 * i];
+    }
+    if (copied[2 * i + 1] >= 0) {
+      views[i].value = copies->start + copied[2 * i + 1];
+    }
+  }
+  sparkey_returncode returncode = callback(ctx, views, n);
+  copies->cur = copies->start;
+  return returncode;
+}
+
+sparkey_returncode sparkey_logiter_foreach_batch(sparkey_logiter *iter, sparkey_logreader *log, int max_entries, sparkey_batch_callback callback, void *ctx) {
+  RETHROW(assert_iter_open(iter, log));
+  if (max_entries < 1) {
+    return SPARKEY_INVALID_ARGUMENT;
+  }
+  follow_log(iter, log);
+
+  int front_coded = log->header.flags & LOG_FLAG_FRONT_CODED;
+  sparkey_entry_view *views = malloc(max_entries * sizeof(sparkey_entry_view));
+  // Offsets into copies of keys and values that are not in the decoded block, -1 for the ones that are.
+  int64_t *copied = malloc(2 * max_entries * sizeof(int64_t));
+  sparkey_buf copies;
+  memset(&copies, 0, sizeof(sparkey_buf));
+  sparkey_returncode returncode = SPARKEY_SUCCESS;
+  if (views == NULL || copied == NULL) {
+    returncode = SPARKEY_INTERNAL_ERROR;
+    goto cleanup;
+  }
+
+  int n = 0;
+  while (1) {
+    // The views point into the decoded block, so they must be handed over before it's replaced.
+    if (n == max_entries || (n > 0 && !next_in_block(iter, log))) {
+      TRY(emit_batch(views, copied, n, &copies, callback, ctx), cleanup);
+      n = 0;
+    }
+    TRY(next_entry(iter, log), cleanup);
+    if (iter->state != SPARKEY_ITER_ACTIVE) {
+      break;
+    }
+    // Decided after next_entry, which may have loaded a block that holds all of the entry.
+    int in_block = entry_in_block(iter, log);
+    sparkey_entry_view *view = &views[n];
+    view->type = iter->type;
+    view->keylen = iter->keylen;
+    view->valuelen = iter->valuelen;
+    copied[2 * n] = -1;
+    copied[2 * n + 1] = -1;
+    if (front_coded) {
+      copied[2 * n] = buf_used(&copies);
+      TRY(buf_append(&copies, iter->key_buf.start, iter->keylen), cleanup);
+      iter->key_remaining = 0;
+    } else if (in_block) {
+      view->key = &iter->compression_buf[iter->block_offset];
+      iter->block_offset += iter->key_remaining;
+      iter->key_remaining = 0;
+    } else {
+      copied[2 * n] = buf_used(&copies);
+      TRY(copy_remaining(iter, log, &iter->key_remaining, &copies), cleanup);
+    }
+    if (in_block) {
+      view->value = &iter->compression_buf[iter->block_offset];
+      iter->block_offset += iter->value_remaining;
+      iter->value_remaining = 0;
+    } else {
+      copied[2 * n + 1] = buf_used(&copies);
+      TRY(copy_remaining(iter, log, &iter->value_remaining, &copies), cleanup);
+    }
+    n++;
+  }
+  if (n > 0) {
+    returncode = emit_batch(views, copied, n, &copies, callback, ctx);
+  }
+
+cleanup:
+  free(views);
+  free(copied);
+  buf_close(&copies);
+  return returncode;
+}
+
 sparkey_returncode sparkey_logiter_reset(sparkey_logiter *iter, sparkey_logreader *log) {
   if (iter->state != SPARKEY_ITER_ACTIVE) {
     return SPARKEY_LOG_ITERATOR_INACTIVE;
   }
+  follow_log(iter, log);
   RETHROW(seekblock(iter, log, iter->entry_block_position));
 
   iter->key_remaining = iter->keylen;
@@ -358,6 +1049,21 @@ sparkey_returncode sparkey_logiter_reset(sparkey_logiter *iter, sparkey_logreade
 }
 
 sparkey_returncode sparkey_logiter_skip(sparkey_logiter *iter, sparkey_logreader *log, int count) {
+  STATS_ADD(log->stats, entries_skipped, count);
+  uint32_t interval = log->header.restart_interval;
+  if ((log->header.flags & LOG_FLAG_FRONT_CODED) && iter->state == SPARKEY_ITER_NEW &&
+      iter->block_offset == 0 && iter->entry_count == -1 && iter->restart_count > 0 && (uint32_t) count >= interval) {
+    // Jump straight to the closest restart point, its key is stored in full.
+    uint32_t r = count / interval;
+    if (r >= iter->restart_count) {
+      r = iter->restart_count - 1;
+    }
+    if (r > 0) {
+      iter->block_offset = read_little_endian32(iter->restarts, 4 * (uint64_t) r);
+      iter->entry_count = r * interval - 1;
+      count -= r * interval;
+    }
+  }
   while (count > 0) {
     count--;
     RETHROW(sparkey_logiter_next(iter, log));
@@ -369,6 +1075,7 @@ sparkey_returncode sparkey_logiter_skip(sparkey_logiter *iter, sparkey_logreader
 
 static sparkey_returncode sparkey_logiter_chunk(sparkey_logiter *iter, sparkey_logreader *log, uint64_t maxlen, uint64_t *len, uint8_t ** res, uint64_t *var) {
   RETHROW(assert_iter_open(iter, log));
+  follow_log(iter, log);
 
   if (iter->state != SPARKEY_ITER_ACTIVE) {
     return SPARKEY_LOG_ITERATOR_INACTIVE;
@@ -389,11 +1096,24 @@ static sparkey_returncode sparkey_logiter_chunk(sparkey_logiter *iter, sparkey_l
 }
 
 sparkey_returncode sparkey_logiter_keychunk(sparkey_logiter *iter, sparkey_logreader *log, uint64_t maxlen, uint8_t ** res, uint64_t *len) {
+  if (log->header.flags & LOG_FLAG_FRONT_CODED) {
+    RETHROW(assert_iter_open(iter, log));
+    if (iter->state != SPARKEY_ITER_ACTIVE) {
+      return SPARKEY_LOG_ITERATOR_INACTIVE;
+    }
+    uint64_t m = min64(maxlen, iter->key_remaining);
+    *len = m;
+    *res = iter->key_buf.start + (iter->keylen - iter->key_remaining);
+    iter->key_remaining -= m;
+    return SPARKEY_SUCCESS;
+  }
   return sparkey_logiter_chunk(iter, log, maxlen, len, res, &iter->key_remaining);
 }
 
 sparkey_returncode sparkey_logiter_valuechunk(sparkey_logiter *iter, sparkey_logreader *log, uint64_t maxlen, uint8_t ** res, uint64_t *len) {
-  RETHROW(skip(iter, log, iter->key_remaining));
+  if (!(log->header.flags & LOG_FLAG_FRONT_CODED)) {
+    RETHROW(skip(iter, log, iter->key_remaining));
+  }
   iter->key_remaining = 0;
   return sparkey_logiter_chunk(iter, log, maxlen, len, res, &iter->value_remaining);
 }
@@ -0,0 +1,421 @@
+/*
+* Copyright (c) 2012-2013 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "util.h"
+#include "buf.h"
+#include "vlq.h"
+#include "logsorter.h"
+
+typedef struct {
+  uint64_t offset;
+  uint64_t keylen;
+  uint64_t valuelen;
+  uint32_t header_len;
+  sparkey_entry_type type;
+} sorted_entry;
+
+typedef struct {
+  FILE *fp;
+  sparkey_entry_type type;
+  sparkey_buf key;
+  sparkey_buf value;
+  int done;
+} sorted_run;
+
+struct sparkey_logsorter {
+  char *prefix;
+  uint64_t memory_limit;
+
+  // Entries are stored in the log entry format, without compression.
+  sparkey_buf data;
+  sorted_entry *entries;
+  uint64_t num_entries;
+  uint64_t entries_capacity;
+
+  FILE **runs;
+  int num_runs;
+};
+
+sparkey_returncode logsorter_create(sparkey_logsorter **sorter_ref, const char *prefix, uint64_t memory_limit) {
+  sparkey_logsorter *sorter = malloc(sizeof(sparkey_logsorter));
+  if (sorter == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  memset(sorter, 0, sizeof(sparkey_logsorter));
+  sorter->memory_limit = memory_limit;
+  sorter->prefix = strdup(prefix);
+  sparkey_returncode returncode;
+  if (sorter->prefix == NULL) {
+    returncode = SPARKEY_INTERNAL_ERROR;
+    goto cleanup;
+  }
+  TRY(buf_init(&sorter->data, 64*1024), cleanup);
+  *sorter_ref = sorter;
+  return SPARKEY_SUCCESS;
+
+cleanup:
+  free(sorter->prefix);
+  free(sorter);
+  return returncode;
+}
+
+uint64_t logsorter_size(sparkey_logsorter *sorter) {
+  return sorter->num_entries;
+}
+
+static int compare_keys(const uint8_t *key1, uint64_t keylen1, const uint8_t *key2, uint64_t keylen2) {
+  int cmp = memcmp(key1, key2, keylen1 < keylen2 ? keylen1 : keylen2);
+  if (cmp != 0) {
+    return cmp;
+  }
+  if (keylen1 == keylen2) {
+    return 0;
+  }
+  return keylen1 < keylen2 ? -1 : 1;
+}
+
+static int compare_entries(uint8_t *data, sorted_entry *a, sorted_entry *b) {
+  return compare_keys(data + a->offset + a->header_len, a->keylen, data + b->offset + b->header_len, b->keylen);
+}
+
+/**
+ * Bottom up merge sort, which unlike qsort keeps equal keys in insertion order.
+ */
+static sparkey_returncode sort_entries(sparkey_logsorter *sorter) {
+  uint64_t n = sorter->num_entries;
+  sorted_entry *src = sorter->entries;
+  sorted_entry *dst = malloc(n * sizeof(sorted_entry));
+  if (dst == NULL && n > 0) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  uint8_t *data = sorter->data.start;
+  for (uint64_t width = 1; width < n; width *= 2) {
+    for (uint64_t lo = 0; lo < n; lo += 2 * width) {
+      uint64_t mid = lo + width < n ? lo + width : n;
+      uint64_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+      uint64_t i = lo, j = mid, k = lo;
+      while (i < mid && j < hi) {
+        if (compare_entries(data, &src[j], &src[i]) < 0) {
+          dst[k++] = src[j++];
+        } else {
+          dst[k++] = src[i++];
+        }
+      }
+      while (i < mid) {
+        dst[k++] = src[i++];
+      }
+      while (j < hi) {
+        dst[k++] = src[j++];
+      }
+    }
+    sorted_entry *tmp = src;
+    src = dst;
+    dst = tmp;
+  }
+  sorter->entries = src;
+  sorter->entries_capacity = n;
+  free(dst);
+  return SPARKEY_SUCCESS;
+}
+
+static void clear_memory(sparkey_logsorter *sorter) {
+  sorter->data.cur = sorter->data.start;
+  sorter->num_entries = 0;
+}
+
+static sparkey_returncode emit_entry(sparkey_logsorter *sorter, sorted_entry *e, logsorter_emit emit, void *ctx) {
+  uint8_t *key = sorter->data.start + e->offset + e->header_len;
+  return emit(ctx, e->type, key, e->keylen, key + e->keylen, e->valuelen);
+}
+
+static sparkey_returncode write_run_entry(void *ctx, sparkey_entry_type type, const uint8_t *key, uint64_t keylen, const uint8_t *value, uint64_t valuelen) {
+  FILE *fp = ctx;
+  uint8_t header[20];
+  int header_len = write_vlq(header, type == SPARKEY_ENTRY_PUT ? keylen + 1 : 0);
+  header_len += write_vlq(header + header_len, type == SPARKEY_ENTRY_PUT ? valuelen : keylen);
+  if (fwrite(header, 1, header_len, fp) != (size_t) header_len ||
+      fwrite(key, 1, keylen, fp) != keylen ||
+      fwrite(value, 1, valuelen, fp) != valuelen) {
+    return sparkey_write_returncode(errno);
+  }
+  return SPARKEY_SUCCESS;
+}
+
+/**
+ * Sorts the entries in memory and writes them to a new temporary file.
+ */
+static sparkey_returncode spill(sparkey_logsorter *sorter) {
+  RETHROW(sort_entries(sorter));
+
+  size_t len = strlen(sorter->prefix);
+  char *path = malloc(len + 8);
+  if (path == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  memcpy(path, sorter->prefix, len);
+  memcpy(path + len, "XXXXXX", 7);
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    free(path);
+    return sparkey_create_returncode(errno);
+  }
+  // The file is only reachable through fp from now on, and goes away when it's closed.
+  unlink(path);
+  free(path);
+  FILE *fp = fdopen(fd, "w+");
+  if (fp == NULL) {
+    close(fd);
+    return sparkey_create_returncode(errno);
+  }
+
+  FILE **runs = realloc(sorter->runs, (sorter->num_runs + 1) * sizeof(FILE *));
+  if (runs == NULL) {
+    fclose(fp);
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  sorter->runs = runs;
+  sorter->runs[sorter->num_runs++] = fp;
+
+  for (uint64_t i = 0; i < sorter->num_entries; i++) {
+    RETHROW(emit_entry(sorter, &sorter->entries[i], write_run_entry, fp));
+  }
+  if (fflush(fp) != 0) {
+    return sparkey_write_returncode(errno);
+  }
+  clear_memory(sorter);
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode logsorter_add(sparkey_logsorter *sorter, sparkey_entry_type type, const uint8_t *key, uint64_t keylen, const uint8_t *value, uint64_t valuelen) {
+  uint64_t used = sorter->num_entries * sizeof(sorted_entry) + buf_used(&sorter->data);
+  if (used >= sorter->memory_limit && sorter->num_entries > 0) {
+    RETHROW(spill(sorter));
+  }
+  if (sorter->num_entries == sorter->entries_capacity) {
+    uint64_t capacity = 2 * sorter->entries_capacity + 1024;
+    sorted_entry *entries = realloc(sorter->entries, capacity * sizeof(sorted_entry));
+    if (entries == NULL) {
+      return SPARKEY_INTERNAL_ERROR;
+    }
+    sorter->entries = entries;
+    sorter->entries_capacity = capacity;
+  }
+  if (type == SPARKEY_ENTRY_DELETE) {
+    valuelen = 0;
+  }
+
+  sorted_entry *e = &sorter->entries[sorter->num_entries];
+  e->offset = buf_used(&sorter->data);
+  e->keylen = keylen;
+  e->valuelen = valuelen;
+  e->type = type;
+  uint8_t header[20];
+  e->header_len = write_vlq(header, type == SPARKEY_ENTRY_PUT ? keylen + 1 : 0);
+  e->header_len += write_vlq(header + e->header_len, type == SPARKEY_ENTRY_PUT ? valuelen : keylen);
+  RETHROW(buf_append(&sorter->data, header, e->header_len));
+  RETHROW(buf_append(&sorter->data, key, keylen));
+  RETHROW(buf_append(&sorter->data, value, valuelen));
+  sorter->num_entries++;
+  return SPARKEY_SUCCESS;
+}
+
+static sparkey_returncode fread_vlq(FILE *fp, uint64_t *value, int *eof) {
+  uint64_t res = 0;
+  uint64_t shift = 0;
+  *eof = 0;
+  while (1) {
+    int c = fgetc(fp);
+    if (c == EOF) {
+      if (shift == 0 && !ferror(fp)) {
+        *eof = 1;
+        return SPARKEY_SUCCESS;
+      }
+      return SPARKEY_UNEXPECTED_EOF;
+    }
+    res |= (uint64_t) (c & 0x7f) << shift;
+    if ((c & 0x80) == 0) {
+      *value = res;
+      return SPARKEY_SUCCESS;
+    }
+    shift += 7;
+  }
+}
+
+static sparkey_returncode fread_bytes(FILE *fp, sparkey_buf *buf, uint64_t len) {
+  buf->cur = buf->start;
+  while (len > 0) {
+    uint8_t tmp[4096];
+    size_t n = len < sizeof(tmp) ? len : sizeof(tmp);
+    if (fread(tmp, 1, n, fp) != n) {
+      return SPARKEY_UNEXPECTED_EOF;
+    }
+    RETHROW(buf_append(buf, tmp, n));
+    len -= n;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+static sparkey_returncode run_next(sorted_run *run) {
+  uint64_t a, b;
+  int eof;
+  RETHROW(fread_vlq(run->fp, &a, &eof));
+  if (eof) {
+    run->done = 1;
+    return SPARKEY_SUCCESS;
+  }
+  RETHROW(fread_vlq(run->fp, &b, &eof));
+  if (eof) {
+    return SPARKEY_UNEXPECTED_EOF;
+  }
+  if (a == 0) {
+    run->type = SPARKEY_ENTRY_DELETE;
+    RETHROW(fread_bytes(run->fp, &run->key, b));
+    run->value.cur = run->value.start;
+  } else {
+    run->type = SPARKEY_ENTRY_PUT;
+    RETHROW(fread_bytes(run->fp, &run->key, a - 1));
+    RETHROW(fread_bytes(run->fp, &run->value, b));
+  }
+  return SPARKEY_SUCCESS;
+}
+
+/**
+ * Orders runs by their current key, and by run number for equal keys
+ * since earlier runs hold earlier entries.
+ */
+static int run_less(sorted_run *runs, int a, int b) {
+  int cmp = compare_keys(runs[a].key.start, buf_used(&runs[a].key), runs[b].key.start, buf_used(&runs[b].key));
+  if (cmp != 0) {
+    return cmp < 0;
+  }
+  return a < b;
+}
+
+static void sift_down(sorted_run *runs, int *heap, int size, int i) {
+  while (1) {
+    int smallest = i;
+    int left = 2 * i + 1;
+    int right = left + 1;
+    if (left < size && run_less(runs, heap[left], heap[smallest])) {
+      smallest = left;
+    }
+    if (right < size && run_less(runs, heap[right], heap[smallest])) {
+      smallest = right;
+    }
+    if (smallest == i) {
+      return;
+    }
+    int tmp = heap[i];
+    heap[i] = heap[smallest];
+    heap[smallest] = tmp;
+    i = smallest;
+  }
+}
+
+static sparkey_returncode merge_runs(sparkey_logsorter *sorter, logsorter_emit emit, void *ctx) {
+  int n = sorter->num_runs;
+  sorted_run *runs = calloc(n, sizeof(sorted_run));
+  int *heap = malloc(n * sizeof(int));
+  sparkey_returncode returncode = SPARKEY_SUCCESS;
+  if (runs == NULL || heap == NULL) {
+    returncode = SPARKEY_INTERNAL_ERROR;
+    goto cleanup;
+  }
+  int size = 0;
+  for (int i = 0; i < n; i++) {
+    runs[i].fp = sorter->runs[i];
+    TRY(buf_init(&runs[i].key, 1024), cleanup);
+    TRY(buf_init(&runs[i].value, 1024), cleanup);
+    if (fseek(runs[i].fp, 0, SEEK_SET) != 0) {
+      returncode = SPARKEY_INTERNAL_ERROR;
+      goto cleanup;
+    }
+    TRY(run_next(&runs[i]), cleanup);
+    if (!runs[i].done) {
+      heap[size++] = i;
+    }
+  }
+  for (int i = size / 2 - 1; i >= 0; i--) {
+    sift_down(runs, heap, size, i);
+  }
+
+  while (size > 0) {
+    sorted_run *run = &runs[heap[0]];
+    TRY(emit(ctx, run->type, run->key.start, buf_used(&run->key), run->value.start, buf_used(&run->value)), cleanup);
+    TRY(run_next(run), cleanup);
+    if (run->done) {
+      heap[0] = heap[--size];
+    }
+    sift_down(runs, heap, size, 0);
+  }
+
+cleanup:
+  if (runs != NULL) {
+    for (int i = 0; i < n; i++) {
+      buf_close(&runs[i].key);
+      buf_close(&runs[i].value);
+    }
+  }
+  free(runs);
+  free(heap);
+  return returncode;
+}
+
+static void close_runs(sparkey_logsorter *sorter) {
+  for (int i = 0; i < sorter->num_runs; i++) {
+    fclose(sorter->runs[i]);
+  }
+  free(sorter->runs);
+  sorter->runs = NULL;
+  sorter->num_runs = 0;
+}
+
+sparkey_returncode logsorter_drain(sparkey_logsorter *sorter, logsorter_emit emit, void *ctx) {
+  sparkey_returncode returncode = SPARKEY_SUCCESS;
+  if (sorter->num_runs == 0) {
+    TRY(sort_entries(sorter), cleanup);
+    for (uint64_t i = 0; i < sorter->num_entries; i++) {
+      TRY(emit_entry(sorter, &sorter->entries[i], emit, ctx), cleanup);
+    }
+  } else {
+    if (sorter->num_entries > 0) {
+      TRY(spill(sorter), cleanup);
+    }
+    TRY(merge_runs(sorter, emit, ctx), cleanup);
+  }
+
+cleanup:
+  clear_memory(sorter);
+  close_runs(sorter);
+  return returncode;
+}
+
+void logsorter_close(sparkey_logsorter **sorter_ref) {
+  sparkey_logsorter *sorter = *sorter_ref;
+  if (sorter == NULL) {
+    return;
+  }
+  close_runs(sorter);
+  buf_close(&sorter->data);
+  free(sorter->entries);
+  free(sorter->prefix);
+  free(sorter);
+  *sorter_ref = NULL;
+}
@@ -0,0 +1,60 @@
+/*
+* Copyright (c) 2012-2013 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#ifndef SPARKEY_LOGSORTER_H_INCLUDED
+#define SPARKEY_LOGSORTER_H_INCLUDED
+
+#include <stdint.h>
+
+#include "sparkey.h"
+
+/**
+ * Collects log entries and hands them back sorted by key.
+ * Entries with the same key keep the order they were added in.
+ * When the entries don't fit in memory, sorted runs are spilled to temporary files
+ * and merged when draining.
+ */
+struct sparkey_logsorter;
+typedef struct sparkey_logsorter sparkey_logsorter;
+
+/**
+ * Receives the entries of a sorter in order.
+ */
+typedef sparkey_returncode (*logsorter_emit)(void *ctx, sparkey_entry_type type, const uint8_t *key, uint64_t keylen, const uint8_t *value, uint64_t valuelen);
+
+/**
+ * @param sorter_ref set to a new sorter.
+ * @param prefix temporary files are created with this path prefix.
+ * @param memory_limit how much memory to use for buffering entries before spilling to disk.
+ * @returns SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode logsorter_create(sparkey_logsorter **sorter_ref, const char *prefix, uint64_t memory_limit);
+
+sparkey_returncode logsorter_add(sparkey_logsorter *sorter, sparkey_entry_type type, const uint8_t *key, uint64_t keylen, const uint8_t *value, uint64_t valuelen);
+
+/**
+ * Passes all entries to emit in sorted order, and removes them from the sorter.
+ * Stops at the first error returned by emit.
+ */
+sparkey_returncode logsorter_drain(sparkey_logsorter *sorter, logsorter_emit emit, void *ctx);
+
+/**
+ * @returns the number of entries currently in the sorter.
+ */
+uint64_t logsorter_size(sparkey_logsorter *sorter);
+
+void logsorter_close(sparkey_logsorter **sorter_ref);
+
+#endif
@@ -28,21 +28,24 @@
 #include "endiantools.h"
 #include "buf.h"
 #include "sparkey-internal.h"
+#include "vlq.h"
+#include "crc32c.h"
+#include "blockindex.h"
+#include "probes.h"
 
 #define MAGIC_VALUE_LOGWRITER (0x2866211b)
+#define MAGIC_VALUE_LOGAPPENDER (0x4d1f7a32)
 
+// Appenders collect complete entries until at least this much can be written at once.
+#define APPENDER_COMMIT_SIZE (1024*1024)
+
+// Number of front coded entries between each full key.
+#define RESTART_INTERVAL (16)
+// Memory used for sorting when appending to a front coded log.
+#define DEFAULT_SORT_MEMORY (64*1024*1024)
+
+static sparkey_returncode emit_sorted(void *ctx, sparkey_entry_type type, const uint8_t *key, uint64_t keylen, const uint8_t *value, uint64_t valuelen);
 
-static inline int write_vlq(uint8_t *buf, uint64_t value) {
-  int count = 1;
-  while (value >= 1 << 7) {
-    *buf = (value & 0x7f) | 0x80;
-    value >>= 7;
-    count++;
-    buf++;
-  }
-  *buf = value;
-  return count;
-}
 
 static sparkey_returncode assert_writer_open(sparkey_logwriter *log) {
   if (log->open_status != MAGIC_VALUE_LOGWRITER) {
@@ -51,6 +54,211 @@ static sparkey_returncode assert_writer_open(sparkey_logwriter *log) {
   return SPARKEY_SUCCESS;
 }
 
+static sparkey_returncode init_durability(sparkey_logwriter *log) {
+  log->durability = SPARKEY_DURABILITY_NONE;
+  log->write_seq = 0;
+  log->synced_seq = 0;
+  log->syncing = 0;
+  log->num_appenders = 0;
+  log->appends_inflight = 0;
+  log->append_error = SPARKEY_SUCCESS;
+  if (pthread_mutex_init(&log->lock, NULL) != 0) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  if (pthread_mutex_init(&log->sync_lock, NULL) != 0) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  if (pthread_cond_init(&log->synced, NULL) != 0) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  if (pthread_cond_init(&log->appends_done, NULL) != 0) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+static sparkey_returncode init_front_coding(sparkey_logwriter *log, const char *filename) {
+  log->sorter = NULL;
+  log->restarts = NULL;
+  log->restart_count = 0;
+  log->since_restart = 0;
+  memset(&log->last_key, 0, sizeof(sparkey_buf));
+  log->filename = strdup(filename);
+  if (log->filename == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+/**
+ * Sets up sorting, and makes room for the restart point trailer after each block.
+ * The header must already have the front coded flag.
+ */
+static sparkey_returncode enable_front_coding(sparkey_logwriter *log, uint64_t memory_limit) {
+  uint64_t block_size = log->header.compression_block_size;
+  uint64_t max_block_size = logheader_max_block_size(&log->header);
+  buf_close(&log->block_buf);
+  RETHROW(buf_init(&log->block_buf, max_block_size));
+  // Entries may only fill the block size, the rest is for the trailer.
+  log->block_buf.end = log->block_buf.start + block_size;
+
+  free(log->compressed);
+  log->max_compressed_size = snappy_max_compressed_length(max_block_size);
+  log->compressed = malloc(log->max_compressed_size);
+  if (log->compressed == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+
+  log->restarts = malloc((max_block_size - block_size) / 4 * sizeof(uint32_t));
+  if (log->restarts == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+
+  size_t len = strlen(log->filename);
+  char *prefix = malloc(len + 6);
+  if (prefix == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  memcpy(prefix, log->filename, len);
+  memcpy(prefix + len, ".sort", 6);
+  sparkey_returncode returncode = logsorter_create(&log->sorter, prefix, memory_limit);
+  free(prefix);
+  return returncode;
+}
+
+static void init_blockindex(sparkey_logwriter *log) {
+  log->blockindex_fd = -1;
+  memset(&log->blockindex_buf, 0, sizeof(sparkey_buf));
+  log->blockindex_entries = 0;
+}
+
+static sparkey_returncode create_blockindex(sparkey_logwriter *log) {
+  char *filename = sparkey_create_blockindex_filename(log->filename);
+  if (filename == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  int fd = open(filename, O_WRONLY | O_TRUNC | O_CREAT, 00644);
+  free(filename);
+  if (fd < 0) {
+    return sparkey_create_returncode(errno);
+  }
+  uint8_t header[BLOCKINDEX_HEADER_SIZE];
+  blockindex_encode_header(header, log->header.file_identifier);
+  sparkey_returncode returncode = pwrite_full(fd, header, BLOCKINDEX_HEADER_SIZE, 0);
+  if (returncode == SPARKEY_SUCCESS && lseek(fd, BLOCKINDEX_HEADER_SIZE, SEEK_SET) < 0) {
+    returncode = sparkey_write_returncode(errno);
+  }
+  if (returncode == SPARKEY_SUCCESS) {
+    returncode = buf_init(&log->blockindex_buf, 128 * BLOCKINDEX_RECORD_SIZE);
+  }
+  if (returncode != SPARKEY_SUCCESS) {
+    close(fd);
+    return returncode;
+  }
+  log->blockindex_fd = fd;
+  log->blockindex_entries = 0;
+  return SPARKEY_SUCCESS;
+}
+
+/**
+ * Checks that the block index describes exactly the blocks of the log, dropping records past data_end.
+ * @returns the number of entries in the log, or -1 if the index does not match the log.
+ */
+static int64_t trim_blockindex(sparkey_logwriter *log, int fd) {
+  struct stat s;
+  uint8_t buf[BLOCKINDEX_HEADER_SIZE + BLOCKINDEX_RECORD_SIZE];
+  if (fstat(fd, &s) < 0 || pread(fd, buf, BLOCKINDEX_HEADER_SIZE, 0) != BLOCKINDEX_HEADER_SIZE) {
+    return -1;
+  }
+  if (blockindex_check_header(buf, s.st_size, log->header.file_identifier) != SPARKEY_SUCCESS) {
+    return -1;
+  }
+  uint64_t num_records = (s.st_size - BLOCKINDEX_HEADER_SIZE) / BLOCKINDEX_RECORD_SIZE;
+  sparkey_block_info info;
+  // Records are only ever ahead of the log, so the matching end is near the end of the file.
+  while (num_records > 0) {
+    uint64_t pos = BLOCKINDEX_HEADER_SIZE + (num_records - 1) * BLOCKINDEX_RECORD_SIZE;
+    if (pread(fd, buf, BLOCKINDEX_RECORD_SIZE, pos) != BLOCKINDEX_RECORD_SIZE) {
+      return -1;
+    }
+    blockindex_decode_record(buf, &info);
+    if (info.offset < log->header.data_end) {
+      break;
+    }
+    num_records--;
+  }
+  uint64_t end = log->header.header_size;
+  int64_t num_entries = 0;
+  if (num_records > 0) {
+    uint8_t vlq[10];
+    end = info.offset + write_vlq(vlq, info.compressed_size) + info.compressed_size + logheader_checksum_size(&log->header);
+    num_entries = info.first_entry + info.entry_count;
+  }
+  if (end != log->header.data_end) {
+    return -1;
+  }
+  uint64_t size = BLOCKINDEX_HEADER_SIZE + num_records * BLOCKINDEX_RECORD_SIZE;
+  if (ftruncate(fd, size) < 0 || lseek(fd, size, SEEK_SET) < 0) {
+    return -1;
+  }
+  return num_entries;
+}
+
+/**
+ * Continues the block index of a log that is appended to, if there is one.
+ * An index that doesn't match the log is removed, since it can't be completed.
+ */
+static sparkey_returncode reopen_blockindex(sparkey_logwriter *log) {
+  if (log->header.compression_type == SPARKEY_COMPRESSION_NONE) {
+    return SPARKEY_SUCCESS;
+  }
+  char *filename = sparkey_create_blockindex_filename(log->filename);
+  if (filename == NULL) {
+    return SPARKEY_SUCCESS;
+  }
+  int fd = open(filename, O_RDWR);
+  if (fd < 0) {
+    free(filename);
+    return errno == ENOENT ? SPARKEY_SUCCESS : sparkey_open_returncode(errno);
+  }
+  int64_t num_entries = trim_blockindex(log, fd);
+  if (num_entries < 0) {
+    close(fd);
+    unlink(filename);
+    free(filename);
+    return SPARKEY_SUCCESS;
+  }
+  free(filename);
+  sparkey_returncode returncode = buf_init(&log->blockindex_buf, 128 * BLOCKINDEX_RECORD_SIZE);
+  if (returncode != SPARKEY_SUCCESS) {
+    close(fd);
+    return returncode;
+  }
+  log->blockindex_fd = fd;
+  log->blockindex_entries = num_entries;
+  return SPARKEY_SUCCESS;
+}
+
+static void close_blockindex(sparkey_logwriter *log) {
+  if (log->blockindex_fd >= 0) {
+    close(log->blockindex_fd);
+    log->blockindex_fd = -1;
+  }
+  buf_close(&log->blockindex_buf);
+}
+
+static void lock_writer(sparkey_logwriter *log) {
+  if (log->durability == SPARKEY_DURABILITY_GROUP_COMMIT) {
+    pthread_mutex_lock(&log->lock);
+  }
+}
+
+static void unlock_writer(sparkey_logwriter *log) {
+  if (log->durability == SPARKEY_DURABILITY_GROUP_COMMIT) {
+    pthread_mutex_unlock(&log->lock);
+  }
+}
+
 sparkey_returncode sparkey_logwriter_create(sparkey_logwriter **log, const char *filename, sparkey_compression_type compression_type, int compression_block_size) {
   *log = malloc(sizeof(sparkey_logwriter));
   if (*log == NULL) {
@@ -84,7 +292,7 @@ sparkey_returncode sparkey_logwriter_create(sparkey_logwriter **log, const char
     }
   }
 
-  int fd = open(filename, O_WRONLY | O_TRUNC | O_CREAT, 00644);
+  int fd = open(filename, O_RDWR | O_TRUNC | O_CREAT, 00644);
   if (fd == -1) {
     return sparkey_create_returncode(errno);
   }
@@ -95,8 +303,12 @@ sparkey_returncode sparkey_logwriter_create(sparkey_logwriter **log, const char
 
   RETHROW(rand32(&(l->header.file_identifier)));
   l->header.data_end = LOG_HEADER_SIZE;
+  l->header.header_size = LOG_HEADER_SIZE;
   l->header.major_version = LOG_MAJOR_VERSION;
-  l->header.minor_version = LOG_MINOR_VERSION;
+  // Front coding needs minor version 1, other logs stay readable by older versions.
+  l->header.minor_version = 0;
+  l->header.flags = 0;
+  l->header.restart_interval = 0;
   l->header.put_size = 0;
   l->header.delete_size = 0;
   l->header.num_puts = 0;
@@ -115,6 +327,15 @@ sparkey_returncode sparkey_logwriter_create(sparkey_logwriter **log, const char
   RETHROW(buf_init(&l->block_buf, compression_block_size));
 
   l->entry_count = 0;
+  l->direct_io = 0;
+  l->packing = SPARKEY_PACKING_NO_SPLIT;
+  memset(&l->stats, 0, sizeof(sparkey_writer_stats));
+  l->position = LOG_HEADER_SIZE;
+  l->checkpoint_crc = 0;
+  l->checkpoint_len = 0;
+  RETHROW(init_durability(l));
+  RETHROW(init_front_coding(l, filename));
+  init_blockindex(l);
 
   l->open_status = MAGIC_VALUE_LOGWRITER;
   return SPARKEY_SUCCESS;
@@ -129,7 +350,7 @@ sparkey_returncode sparkey_logwriter_append(sparkey_logwriter *log, const char *
   if (log->header.major_version != LOG_MAJOR_VERSION) {
     return SPARKEY_WRONG_LOG_MAJOR_VERSION;
   }
-  if (log->header.minor_version != LOG_MINOR_VERSION) {
+  if (log->header.minor_version > LOG_MINOR_VERSION) {
     return SPARKEY_UNSUPPORTED_LOG_MINOR_VERSION;
   }
 
@@ -149,7 +370,7 @@ sparkey_returncode sparkey_logwriter_append(sparkey_logwriter *log, const char *
     return SPARKEY_INVALID_COMPRESSION_TYPE;
   }
 
-  int fd = open(filename, O_WRONLY, 00644);
+  int fd = open(filename, O_RDWR, 00644);
   if (fd == -1) {
     int e = errno;
     return sparkey_create_returncode(e);
@@ -162,22 +383,80 @@ sparkey_returncode sparkey_logwriter_append(sparkey_logwriter *log, const char *
   RETHROW(buf_init(&log->block_buf, log->header.compression_block_size));
 
   log->entry_count = 0;
+  log->direct_io = 0;
+  log->packing = SPARKEY_PACKING_NO_SPLIT;
+  memset(&log->stats, 0, sizeof(sparkey_writer_stats));
+  log->position = log->header.data_end;
+  log->checkpoint_crc = 0;
+  log->checkpoint_len = 0;
+  RETHROW(init_durability(log));
+  RETHROW(init_front_coding(log, filename));
+  init_blockindex(log);
+  RETHROW(reopen_blockindex(log));
+  if (log->header.flags & LOG_FLAG_FRONT_CODED) {
+    RETHROW(enable_front_coding(log, DEFAULT_SORT_MEMORY));
+  }
 
   log->open_status = MAGIC_VALUE_LOGWRITER;
   return SPARKEY_SUCCESS;
 }
 
+static sparkey_returncode file_add(sparkey_logwriter *log, const uint8_t *data, ptrdiff_t len) {
+  log->position += len;
+  if (log->direct_io) {
+    return aiobuf_add(&log->aio, data, len);
+  }
+  return buf_add(&log->file_buf, log->fd, data, len);
+}
+
+/**
+ * Adds entry data to an uncompressed log, keeping track of the checksum for the next checkpoint.
+ */
+static sparkey_returncode plain_add(sparkey_logwriter *log, const uint8_t *data, ptrdiff_t len) {
+  if (log->header.flags & LOG_FLAG_CHECKSUMS) {
+    log->checkpoint_crc = crc32c(log->checkpoint_crc, data, len);
+    log->checkpoint_len += len;
+  }
+  return file_add(log, data, len);
+}
+
+/**
+ * Writes a checkpoint covering the entries added since the previous one, see LOG_CHECKPOINT_MARKER_0.
+ */
+static sparkey_returncode write_checkpoint(sparkey_logwriter *log) {
+  uint8_t buf[2 + 10 + LOG_CHECKSUM_SIZE];
+  buf[0] = LOG_CHECKPOINT_MARKER_0;
+  buf[1] = LOG_CHECKPOINT_MARKER_1;
+  ptrdiff_t len = 2 + write_vlq(&buf[2], log->checkpoint_len);
+  write_little_endian32(&buf[len], log->checkpoint_crc);
+  len += LOG_CHECKSUM_SIZE;
+  log->checkpoint_crc = 0;
+  log->checkpoint_len = 0;
+  return file_add(log, buf, len);
+}
+
 static sparkey_returncode flush_snappy(sparkey_logwriter *log) {
   log->flushed = 1;
   if (log->entry_count > (int) log->header.max_entries_per_block) {
     log->header.max_entries_per_block = log->entry_count;
   }
+  uint32_t entry_count = log->entry_count;
   log->entry_count = 0;
   sparkey_buf *block_buf = &log->block_buf;
+  log->stats.num_blocks++;
+  log->stats.unused_block_bytes += buf_remaining(block_buf);
+  if (log->header.flags & LOG_FLAG_FRONT_CODED) {
+    // The trailer goes into the space reserved past the end of the block.
+    for (int i = 0; i < log->restart_count; i++) {
+      write_little_endian32(block_buf->cur, log->restarts[i]);
+      block_buf->cur += 4;
+    }
+    write_little_endian32(block_buf->cur, log->restart_count);
+    block_buf->cur += 4;
+    log->restart_count = 0;
+  }
   uint8_t *compressed = log->compressed;
   uint32_t max_compressed_size = log->max_compressed_size;
-  sparkey_buf *file_buf = &log->file_buf;
-  int fd = log->fd;
 
   size_t compressed_size = max_compressed_size;
   snappy_status status = snappy_compress((char *) block_buf->start, buf_used(block_buf), (char *) compressed, &compressed_size);
@@ -188,51 +467,337 @@ static sparkey_returncode flush_snappy(sparkey_logwriter *log) {
   default:
     return SPARKEY_INTERNAL_ERROR;
   }
+  SPARKEY_PROBE3(flush__snappy, buf_used(block_buf), compressed_size, entry_count);
+  if (log->blockindex_fd >= 0) {
+    sparkey_block_info info;
+    info.offset = log->position;
+    info.compressed_size = compressed_size;
+    info.entry_count = entry_count;
+    info.first_entry = log->blockindex_entries;
+    uint8_t record[BLOCKINDEX_RECORD_SIZE];
+    blockindex_encode_record(record, &info);
+    RETHROW(buf_add(&log->blockindex_buf, log->blockindex_fd, record, BLOCKINDEX_RECORD_SIZE));
+    log->blockindex_entries += entry_count;
+  }
   uint8_t buf1[10];
   ptrdiff_t written1 = write_vlq(buf1, compressed_size);
-  RETHROW(buf_add(file_buf, fd, buf1, written1));
-  RETHROW(buf_add(file_buf, fd, compressed, compressed_size));
+  RETHROW(file_add(log, buf1, written1));
+  RETHROW(file_add(log, compressed, compressed_size));
+  if (log->header.flags & LOG_FLAG_CHECKSUMS) {
+    uint8_t checksum[LOG_CHECKSUM_SIZE];
+    write_little_endian32(checksum, crc32c(0, compressed, compressed_size));
+    RETHROW(file_add(log, checksum, LOG_CHECKSUM_SIZE));
+  }
   block_buf->cur = block_buf->start;
   return SPARKEY_SUCCESS;
 }
 
 
-sparkey_returncode sparkey_logwriter_flush(sparkey_logwriter *log) {
-  RETHROW(assert_writer_open(log));
+static sparkey_returncode sync_file(int fd) {
+#if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+  int r = fdatasync(fd);
+#else
+  int r = fsync(fd);
+#endif
+  if (r < 0) {
+    return sparkey_write_returncode(errno);
+  }
+  return SPARKEY_SUCCESS;
+}
+
+/**
+ * Writes all buffered data to the file and prepares a matching header in flushed_header.
+ * Must be called with lock held.
+ */
+static sparkey_returncode write_data(sparkey_logwriter *log) {
+  // Appenders may still be writing to the ranges they reserved.
+  while (log->appends_inflight > 0) {
+    pthread_cond_wait(&log->appends_done, &log->lock);
+  }
+  RETHROW(log->append_error);
+  if (log->sorter != NULL && logsorter_size(log->sorter) > 0) {
+    RETHROW(logsorter_drain(log->sorter, emit_sorted, log));
+  }
   if (buf_used(&log->block_buf) > 0) {
     RETHROW(flush_snappy(log));
   }
-  if (buf_used(&log->file_buf) > 0) {
+  if (log->checkpoint_len > 0) {
+    RETHROW(write_checkpoint(log));
+  }
+  if (log->direct_io) {
+    RETHROW(aiobuf_flush(&log->aio));
+  } else if (buf_used(&log->file_buf) > 0) {
     RETHROW(buf_flushfile(&log->file_buf, log->fd));
   }
-  off_t pos = lseek(log->fd, 0, SEEK_CUR);
-  log->header.data_end = pos;
-  lseek(log->fd, 0, SEEK_SET);
-  RETHROW(write_logheader(log->fd, &log->header));
-  lseek(log->fd, pos, SEEK_SET);
-
-  /* Can't build fsync support on lenny */
-  /* fsync(log->fd); */
+  // The index must not fall behind the header, or readers would consider it stale.
+  if (log->blockindex_fd >= 0 && buf_used(&log->blockindex_buf) > 0) {
+    RETHROW(buf_flushfile(&log->blockindex_buf, log->blockindex_fd));
+  }
+  log->header.data_end = log->position;
+  encode_logheader(log->flushed_header, &log->header);
   return SPARKEY_SUCCESS;
 }
 
+static sparkey_returncode write_header(sparkey_logwriter *log, const uint8_t *header) {
+  if (log->direct_io) {
+    return aiobuf_write_head(&log->aio, header, log->header.header_size);
+  }
+  return pwrite_full(log->fd, header, log->header.header_size, 0);
+}
+
+/**
+ * Makes everything flushed so far durable, and sets seq to the last flush that it covers.
+ */
+static sparkey_returncode group_sync(sparkey_logwriter *log, uint64_t *seq) {
+  uint8_t header[LOG_MAX_HEADER_SIZE];
+  pthread_mutex_lock(&log->lock);
+  memcpy(header, log->flushed_header, LOG_MAX_HEADER_SIZE);
+  *seq = log->write_seq;
+  pthread_mutex_unlock(&log->lock);
+
+  // Writers may keep adding data while the file is synced, the header copy only covers what was flushed before.
+  RETHROW(sync_file(log->fd));
+  pthread_mutex_lock(&log->lock);
+  sparkey_returncode returncode = write_header(log, header);
+  pthread_mutex_unlock(&log->lock);
+  if (returncode != SPARKEY_SUCCESS) {
+    return returncode;
+  }
+  return sync_file(log->fd);
+}
+
+static sparkey_returncode group_commit(sparkey_logwriter *log) {
+  pthread_mutex_lock(&log->lock);
+  sparkey_returncode returncode = write_data(log);
+  uint64_t seq = ++log->write_seq;
+  pthread_mutex_unlock(&log->lock);
+  if (returncode != SPARKEY_SUCCESS) {
+    return returncode;
+  }
+
+  // The first caller to find no sync in progress syncs on behalf of everyone waiting.
+  pthread_mutex_lock(&log->sync_lock);
+  while (log->synced_seq < seq && returncode == SPARKEY_SUCCESS) {
+    if (log->syncing) {
+      pthread_cond_wait(&log->synced, &log->sync_lock);
+      continue;
+    }
+    log->syncing = 1;
+    pthread_mutex_unlock(&log->sync_lock);
+
+    uint64_t covered;
+    returncode = group_sync(log, &covered);
+
+    pthread_mutex_lock(&log->sync_lock);
+    log->syncing = 0;
+    if (returncode == SPARKEY_SUCCESS && covered > log->synced_seq) {
+      log->synced_seq = covered;
+    }
+    pthread_cond_broadcast(&log->synced);
+  }
+  pthread_mutex_unlock(&log->sync_lock);
+  return returncode;
+}
+
+static sparkey_returncode write_data_locked(sparkey_logwriter *log, uint8_t *header) {
+  pthread_mutex_lock(&log->lock);
+  sparkey_returncode returncode = write_data(log);
+  memcpy(header, log->flushed_header, LOG_MAX_HEADER_SIZE);
+  pthread_mutex_unlock(&log->lock);
+  return returncode;
+}
+
+sparkey_returncode sparkey_logwriter_flush(sparkey_logwriter *log) {
+  RETHROW(assert_writer_open(log));
+  uint8_t header[LOG_MAX_HEADER_SIZE];
+  switch (log->durability) {
+  case SPARKEY_DURABILITY_GROUP_COMMIT:
+    return group_commit(log);
+  case SPARKEY_DURABILITY_FDATASYNC:
+    RETHROW(write_data_locked(log, header));
+    // The data must be on disk before the header that makes it visible.
+    RETHROW(sync_file(log->fd));
+    RETHROW(write_header(log, header));
+    return sync_file(log->fd);
+  case SPARKEY_DURABILITY_NONE:
+  default:
+    RETHROW(write_data_locked(log, header));
+    return write_header(log, header);
+  }
+}
+
+sparkey_returncode sparkey_logwriter_set_durability(sparkey_logwriter *log, sparkey_durability durability) {
+  RETHROW(assert_writer_open(log));
+  switch (durability) {
+  case SPARKEY_DURABILITY_NONE:
+  case SPARKEY_DURABILITY_FDATASYNC:
+  case SPARKEY_DURABILITY_GROUP_COMMIT:
+    log->durability = durability;
+    return SPARKEY_SUCCESS;
+  default:
+    return SPARKEY_INVALID_ARGUMENT;
+  }
+}
+
 sparkey_returncode sparkey_logwriter_close(sparkey_logwriter **log) {
   sparkey_logwriter *l = *log;
   if (l->open_status != MAGIC_VALUE_LOGWRITER) {
     return SPARKEY_SUCCESS;
   }
+  if (l->num_appenders > 0) {
+    return SPARKEY_LOG_HAS_APPENDERS;
+  }
 
-  RETHROW(sparkey_logwriter_flush(l));
+  // A failed flush is reported, but the writer is still closed since it can't be retried after a failed append.
+  sparkey_returncode returncode = sparkey_logwriter_flush(l);
+  if (l->direct_io) {
+    sparkey_returncode aio_returncode = aiobuf_close(&l->aio);
+    if (returncode == SPARKEY_SUCCESS) {
+      returncode = aio_returncode;
+    }
+  }
   close(l->fd);
+  pthread_mutex_destroy(&l->lock);
+  pthread_mutex_destroy(&l->sync_lock);
+  pthread_cond_destroy(&l->synced);
+  pthread_cond_destroy(&l->appends_done);
   buf_close(&l->file_buf);
   buf_close(&l->block_buf);
   if (l->compressed != NULL) {
     free(l->compressed);
   }
+  close_blockindex(l);
+  logsorter_close(&l->sorter);
+  free(l->restarts);
+  buf_close(&l->last_key);
+  free(l->filename);
 
   l->open_status = 0;
   free(l);
   *log = NULL;
+  return returncode;
+}
+
+sparkey_returncode sparkey_logwriter_set_direct_io(sparkey_logwriter *log, int enabled) {
+  RETHROW(assert_writer_open(log));
+  enabled = enabled != 0;
+  if (enabled == log->direct_io) {
+    return SPARKEY_SUCCESS;
+  }
+  if (log->num_appenders > 0) {
+    return SPARKEY_LOG_HAS_APPENDERS;
+  }
+  RETHROW(sparkey_logwriter_flush(log));
+  if (enabled) {
+    RETHROW(aiobuf_init(&log->aio, log->fd, log->position, buf_size(&log->file_buf)));
+    log->direct_io = 1;
+  } else {
+    log->direct_io = 0;
+    RETHROW(aiobuf_close(&log->aio));
+    if (lseek(log->fd, log->position, SEEK_SET) < 0) {
+      return sparkey_write_returncode(errno);
+    }
+  }
+  return SPARKEY_SUCCESS;
+}
+
+/**
+ * Sets header flags that change the format of the data. The header grows to minor version 1
+ * and is rewritten, which is only possible while the log is empty.
+ */
+static sparkey_returncode set_format_flags(sparkey_logwriter *log, uint32_t flags) {
+  if (log->num_appenders > 0) {
+    return SPARKEY_LOG_HAS_APPENDERS;
+  }
+  if (log->direct_io) {
+    return SPARKEY_INCOMPATIBLE_LOG_MODES;
+  }
+  if (log->header.num_puts + log->header.num_deletes > 0 || log->position != log->header.header_size ||
+      (log->sorter != NULL && logsorter_size(log->sorter) > 0)) {
+    return SPARKEY_LOG_NOT_EMPTY;
+  }
+  log->header.minor_version = 1;
+  log->header.header_size = LOG_HEADER_SIZE_1;
+  log->header.flags = flags;
+  log->header.data_end = LOG_HEADER_SIZE_1;
+  log->position = LOG_HEADER_SIZE_1;
+
+  uint8_t header[LOG_MAX_HEADER_SIZE];
+  encode_logheader(header, &log->header);
+  RETHROW(pwrite_full(log->fd, header, log->header.header_size, 0));
+  if (lseek(log->fd, log->position, SEEK_SET) < 0) {
+    return sparkey_write_returncode(errno);
+  }
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode sparkey_logwriter_set_sorted(sparkey_logwriter *log, uint64_t memory_limit) {
+  RETHROW(assert_writer_open(log));
+  if (log->header.compression_type != SPARKEY_COMPRESSION_SNAPPY) {
+    return SPARKEY_INVALID_COMPRESSION_TYPE;
+  }
+  if (log->sorter != NULL) {
+    return SPARKEY_SUCCESS;
+  }
+  log->header.restart_interval = RESTART_INTERVAL;
+  RETHROW(set_format_flags(log, log->header.flags | LOG_FLAG_FRONT_CODED));
+  return enable_front_coding(log, memory_limit);
+}
+
+sparkey_returncode sparkey_logwriter_set_checksums(sparkey_logwriter *log, int enabled) {
+  RETHROW(assert_writer_open(log));
+  uint32_t flags = enabled ? log->header.flags | LOG_FLAG_CHECKSUMS : log->header.flags & ~LOG_FLAG_CHECKSUMS;
+  if (flags == log->header.flags) {
+    return SPARKEY_SUCCESS;
+  }
+  return set_format_flags(log, flags);
+}
+
+sparkey_returncode sparkey_logwriter_set_blockindex(sparkey_logwriter *log, int enabled) {
+  RETHROW(assert_writer_open(log));
+  if (log->header.compression_type == SPARKEY_COMPRESSION_NONE) {
+    return SPARKEY_INVALID_COMPRESSION_TYPE;
+  }
+  if (log->num_appenders > 0) {
+    return SPARKEY_LOG_HAS_APPENDERS;
+  }
+  enabled = enabled != 0;
+  if (enabled == (log->blockindex_fd >= 0)) {
+    return SPARKEY_SUCCESS;
+  }
+  if (enabled) {
+    if (log->header.num_puts + log->header.num_deletes > 0 || log->position != log->header.header_size) {
+      return SPARKEY_LOG_NOT_EMPTY;
+    }
+    return create_blockindex(log);
+  }
+  close_blockindex(log);
+  char *filename = sparkey_create_blockindex_filename(log->filename);
+  if (filename != NULL && unlink(filename) < 0) {
+    free(filename);
+    return sparkey_remove_returncode(errno);
+  }
+  free(filename);
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode sparkey_logwriter_set_packing(sparkey_logwriter *log, sparkey_packing_policy policy) {
+  RETHROW(assert_writer_open(log));
+  switch (policy) {
+  case SPARKEY_PACKING_NO_SPLIT:
+  case SPARKEY_PACKING_MIN_WASTE:
+    log->packing = policy;
+    return SPARKEY_SUCCESS;
+  default:
+    return SPARKEY_INVALID_ARGUMENT;
+  }
+}
+
+sparkey_returncode sparkey_logwriter_stats(sparkey_logwriter *log, sparkey_writer_stats *stats) {
+  RETHROW(assert_writer_open(log));
+  pthread_mutex_lock(&log->lock);
+  *stats = log->stats;
+  pthread_mutex_unlock(&log->lock);
   return SPARKEY_SUCCESS;
 }
 
@@ -256,6 +821,36 @@ static sparkey_returncode snappy_add(sparkey_logwriter *log, const uint8_t *data
   return SPARKEY_SUCCESS;
 }
 
+/**
+ * Decides if the current block should be closed before adding an entry to it.
+ * Entry headers are never split over two blocks.
+ */
+static int should_flush(sparkey_buf *block_buf, sparkey_packing_policy packing, uint64_t header_len, uint64_t entry_len) {
+  if (buf_used(block_buf) == 0) {
+    return 0;
+  }
+  uint64_t remaining = buf_remaining(block_buf);
+  if (remaining < header_len) {
+    return 1;
+  }
+  if (entry_len <= remaining) {
+    return 0;
+  }
+  uint64_t block_size = buf_size(block_buf);
+  if (entry_len <= block_size) {
+    // Splitting never saves any blocks, since the next entry has to start on a new block anyway.
+    return 1;
+  }
+  switch (packing) {
+  case SPARKEY_PACKING_MIN_WASTE:
+    return 0;
+  case SPARKEY_PACKING_NO_SPLIT:
+  default:
+    // Large entries are always split, but starting on a new block
+    // may let it span fewer blocks, which means fewer decompressions when reading it.
+    return (entry_len + block_size - 1) / block_size < 1 + (entry_len - remaining + block_size - 1) / block_size;
+  }
+}
 
 static sparkey_returncode log_add(sparkey_logwriter *log, uint64_t num1, uint64_t num2, uint64_t len1, const uint8_t *data1, uint64_t len2, const uint8_t *data2, ptrdiff_t *datasize) {
   uint8_t buf1[10];
@@ -265,30 +860,34 @@ static sparkey_returncode log_add(sparkey_logwriter *log, uint64_t num1, uint64_
   uint64_t written2 = write_vlq(buf2, num2);
 
   *datasize = written1 + written2 + len1 + len2;
-  uint64_t remaining;
   switch (log->header.compression_type) {
   case SPARKEY_COMPRESSION_NONE:
-    RETHROW(buf_add(&log->file_buf, log->fd, buf1, written1));
-    RETHROW(buf_add(&log->file_buf, log->fd, buf2, written2));
-    RETHROW(buf_add(&log->file_buf, log->fd, data1, len1));
-    RETHROW(buf_add(&log->file_buf, log->fd, data2, len2));
+    RETHROW(plain_add(log, buf1, written1));
+    RETHROW(plain_add(log, buf2, written2));
+    RETHROW(plain_add(log, data1, len1));
+    RETHROW(plain_add(log, data2, len2));
+    if (log->checkpoint_len >= LOG_CHECKPOINT_INTERVAL) {
+      RETHROW(write_checkpoint(log));
+    }
     break;
   case SPARKEY_COMPRESSION_SNAPPY:
-    remaining = buf_remaining(&log->block_buf);
-    // todo: make it smarter by checking if it's better to flush directly
-    uint64_t fits_in_one = written1 + written2 + len1 + len2 <= buf_size(&log->block_buf);
-    uint64_t doesnt_fit_this = written1 + written2 + len1 + len2 > buf_remaining(&log->block_buf);
-    if ((remaining < written1 + written2) || (fits_in_one && doesnt_fit_this)) {
+    if (should_flush(&log->block_buf, log->packing, written1 + written2, *datasize)) {
       RETHROW(flush_snappy(log));
     }
     log->entry_count++;
     log->flushed = 0;
+    uint64_t num_blocks = log->stats.num_blocks;
     RETHROW(snappy_add(log, buf1, written1));
     RETHROW(snappy_add(log, buf2, written2));
     RETHROW(snappy_add(log, data1, len1));
     RETHROW(snappy_add(log, data2, len2));
-    if (log->flushed && buf_used(&log->block_buf) > 0) {
-      RETHROW(flush_snappy(log));
+    if (log->flushed) {
+      log->stats.num_split_entries++;
+      // The next entry must start at the beginning of a block to be addressable.
+      if (buf_used(&log->block_buf) > 0) {
+        RETHROW(flush_snappy(log));
+      }
+      log->stats.num_split_blocks += log->stats.num_blocks - num_blocks;
     }
     break;
   default:
@@ -297,11 +896,80 @@ static sparkey_returncode log_add(sparkey_logwriter *log, uint64_t num1, uint64_
   return SPARKEY_SUCCESS;
 }
 
-sparkey_returncode sparkey_logwriter_put(sparkey_logwriter *log, uint64_t keylen, const uint8_t *key, uint64_t valuelen, const uint8_t *value) {
-  RETHROW(assert_writer_open(log));
+static sparkey_returncode log_add_front_coded(sparkey_logwriter *log, sparkey_entry_type type, uint64_t keylen, const uint8_t *key, uint64_t valuelen, const uint8_t *value, ptrdiff_t *datasize) {
+  uint8_t buf1[10];
+  uint8_t buf2[10];
+  uint8_t buf3[10];
+  uint64_t written1 = write_vlq(buf1, type == SPARKEY_ENTRY_PUT ? keylen + 1 : 0);
+  uint64_t written2 = write_vlq(buf2, type == SPARKEY_ENTRY_PUT ? valuelen : keylen);
+
+  int restart = buf_used(&log->block_buf) == 0 || log->since_restart >= (int) log->header.restart_interval;
+  uint64_t shared = 0;
+  if (!restart) {
+    uint64_t max_shared = keylen < buf_used(&log->last_key) ? keylen : buf_used(&log->last_key);
+    while (shared < max_shared && key[shared] == log->last_key.start[shared]) {
+      shared++;
+    }
+  }
+  uint64_t written3 = write_vlq(buf3, shared);
+  *datasize = written1 + written2 + written3 + keylen - shared + valuelen;
+
+  if (should_flush(&log->block_buf, log->packing, written1 + written2 + written3, *datasize)) {
+    RETHROW(flush_snappy(log));
+    if (!restart) {
+      restart = 1;
+      shared = 0;
+      written3 = write_vlq(buf3, 0);
+      *datasize = written1 + written2 + written3 + keylen + valuelen;
+    }
+  }
+  if (restart) {
+    log->restarts[log->restart_count++] = buf_used(&log->block_buf);
+    log->since_restart = 0;
+  }
+  log->since_restart++;
+
+  log->entry_count++;
+  log->flushed = 0;
+  uint64_t num_blocks = log->stats.num_blocks;
+  RETHROW(snappy_add(log, buf1, written1));
+  RETHROW(snappy_add(log, buf2, written2));
+  RETHROW(snappy_add(log, buf3, written3));
+  RETHROW(snappy_add(log, key + shared, keylen - shared));
+  RETHROW(snappy_add(log, value, valuelen));
+  if (log->flushed) {
+    log->stats.num_split_entries++;
+    if (buf_used(&log->block_buf) > 0) {
+      RETHROW(flush_snappy(log));
+    }
+    log->stats.num_split_blocks += log->stats.num_blocks - num_blocks;
+  }
+
+  log->last_key.cur = log->last_key.start;
+  return buf_append(&log->last_key, key, keylen);
+}
+
+/**
+ * Writes an entry to the log and updates the header.
+ */
+static sparkey_returncode log_entry(sparkey_logwriter *log, sparkey_entry_type type, uint64_t keylen, const uint8_t *key, uint64_t valuelen, const uint8_t *value) {
   ptrdiff_t datasize;
-  RETHROW(log_add(log, keylen + 1, valuelen, keylen, key, valuelen, value, &datasize));
+  if (type == SPARKEY_ENTRY_DELETE) {
+    valuelen = 0;
+  }
+  if (log->header.flags & LOG_FLAG_FRONT_CODED) {
+    RETHROW(log_add_front_coded(log, type, keylen, key, valuelen, value, &datasize));
+  } else if (type == SPARKEY_ENTRY_PUT) {
+    RETHROW(log_add(log, keylen + 1, valuelen, keylen, key, valuelen, value, &datasize));
+  } else {
+    RETHROW(log_add(log, 0, keylen, 0, NULL, keylen, key, &datasize));
+  }
 
+  if (type == SPARKEY_ENTRY_DELETE) {
+    log->header.num_deletes++;
+    log->header.delete_size += datasize;
+    return SPARKEY_SUCCESS;
+  }
   log->header.num_puts++;
   log->header.put_size += datasize;
   if (keylen > log->header.max_key_len) {
@@ -313,13 +981,323 @@ sparkey_returncode sparkey_logwriter_put(sparkey_logwriter *log, uint64_t keylen
   return SPARKEY_SUCCESS;
 }
 
+static sparkey_returncode emit_sorted(void *ctx, sparkey_entry_type type, const uint8_t *key, uint64_t keylen, const uint8_t *value, uint64_t valuelen) {
+  return log_entry(ctx, type, keylen, key, valuelen, value);
+}
+
+static sparkey_returncode log_put(sparkey_logwriter *log, uint64_t keylen, const uint8_t *key, uint64_t valuelen, const uint8_t *value) {
+  if (log->num_appenders > 0) {
+    return SPARKEY_LOG_HAS_APPENDERS;
+  }
+  if (log->sorter != NULL) {
+    return logsorter_add(log->sorter, SPARKEY_ENTRY_PUT, key, keylen, value, valuelen);
+  }
+  return log_entry(log, SPARKEY_ENTRY_PUT, keylen, key, valuelen, value);
+}
+
+static sparkey_returncode log_delete(sparkey_logwriter *log, uint64_t keylen, const uint8_t *key) {
+  if (log->num_appenders > 0) {
+    return SPARKEY_LOG_HAS_APPENDERS;
+  }
+  if (log->sorter != NULL) {
+    return logsorter_add(log->sorter, SPARKEY_ENTRY_DELETE, key, keylen, NULL, 0);
+  }
+  return log_entry(log, SPARKEY_ENTRY_DELETE, keylen, key, 0, NULL);
+}
+
+sparkey_returncode sparkey_logwriter_put(sparkey_logwriter *log, uint64_t keylen, const uint8_t *key, uint64_t valuelen, const uint8_t *value) {
+  RETHROW(assert_writer_open(log));
+  lock_writer(log);
+  sparkey_returncode returncode = log_put(log, keylen, key, valuelen, value);
+  unlock_writer(log);
+  return returncode;
+}
+
 sparkey_returncode sparkey_logwriter_delete(sparkey_logwriter *log, uint64_t keylen, const uint8_t *key) {
   RETHROW(assert_writer_open(log));
-  ptrdiff_t datasize;
-  RETHROW(log_add(log, 0, keylen, 0, NULL, keylen, key, &datasize));
+  lock_writer(log);
+  sparkey_returncode returncode = log_delete(log, keylen, key);
+  unlock_writer(log);
+  return returncode;
+}
+
+static sparkey_returncode assert_appender_open(sparkey_logappender *appender) {
+  if (appender->open_status != MAGIC_VALUE_LOGAPPENDER) {
+    return SPARKEY_LOG_CLOSED;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+static void merge_counters(sparkey_logheader *dst, sparkey_logheader *src) {
+  dst->num_puts += src->num_puts;
+  dst->num_deletes += src->num_deletes;
+  dst->put_size += src->put_size;
+  dst->delete_size += src->delete_size;
+  if (src->max_key_len > dst->max_key_len) {
+    dst->max_key_len = src->max_key_len;
+  }
+  if (src->max_value_len > dst->max_value_len) {
+    dst->max_value_len = src->max_value_len;
+  }
+  if (src->max_entries_per_block > dst->max_entries_per_block) {
+    dst->max_entries_per_block = src->max_entries_per_block;
+  }
+  memset(src, 0, sizeof(sparkey_logheader));
+}
+
+static void merge_stats(sparkey_writer_stats *dst, sparkey_writer_stats *src) {
+  dst->num_blocks += src->num_blocks;
+  dst->num_split_entries += src->num_split_entries;
+  dst->num_split_blocks += src->num_split_blocks;
+  dst->unused_block_bytes += src->unused_block_bytes;
+  memset(src, 0, sizeof(sparkey_writer_stats));
+}
+
+sparkey_returncode sparkey_logappender_create(sparkey_logappender **appender_ref, sparkey_logwriter *log) {
+  RETHROW(assert_writer_open(log));
+  sparkey_logappender *appender = malloc(sizeof(sparkey_logappender));
+  if (appender == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  memset(appender, 0, sizeof(sparkey_logappender));
+  appender->log = log;
+
+  sparkey_returncode returncode;
+  TRY(buf_init(&appender->out, APPENDER_COMMIT_SIZE), free_appender);
+  if (log->header.compression_type == SPARKEY_COMPRESSION_SNAPPY) {
+    TRY(buf_init(&appender->block_buf, log->header.compression_block_size), free_appender);
+    appender->max_compressed_size = log->max_compressed_size;
+    appender->compressed = malloc(appender->max_compressed_size);
+    if (appender->compressed == NULL) {
+      returncode = SPARKEY_INTERNAL_ERROR;
+      goto free_appender;
+    }
+  }
 
-  log->header.num_deletes++;
-  log->header.delete_size += datasize;
+  pthread_mutex_lock(&log->lock);
+  // Checkpoints of uncompressed logs cover the data since the previous one, which appenders would interleave.
+  int checkpoints = log->header.compression_type == SPARKEY_COMPRESSION_NONE && (log->header.flags & LOG_FLAG_CHECKSUMS);
+  if (log->direct_io || log->sorter != NULL || log->blockindex_fd >= 0 || checkpoints) {
+    returncode = SPARKEY_INCOMPATIBLE_LOG_MODES;
+  } else if (log->num_appenders == 0) {
+    // Entries added directly to the writer must reach the file before the appenders reserve space after them.
+    returncode = write_data(log);
+  } else {
+    returncode = SPARKEY_SUCCESS;
+  }
+  if (returncode == SPARKEY_SUCCESS) {
+    log->num_appenders++;
+  }
+  pthread_mutex_unlock(&log->lock);
+  if (returncode != SPARKEY_SUCCESS) {
+    goto free_appender;
+  }
+
+  appender->open_status = MAGIC_VALUE_LOGAPPENDER;
+  *appender_ref = appender;
   return SPARKEY_SUCCESS;
+
+free_appender:
+  buf_close(&appender->out);
+  buf_close(&appender->block_buf);
+  free(appender->compressed);
+  free(appender);
+  return returncode;
 }
 
+/**
+ * Reserves a range at the end of the log and writes all complete entries to it.
+ */
+static sparkey_returncode appender_commit(sparkey_logappender *appender) {
+  uint64_t len = buf_used(&appender->out);
+  if (len == 0) {
+    return SPARKEY_SUCCESS;
+  }
+  sparkey_logwriter *log = appender->log;
+  pthread_mutex_lock(&log->lock);
+  uint64_t position = log->position;
+  log->position += len;
+  log->appends_inflight++;
+  merge_counters(&log->header, &appender->header);
+  merge_stats(&log->stats, &appender->stats);
+  pthread_mutex_unlock(&log->lock);
+
+  sparkey_returncode returncode = pwrite_full(log->fd, appender->out.start, len, position);
+  appender->out.cur = appender->out.start;
+
+  pthread_mutex_lock(&log->lock);
+  if (returncode != SPARKEY_SUCCESS && log->append_error == SPARKEY_SUCCESS) {
+    // The log now has a hole, so no header may ever cover it.
+    log->append_error = returncode;
+  }
+  if (--log->appends_inflight == 0) {
+    pthread_cond_broadcast(&log->appends_done);
+  }
+  pthread_mutex_unlock(&log->lock);
+  return returncode;
+}
+
+static sparkey_returncode appender_flush_block(sparkey_logappender *appender) {
+  appender->flushed = 1;
+  if (appender->entry_count > (int) appender->header.max_entries_per_block) {
+    appender->header.max_entries_per_block = appender->entry_count;
+  }
+  // Entries are counted once they are complete, so everything pending is in this or earlier blocks.
+  merge_counters(&appender->header, &appender->pending);
+  uint32_t entry_count = appender->entry_count;
+  appender->entry_count = 0;
+  sparkey_buf *block_buf = &appender->block_buf;
+  appender->stats.num_blocks++;
+  appender->stats.unused_block_bytes += buf_remaining(block_buf);
+
+  size_t compressed_size = appender->max_compressed_size;
+  snappy_status status = snappy_compress((char *) block_buf->start, buf_used(block_buf), (char *) appender->compressed, &compressed_size);
+  if (status != SNAPPY_OK) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  SPARKEY_PROBE3(flush__snappy, buf_used(block_buf), compressed_size, entry_count);
+  uint8_t buf1[10];
+  ptrdiff_t written1 = write_vlq(buf1, compressed_size);
+  RETHROW(buf_append(&appender->out, buf1, written1));
+  RETHROW(buf_append(&appender->out, appender->compressed, compressed_size));
+  if (appender->log->header.flags & LOG_FLAG_CHECKSUMS) {
+    uint8_t checksum[LOG_CHECKSUM_SIZE];
+    write_little_endian32(checksum, crc32c(0, appender->compressed, compressed_size));
+    RETHROW(buf_append(&appender->out, checksum, LOG_CHECKSUM_SIZE));
+  }
+  block_buf->cur = block_buf->start;
+  return SPARKEY_SUCCESS;
+}
+
+static sparkey_returncode appender_block_add(sparkey_logappender *appender, const uint8_t *data, ptrdiff_t len) {
+  sparkey_buf *block_buf = &appender->block_buf;
+  while (1) {
+    ptrdiff_t remaining = buf_remaining(block_buf);
+    if (remaining >= len) {
+      memcpy(block_buf->cur, data, len);
+      block_buf->cur += len;
+      return SPARKEY_SUCCESS;
+    }
+    memcpy(block_buf->cur, data, remaining);
+    block_buf->cur += remaining;
+    data += remaining;
+    len -= remaining;
+    RETHROW(appender_flush_block(appender));
+  }
+}
+
+static sparkey_returncode appender_add(sparkey_logappender *appender, uint64_t num1, uint64_t num2, uint64_t len1, const uint8_t *data1, uint64_t len2, const uint8_t *data2, ptrdiff_t *datasize) {
+  uint8_t buf1[10];
+  uint8_t buf2[10];
+  uint64_t written1 = write_vlq(buf1, num1);
+  uint64_t written2 = write_vlq(buf2, num2);
+
+  *datasize = written1 + written2 + len1 + len2;
+  switch (appender->log->header.compression_type) {
+  case SPARKEY_COMPRESSION_NONE:
+    RETHROW(buf_append(&appender->out, buf1, written1));
+    RETHROW(buf_append(&appender->out, buf2, written2));
+    RETHROW(buf_append(&appender->out, data1, len1));
+    RETHROW(buf_append(&appender->out, data2, len2));
+    break;
+  case SPARKEY_COMPRESSION_SNAPPY:
+    if (should_flush(&appender->block_buf, appender->log->packing, written1 + written2, *datasize)) {
+      RETHROW(appender_flush_block(appender));
+    }
+    appender->entry_count++;
+    appender->flushed = 0;
+    uint64_t num_blocks = appender->stats.num_blocks;
+    RETHROW(appender_block_add(appender, buf1, written1));
+    RETHROW(appender_block_add(appender, buf2, written2));
+    RETHROW(appender_block_add(appender, data1, len1));
+    RETHROW(appender_block_add(appender, data2, len2));
+    if (appender->flushed) {
+      appender->stats.num_split_entries++;
+      // The blocks of a split entry are committed together, so they stay adjacent in the file.
+      if (buf_used(&appender->block_buf) > 0) {
+        RETHROW(appender_flush_block(appender));
+      }
+      appender->stats.num_split_blocks += appender->stats.num_blocks - num_blocks;
+    }
+    break;
+  default:
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+/**
+ * Called after each entry. Commits once enough data is collected,
+ * which is only safe between entries since a split entry must be committed as a whole.
+ */
+static sparkey_returncode appender_entry_done(sparkey_logappender *appender, sparkey_logheader *pending) {
+  if (buf_used(&appender->block_buf) == 0) {
+    merge_counters(&appender->header, pending);
+  }
+  if (buf_used(&appender->out) >= APPENDER_COMMIT_SIZE) {
+    return appender_commit(appender);
+  }
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode sparkey_logappender_put(sparkey_logappender *appender, uint64_t keylen, const uint8_t *key, uint64_t valuelen, const uint8_t *value) {
+  RETHROW(assert_appender_open(appender));
+  ptrdiff_t datasize;
+  RETHROW(appender_add(appender, keylen + 1, valuelen, keylen, key, valuelen, value, &datasize));
+
+  sparkey_logheader *pending = &appender->pending;
+  pending->num_puts++;
+  pending->put_size += datasize;
+  if (keylen > pending->max_key_len) {
+    pending->max_key_len = keylen;
+  }
+  if (valuelen > pending->max_value_len) {
+    pending->max_value_len = valuelen;
+  }
+  return appender_entry_done(appender, pending);
+}
+
+sparkey_returncode sparkey_logappender_delete(sparkey_logappender *appender, uint64_t keylen, const uint8_t *key) {
+  RETHROW(assert_appender_open(appender));
+  ptrdiff_t datasize;
+  RETHROW(appender_add(appender, 0, keylen, 0, NULL, keylen, key, &datasize));
+
+  sparkey_logheader *pending = &appender->pending;
+  pending->num_deletes++;
+  pending->delete_size += datasize;
+  return appender_entry_done(appender, pending);
+}
+
+sparkey_returncode sparkey_logappender_flush(sparkey_logappender *appender) {
+  RETHROW(assert_appender_open(appender));
+  if (buf_used(&appender->block_buf) > 0) {
+    RETHROW(appender_flush_block(appender));
+  }
+  return appender_commit(appender);
+}
+
+sparkey_returncode sparkey_logappender_close(sparkey_logappender **appender_ref) {
+  sparkey_logappender *appender = *appender_ref;
+  if (appender->open_status != MAGIC_VALUE_LOGAPPENDER) {
+    return SPARKEY_SUCCESS;
+  }
+  // The appender is detached even if the flush fails, so that the writer can still be closed.
+  sparkey_returncode returncode = sparkey_logappender_flush(appender);
+  sparkey_logwriter *log = appender->log;
+  pthread_mutex_lock(&log->lock);
+  if (--log->num_appenders == 0) {
+    // The writer's own entries are written at the file offset, so continue after the appended data.
+    if (lseek(log->fd, log->position, SEEK_SET) < 0 && returncode == SPARKEY_SUCCESS) {
+      returncode = sparkey_write_returncode(errno);
+    }
+  }
+  pthread_mutex_unlock(&log->lock);
+
+  buf_close(&appender->out);
+  buf_close(&appender->block_buf);
+  free(appender->compressed);
+  appender->open_status = 0;
+  free(appender);
+  *appender_ref = NULL;
+  return returncode;
+}
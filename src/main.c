@@ -17,18 +17,90 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <inttypes.h>
+#include <unistd.h>
 
 #include "logheader.h"
 #include "hashheader.h"
+#include "analyze.h"
 #include "sparkey.h"
 
 void usage() {
 	printf("Usage: sparkey <command> <options>\n");
-	printf("Commands: info [file...]\n");
-	printf("Commands: get <index file> <key>\n");
+	printf("Commands: info [-s] [file...]\n");
+	printf("Commands: get <index or pack file> <key>\n");
+	printf("Commands: pack <index file> [pack file]\n");
+	printf("Commands: stats <index file> [threads]\n");
 }
 
-int info(int argv, const char **args) {
+static void print_reader_stats(const sparkey_reader_stats *stats) {
+  printf("Lookups: %"PRIu64", Hits: %"PRIu64", Misses: %"PRIu64"\n", stats->lookups, stats->hits, stats->misses);
+  printf("Probe lengths:");
+  for (int i = 0; i < SPARKEY_PROBE_HISTOGRAM_SIZE; i++) {
+    printf(" %d%s: %"PRIu64, i + 1, i == SPARKEY_PROBE_HISTOGRAM_SIZE - 1 ? "+" : "", stats->probe_lengths[i]);
+  }
+  printf("\n");
+  printf("Hash collisions: %"PRIu64"\n", stats->hash_collisions);
+  printf("Blocks decompressed: %"PRIu64", Bytes decompressed: %"PRIu64"\n", stats->blocks_decompressed, stats->bytes_decompressed);
+  printf("Entries skipped: %"PRIu64"\n", stats->entries_skipped);
+}
+
+/**
+ * Looks up every live key of an index file and prints the reader counters of those lookups.
+ */
+static sparkey_returncode info_stats(const char *hash_filename) {
+  char *log_filename = sparkey_create_log_filename(hash_filename);
+  if (log_filename == NULL) {
+    printf("index filename must end with .spi\n");
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  sparkey_hashreader *reader;
+  sparkey_returncode returncode = sparkey_hash_open(&reader, hash_filename, log_filename);
+  free(log_filename);
+  if (returncode != SPARKEY_SUCCESS) {
+    return returncode;
+  }
+  sparkey_logreader *logreader = sparkey_hash_getreader(reader);
+  sparkey_logiter *scan = NULL;
+  sparkey_logiter *lookup = NULL;
+  uint8_t *key = malloc(sparkey_logreader_maxkeylen(logreader) + 1);
+  if (key == NULL) {
+    returncode = SPARKEY_INTERNAL_ERROR;
+    goto cleanup;
+  }
+  if ((returncode = sparkey_logiter_create(&scan, logreader)) != SPARKEY_SUCCESS ||
+      (returncode = sparkey_logiter_create(&lookup, logreader)) != SPARKEY_SUCCESS) {
+    goto cleanup;
+  }
+  while ((returncode = sparkey_logiter_hashnext(scan, reader)) == SPARKEY_SUCCESS &&
+      sparkey_logiter_state(scan) == SPARKEY_ITER_ACTIVE) {
+    uint64_t keylen;
+    returncode = sparkey_logiter_fill_key(scan, logreader, sparkey_logiter_keylen(scan), key, &keylen);
+    if (returncode != SPARKEY_SUCCESS) {
+      break;
+    }
+    returncode = sparkey_hash_get(reader, key, keylen, lookup);
+    if (returncode != SPARKEY_SUCCESS) {
+      break;
+    }
+  }
+  if (returncode == SPARKEY_SUCCESS) {
+    sparkey_reader_stats stats;
+    returncode = sparkey_hash_stats(reader, &stats);
+    if (returncode == SPARKEY_SUCCESS) {
+      print_reader_stats(&stats);
+    }
+  }
+
+cleanup:
+  free(key);
+  sparkey_logiter_close(&scan);
+  sparkey_logiter_close(&lookup);
+  sparkey_hash_close(&reader);
+  return returncode;
+}
+
+int info(int argv, const char **args, int stats) {
   int retval = 0;
   sparkey_logheader logheader;
   sparkey_hashheader hashheader;
@@ -43,6 +115,13 @@ int info(int argv, const char **args) {
       if (res2 == SPARKEY_SUCCESS) {
         printf("%s\n", args[i]);
         print_hashheader(&hashheader);
+        if (stats) {
+          sparkey_returncode res3 = info_stats(filename);
+          if (res3 != SPARKEY_SUCCESS) {
+            printf("Could not collect statistics: %s\n", sparkey_errstring(res3));
+            retval = 1;
+          }
+        }
       } else {
         printf("%s is neither a sparkey log file (%s) nor an index file (%s)\n", filename, sparkey_errstring(res), sparkey_errstring(res2));
         retval = 1;
@@ -52,11 +131,66 @@ int info(int argv, const char **args) {
   return retval;
 }
 
+static void print_histogram(const char *name, const sparkey_histogram *histogram, int log2) {
+  printf("%s: count %"PRIu64", mean %.2f, max %"PRIu64"\n", name, histogram->count,
+      histogram->count == 0 ? 0.0 : (double) histogram->sum / (double) histogram->count, histogram->max);
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    if (histogram->buckets[i] == 0) {
+      continue;
+    }
+    uint64_t lower = log2 ? (i == 0 ? 0 : 1ULL << (i - 1)) : (uint64_t) i;
+    uint64_t upper = log2 ? (i == 0 ? 0 : (1ULL << i) - 1) : (uint64_t) i;
+    double percent = 100.0 * (double) histogram->buckets[i] / (double) histogram->count;
+    if (i == HISTOGRAM_BUCKETS - 1) {
+      printf("  %12"PRIu64" and up     %12"PRIu64" %6.2f%%\n", lower, histogram->buckets[i], percent);
+    } else if (lower == upper) {
+      printf("  %12"PRIu64"                %12"PRIu64" %6.2f%%\n", lower, histogram->buckets[i], percent);
+    } else {
+      printf("  %12"PRIu64" - %-12"PRIu64" %12"PRIu64" %6.2f%%\n", lower, upper, histogram->buckets[i], percent);
+    }
+  }
+}
+
+static double ratio(uint64_t part, uint64_t total) {
+  return total == 0 ? 0.0 : (double) part / (double) total;
+}
+
+int stats(const char *hashfile, const char *logfile, int num_threads) {
+  sparkey_analysis analysis;
+  sparkey_returncode errcode = sparkey_analyze(&analysis, hashfile, logfile, num_threads);
+  if (errcode != SPARKEY_SUCCESS) {
+    printf("%s\n", sparkey_errstring(errcode));
+    return 1;
+  }
+  uint64_t used = analysis.displacement.count;
+  printf("Hash table: %"PRIu64" of %"PRIu64" slots used (load factor %.3f), %"PRIu64" bytes per slot\n",
+      used, analysis.capacity, ratio(used, analysis.capacity), analysis.slot_size);
+  print_histogram("Displacement", &analysis.displacement, 0);
+  printf("Probes crossing cache lines: %.4f, crossing pages: %.4f\n",
+      ratio(analysis.probes_crossing_lines, used), ratio(analysis.probes_crossing_pages, used));
+
+  printf("Log: %"PRIu64" puts, %"PRIu64" deletes, %"PRIu64" bytes\n", analysis.puts, analysis.deletes, analysis.data_size);
+  printf("Garbage: %"PRIu64" bytes, ratio %.4f\n", analysis.garbage_size, ratio(analysis.garbage_size, analysis.data_size));
+  if (analysis.block_stored_size.count > 0) {
+    print_histogram("Block stored size", &analysis.block_stored_size, 1);
+    print_histogram("Block uncompressed size", &analysis.block_uncompressed_size, 1);
+    print_histogram("Entries starting per block", &analysis.block_entries, 1);
+    printf("Entries split across blocks: %"PRIu64" (%.4f)\n", analysis.split_entries,
+        ratio(analysis.split_entries, analysis.puts + analysis.deletes));
+  }
+  print_histogram("Key size", &analysis.key_size, 1);
+  print_histogram("Value size", &analysis.value_size, 1);
+  return 0;
+}
+
 int get(const char *hashfile, const char *logfile, const char *key) {
   sparkey_hashreader *reader;
   sparkey_logreader *logreader;
   sparkey_logiter *iter;
-  sparkey_returncode errcode = sparkey_hash_open(&reader, hashfile, logfile);
+  // Without a log file, hashfile is a pack file.
+  sparkey_returncode errcode = logfile == NULL ?
+    sparkey_hash_open_pack(&reader, hashfile) :
+    sparkey_hash_open(&reader, hashfile, logfile);
   if (errcode != SPARKEY_SUCCESS) {
     puts(sparkey_errstring(errcode));
     puts("\n");
@@ -109,25 +243,65 @@ int main(int argv, const char **args) {
     return 1;
   }
   if (strcmp(args[1], "info") == 0) {
-    if (argv < 3) {
+    int stats = argv >= 3 && strcmp(args[2], "-s") == 0;
+    if (argv < 3 + stats) {
       usage();
       return 1;
     }
-    return info(argv - 2, args + 2);
+    return info(argv - 2 - stats, args + 2 + stats, stats);
   } else if (strcmp(args[1], "get") == 0) {
     if (argv < 4) {
       usage();
       return 1;
     }
     const char *index_filename = args[2];
+    size_t len = strlen(index_filename);
+    if (len >= 4 && strcmp(&index_filename[len - 4], ".spk") == 0) {
+      return get(index_filename, NULL, args[3]);
+    }
     char *log_filename = sparkey_create_log_filename(index_filename);
     if (log_filename == NULL) {
-      printf("index filename must end with .spi\n");
+      printf("index filename must end with .spi or .spk\n");
       return 1;
     }
     int retval = get(args[2], log_filename, args[3]);
     free(log_filename);
     return retval;
+  } else if (strcmp(args[1], "stats") == 0) {
+    if (argv < 3) {
+      usage();
+      return 1;
+    }
+    const char *index_filename = args[2];
+    char *log_filename = sparkey_create_log_filename(index_filename);
+    if (log_filename == NULL) {
+      printf("index filename must end with .spi\n");
+      return 1;
+    }
+    int num_threads = argv >= 4 ? atoi(args[3]) : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int retval = stats(index_filename, log_filename, num_threads);
+    free(log_filename);
+    return retval;
+  } else if (strcmp(args[1], "pack") == 0) {
+    if (argv < 3) {
+      usage();
+      return 1;
+    }
+    const char *index_filename = args[2];
+    char *log_filename = sparkey_create_log_filename(index_filename);
+    if (log_filename == NULL) {
+      printf("index filename must end with .spi\n");
+      return 1;
+    }
+    char *pack_filename = argv >= 4 ? strdup(args[3]) : sparkey_create_pack_filename(index_filename);
+    sparkey_returncode errcode = sparkey_pack(pack_filename, index_filename, log_filename);
+    free(pack_filename);
+    free(log_filename);
+    if (errcode != SPARKEY_SUCCESS) {
+      printf("%s\n", sparkey_errstring(errcode));
+      return 1;
+    }
+    return 0;
   } else {
     printf("Unknown command: %s\n", args[1]);
     usage();
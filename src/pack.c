@@ -0,0 +1,143 @@
+/*
+* Copyright (c) 2012-2013 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "sparkey.h"
+#include "sparkey-internal.h"
+#include "pack.h"
+#include "endiantools.h"
+#include "util.h"
+
+static uint64_t align_up(uint64_t offset) {
+  return (offset + PACK_ALIGNMENT - 1) & ~((uint64_t) PACK_ALIGNMENT - 1);
+}
+
+void pack_encode_header(uint8_t *buf, const sparkey_packheader *header) {
+  write_little_endian32(buf, PACK_MAGIC_NUMBER);
+  write_little_endian32(buf + 4, PACK_MAJOR_VERSION);
+  write_little_endian32(buf + 8, PACK_MINOR_VERSION);
+  write_little_endian32(buf + 12, header->file_identifier);
+  write_little_endian64(buf + 16, header->log_offset);
+  write_little_endian64(buf + 24, header->log_len);
+  write_little_endian64(buf + 32, header->hash_offset);
+  write_little_endian64(buf + 40, header->hash_len);
+}
+
+static int section_valid(uint64_t offset, uint64_t len, uint64_t file_len) {
+  return offset >= PACK_HEADER_SIZE && offset % PACK_ALIGNMENT == 0 &&
+    offset <= file_len && len <= file_len - offset;
+}
+
+sparkey_returncode pack_decode_header(sparkey_packheader *header, const uint8_t *data, uint64_t file_len) {
+  if (file_len < PACK_HEADER_SIZE) {
+    return SPARKEY_PACK_CORRUPT;
+  }
+  if (read_little_endian32(data, 0) != PACK_MAGIC_NUMBER) {
+    return SPARKEY_WRONG_PACK_MAGIC_NUMBER;
+  }
+  if (read_little_endian32(data, 4) != PACK_MAJOR_VERSION) {
+    return SPARKEY_WRONG_PACK_MAJOR_VERSION;
+  }
+  if (read_little_endian32(data, 8) > PACK_MINOR_VERSION) {
+    return SPARKEY_UNSUPPORTED_PACK_MINOR_VERSION;
+  }
+  header->file_identifier = read_little_endian32(data, 12);
+  header->log_offset = read_little_endian64(data, 16);
+  header->log_len = read_little_endian64(data, 24);
+  header->hash_offset = read_little_endian64(data, 32);
+  header->hash_len = read_little_endian64(data, 40);
+  if (!section_valid(header->log_offset, header->log_len, file_len) ||
+      !section_valid(header->hash_offset, header->hash_len, file_len)) {
+    return SPARKEY_PACK_CORRUPT;
+  }
+  if (header->log_offset < header->hash_offset ?
+      header->log_offset + header->log_len > header->hash_offset :
+      header->hash_offset + header->hash_len > header->log_offset) {
+    return SPARKEY_PACK_CORRUPT;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode sparkey_pack(const char *pack_filename, const char *hash_filename, const char *log_filename) {
+  sparkey_hashreader *reader;
+  RETHROW(sparkey_hash_open(&reader, hash_filename, log_filename));
+
+  sparkey_returncode returncode;
+  sparkey_packheader header;
+  header.file_identifier = reader->header.file_identifier;
+  header.log_offset = PACK_ALIGNMENT;
+  header.log_len = reader->log.data_len;
+  header.hash_offset = align_up(header.log_offset + header.log_len);
+  header.hash_len = reader->data_len;
+  uint8_t buf[PACK_HEADER_SIZE];
+  pack_encode_header(buf, &header);
+
+  // Write everything to a temporary file next to the pack, so that a single rename publishes it.
+  size_t len = strlen(pack_filename);
+  char *path = malloc(len + 8);
+  if (path == NULL) {
+    returncode = SPARKEY_INTERNAL_ERROR;
+    goto close_reader;
+  }
+  memcpy(path, pack_filename, len);
+  memcpy(path + len, ".XXXXXX", 8);
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    returncode = sparkey_create_returncode(errno);
+    goto free_path;
+  }
+
+  // mkstemp creates the file as 0600, give it the same permissions as logs and hash tables.
+  if (fchmod(fd, 00644) < 0) {
+    returncode = sparkey_create_returncode(errno);
+    goto close_fd;
+  }
+  TRY(pwrite_full(fd, buf, PACK_HEADER_SIZE, 0), close_fd);
+  TRY(pwrite_full(fd, reader->log.data, header.log_len, header.log_offset), close_fd);
+  TRY(pwrite_full(fd, reader->data, header.hash_len, header.hash_offset), close_fd);
+  if (fsync(fd) < 0) {
+    returncode = sparkey_create_returncode(errno);
+    goto close_fd;
+  }
+  if (close(fd) < 0) {
+    returncode = sparkey_create_returncode(errno);
+    goto unlink_path;
+  }
+  if (rename(path, pack_filename) < 0) {
+    returncode = sparkey_create_returncode(errno);
+    goto unlink_path;
+  }
+
+  free(path);
+  sparkey_hash_close(&reader);
+  return SPARKEY_SUCCESS;
+
+close_fd:
+  close(fd);
+unlink_path:
+  unlink(path);
+free_path:
+  free(path);
+close_reader:
+  sparkey_hash_close(&reader);
+  return returncode;
+}
@@ -0,0 +1,59 @@
+/*
+* Copyright (c) 2012-2013 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#ifndef SPARKEY_PACK_H_INCLUDED
+#define SPARKEY_PACK_H_INCLUDED
+
+#include <stdint.h>
+
+#include "sparkey.h"
+
+/*
+ * A pack (.spk) bundles a log and its hash table in a single file:
+ * a 48 byte directory followed by the log data and the hash data,
+ * each starting at a multiple of PACK_ALIGNMENT so that both sections are page aligned
+ * within a single mapping of the file.
+ */
+#define PACK_MAGIC_NUMBER (0x3a84c1e5)
+#define PACK_MAJOR_VERSION (1)
+#define PACK_MINOR_VERSION (0)
+#define PACK_HEADER_SIZE (48)
+#define PACK_ALIGNMENT (4096)
+
+typedef struct {
+  uint32_t file_identifier;
+  uint64_t log_offset;
+  uint64_t log_len;
+  uint64_t hash_offset;
+  uint64_t hash_len;
+} sparkey_packheader;
+
+/**
+ * Encodes a pack directory.
+ * @param buf destination, must have room for PACK_HEADER_SIZE bytes.
+ * @param header the directory to encode.
+ */
+void pack_encode_header(uint8_t *buf, const sparkey_packheader *header);
+
+/**
+ * Decodes a pack directory and checks that both sections fit in the file.
+ * @param header set to the decoded directory.
+ * @param data the start of the file, at least PACK_HEADER_SIZE bytes.
+ * @param file_len the size of the file.
+ * @returns SPARKEY_SUCCESS if the directory is valid.
+ */
+sparkey_returncode pack_decode_header(sparkey_packheader *header, const uint8_t *data, uint64_t file_len);
+
+#endif
@@ -0,0 +1,51 @@
+/*
+* Copyright (c) 2012-2013 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#ifndef SPARKEY_PROBES_H_INCLUDED
+#define SPARKEY_PROBES_H_INCLUDED
+
+/*
+ * USDT static tracepoints in the "sparkey" provider, for tools like bpftrace, perf and SystemTap:
+ *
+ *   hash_get__entry(keylen)
+ *   hash_get__exit(found, probes)         probes is the number of slots probed
+ *   block__decompress(position, compressed_size, uncompressed_size)
+ *   flush__snappy(uncompressed_size, compressed_size, entries)
+ *   hash_write__start(log_data_end)
+ *   hash_write__copied(entries)           existing entries taken over from the previous hash file
+ *   hash_write__inserted(entries)         all entries of the log inserted
+ *   hash_write__done(returncode)
+ *
+ * A probe is a single nop until a tracer attaches to it. They are compiled in when
+ * configure finds sys/sdt.h (HAVE_SYS_SDT_H), and compile to nothing otherwise.
+ */
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define SPARKEY_PROBE1(name, a) DTRACE_PROBE1(sparkey, name, a)
+#define SPARKEY_PROBE2(name, a, b) DTRACE_PROBE2(sparkey, name, a, b)
+#define SPARKEY_PROBE3(name, a, b, c) DTRACE_PROBE3(sparkey, name, a, b, c)
+
+#else
+
+// sizeof doesn't evaluate the arguments, it only keeps variables that exist for a probe from being unused.
+#define SPARKEY_PROBE1(name, a) do { (void) sizeof(a); } while (0)
+#define SPARKEY_PROBE2(name, a, b) do { (void) sizeof(a); (void) sizeof(b); } while (0)
+#define SPARKEY_PROBE3(name, a, b, c) do { (void) sizeof(a); (void) sizeof(b); (void) sizeof(c); } while (0)
+
+#endif
+
+#endif
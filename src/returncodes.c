@@ -19,6 +19,8 @@ const char * sparkey_errstring(sparkey_returncode code) {
   switch (code) {
   case SPARKEY_SUCCESS: return "Success";
   case SPARKEY_INTERNAL_ERROR: return "Internal error";
+  case SPARKEY_STATS_DISABLED: return "Statistics are not compiled in";
+  case SPARKEY_INVALID_ARGUMENT: return "Invalid argument";
   case SPARKEY_FILE_NOT_FOUND: return "File not found";
   case SPARKEY_PERMISSION_DENIED: return "Permission denied";
   case SPARKEY_TOO_MANY_OPEN_FILES: return "Too many open files";
@@ -44,6 +46,12 @@ const char * sparkey_errstring(sparkey_returncode code) {
 
   case SPARKEY_INVALID_COMPRESSION_BLOCK_SIZE: return "Invalid compression block size";
   case SPARKEY_INVALID_COMPRESSION_TYPE: return "Invalid compression type";
+  case SPARKEY_LOG_HAS_APPENDERS: return "Log writer is in use by appenders";
+  case SPARKEY_INVALID_LOG_RANGE: return "Log range is outside the log data";
+  case SPARKEY_BLOCKINDEX_CORRUPT: return "Block index is corrupt";
+  case SPARKEY_CHECKSUM_MISMATCH: return "Log block checksum mismatch";
+  case SPARKEY_INCOMPATIBLE_LOG_MODES: return "Log writer modes can not be combined";
+  case SPARKEY_LOG_NOT_EMPTY: return "Log format can only be changed while the log is empty";
 
   case SPARKEY_WRONG_HASH_MAGIC_NUMBER: return "Wrong magic number of hash file";
   case SPARKEY_WRONG_HASH_MAJOR_VERSION: return "Wrong major version of hash file";
@@ -53,6 +61,18 @@ const char * sparkey_errstring(sparkey_returncode code) {
   case SPARKEY_FILE_IDENTIFIER_MISMATCH: return "File identifier differs between hash file and log file";
   case SPARKEY_HASH_HEADER_CORRUPT: return "Hash header is corrupt";
   case SPARKEY_HASH_SIZE_INVALID: return "Hash size is invalid";
+  case SPARKEY_TOO_MANY_PINS: return "Too many pinned readers";
+
+  case SPARKEY_WRONG_PACK_MAGIC_NUMBER: return "Wrong magic number of pack file";
+  case SPARKEY_WRONG_PACK_MAJOR_VERSION: return "Wrong major version of pack file";
+  case SPARKEY_UNSUPPORTED_PACK_MINOR_VERSION: return "Unsupported minor version of pack file";
+  case SPARKEY_PACK_CORRUPT: return "Pack file is corrupt";
+
+  case SPARKEY_WRONG_MANIFEST_MAGIC_NUMBER: return "Wrong magic number of manifest file";
+  case SPARKEY_WRONG_MANIFEST_MAJOR_VERSION: return "Wrong major version of manifest file";
+  case SPARKEY_UNSUPPORTED_MANIFEST_MINOR_VERSION: return "Unsupported minor version of manifest file";
+  case SPARKEY_MANIFEST_CORRUPT: return "Manifest file is corrupt";
+  case SPARKEY_SHARD_MISMATCH: return "Shard does not match the manifest";
 
   default: return "Unknown error";
   }
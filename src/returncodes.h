@@ -19,6 +19,8 @@
 typedef enum {
   SPARKEY_SUCCESS = 0,
   SPARKEY_INTERNAL_ERROR = -1,
+  SPARKEY_STATS_DISABLED = -2,
+  SPARKEY_INVALID_ARGUMENT = -3,
 
   SPARKEY_FILE_NOT_FOUND = -100,
   SPARKEY_PERMISSION_DENIED = -101,
@@ -44,6 +46,12 @@ typedef enum {
   SPARKEY_LOG_HEADER_CORRUPT = -208,
   SPARKEY_INVALID_COMPRESSION_BLOCK_SIZE = -209,
   SPARKEY_INVALID_COMPRESSION_TYPE = -210,
+  SPARKEY_LOG_HAS_APPENDERS = -211,
+  SPARKEY_INVALID_LOG_RANGE = -212,
+  SPARKEY_BLOCKINDEX_CORRUPT = -213,
+  SPARKEY_CHECKSUM_MISMATCH = -214,
+  SPARKEY_INCOMPATIBLE_LOG_MODES = -215,
+  SPARKEY_LOG_NOT_EMPTY = -216,
 
   SPARKEY_WRONG_HASH_MAGIC_NUMBER = -300,
   SPARKEY_WRONG_HASH_MAJOR_VERSION = -301,
@@ -53,6 +61,18 @@ typedef enum {
   SPARKEY_FILE_IDENTIFIER_MISMATCH = -305,
   SPARKEY_HASH_HEADER_CORRUPT = -306,
   SPARKEY_HASH_SIZE_INVALID = -307,
+  SPARKEY_TOO_MANY_PINS = -308,
+
+  SPARKEY_WRONG_PACK_MAGIC_NUMBER = -400,
+  SPARKEY_WRONG_PACK_MAJOR_VERSION = -401,
+  SPARKEY_UNSUPPORTED_PACK_MINOR_VERSION = -402,
+  SPARKEY_PACK_CORRUPT = -403,
+
+  SPARKEY_WRONG_MANIFEST_MAGIC_NUMBER = -500,
+  SPARKEY_WRONG_MANIFEST_MAJOR_VERSION = -501,
+  SPARKEY_UNSUPPORTED_MANIFEST_MINOR_VERSION = -502,
+  SPARKEY_MANIFEST_CORRUPT = -503,
+  SPARKEY_SHARD_MISMATCH = -504,
 
 } sparkey_returncode;
 
@@ -0,0 +1,450 @@
+/*
+* Copyright (c) 2012-2013 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "sparkey.h"
+#include "sparkey-internal.h"
+#include "hashalgorithms.h"
+#include "endiantools.h"
+#include "util.h"
+
+#define MAGIC_VALUE_SHARDED_WRITER (0x1c7e04a9)
+#define MAGIC_VALUE_SHARDED_READER (0x6b2f93d5)
+#define MAGIC_VALUE_SHARDED_ITER (0x35d8a17e)
+
+/*
+ * A manifest (.spm) is a 20 byte file:
+ * magic number, major version, minor version, number of shards and hash seed.
+ */
+#define MANIFEST_MAGIC_NUMBER (0x7a51e3c2)
+#define MANIFEST_MAJOR_VERSION (1)
+#define MANIFEST_MINOR_VERSION (0)
+#define MANIFEST_SIZE (20)
+
+// All shards use the 64 bit hash, so that routing and probing can share it.
+#define SHARD_HASH_SIZE (8)
+
+/**
+ * Picks the shard of a hash. The hash tables use the hash modulo their capacity,
+ * so the shard is taken from the upper bits to keep the two independent.
+ */
+static inline int route(uint64_t hash, int num_shards) {
+  return (int) (((hash >> 32) * (uint64_t) num_shards) >> 32);
+}
+
+static char * shard_filename(const char *manifest_filename, int shard, char type) {
+  size_t l = strlen(manifest_filename);
+  if (l >= 4 && memcmp(&manifest_filename[l - 4], ".spm", 4) == 0) {
+    l -= 4;
+  }
+  size_t size = l + 32;
+  char *filename = malloc(size);
+  if (filename == NULL) {
+    return NULL;
+  }
+  snprintf(filename, size, "%.*s-%d.sp%c", (int) l, manifest_filename, shard, type);
+  return filename;
+}
+
+static sparkey_returncode write_manifest(const char *manifest_filename, int num_shards, uint32_t hash_seed) {
+  uint8_t buf[MANIFEST_SIZE];
+  write_little_endian32(buf, MANIFEST_MAGIC_NUMBER);
+  write_little_endian32(buf + 4, MANIFEST_MAJOR_VERSION);
+  write_little_endian32(buf + 8, MANIFEST_MINOR_VERSION);
+  write_little_endian32(buf + 12, num_shards);
+  write_little_endian32(buf + 16, hash_seed);
+
+  int fd = open(manifest_filename, O_WRONLY | O_TRUNC | O_CREAT, 00644);
+  if (fd < 0) {
+    return sparkey_create_returncode(errno);
+  }
+  sparkey_returncode returncode = write_full(fd, buf, MANIFEST_SIZE);
+  if (close(fd) < 0 && returncode == SPARKEY_SUCCESS) {
+    returncode = sparkey_write_returncode(errno);
+  }
+  return returncode;
+}
+
+static sparkey_returncode read_manifest(const char *manifest_filename, int *num_shards, uint32_t *hash_seed) {
+  int fd = open(manifest_filename, O_RDONLY);
+  if (fd < 0) {
+    return sparkey_open_returncode(errno);
+  }
+  uint8_t buf[MANIFEST_SIZE];
+  sparkey_returncode returncode = pread_full(fd, buf, MANIFEST_SIZE, 0);
+  close(fd);
+  if (returncode == SPARKEY_UNEXPECTED_EOF) {
+    return SPARKEY_MANIFEST_CORRUPT;
+  }
+  if (returncode != SPARKEY_SUCCESS) {
+    return returncode;
+  }
+
+  if (read_little_endian32(buf, 0) != MANIFEST_MAGIC_NUMBER) {
+    return SPARKEY_WRONG_MANIFEST_MAGIC_NUMBER;
+  }
+  if (read_little_endian32(buf, 4) != MANIFEST_MAJOR_VERSION) {
+    return SPARKEY_WRONG_MANIFEST_MAJOR_VERSION;
+  }
+  if (read_little_endian32(buf, 8) > MANIFEST_MINOR_VERSION) {
+    return SPARKEY_UNSUPPORTED_MANIFEST_MINOR_VERSION;
+  }
+  uint32_t shards = read_little_endian32(buf, 12);
+  if (shards < 1 || shards > (1 << 16)) {
+    return SPARKEY_MANIFEST_CORRUPT;
+  }
+  *num_shards = shards;
+  *hash_seed = read_little_endian32(buf, 16);
+  return SPARKEY_SUCCESS;
+}
+
+static void close_logs(sparkey_sharded_writer *writer) {
+  for (int i = 0; i < writer->num_shards; i++) {
+    if (writer->logs[i] != NULL) {
+      sparkey_logwriter_close(&writer->logs[i]);
+    }
+  }
+  free(writer->logs);
+}
+
+sparkey_returncode sparkey_sharded_create(sparkey_sharded_writer **writer_ref, const char *manifest_filename, int num_shards, sparkey_compression_type compression_type, int compression_block_size) {
+  RETHROW(correct_endian_platform());
+  if (num_shards < 1 || num_shards > (1 << 16)) {
+    return SPARKEY_INVALID_ARGUMENT;
+  }
+
+  sparkey_returncode returncode;
+  sparkey_sharded_writer *writer = malloc(sizeof(sparkey_sharded_writer));
+  if (writer == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  writer->num_shards = num_shards;
+  writer->logs = calloc(num_shards, sizeof(sparkey_logwriter *));
+  if (writer->logs == NULL) {
+    returncode = SPARKEY_INTERNAL_ERROR;
+    goto free_writer;
+  }
+  TRY(rand32(&writer->hash_seed), close_writer);
+
+  for (int i = 0; i < num_shards; i++) {
+    char *log_filename = shard_filename(manifest_filename, i, 'l');
+    if (log_filename == NULL) {
+      returncode = SPARKEY_INTERNAL_ERROR;
+      goto close_writer;
+    }
+    returncode = sparkey_logwriter_create(&writer->logs[i], log_filename, compression_type, compression_block_size);
+    free(log_filename);
+    if (returncode != SPARKEY_SUCCESS) {
+      goto close_writer;
+    }
+  }
+  TRY(write_manifest(manifest_filename, num_shards, writer->hash_seed), close_writer);
+
+  writer->open_status = MAGIC_VALUE_SHARDED_WRITER;
+  *writer_ref = writer;
+  return SPARKEY_SUCCESS;
+
+close_writer:
+  close_logs(writer);
+free_writer:
+  free(writer);
+  return returncode;
+}
+
+static sparkey_returncode assert_writer_open(sparkey_sharded_writer *writer) {
+  if (writer->open_status != MAGIC_VALUE_SHARDED_WRITER) {
+    return SPARKEY_LOG_CLOSED;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+static sparkey_logwriter * writer_shard(sparkey_sharded_writer *writer, uint64_t keylen, const uint8_t *key) {
+  uint64_t hash = sparkey_get_hash_algorithm(SHARD_HASH_SIZE).hash(key, keylen, writer->hash_seed);
+  return writer->logs[route(hash, writer->num_shards)];
+}
+
+sparkey_returncode sparkey_sharded_put(sparkey_sharded_writer *writer, uint64_t keylen, const uint8_t *key, uint64_t valuelen, const uint8_t *value) {
+  RETHROW(assert_writer_open(writer));
+  return sparkey_logwriter_put(writer_shard(writer, keylen, key), keylen, key, valuelen, value);
+}
+
+sparkey_returncode sparkey_sharded_delete(sparkey_sharded_writer *writer, uint64_t keylen, const uint8_t *key) {
+  RETHROW(assert_writer_open(writer));
+  return sparkey_logwriter_delete(writer_shard(writer, keylen, key), keylen, key);
+}
+
+sparkey_returncode sparkey_sharded_writer_close(sparkey_sharded_writer **writer_ref) {
+  if (writer_ref == NULL || *writer_ref == NULL) {
+    return SPARKEY_SUCCESS;
+  }
+  sparkey_sharded_writer *writer = *writer_ref;
+  RETHROW(assert_writer_open(writer));
+
+  sparkey_returncode returncode = SPARKEY_SUCCESS;
+  for (int i = 0; i < writer->num_shards; i++) {
+    sparkey_returncode r = sparkey_logwriter_close(&writer->logs[i]);
+    if (returncode == SPARKEY_SUCCESS) {
+      returncode = r;
+    }
+  }
+  writer->open_status = 0;
+  free(writer->logs);
+  free(writer);
+  *writer_ref = NULL;
+  return returncode;
+}
+
+typedef struct {
+  char *hash_filename;
+  char *log_filename;
+  sparkey_returncode returncode;
+} shard_build;
+
+typedef struct {
+  shard_build *builds;
+  int num_shards;
+  uint32_t hash_seed;
+  // The next shard to build, taken by the workers as they become idle.
+  int next_shard;
+} build_pool;
+
+static void * build_shards(void *arg) {
+  build_pool *pool = arg;
+  while (1) {
+    int i = __atomic_fetch_add(&pool->next_shard, 1, __ATOMIC_RELAXED);
+    if (i >= pool->num_shards) {
+      return NULL;
+    }
+    shard_build *build = &pool->builds[i];
+    if (build->hash_filename != NULL && build->log_filename != NULL) {
+      uint32_t hash_seed = pool->hash_seed;
+      build->returncode = sparkey_hash_write_seeded(build->hash_filename, build->log_filename, SHARD_HASH_SIZE, &hash_seed);
+    }
+  }
+}
+
+sparkey_returncode sparkey_sharded_hash_write(const char *manifest_filename, int num_threads) {
+  build_pool pool;
+  RETHROW(read_manifest(manifest_filename, &pool.num_shards, &pool.hash_seed));
+  pool.next_shard = 0;
+
+  if (num_threads < 1) {
+    num_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (num_threads > pool.num_shards) {
+    num_threads = pool.num_shards;
+  }
+  if (num_threads < 1) {
+    num_threads = 1;
+  }
+
+  pool.builds = calloc(pool.num_shards, sizeof(shard_build));
+  pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+  int *started = calloc(num_threads, sizeof(int));
+  sparkey_returncode returncode = SPARKEY_SUCCESS;
+  if (pool.builds == NULL || threads == NULL || started == NULL) {
+    returncode = SPARKEY_INTERNAL_ERROR;
+    goto cleanup;
+  }
+  for (int i = 0; i < pool.num_shards; i++) {
+    pool.builds[i].hash_filename = shard_filename(manifest_filename, i, 'i');
+    pool.builds[i].log_filename = shard_filename(manifest_filename, i, 'l');
+    pool.builds[i].returncode = SPARKEY_INTERNAL_ERROR;
+  }
+  // The calling thread is one of the workers, so all shards get built even if no thread can be started.
+  for (int i = 1; i < num_threads; i++) {
+    started[i] = pthread_create(&threads[i], NULL, build_shards, &pool) == 0;
+  }
+  build_shards(&pool);
+  for (int i = 1; i < num_threads; i++) {
+    if (started[i]) {
+      pthread_join(threads[i], NULL);
+    }
+  }
+  for (int i = 0; i < pool.num_shards; i++) {
+    if (returncode == SPARKEY_SUCCESS) {
+      returncode = pool.builds[i].returncode;
+    }
+  }
+
+cleanup:
+  if (pool.builds != NULL) {
+    for (int i = 0; i < pool.num_shards; i++) {
+      free(pool.builds[i].hash_filename);
+      free(pool.builds[i].log_filename);
+    }
+  }
+  free(pool.builds);
+  free(threads);
+  free(started);
+  return returncode;
+}
+
+static void close_shards(sparkey_sharded_reader *reader) {
+  for (int i = 0; i < reader->num_shards; i++) {
+    sparkey_hash_close(&reader->shards[i]);
+  }
+  free(reader->shards);
+}
+
+static sparkey_returncode open_shard(sparkey_sharded_reader *reader, const char *manifest_filename, int shard) {
+  char *hash_filename = shard_filename(manifest_filename, shard, 'i');
+  char *log_filename = shard_filename(manifest_filename, shard, 'l');
+  sparkey_returncode returncode = SPARKEY_INTERNAL_ERROR;
+  if (hash_filename != NULL && log_filename != NULL) {
+    returncode = sparkey_hash_open(&reader->shards[shard], hash_filename, log_filename);
+  }
+  free(hash_filename);
+  free(log_filename);
+  if (returncode != SPARKEY_SUCCESS) {
+    return returncode;
+  }
+
+  // Routing relies on every shard hashing keys the same way.
+  sparkey_hashheader *header = &reader->shards[shard]->header;
+  if (header->hash_seed != reader->hash_seed || header->hash_size != SHARD_HASH_SIZE) {
+    return SPARKEY_SHARD_MISMATCH;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode sparkey_sharded_open(sparkey_sharded_reader **reader_ref, const char *manifest_filename) {
+  RETHROW(correct_endian_platform());
+
+  sparkey_returncode returncode;
+  sparkey_sharded_reader *reader = malloc(sizeof(sparkey_sharded_reader));
+  if (reader == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  TRY(read_manifest(manifest_filename, &reader->num_shards, &reader->hash_seed), free_reader);
+  reader->shards = calloc(reader->num_shards, sizeof(sparkey_hashreader *));
+  if (reader->shards == NULL) {
+    returncode = SPARKEY_INTERNAL_ERROR;
+    goto free_reader;
+  }
+  for (int i = 0; i < reader->num_shards; i++) {
+    TRY(open_shard(reader, manifest_filename, i), close_reader);
+  }
+
+  reader->open_status = MAGIC_VALUE_SHARDED_READER;
+  *reader_ref = reader;
+  return SPARKEY_SUCCESS;
+
+close_reader:
+  close_shards(reader);
+free_reader:
+  free(reader);
+  return returncode;
+}
+
+int sparkey_sharded_numshards(sparkey_sharded_reader *reader) {
+  return reader->num_shards;
+}
+
+sparkey_hashreader * sparkey_sharded_getshard(sparkey_sharded_reader *reader, int shard) {
+  return reader->shards[shard];
+}
+
+static void close_iters(sparkey_sharded_iter *iter) {
+  for (int i = 0; i < iter->num_shards; i++) {
+    if (iter->iters[i] != NULL) {
+      sparkey_logiter_close(&iter->iters[i]);
+    }
+  }
+  free(iter->iters);
+}
+
+sparkey_returncode sparkey_sharded_iter_create(sparkey_sharded_iter **iter_ref, sparkey_sharded_reader *reader) {
+  if (reader->open_status != MAGIC_VALUE_SHARDED_READER) {
+    return SPARKEY_HASH_CLOSED;
+  }
+  sparkey_returncode returncode;
+  sparkey_sharded_iter *iter = malloc(sizeof(sparkey_sharded_iter));
+  if (iter == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  iter->num_shards = reader->num_shards;
+  iter->iters = calloc(reader->num_shards, sizeof(sparkey_logiter *));
+  if (iter->iters == NULL) {
+    returncode = SPARKEY_INTERNAL_ERROR;
+    goto free_iter;
+  }
+  for (int i = 0; i < reader->num_shards; i++) {
+    TRY(sparkey_logiter_create(&iter->iters[i], sparkey_hash_getreader(reader->shards[i])), close_iter);
+  }
+
+  iter->open_status = MAGIC_VALUE_SHARDED_ITER;
+  *iter_ref = iter;
+  return SPARKEY_SUCCESS;
+
+close_iter:
+  close_iters(iter);
+free_iter:
+  free(iter);
+  return returncode;
+}
+
+void sparkey_sharded_iter_close(sparkey_sharded_iter **iter_ref) {
+  if (iter_ref == NULL || *iter_ref == NULL) {
+    return;
+  }
+  sparkey_sharded_iter *iter = *iter_ref;
+  if (iter->open_status != MAGIC_VALUE_SHARDED_ITER) {
+    return;
+  }
+  iter->open_status = 0;
+  close_iters(iter);
+  free(iter);
+  *iter_ref = NULL;
+}
+
+sparkey_returncode sparkey_sharded_get(sparkey_sharded_reader *reader, const uint8_t *key, uint64_t keylen, sparkey_sharded_iter *iter, sparkey_logiter **logiter_ref, sparkey_logreader **log_ref) {
+  if (reader->open_status != MAGIC_VALUE_SHARDED_READER) {
+    return SPARKEY_HASH_CLOSED;
+  }
+  if (iter->open_status != MAGIC_VALUE_SHARDED_ITER) {
+    return SPARKEY_LOG_ITERATOR_CLOSED;
+  }
+  if (iter->num_shards != reader->num_shards) {
+    return SPARKEY_LOG_ITERATOR_MISMATCH;
+  }
+  sparkey_hashreader *first = reader->shards[0];
+  uint64_t hash = first->header.hash_algorithm.hash(key, keylen, reader->hash_seed);
+  int s = route(hash, reader->num_shards);
+  *logiter_ref = iter->iters[s];
+  *log_ref = sparkey_hash_getreader(reader->shards[s]);
+  return sparkey_hash_get_hashed(reader->shards[s], key, keylen, hash, iter->iters[s]);
+}
+
+void sparkey_sharded_reader_close(sparkey_sharded_reader **reader_ref) {
+  if (reader_ref == NULL || *reader_ref == NULL) {
+    return;
+  }
+  sparkey_sharded_reader *reader = *reader_ref;
+  if (reader->open_status != MAGIC_VALUE_SHARDED_READER) {
+    return;
+  }
+  reader->open_status = 0;
+  close_shards(reader);
+  free(reader);
+  *reader_ref = NULL;
+}
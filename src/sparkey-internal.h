@@ -16,12 +16,16 @@
 #ifndef SPARKEY_INTERNAL_H
 #define SPARKEY_INTERNAL_H
 #include <stdint.h>
+#include <pthread.h>
 
 #include "sparkey.h"
 
 #include "logheader.h"
 #include "hashheader.h"
 #include "buf.h"
+#include "aiobuf.h"
+#include "logsorter.h"
+#include "stats.h"
 
 struct sparkey_logreader {
   uint32_t open_status;
@@ -30,6 +34,15 @@ struct sparkey_logreader {
 
   uint64_t data_len;
   uint8_t *data;
+  // Whether data is mapped by the reader, rather than memory owned by the caller.
+  int mapped;
+  // Incremented each time data is remapped by sparkey_logreader_refresh.
+  uint64_t generation;
+  sparkey_verify_mode verify;
+#ifdef SPARKEY_STATS
+  // Counters of this log and of the hashreader that owns it, see sparkey_hash_stats.
+  sparkey_stats_slot stats[STATS_SLOTS];
+#endif
 };
 
 struct sparkey_logiter {
@@ -42,12 +55,35 @@ struct sparkey_logiter {
   uint64_t block_offset;
   uint64_t block_len;
   int entry_count;
+  // range to iterate over
+  uint64_t start;
+  uint64_t end;
+  // whether end follows the end of the log when it's refreshed
+  int follow;
+  uint64_t generation;
+
+  // madvise state, see sparkey_logiter_set_access_pattern
+  sparkey_access_pattern access_pattern;
+  uint64_t advised_until;
+  uint64_t released_until;
 
   // compression buffer
   int compression_buf_allocated;
   uint8_t *compression_buf;
 
+  // restart points of the current block, for front coded logs
+  uint8_t *restarts;
+  uint32_t restart_count;
+
+  // recently verified block positions, for SPARKEY_VERIFY_FIRST_ACCESS
+  uint64_t *verified;
+  // the data covered by the last verified checkpoint, for uncompressed logs
+  uint64_t checkpoint_start;
+  uint64_t checkpoint_end;
+
   // current entry
+  uint64_t entry_position;
+  int entry_index;
   uint64_t entry_block_position;
   uint64_t entry_block_offset;
   sparkey_entry_type type;
@@ -56,22 +92,87 @@ struct sparkey_logiter {
   uint64_t valuelen;
   uint64_t key_remaining;
   uint64_t value_remaining;
+
+  // the key of the current entry, for front coded logs
+  sparkey_buf key_buf;
 };
 
 struct sparkey_logwriter {
   uint32_t open_status;
   sparkey_logheader header;
   int fd;
+  char *filename;
 
   sparkey_buf block_buf;
   uint32_t max_compressed_size;
   uint8_t *compressed;
   sparkey_buf file_buf;
   int flushed;
+  // Logical end of the data, including what's still buffered.
+  uint64_t position;
+  // Checksum and length of the data since the last checkpoint, for uncompressed logs with checksums.
+  uint32_t checkpoint_crc;
+  uint64_t checkpoint_len;
+
+  int direct_io;
+  sparkey_aiobuf aio;
+
+  sparkey_packing_policy packing;
+  sparkey_writer_stats stats;
+
+  sparkey_durability durability;
+  // Guards all writer state when durability is SPARKEY_DURABILITY_GROUP_COMMIT.
+  pthread_mutex_t lock;
+  // Header matching the data of the latest flush, guarded by lock.
+  uint8_t flushed_header[LOG_MAX_HEADER_SIZE];
+  uint64_t write_seq;
+  // Group sync state, guarded by sync_lock.
+  pthread_mutex_t sync_lock;
+  pthread_cond_t synced;
+  uint64_t synced_seq;
+  int syncing;
+
+  // Appender state, guarded by lock.
+  int num_appenders;
+  int appends_inflight;
+  pthread_cond_t appends_done;
+  sparkey_returncode append_error;
+
+  // Sorted mode, see sparkey_logwriter_set_sorted.
+  sparkey_logsorter *sorter;
+  // Front coding state of the current block.
+  uint32_t *restarts;
+  int restart_count;
+  int since_restart;
+  sparkey_buf last_key;
+
+  // Block index, see sparkey_logwriter_set_blockindex. blockindex_fd is -1 when disabled.
+  int blockindex_fd;
+  sparkey_buf blockindex_buf;
+  uint64_t blockindex_entries;
 
   int entry_count;
 };
 
+struct sparkey_logappender {
+  uint32_t open_status;
+  sparkey_logwriter *log;
+
+  sparkey_buf block_buf;
+  uint32_t max_compressed_size;
+  uint8_t *compressed;
+  int flushed;
+  int entry_count;
+
+  // Whole blocks not yet committed to the file.
+  sparkey_buf out;
+  // Header counters and stats of the entries in out.
+  sparkey_logheader header;
+  sparkey_writer_stats stats;
+  // Header counters of the entries in the current block.
+  sparkey_logheader pending;
+};
+
 struct sparkey_hashreader {
   uint32_t open_status;
   sparkey_hashheader header;
@@ -81,10 +182,81 @@ struct sparkey_hashreader {
 
   uint64_t data_len;
   uint8_t *data;
+  // Whether data is mapped by the reader, rather than memory owned by the caller.
+  int mapped;
+  // Mapping of the whole pack file that data and log.data point into, see sparkey_hash_open_pack.
+  uint8_t *pack_data;
+  uint64_t pack_len;
+};
 
+#define HASH_HANDLE_SLOTS (128)
+
+// A hazard slot, padded so that pins of different threads don't share cache lines.
+typedef struct {
+  sparkey_hashreader *reader;
+  uint8_t padding[64 - sizeof(sparkey_hashreader *)];
+} sparkey_hazard_slot;
+
+struct sparkey_hash_handle {
+  sparkey_hazard_slot slots[HASH_HANDLE_SLOTS];
+  uint32_t open_status;
+  char *hash_filename;
+  // NULL when hash_filename is a pack file.
+  char *log_filename;
+
+  // The published version, only accessed atomically.
+  sparkey_hashreader *current;
+
+  // Replaced versions that may still be pinned, guarded by lock.
+  pthread_mutex_t lock;
+  sparkey_hashreader **retired;
+  int num_retired;
+
+  // Watcher state, see sparkey_hash_handle_watch.
+  int watching;
+  pthread_t watcher;
+  int inotify_fd;
+  // Written to by sparkey_hash_handle_close to stop the watcher.
+  int stop_fds[2];
+};
+
+struct sparkey_sharded_writer {
+  uint32_t open_status;
+  int num_shards;
+  uint32_t hash_seed;
+  sparkey_logwriter **logs;
+};
+
+struct sparkey_sharded_reader {
+  uint32_t open_status;
+  int num_shards;
+  uint32_t hash_seed;
+  sparkey_hashreader **shards;
+};
+
+struct sparkey_sharded_iter {
+  uint32_t open_status;
+  int num_shards;
+  // One iterator per shard, over the log of that shard.
+  sparkey_logiter **iters;
+};
+
+struct sparkey_blockindex {
+  uint32_t open_status;
+  int fd;
+
+  uint64_t data_len;
+  uint8_t *data;
+  // Number of records that describe blocks within the log data.
+  uint64_t num_blocks;
 };
 
 sparkey_returncode sparkey_logreader_open_noalloc(sparkey_logreader *log, const char *filename);
+// Takes ownership of fd, also when it fails.
+sparkey_returncode sparkey_logreader_open_fd_noalloc(sparkey_logreader *log, int fd);
+sparkey_returncode sparkey_logreader_open_mem_noalloc(sparkey_logreader *log, const uint8_t *data, uint64_t len);
 void sparkey_logreader_close_nodealloc(sparkey_logreader *log);
+// Same as sparkey_hash_write, but uses the given seed unless it's NULL.
+sparkey_returncode sparkey_hash_write_seeded(const char *hash_filename, const char *log_filename, int hash_size, const uint32_t *seed);
 
 #endif
@@ -208,6 +208,8 @@
 typedef enum {
   SPARKEY_SUCCESS = 0,
   SPARKEY_INTERNAL_ERROR = -1,
+  SPARKEY_STATS_DISABLED = -2,
+  SPARKEY_INVALID_ARGUMENT = -3,
 
   SPARKEY_FILE_NOT_FOUND = -100,
   SPARKEY_PERMISSION_DENIED = -101,
@@ -233,6 +235,12 @@ typedef enum {
   SPARKEY_LOG_HEADER_CORRUPT = -208,
   SPARKEY_INVALID_COMPRESSION_BLOCK_SIZE = -209,
   SPARKEY_INVALID_COMPRESSION_TYPE = -210,
+  SPARKEY_LOG_HAS_APPENDERS = -211,
+  SPARKEY_INVALID_LOG_RANGE = -212,
+  SPARKEY_BLOCKINDEX_CORRUPT = -213,
+  SPARKEY_CHECKSUM_MISMATCH = -214,
+  SPARKEY_INCOMPATIBLE_LOG_MODES = -215,
+  SPARKEY_LOG_NOT_EMPTY = -216,
 
   SPARKEY_WRONG_HASH_MAGIC_NUMBER = -300,
   SPARKEY_WRONG_HASH_MAJOR_VERSION = -301,
@@ -242,6 +250,18 @@ typedef enum {
   SPARKEY_FILE_IDENTIFIER_MISMATCH = -305,
   SPARKEY_HASH_HEADER_CORRUPT = -306,
   SPARKEY_HASH_SIZE_INVALID = -307,
+  SPARKEY_TOO_MANY_PINS = -308,
+
+  SPARKEY_WRONG_PACK_MAGIC_NUMBER = -400,
+  SPARKEY_WRONG_PACK_MAJOR_VERSION = -401,
+  SPARKEY_UNSUPPORTED_PACK_MINOR_VERSION = -402,
+  SPARKEY_PACK_CORRUPT = -403,
+
+  SPARKEY_WRONG_MANIFEST_MAGIC_NUMBER = -500,
+  SPARKEY_WRONG_MANIFEST_MAJOR_VERSION = -501,
+  SPARKEY_UNSUPPORTED_MANIFEST_MINOR_VERSION = -502,
+  SPARKEY_MANIFEST_CORRUPT = -503,
+  SPARKEY_SHARD_MISMATCH = -504,
 
 } sparkey_returncode;
 
@@ -265,6 +285,73 @@ typedef enum {
   SPARKEY_COMPRESSION_SNAPPY
 } sparkey_compression_type;
 
+/**
+ * Decides how entries are packed into compression blocks.
+ * Entries that fit in a block are never split over two blocks, regardless of the policy.
+ */
+typedef enum {
+  /** Entries larger than a block start on a new block if that makes them span fewer blocks.
+   * This minimizes the number of blocks to decompress for each lookup. */
+  SPARKEY_PACKING_NO_SPLIT,
+  /** Entries larger than a block are always appended to the current block.
+   * This minimizes the number of blocks and the unused space in them. */
+  SPARKEY_PACKING_MIN_WASTE
+} sparkey_packing_policy;
+
+/**
+ * Statistics about how the entries written by a logwriter were laid out in compression blocks.
+ */
+typedef struct {
+  /** Number of compression blocks written. */
+  uint64_t num_blocks;
+  /** Number of entries that were split over more than one block. */
+  uint64_t num_split_entries;
+  /** Total number of blocks spanned by the split entries. */
+  uint64_t num_split_blocks;
+  /** Total number of bytes left unused at the end of blocks. */
+  uint64_t unused_block_bytes;
+} sparkey_writer_stats;
+
+/**
+ * Decides what sparkey_logwriter_flush guarantees when it returns.
+ */
+typedef enum {
+  /** Data is handed over to the operating system, but may be lost on a system crash. */
+  SPARKEY_DURABILITY_NONE,
+  /** Data is synced to disk before the header that makes it visible, which is then synced as well. */
+  SPARKEY_DURABILITY_FDATASYNC,
+  /** Same guarantees as SPARKEY_DURABILITY_FDATASYNC, but the writer may be shared between threads,
+   * and concurrent flushes share the syncs to disk. */
+  SPARKEY_DURABILITY_GROUP_COMMIT
+} sparkey_durability;
+
+/**
+ * Describes how a log iterator moves through the log, so that the operating system can read ahead
+ * and keep pages cached accordingly.
+ */
+typedef enum {
+  /** No hint, the default readahead of the operating system applies. */
+  SPARKEY_ACCESS_NORMAL,
+  /** The iterator scans the log from start to end. Data ahead of the iterator is read in advance,
+   * and data behind it is released from the mapping. */
+  SPARKEY_ACCESS_SEQUENTIAL,
+  /** The iterator jumps around in the log, as with sparkey_hash_get. Readahead is disabled. */
+  SPARKEY_ACCESS_RANDOM
+} sparkey_access_pattern;
+
+/**
+ * Controls when a log reader checks the block checksums of logs written with sparkey_logwriter_set_checksums.
+ */
+typedef enum {
+  /** Checksums are not checked. */
+  SPARKEY_VERIFY_OFF,
+  /** Each iterator checks a block the first time it reads it,
+   * and skips the check when it returns to a block it recently verified. */
+  SPARKEY_VERIFY_FIRST_ACCESS,
+  /** Every block is checked each time it is read. This is the default. */
+  SPARKEY_VERIFY_ALWAYS
+} sparkey_verify_mode;
+
 typedef enum {
   SPARKEY_ENTRY_PUT,
   SPARKEY_ENTRY_DELETE
@@ -286,6 +373,81 @@ typedef struct sparkey_logiter sparkey_logiter;
 struct sparkey_hashreader;
 typedef struct sparkey_hashreader sparkey_hashreader;
 
+struct sparkey_blockindex;
+typedef struct sparkey_blockindex sparkey_blockindex;
+
+struct sparkey_hash_handle;
+typedef struct sparkey_hash_handle sparkey_hash_handle;
+
+struct sparkey_sharded_writer;
+typedef struct sparkey_sharded_writer sparkey_sharded_writer;
+
+struct sparkey_sharded_reader;
+typedef struct sparkey_sharded_reader sparkey_sharded_reader;
+
+struct sparkey_sharded_iter;
+typedef struct sparkey_sharded_iter sparkey_sharded_iter;
+
+#define SPARKEY_PROBE_HISTOGRAM_SIZE (16)
+
+/**
+ * Counters of the lookups done through a hashreader, see sparkey_hash_stats.
+ */
+typedef struct {
+  /** Number of calls to sparkey_hash_get and sparkey_hash_get_hashed. */
+  uint64_t lookups;
+  /** Number of lookups that found the key. */
+  uint64_t hits;
+  /** Number of lookups that didn't find the key. */
+  uint64_t misses;
+  /** Number of lookups that probed 1, 2, ... slots. The last bucket includes all longer probes. */
+  uint64_t probe_lengths[SPARKEY_PROBE_HISTOGRAM_SIZE];
+  /** Number of slots whose hash matched, but whose key differed from the wanted key. */
+  uint64_t hash_collisions;
+  /** Number of compression blocks decompressed, by lookups and iteration. */
+  uint64_t blocks_decompressed;
+  /** Total uncompressed size of those blocks. */
+  uint64_t bytes_decompressed;
+  /** Number of entries passed over by sparkey_logiter_skip. */
+  uint64_t entries_skipped;
+} sparkey_reader_stats;
+
+/**
+ * Describes a compression block of a log, see sparkey_blockindex_get.
+ */
+typedef struct {
+  /** Position of the block in the log. */
+  uint64_t offset;
+  /** Size of the compressed block data, excluding the length prefix. */
+  uint32_t compressed_size;
+  /** Number of entries that start in the block. Is 0 for blocks that only hold the rest of a split entry. */
+  uint32_t entry_count;
+  /** Ordinal of the first entry that starts in the block, counting from 0 at the start of the log. */
+  uint64_t first_entry;
+} sparkey_block_info;
+
+/**
+ * An entry handed out by sparkey_logiter_foreach_batch.
+ * The key and value are only valid during the callback.
+ */
+typedef struct {
+  sparkey_entry_type type;
+  const uint8_t *key;
+  uint64_t keylen;
+  /** Empty for deletes. */
+  const uint8_t *value;
+  uint64_t valuelen;
+} sparkey_entry_view;
+
+/**
+ * Receives a batch of entries from sparkey_logiter_foreach_batch.
+ * @param ctx the context passed to sparkey_logiter_foreach_batch.
+ * @param entries the entries of the batch, in log order.
+ * @param num_entries the number of entries, at least 1.
+ * @returns SPARKEY_SUCCESS to continue with the next batch. Any other value stops the scan and is returned to the caller.
+ */
+typedef sparkey_returncode (*sparkey_batch_callback)(void *ctx, const sparkey_entry_view *entries, int num_entries);
+
 
 /**
  * Creates a new Sparkey log file, possibly overwriting an already existing.
@@ -334,21 +496,190 @@ sparkey_returncode sparkey_logwriter_delete(sparkey_logwriter *log, uint64_t key
  * Flush any open compression block to file buffer.
  * Flush any open file buffer to disk.
  * Rewrite the header on disk.
+ * Sync the file according to the durability mode, see sparkey_logwriter_set_durability.
  * This enables readers to read from the log.
  * @param log a reference to an open log writer.
  * @return SPARKEY_SUCCESS if all goes well.
  */
 sparkey_returncode sparkey_logwriter_flush(sparkey_logwriter *log);
 
+/**
+ * Switches the log writer between regular buffered writes and direct io.
+ * With direct io, data is written from aligned buffers past the page cache,
+ * so building a large log does not evict other files from memory.
+ * One buffer is written to disk in the background while the next one is being filled,
+ * and disk space is preallocated ahead of the writes where the file system supports it.
+ * Falls back to regular writes if the file system does not support direct io.
+ * Any pending data is flushed before switching.
+ * @param log a reference to an open log writer.
+ * @param enabled non-zero to use direct io, zero to use buffered writes.
+ * @return SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_logwriter_set_direct_io(sparkey_logwriter *log, int enabled);
+
+/**
+ * Sets how entries are packed into compression blocks.
+ * This only has an effect on logs with compression, and only applies to entries written after the call.
+ * The default is SPARKEY_PACKING_NO_SPLIT.
+ * @param log a reference to an open log writer.
+ * @param policy the packing policy to use.
+ * @return SPARKEY_SUCCESS if all goes well. SPARKEY_INVALID_ARGUMENT if policy is not a packing policy.
+ */
+sparkey_returncode sparkey_logwriter_set_packing(sparkey_logwriter *log, sparkey_packing_policy policy);
+
+/**
+ * Makes the log writer sort entries by key and front code the keys.
+ * Entries are buffered and written in key order each time the log is flushed,
+ * so iteration order is only sorted within each flush.
+ * Entries with equal keys keep the order they were written in.
+ * Within a compression block, each key only stores the suffix that differs from the previous key,
+ * which makes logs with long shared key prefixes much smaller.
+ *
+ * Front coded logs can not be read by older versions of the library.
+ * This can only be used with SPARKEY_COMPRESSION_SNAPPY, and only while the log is empty,
+ * i.e. before any entries are written.
+ * Sorting can not be combined with direct io or appenders.
+ * @param log a reference to an open log writer.
+ * @param memory_limit the amount of entry data to buffer in memory before spilling sorted runs to temporary files.
+ * @return SPARKEY_SUCCESS if all goes well. SPARKEY_LOG_NOT_EMPTY if entries were already written,
+ *         SPARKEY_INCOMPATIBLE_LOG_MODES if direct io is enabled.
+ */
+sparkey_returncode sparkey_logwriter_set_sorted(sparkey_logwriter *log, uint64_t memory_limit);
+
+/**
+ * Makes the log writer maintain a block index next to the log, see sparkey_blockindex_open.
+ * The index file name is derived with sparkey_create_blockindex_filename,
+ * so the log file name must end with ".spl".
+ * When appending to a log that already has a block index, it is kept up to date automatically.
+ *
+ * This can only be used with compressed logs, and must be enabled before any entries are written.
+ * Block indexes can not be combined with appenders.
+ * Disabling it removes the index file, since it would no longer cover the whole log.
+ * @param log a reference to an open log writer.
+ * @param enabled non-zero to write a block index.
+ * @return SPARKEY_SUCCESS if all goes well. SPARKEY_LOG_NOT_EMPTY if it's enabled after entries were written.
+ */
+sparkey_returncode sparkey_logwriter_set_blockindex(sparkey_logwriter *log, int enabled);
+
+/**
+ * Makes the log writer store a CRC32C checksum of the compressed data after each block,
+ * so that readers detect corrupt blocks, see sparkey_logreader_set_verify.
+ * Uncompressed logs get a checkpoint with a checksum of the preceding entries every 4 KB and at each flush.
+ * Readers check the checkpoint that covers an entry before reading the entry.
+ *
+ * Logs with checksums can not be read by older versions of the library.
+ * This can only be used while the log is empty, and uncompressed logs with checksums can not have appenders.
+ * @param log a reference to an open log writer.
+ * @param enabled non-zero to write checksums.
+ * @return SPARKEY_SUCCESS if all goes well. SPARKEY_LOG_NOT_EMPTY if entries were already written,
+ *         SPARKEY_LOG_HAS_APPENDERS if appenders are open and
+ *         SPARKEY_INCOMPATIBLE_LOG_MODES if direct io is enabled.
+ */
+sparkey_returncode sparkey_logwriter_set_checksums(sparkey_logwriter *log, int enabled);
+
+/**
+ * Gets statistics about the blocks written since the writer was created or opened for appending.
+ * Blocks that are still being filled are not included.
+ * @param log a reference to an open log writer.
+ * @param stats (output parameter) the statistics.
+ * @return SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_logwriter_stats(sparkey_logwriter *log, sparkey_writer_stats *stats);
+
+/**
+ * Sets what sparkey_logwriter_flush guarantees about the data reaching the disk.
+ * The default is SPARKEY_DURABILITY_NONE.
+ *
+ * With SPARKEY_DURABILITY_GROUP_COMMIT, sparkey_logwriter_put, sparkey_logwriter_delete
+ * and sparkey_logwriter_flush may be called concurrently from several threads.
+ * A flush returns once everything written before it is on disk, and callers that
+ * flush at the same time wait for a single sync instead of one each.
+ * This function itself must not be called concurrently with any other operation on the writer.
+ *
+ * @param log a reference to an open log writer.
+ * @param durability the durability mode to use.
+ * @return SPARKEY_SUCCESS if all goes well. SPARKEY_INVALID_ARGUMENT if durability is not a durability mode.
+ */
+sparkey_returncode sparkey_logwriter_set_durability(sparkey_logwriter *log, sparkey_durability durability);
+
 /**
  * Flushes the log, then closes the file and marks the log as closed.
  * The log will be closed after this, the sparkey_logwriter struct
  * referenced will be freed and *log will be set to NULL.
+ * This also happens when the final flush fails, in which case its error is returned.
  * @param log a double reference to an open log writer.
- * @return SPARKEY_SUCCESS if all goes well.
+ * @return SPARKEY_SUCCESS if all goes well. SPARKEY_LOG_HAS_APPENDERS if the writer still has appenders,
+ *         in which case it is left open.
  */
 sparkey_returncode sparkey_logwriter_close(sparkey_logwriter **log);
 
+/* logappender */
+
+/**
+ * A handle for adding entries to a log writer from one of several threads.
+ */
+struct sparkey_logappender;
+typedef struct sparkey_logappender sparkey_logappender;
+
+/**
+ * Creates an appender for a log writer. Each thread should use its own appender,
+ * and appenders of the same writer may be used concurrently.
+ *
+ * Every appender fills its own compression blocks and writes them to the log
+ * once they are complete, so entries from different appenders are interleaved in the file.
+ * Entries from the same appender appear in the order they were added.
+ *
+ * While the writer has appenders, sparkey_logwriter_put, sparkey_logwriter_delete,
+ * sparkey_logwriter_set_direct_io and sparkey_logwriter_close fail with SPARKEY_LOG_HAS_APPENDERS.
+ * sparkey_logwriter_flush may be called at any time, but only includes entries that
+ * the appenders have written, see sparkey_logappender_flush.
+ * Appenders can not be combined with direct io, sorted output (sparkey_logwriter_set_sorted),
+ * a block index (sparkey_logwriter_set_blockindex) or checksums in an uncompressed log.
+ *
+ * @param appender_ref a reference to a sparkey_logappender pointer that is uninitialized. It will be set to an allocated appender.
+ * @param log a reference to an open log writer.
+ * @return SPARKEY_SUCCESS if all goes well. SPARKEY_INCOMPATIBLE_LOG_MODES if one of those modes is enabled on the writer.
+ */
+sparkey_returncode sparkey_logappender_create(sparkey_logappender **appender_ref, sparkey_logwriter *log);
+
+/**
+ * Adds a key-value entry through an appender.
+ * @param appender a reference to an open appender.
+ * @param keylen the number of bytes of the key block
+ * @param key pointer to the key block
+ * @param valuelen the number of bytes of the value block
+ * @param value pointer to the value block
+ * @return SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_logappender_put(sparkey_logappender *appender, uint64_t keylen, const uint8_t *key, uint64_t valuelen, const uint8_t *value);
+
+/**
+ * Adds a delete entry through an appender.
+ * @param appender a reference to an open appender.
+ * @param keylen the number of bytes of the key block
+ * @param key pointer to the key block
+ * @return SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_logappender_delete(sparkey_logappender *appender, uint64_t keylen, const uint8_t *key);
+
+/**
+ * Writes all entries of the appender to the log, including a partially filled block.
+ * The entries become visible to readers on the next sparkey_logwriter_flush.
+ * @param appender a reference to an open appender.
+ * @return SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_logappender_flush(sparkey_logappender *appender);
+
+/**
+ * Flushes the appender, then detaches it from its writer and frees it.
+ * *appender_ref will be set to NULL.
+ * The appender is detached and freed even if the flush fails, in which case the error is returned.
+ * The log then has a gap, so the writer fails to flush from then on, but it can still be closed.
+ * @param appender_ref a double reference to an open appender.
+ * @return SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_logappender_close(sparkey_logappender **appender_ref);
+
 /* logreader */
 
 /**
@@ -359,6 +690,26 @@ sparkey_returncode sparkey_logwriter_close(sparkey_logwriter **log);
  */
 sparkey_returncode sparkey_logreader_open(sparkey_logreader **log, const char *filename);
 
+/**
+ * Opens a log for reading from an open file descriptor, such as a memfd.
+ * The logreader uses a duplicate of fd, so the caller may close fd afterwards.
+ * @param log a double reference to a logreader.
+ * @param fd a descriptor of a sparkey log, open for reading.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a return code indicating the error.
+ */
+sparkey_returncode sparkey_logreader_open_fd(sparkey_logreader **log, int fd);
+
+/**
+ * Opens a log for reading from memory, such as a table embedded in a binary.
+ * The data is not copied, so it must stay valid and unchanged until the logreader is closed.
+ * Such logreaders can not be refreshed, and ignore access pattern hints.
+ * @param log a double reference to a logreader.
+ * @param data the contents of a sparkey log.
+ * @param len the number of bytes at data.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a return code indicating the error.
+ */
+sparkey_returncode sparkey_logreader_open_mem(sparkey_logreader **log, const uint8_t *data, uint64_t len);
+
 /**
  * Closes a logreader.
  * It's allowed to close a logreader while there are open logiterators.
@@ -369,6 +720,34 @@ sparkey_returncode sparkey_logreader_open(sparkey_logreader **log, const char *f
  */
 void sparkey_logreader_close(sparkey_logreader **log);
 
+/**
+ * Picks up entries that were flushed to the log after it was opened.
+ * The header is read again and the memory map is extended to the new end of the data.
+ * Iterators created with sparkey_logiter_create, including ones that have reached the end,
+ * continue into the new data on their next call to sparkey_logiter_next.
+ * Iterators created with sparkey_logiter_create_range keep their range.
+ *
+ * The memory map may move to a new address, so the caller needs exclusive access to the logreader:
+ * no other thread may use it, its iterators, or a hashreader built on it while refresh runs.
+ * @param log an open logreader, not opened with sparkey_logreader_open_mem.
+ * @returns SPARKEY_SUCCESS if all goes well. SPARKEY_FILE_IDENTIFIER_MISMATCH if the log was recreated.
+ *          SPARKEY_INVALID_ARGUMENT if the log was opened with sparkey_logreader_open_mem.
+ *          SPARKEY_LOG_HEADER_CORRUPT if the format of the log changed, such as its compression,
+ *          version or format flags.
+ */
+sparkey_returncode sparkey_logreader_refresh(sparkey_logreader *log);
+
+/**
+ * Sets when the block checksums of the log are checked. Logs without checksums are never checked.
+ * In uncompressed logs, the checkpoint that covers an entry counts as its block.
+ * Applies to all iterators of the logreader, including the ones already created.
+ * A block that fails the check makes the iterator return SPARKEY_CHECKSUM_MISMATCH.
+ * @param log an open logreader.
+ * @param mode one of SPARKEY_VERIFY_OFF, SPARKEY_VERIFY_FIRST_ACCESS or SPARKEY_VERIFY_ALWAYS.
+ * @returns SPARKEY_SUCCESS if all goes well. SPARKEY_INVALID_ARGUMENT for an unknown mode.
+ */
+sparkey_returncode sparkey_logreader_set_verify(sparkey_logreader *log, sparkey_verify_mode mode);
+
 /**
  * Get the size of the largest key in the log.
  * @param log a reference to a logreader.
@@ -392,6 +771,46 @@ uint64_t sparkey_logreader_maxvaluelen(sparkey_logreader *log);
  */
 sparkey_returncode sparkey_logiter_create(sparkey_logiter **iter, sparkey_logreader *log);
 
+/**
+ * Initializes a logiter that only iterates over the entries in a part of the log.
+ * The range must start and end at entry boundaries, which is what sparkey_logreader_partition returns.
+ * Iterators over different ranges can be used from different threads, as long as each has its own logiter.
+ * @param iter a double reference to an uninitialized logiter. Will be set on success.
+ * @param log an open logreader
+ * @param start the position of the first entry in the range.
+ * @param end the position after the last entry in the range.
+ * @returns SPARKEY_SUCCESS or all goes well. SPARKEY_INVALID_LOG_RANGE if the range is outside the log data.
+ */
+sparkey_returncode sparkey_logiter_create_range(sparkey_logiter **iter, sparkey_logreader *log, uint64_t start, uint64_t end);
+
+/**
+ * Tells the operating system how the iterator will access the log.
+ * The hint covers the range of the iterator in the memory map of the logreader,
+ * which is shared by all iterators of the logreader, so the latest hint wins where ranges overlap.
+ * Use separate logreaders for a scan that runs alongside random lookups.
+ * The default is SPARKEY_ACCESS_NORMAL.
+ * @param iter an open logiter.
+ * @param log the logreader that the iterator belongs to.
+ * @param pattern the access pattern.
+ * @returns SPARKEY_SUCCESS or all goes well. SPARKEY_INVALID_ARGUMENT for an unknown pattern.
+ */
+sparkey_returncode sparkey_logiter_set_access_pattern(sparkey_logiter *iter, sparkey_logreader *log, sparkey_access_pattern pattern);
+
+/**
+ * Splits the log into ranges of roughly equal size that can be iterated over in parallel
+ * with sparkey_logiter_create_range.
+ *
+ * For compressed logs, this walks the block lengths and only decompresses a block next to each boundary,
+ * to avoid starting a range in the middle of an entry that was split across blocks.
+ * Uncompressed logs have no blocks, so this walks the entry lengths instead.
+ * Range i is [boundaries[i], boundaries[i + 1]).
+ * @param log an open logreader
+ * @param boundaries an array with room for num_ranges + 1 positions.
+ * @param num_ranges the wanted number of ranges. Is set to the actual number, which may be lower for small logs.
+ * @returns SPARKEY_SUCCESS or all goes well. SPARKEY_INVALID_ARGUMENT if num_ranges is less than 1.
+ */
+sparkey_returncode sparkey_logreader_partition(sparkey_logreader *log, uint64_t *boundaries, int *num_ranges);
+
 /**
  * Closes a log iterator.
  * This is a failsafe operation.
@@ -433,6 +852,26 @@ sparkey_returncode sparkey_logiter_skip(sparkey_logiter *iter, sparkey_logreader
  */
 sparkey_returncode sparkey_logiter_next(sparkey_logiter *iter, sparkey_logreader *log);
 
+/**
+ * Reads all remaining entries of the iterator and hands them to a callback in batches.
+ * This avoids the per entry overhead of sparkey_logiter_next and the chunk functions,
+ * since keys and values point straight into the decoded block or the memory mapped log.
+ * Only entries that continue into the next block, and the keys of front coded logs, are copied.
+ * A batch ends when the next entry doesn't fit in the current block, so batches may be smaller than max_entries.
+ * An entry that starts a new block is read from that block, not copied.
+ *
+ * Afterwards the iterator is SPARKEY_ITER_CLOSED, or if the callback stopped the scan,
+ * positioned at the last entry it was given, with the key and value consumed.
+ * @param iter an open logiter
+ * @param log an open logreader associated with iter.
+ * @param max_entries the largest number of entries to hand to the callback at a time.
+ * @param callback called for each batch.
+ * @param ctx passed to the callback.
+ * @returns SPARKEY_SUCCESS if all goes well, or the returncode of the callback if it stopped the scan.
+ *          SPARKEY_INVALID_ARGUMENT if max_entries is less than 1.
+ */
+sparkey_returncode sparkey_logiter_foreach_batch(sparkey_logiter *iter, sparkey_logreader *log, int max_entries, sparkey_batch_callback callback, void *ctx);
+
 /**
  * Resets the iterator to the start of the current entry. This is only valid if
  * iter->state is SPARKEY_ITER_ACTIVE.
@@ -553,6 +992,60 @@ uint64_t sparkey_logiter_keylen(sparkey_logiter *iter);
  */
 uint64_t sparkey_logiter_valuelen(sparkey_logiter *iter);
 
+/* blockindex */
+
+/**
+ * Opens a block index, which lists the position and entry count of each compression block of a log.
+ * With it, a log can be split into ranges or entries can be found by ordinal without reading the log.
+ * Blocks written after the index was opened are not included.
+ * @param index a double reference to an uninitialized blockindex. Will be set on success.
+ * @param filename the block index file, see sparkey_create_blockindex_filename.
+ * @param log the open logreader of the log that the index belongs to.
+ * @returns SPARKEY_SUCCESS if all goes well. SPARKEY_FILE_IDENTIFIER_MISMATCH if the index belongs to another log.
+ */
+sparkey_returncode sparkey_blockindex_open(sparkey_blockindex **index, const char *filename, sparkey_logreader *log);
+
+/**
+ * Closes a block index. Will set the reference to NULL.
+ * @param index a double reference to a blockindex.
+ */
+void sparkey_blockindex_close(sparkey_blockindex **index);
+
+/**
+ * @param index an open blockindex.
+ * @returns the number of blocks in the log.
+ */
+uint64_t sparkey_blockindex_numblocks(sparkey_blockindex *index);
+
+/**
+ * Gets the description of a block.
+ * @param index an open blockindex.
+ * @param block the block number, must be less than sparkey_blockindex_numblocks.
+ * @param info set to the description of the block.
+ * @returns SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_blockindex_get(sparkey_blockindex *index, uint64_t block, sparkey_block_info *info);
+
+/**
+ * Positions the iterator right before an entry, so that the next call to sparkey_logiter_next returns it.
+ * @param iter an open logiter.
+ * @param log the logreader that the iterator belongs to.
+ * @param index the block index of the log.
+ * @param entry the ordinal of the entry, counting from 0 at the start of the log.
+ * @returns SPARKEY_SUCCESS if all goes well. SPARKEY_INVALID_LOG_RANGE if there is no such entry.
+ */
+sparkey_returncode sparkey_logiter_seek_entry(sparkey_logiter *iter, sparkey_logreader *log, sparkey_blockindex *index, uint64_t entry);
+
+/**
+ * Same as sparkey_logreader_partition, but uses the block index instead of reading the log.
+ * @param index the block index of the log.
+ * @param log the logreader of the log.
+ * @param boundaries an array with room for num_ranges + 1 positions.
+ * @param num_ranges the wanted number of ranges. Is set to the actual number, which may be lower for small logs.
+ * @returns SPARKEY_SUCCESS if all goes well. SPARKEY_INVALID_ARGUMENT if num_ranges is less than 1.
+ */
+sparkey_returncode sparkey_blockindex_partition(sparkey_blockindex *index, sparkey_logreader *log, uint64_t *boundaries, int *num_ranges);
+
 /* hashwriter */
 
 /**
@@ -574,6 +1067,18 @@ uint64_t sparkey_logiter_valuelen(sparkey_logiter *iter);
  */
 sparkey_returncode sparkey_hash_write(const char *hash_filename, const char *log_filename, int hash_size);
 
+/**
+ * Bundles a hash table and its log into a single pack file, which can be opened with sparkey_hash_open_pack.
+ * The log and the hash table are stored at page aligned offsets after a small directory.
+ * The pack is written to a temporary file and synced before it's renamed into place,
+ * so readers see either the previous pack file or the complete new one.
+ * @param pack_filename the pack file to create or replace.
+ * @param hash_filename a file that must exist and be a sparkey hash table.
+ * @param log_filename the log file that the hash table belongs to.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a returncode indicating the error.
+ */
+sparkey_returncode sparkey_pack(const char *pack_filename, const char *hash_filename, const char *log_filename);
+
 /* hashreader */
 /**
  * Opens a hash file and a log file for reading. The the hashreader is threadsafe, except during opening or closing.
@@ -584,6 +1089,38 @@ sparkey_returncode sparkey_hash_write(const char *hash_filename, const char *log
  */
 sparkey_returncode sparkey_hash_open(sparkey_hashreader **reader, const char *hash_filename, const char *log_filename);
 
+/**
+ * Same as sparkey_hash_open, but uses open file descriptors instead of paths.
+ * The hashreader uses duplicates of the descriptors, so the caller may close them afterwards.
+ * @param reader a double reference to an uninitialized hashreader. Will be set on success.
+ * @param hash_fd a descriptor of a sparkey hash table, open for reading.
+ * @param log_fd a descriptor of a sparkey log, open for reading.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a return code indicating the error.
+ */
+sparkey_returncode sparkey_hash_open_fd(sparkey_hashreader **reader, int hash_fd, int log_fd);
+
+/**
+ * Same as sparkey_hash_open, but reads the hash table and log from memory.
+ * The data is not copied, so it must stay valid and unchanged until the hashreader is closed.
+ * @param reader a double reference to an uninitialized hashreader. Will be set on success.
+ * @param hash_data the contents of a sparkey hash table.
+ * @param hash_len the number of bytes at hash_data.
+ * @param log_data the contents of a sparkey log.
+ * @param log_len the number of bytes at log_data.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a return code indicating the error.
+ */
+sparkey_returncode sparkey_hash_open_mem(sparkey_hashreader **reader, const uint8_t *hash_data, uint64_t hash_len, const uint8_t *log_data, uint64_t log_len);
+
+/**
+ * Same as sparkey_hash_open, but reads the hash table and log from a pack file created by sparkey_pack.
+ * The whole file is served by a single mapping, and the descriptor is closed before this returns.
+ * Access pattern hints given with sparkey_logiter_set_access_pattern are ignored for packs.
+ * @param reader a double reference to an uninitialized hashreader. Will be set on success.
+ * @param pack_filename a filename of a pack file.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a return code indicating the error.
+ */
+sparkey_returncode sparkey_hash_open_pack(sparkey_hashreader **reader, const char *pack_filename);
+
 /**
  * Gets the logreader that is referenced by the hashreader
  * @param reader an open reader.
@@ -612,6 +1149,27 @@ void sparkey_hash_close(sparkey_hashreader **reader);
  */
 sparkey_returncode sparkey_hash_get(sparkey_hashreader *reader, const uint8_t *key, uint64_t keylen, sparkey_logiter *iter);
 
+/**
+ * Computes the hash of a key, the way the hash table of the reader does.
+ * @param reader an open reader.
+ * @param key a buffer containing the key. It does not have be NUL terminated.
+ * @param keylen the length of the key.
+ * @returns the hash of the key.
+ */
+uint64_t sparkey_hash_keyhash(sparkey_hashreader *reader, const uint8_t *key, uint64_t keylen);
+
+/**
+ * Same as sparkey_hash_get, but uses a hash that the caller already computed,
+ * for instance with sparkey_hash_keyhash.
+ * @param reader an open reader.
+ * @param key a buffer containing the key. It does not have be NUL terminated.
+ * @param keylen the length of the key.
+ * @param hash the hash of the key, as computed by the hash table of the reader.
+ * @param iter an iterator associated with the reader. Will be mutated.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a return code indicating the error.
+ */
+sparkey_returncode sparkey_hash_get_hashed(sparkey_hashreader *reader, const uint8_t *key, uint64_t keylen, uint64_t hash, sparkey_logiter *iter);
+
 /**
  * Works the same as sparkey_logiter_next, except it skips entries that are not of type SPARKEY_ENTRY_PUT
  * and entries that have been overwritten or deleted. Thus it only stops at live entries.
@@ -627,6 +1185,186 @@ sparkey_returncode sparkey_logiter_hashnext(sparkey_logiter *iter, sparkey_hashr
 
 uint64_t sparkey_hash_numentries(sparkey_hashreader *reader);
 
+/**
+ * Gets the counters of the lookups done through a hashreader since it was opened, summed over all threads.
+ * The counters are only kept if the library was built with SPARKEY_STATS defined
+ * (configure --enable-stats), otherwise they cost nothing and this returns SPARKEY_STATS_DISABLED.
+ * @param reader an open reader.
+ * @param stats (output parameter) the counters.
+ * @returns SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_hash_stats(sparkey_hashreader *reader, sparkey_reader_stats *stats);
+
+/* hashhandle */
+
+/**
+ * Opens a handle that publishes the current version of a hash table and its log to many threads.
+ * A lookup pins the current hashreader with sparkey_hash_handle_pin, uses it and then unpins it.
+ * Pinning never takes a lock, and never waits for sparkey_hash_handle_reload,
+ * which replaces the current version while pinned readers stay valid until they are unpinned.
+ * @param handle_ref a double reference to an uninitialized handle. Will be set on success.
+ * @param hash_filename a filename of a file containing a sparkey hash table, or of a pack file if log_filename is NULL.
+ * @param log_filename a filename of a file containing a sparkey log, or NULL.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a return code indicating the error.
+ */
+sparkey_returncode sparkey_hash_handle_open(sparkey_hash_handle **handle_ref, const char *hash_filename, const char *log_filename);
+
+/**
+ * Pins the current hashreader of a handle. The reader stays open until it's unpinned,
+ * even if the handle is reloaded in the meantime.
+ * Log iterators belong to a single version, so an iterator created for a previously pinned reader
+ * must be recreated when this returns a different reader.
+ * @param handle an open handle.
+ * @param reader_ref set to the pinned hashreader.
+ * @param pin set to the pin, which must be passed to sparkey_hash_handle_unpin by the same thread.
+ * @returns SPARKEY_SUCCESS if all goes well, or SPARKEY_TOO_MANY_PINS if too many readers are pinned at once.
+ */
+sparkey_returncode sparkey_hash_handle_pin(sparkey_hash_handle *handle, sparkey_hashreader **reader_ref, int *pin);
+
+/**
+ * Releases a reader pinned with sparkey_hash_handle_pin.
+ * @param handle an open handle.
+ * @param pin a pin returned by sparkey_hash_handle_pin.
+ */
+void sparkey_hash_handle_unpin(sparkey_hash_handle *handle, int pin);
+
+/**
+ * Opens the files of the handle again and publishes them as the current version.
+ * The previous version is closed once no thread has it pinned, by this or a later reload,
+ * by the watcher or by sparkey_hash_handle_close.
+ * If opening fails, the current version is kept.
+ * @param handle an open handle.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a return code indicating the error.
+ */
+sparkey_returncode sparkey_hash_handle_reload(sparkey_hash_handle *handle);
+
+/**
+ * Starts a thread that reloads the handle when its hash table or pack file is replaced,
+ * by watching the directory of the file with inotify.
+ * The thread runs until the handle is closed. Only available on Linux.
+ * @param handle an open handle.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a return code indicating the error.
+ */
+sparkey_returncode sparkey_hash_handle_watch(sparkey_hash_handle *handle);
+
+/**
+ * Stops the watcher, closes all versions of the handle and frees it.
+ * No readers may be pinned when the handle is closed.
+ * @param handle_ref a double reference to the handle. Will be set to NULL.
+ */
+void sparkey_hash_handle_close(sparkey_hash_handle **handle_ref);
+
+/* sharded */
+
+/**
+ * Creates a sharded store, which spreads its entries over several logs by the hash of the key.
+ * The manifest file records the number of shards and the seed of the hash that routes keys to shards.
+ * Shard i is stored next to it, in the files "<name>-<i>.spl" and "<name>-<i>.spi"
+ * where <name> is the manifest filename without its ".spm" suffix.
+ * @param writer_ref a double reference to an uninitialized sharded writer. Will be set on success.
+ * @param manifest_filename the manifest file to create or overwrite.
+ * @param num_shards the number of shards, from 1 up to 65536.
+ * @param compression_type the compression of the shard logs, see sparkey_logwriter_create.
+ * @param compression_block_size the compression block size of the shard logs, see sparkey_logwriter_create.
+ * @returns SPARKEY_SUCCESS if all goes well. SPARKEY_INVALID_ARGUMENT if num_shards is out of range.
+ *          Otherwise a return code indicating the error.
+ */
+sparkey_returncode sparkey_sharded_create(sparkey_sharded_writer **writer_ref, const char *manifest_filename, int num_shards, sparkey_compression_type compression_type, int compression_block_size);
+
+/**
+ * Adds a key-value entry to the shard of the key.
+ * @param writer an open sharded writer.
+ * @param keylen the number of bytes of the key block
+ * @param key pointer to the key block
+ * @param valuelen the number of bytes of the value block
+ * @param value pointer to the value block
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a return code indicating the error.
+ */
+sparkey_returncode sparkey_sharded_put(sparkey_sharded_writer *writer, uint64_t keylen, const uint8_t *key, uint64_t valuelen, const uint8_t *value);
+
+/**
+ * Adds a delete entry to the shard of the key.
+ * @param writer an open sharded writer.
+ * @param keylen the number of bytes of the key block
+ * @param key pointer to the key block
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a return code indicating the error.
+ */
+sparkey_returncode sparkey_sharded_delete(sparkey_sharded_writer *writer, uint64_t keylen, const uint8_t *key);
+
+/**
+ * Closes the logs of all shards and frees the writer.
+ * @param writer_ref a double reference to a sharded writer. Will be set to NULL.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise the error of the first log that failed to close.
+ */
+sparkey_returncode sparkey_sharded_writer_close(sparkey_sharded_writer **writer_ref);
+
+/**
+ * Creates the hash tables of all shards. Up to num_threads threads build them,
+ * each taking the next shard that is not yet built.
+ * All shards use 64 bit hashes with the seed of the manifest,
+ * so that a lookup computes the hash of the key once, both to pick the shard and to probe its hash table.
+ * @param manifest_filename the manifest of a sharded store.
+ * @param num_threads the largest number of threads to use, including the calling thread.
+ *                    If less than 1, the number of online processors is used.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise the error of the first shard that failed.
+ */
+sparkey_returncode sparkey_sharded_hash_write(const char *manifest_filename, int num_threads);
+
+/**
+ * Opens all shards of a sharded store for lookups.
+ * @param reader_ref a double reference to an uninitialized sharded reader. Will be set on success.
+ * @param manifest_filename the manifest of a sharded store.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a return code indicating the error.
+ */
+sparkey_returncode sparkey_sharded_open(sparkey_sharded_reader **reader_ref, const char *manifest_filename);
+
+/**
+ * @param reader an open sharded reader.
+ * @returns the number of shards.
+ */
+int sparkey_sharded_numshards(sparkey_sharded_reader *reader);
+
+/**
+ * @param reader an open sharded reader.
+ * @param shard a shard number, from 0 up to the number of shards.
+ * @returns the hashreader of the shard.
+ */
+sparkey_hashreader * sparkey_sharded_getshard(sparkey_sharded_reader *reader, int shard);
+
+/**
+ * Creates the lookup state for sparkey_sharded_get: one log iterator per shard.
+ * The sharded reader is not changed by lookups, so threads can share it as long as each uses its own iterator.
+ * @param iter_ref a double reference to an uninitialized sharded iterator. Will be set on success.
+ * @param reader an open sharded reader.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a return code indicating the error.
+ */
+sparkey_returncode sparkey_sharded_iter_create(sparkey_sharded_iter **iter_ref, sparkey_sharded_reader *reader);
+
+/**
+ * Closes the log iterators of a sharded iterator and frees it.
+ * @param iter_ref a double reference to a sharded iterator. Will be set to NULL.
+ */
+void sparkey_sharded_iter_close(sparkey_sharded_iter **iter_ref);
+
+/**
+ * Looks up a key in its shard. The hash of the key is computed once.
+ * @param reader an open sharded reader.
+ * @param key a buffer containing the key. It does not have be NUL terminated.
+ * @param keylen the length of the key.
+ * @param iter a sharded iterator created for reader.
+ * @param logiter_ref set to the log iterator of the key's shard, positioned as by sparkey_hash_get.
+ *                    It belongs to iter, and is valid until the next lookup with iter in the same shard.
+ * @param log_ref set to the logreader of the key's shard, to be used with the log iterator.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a return code indicating the error.
+ */
+sparkey_returncode sparkey_sharded_get(sparkey_sharded_reader *reader, const uint8_t *key, uint64_t keylen, sparkey_sharded_iter *iter, sparkey_logiter **logiter_ref, sparkey_logreader **log_ref);
+
+/**
+ * Closes all shards and frees the reader.
+ * @param reader_ref a double reference to a sharded reader. Will be set to NULL.
+ */
+void sparkey_sharded_reader_close(sparkey_sharded_reader **reader_ref);
+
 /* util */
 
 /**
@@ -637,5 +1375,21 @@ uint64_t sparkey_hash_numentries(sparkey_hashreader *reader);
  */
 char * sparkey_create_log_filename(const char *index_filename);
 
+/**
+ * Allocates and creates a string denoting a block index file from a log file.
+ * This is simply a string replacement of .spl$ to .spb$
+ * @param log_filename the filename representing the log file
+ * @returns NULL if the log_filename does not end with ".spl"
+ */
+char * sparkey_create_blockindex_filename(const char *log_filename);
+
+/**
+ * Allocates and creates a string denoting a pack file from an index file.
+ * This is simply a string replacement of .spi$ to .spk$
+ * @param index_filename the filename representing the index file
+ * @returns NULL if the index_filename does not end with ".spi"
+ */
+char * sparkey_create_pack_filename(const char *index_filename);
+
 #endif
 
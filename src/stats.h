@@ -0,0 +1,54 @@
+/*
+* Copyright (c) 2012-2013 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#ifndef SPARKEY_STATS_H_INCLUDED
+#define SPARKEY_STATS_H_INCLUDED
+
+#include "sparkey.h"
+
+/*
+ * Reader counters, compiled in when SPARKEY_STATS is defined.
+ * Each thread adds to one of STATS_SLOTS cache line padded copies of the counters,
+ * so that threads rarely share a line. Threads that do share a slot stay correct,
+ * since the counters are updated atomically.
+ */
+#ifdef SPARKEY_STATS
+
+#define STATS_SLOTS (32)
+
+typedef union {
+  sparkey_reader_stats counters;
+  uint8_t padding[(sizeof(sparkey_reader_stats) + 63) / 64 * 64];
+} sparkey_stats_slot;
+
+/**
+ * @returns the slot of the calling thread.
+ */
+sparkey_stats_slot * stats_slot(sparkey_stats_slot *slots);
+
+/**
+ * Sums the counters of all slots.
+ */
+void stats_sum(sparkey_stats_slot *slots, sparkey_reader_stats *stats);
+
+#define STATS_ADD(slots, counter, n) __atomic_fetch_add(&stats_slot(slots)->counters.counter, (n), __ATOMIC_RELAXED)
+
+#else
+
+#define STATS_ADD(slots, counter, n) do { } while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,59 @@
+/*
+* Copyright (c) 2012-2013 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "crc32c.h"
+
+static void assert_crc(uint32_t expected, uint32_t actual, const char *what) {
+  if (expected != actual) {
+    printf("%s: expected %08"PRIx32" but got %08"PRIx32"\n", what, expected, actual);
+    exit(1);
+  }
+}
+
+int main() {
+  // Check values from RFC 3720, appendix B.4.
+  uint8_t buf[4096 + 16];
+  assert_crc(0xe3069283, crc32c(0, (const uint8_t *) "123456789", 9), "123456789");
+  assert_crc(0xe3069283, crc32c_sw(0, (const uint8_t *) "123456789", 9), "sw 123456789");
+  memset(buf, 0, 32);
+  assert_crc(0x8a9136aa, crc32c(0, buf, 32), "zeros");
+  memset(buf, 0xff, 32);
+  assert_crc(0x62a8ab43, crc32c(0, buf, 32), "ones");
+  for (int i = 0; i < 32; i++) {
+    buf[i] = i;
+  }
+  assert_crc(0x46dd794e, crc32c(0, buf, 32), "incrementing");
+  assert_crc(0, crc32c(0, buf, 0), "empty");
+
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    buf[i] = rand();
+  }
+  for (int offset = 0; offset < 16; offset++) {
+    for (size_t len = 0; len + offset <= sizeof(buf); len += 1 + len / 8) {
+      uint32_t expected = crc32c_sw(0, buf + offset, len);
+      assert_crc(expected, crc32c(0, buf + offset, len), "hardware");
+      // Checksums can be computed in pieces.
+      size_t split = len / 3;
+      assert_crc(expected, crc32c(crc32c(0, buf + offset, split), buf + offset + split, len - split), "split");
+      assert_crc(expected, crc32c_sw(crc32c_sw(0, buf + offset, split), buf + offset + split, len - split), "sw split");
+    }
+  }
+  printf("Success!\n");
+}
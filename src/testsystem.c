@@ -17,8 +17,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 
 #include "sparkey.h"
+#include "analyze.h"
 
 static int max(int a, int b) {
   return a > b ? a : b;
@@ -229,6 +236,1466 @@ void verify(sparkey_compression_type compression, int blocksize, int hashsize, i
   sparkey_logiter_close(&myiter);
 }
 
+static void assert_lookup(sparkey_hashreader *reader, sparkey_logiter *iter, const char *key, const char *expected_value) {
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_get(reader, (uint8_t*) key, strlen(key), iter));
+  if (expected_value == NULL) {
+    assert_equals(SPARKEY_ITER_INVALID, sparkey_logiter_state(iter));
+    return;
+  }
+  assert_equals(SPARKEY_ITER_ACTIVE, sparkey_logiter_state(iter));
+  uint64_t wanted_valuelen = sparkey_logiter_valuelen(iter);
+  uint8_t *valuebuf = calloc(1 + wanted_valuelen, 1);
+  uint64_t actual_valuelen;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_value(iter, sparkey_hash_getreader(reader), wanted_valuelen, valuebuf, &actual_valuelen));
+  assert_equals(wanted_valuelen, actual_valuelen);
+  assert_str_equals(expected_value, (char*) valuebuf);
+  free(valuebuf);
+}
+
+void verify_direct_io(sparkey_compression_type compression, int blocksize, int num_puts) {
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", compression, blocksize));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_set_direct_io(mywriter, 1));
+  for (int i = 0; i < num_puts; i++) {
+    char key[100];
+    char value[100];
+    sprintf(key, "key_%d", i);
+    sprintf(value, "value_%d", i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, strlen(value), (uint8_t*) value));
+    if (i == num_puts / 2) {
+      // Flushes a partial direct io block, which must be rewritten when more data is added
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_flush(mywriter));
+    }
+    if (i == 3 * num_puts / 4) {
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_set_direct_io(mywriter, 0));
+    }
+    if (i == 7 * num_puts / 8) {
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_set_direct_io(mywriter, 1));
+    }
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_write("test.spi", "test.spl", 0));
+  sparkey_hashreader *myhashreader;
+  sparkey_logiter *myiter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_open(&myhashreader, "test.spi", "test.spl"));
+  assert_equals(num_puts, sparkey_hash_numentries(myhashreader));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, sparkey_hash_getreader(myhashreader)));
+  for (int i = 0; i < num_puts; i += 7) {
+    char key[100];
+    char value[100];
+    sprintf(key, "key_%d", i);
+    sprintf(value, "value_%d", i);
+    assert_lookup(myhashreader, myiter, key, value);
+  }
+  sparkey_logiter_close(&myiter);
+  sparkey_hash_close(&myhashreader);
+}
+
+static int packed_valuelen(int i) {
+  // Every third entry is larger than a block
+  return i % 3 == 0 ? 300 + (i * 37) % 400 : (i * 37) % 200;
+}
+
+static void write_packed(sparkey_packing_policy policy, int num_puts, sparkey_writer_stats *stats) {
+  sparkey_logwriter *mywriter;
+  char value[1000];
+  memset(value, 'x', sizeof(value));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", SPARKEY_COMPRESSION_SNAPPY, 256));
+  assert_equals(SPARKEY_INVALID_ARGUMENT, sparkey_logwriter_set_packing(mywriter, (sparkey_packing_policy) 42));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_set_packing(mywriter, policy));
+  for (int i = 0; i < num_puts; i++) {
+    char key[100];
+    sprintf(key, "key_%d", i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, packed_valuelen(i), (uint8_t*) value));
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_flush(mywriter));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_stats(mywriter, stats));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_write("test.spi", "test.spl", 0));
+  sparkey_hashreader *myhashreader;
+  sparkey_logiter *myiter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_open(&myhashreader, "test.spi", "test.spl"));
+  assert_equals(num_puts, sparkey_hash_numentries(myhashreader));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, sparkey_hash_getreader(myhashreader)));
+  for (int i = 0; i < num_puts; i++) {
+    char key[100];
+    sprintf(key, "key_%d", i);
+    value[packed_valuelen(i)] = '\0';
+    assert_lookup(myhashreader, myiter, key, value);
+    value[packed_valuelen(i)] = 'x';
+  }
+  sparkey_logiter_close(&myiter);
+  sparkey_hash_close(&myhashreader);
+}
+
+void verify_packing() {
+  sparkey_writer_stats no_split;
+  sparkey_writer_stats min_waste;
+  write_packed(SPARKEY_PACKING_NO_SPLIT, 1000, &no_split);
+  write_packed(SPARKEY_PACKING_MIN_WASTE, 1000, &min_waste);
+
+  // Only the large entries are split
+  assert_equals(334, no_split.num_split_entries);
+  assert_equals(334, min_waste.num_split_entries);
+
+  // Starting large entries on a new block costs no extra blocks, but they span fewer blocks
+  if (no_split.num_split_blocks >= min_waste.num_split_blocks || no_split.num_blocks != min_waste.num_blocks) {
+    printf("Expected large entries to span fewer blocks: %"PRIu64" vs %"PRIu64"\n", no_split.num_split_blocks, min_waste.num_split_blocks);
+    exit(1);
+  }
+}
+
+#define DURABILITY_THREADS 4
+#define DURABILITY_PUTS 1000
+
+static void *durability_writer(void *arg) {
+  sparkey_logwriter **writer_and_id = arg;
+  sparkey_logwriter *mywriter = writer_and_id[0];
+  int id = (int) (intptr_t) writer_and_id[1];
+  for (int i = 0; i < DURABILITY_PUTS; i++) {
+    char key[100];
+    char value[100];
+    sprintf(key, "key_%d_%d", id, i);
+    sprintf(value, "value_%d_%d", id, i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, strlen(value), (uint8_t*) value));
+    if (i % 100 == 0) {
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_flush(mywriter));
+    }
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_flush(mywriter));
+  return NULL;
+}
+
+void verify_durability(sparkey_durability durability, sparkey_compression_type compression, int blocksize, int direct_io) {
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", compression, blocksize));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_set_direct_io(mywriter, direct_io));
+  assert_equals(SPARKEY_INVALID_ARGUMENT, sparkey_logwriter_set_durability(mywriter, (sparkey_durability) 42));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_set_durability(mywriter, durability));
+
+  int num_threads = durability == SPARKEY_DURABILITY_GROUP_COMMIT ? DURABILITY_THREADS : 1;
+  pthread_t threads[DURABILITY_THREADS];
+  sparkey_logwriter *args[DURABILITY_THREADS][2];
+  for (int t = 0; t < num_threads; t++) {
+    args[t][0] = mywriter;
+    args[t][1] = (sparkey_logwriter *) (intptr_t) t;
+    assert_equals(0, pthread_create(&threads[t], NULL, durability_writer, args[t]));
+  }
+  for (int t = 0; t < num_threads; t++) {
+    assert_equals(0, pthread_join(threads[t], NULL));
+  }
+
+  // Everything flushed must be readable before the writer is closed
+  sparkey_logreader *myreader;
+  sparkey_logiter *myiter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_open(&myreader, "test.spl"));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+  int num_entries = 0;
+  while (1) {
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_next(myiter, myreader));
+    if (sparkey_logiter_state(myiter) != SPARKEY_ITER_ACTIVE) {
+      break;
+    }
+    num_entries++;
+  }
+  assert_equals(num_threads * DURABILITY_PUTS, num_entries);
+  sparkey_logiter_close(&myiter);
+  sparkey_logreader_close(&myreader);
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_write("test.spi", "test.spl", 0));
+  sparkey_hashreader *myhashreader;
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_open(&myhashreader, "test.spi", "test.spl"));
+  assert_equals(num_threads * DURABILITY_PUTS, sparkey_hash_numentries(myhashreader));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, sparkey_hash_getreader(myhashreader)));
+  for (int t = 0; t < num_threads; t++) {
+    for (int i = 0; i < DURABILITY_PUTS; i += 7) {
+      char key[100];
+      char value[100];
+      sprintf(key, "key_%d_%d", t, i);
+      sprintf(value, "value_%d_%d", t, i);
+      assert_lookup(myhashreader, myiter, key, value);
+    }
+  }
+  sparkey_logiter_close(&myiter);
+  sparkey_hash_close(&myhashreader);
+}
+
+#define APPENDER_THREADS 4
+#define APPENDER_PUTS 20000
+
+static void appender_value(char *value, int id, int i) {
+  int len = sprintf(value, "value_%d_%d", id, i);
+  // Some entries are larger than the smallest block size, so they get split
+  if (i % 11 == 0) {
+    memset(value + len, 'x', 250 - len);
+    value[250] = '\0';
+  }
+}
+
+static void *appender_thread(void *arg) {
+  sparkey_logwriter **writer_and_id = arg;
+  int id = (int) (intptr_t) writer_and_id[1];
+  sparkey_logappender *myappender;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logappender_create(&myappender, writer_and_id[0]));
+  for (int i = 0; i < APPENDER_PUTS; i++) {
+    char key[100];
+    char value[300];
+    sprintf(key, "key_%d_%d", id, i);
+    appender_value(value, id, i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logappender_put(myappender, strlen(key), (uint8_t*) key, strlen(value), (uint8_t*) value));
+    // Later entries from the same appender always win
+    if (i % 3 == 0) {
+      sprintf(key, "key_%d_%d", id, i / 3);
+      assert_equals(SPARKEY_SUCCESS, sparkey_logappender_delete(myappender, strlen(key), (uint8_t*) key));
+    }
+    if (i % 5000 == 0) {
+      assert_equals(SPARKEY_SUCCESS, sparkey_logappender_flush(myappender));
+    }
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logappender_close(&myappender));
+  return NULL;
+}
+
+void verify_appenders(sparkey_compression_type compression, int blocksize) {
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", compression, blocksize));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, 5, (uint8_t*) "first", 5, (uint8_t*) "value"));
+
+  // The writer can't be used directly while it has appenders
+  sparkey_logappender *myappender;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logappender_create(&myappender, mywriter));
+  assert_equals(SPARKEY_LOG_HAS_APPENDERS, sparkey_logwriter_put(mywriter, 3, (uint8_t*) "key", 5, (uint8_t*) "value"));
+  assert_equals(SPARKEY_LOG_HAS_APPENDERS, sparkey_logwriter_close(&mywriter));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logappender_close(&myappender));
+
+  pthread_t threads[APPENDER_THREADS];
+  sparkey_logwriter *args[APPENDER_THREADS][2];
+  for (int t = 0; t < APPENDER_THREADS; t++) {
+    args[t][0] = mywriter;
+    args[t][1] = (sparkey_logwriter *) (intptr_t) t;
+    assert_equals(0, pthread_create(&threads[t], NULL, appender_thread, args[t]));
+  }
+  for (int t = 0; t < APPENDER_THREADS; t++) {
+    assert_equals(0, pthread_join(threads[t], NULL));
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, 4, (uint8_t*) "last", 5, (uint8_t*) "value"));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_write("test.spi", "test.spl", 0));
+  sparkey_hashreader *myhashreader;
+  sparkey_logiter *myiter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_open(&myhashreader, "test.spi", "test.spl"));
+  int deleted = (APPENDER_PUTS + 2) / 3;
+  assert_equals(2 + APPENDER_THREADS * (APPENDER_PUTS - deleted), sparkey_hash_numentries(myhashreader));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, sparkey_hash_getreader(myhashreader)));
+  assert_lookup(myhashreader, myiter, "first", "value");
+  assert_lookup(myhashreader, myiter, "last", "value");
+  for (int t = 0; t < APPENDER_THREADS; t++) {
+    for (int i = 0; i < APPENDER_PUTS; i += 7) {
+      char key[100];
+      char value[300];
+      sprintf(key, "key_%d_%d", t, i);
+      appender_value(value, t, i);
+      assert_lookup(myhashreader, myiter, key, i < deleted ? NULL : value);
+    }
+  }
+  sparkey_logiter_close(&myiter);
+  sparkey_hash_close(&myhashreader);
+}
+
+void verify_appender_flush_failure(sparkey_compression_type compression, int blocksize) {
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", compression, blocksize));
+  if (compression == SPARKEY_COMPRESSION_SNAPPY) {
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_set_sorted(mywriter, 1024));
+    sparkey_logappender *sortedappender;
+    assert_equals(SPARKEY_INCOMPATIBLE_LOG_MODES, sparkey_logappender_create(&sortedappender, mywriter));
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", compression, blocksize));
+  }
+  sparkey_logappender *myappender;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logappender_create(&myappender, mywriter));
+  char value[1000];
+  memset(value, 'x', sizeof(value));
+  for (int i = 0; i < 100; i++) {
+    char key[100];
+    sprintf(key, "key_%d", i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logappender_put(myappender, strlen(key), (uint8_t*) key, sizeof(value), (uint8_t*) value));
+  }
+
+  // Writes past the file size limit fail with EFBIG instead of raising SIGXFSZ
+  struct rlimit old_limit;
+  struct rlimit limit;
+  assert_equals(0, getrlimit(RLIMIT_FSIZE, &old_limit));
+  limit = old_limit;
+  limit.rlim_cur = 4096;
+  void (*old_handler)(int) = signal(SIGXFSZ, SIG_IGN);
+  assert_equals(0, setrlimit(RLIMIT_FSIZE, &limit));
+  sparkey_returncode returncode = sparkey_logappender_close(&myappender);
+  assert_equals(0, setrlimit(RLIMIT_FSIZE, &old_limit));
+  signal(SIGXFSZ, old_handler);
+
+  assert_equals(SPARKEY_FILE_SIZE_EXCEEDED, returncode);
+  assert_equals(1, myappender == NULL);
+  // The log has a gap now, so it can't be flushed, but the writer no longer counts the appender.
+  assert_equals(SPARKEY_FILE_SIZE_EXCEEDED, sparkey_logwriter_close(&mywriter));
+  assert_equals(1, mywriter == NULL);
+}
+
+#define SORTED_PUTS 5000
+
+static void sorted_key(char *key, int i) {
+  sprintf(key, "users/profiles/settings/%05d", i);
+}
+
+static void write_sorted_log(const char *filename, int sorted) {
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, filename, SPARKEY_COMPRESSION_SNAPPY, 1024));
+  if (sorted) {
+    // Small enough to spill several sorted runs
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_set_sorted(mywriter, 16 * 1024));
+  }
+  for (int n = 0; n < SORTED_PUTS; n++) {
+    int i = (n * 7919) % SORTED_PUTS;
+    char key[100];
+    char value[100];
+    sorted_key(key, i);
+    sprintf(value, "value_%d", i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, strlen(value), (uint8_t*) value));
+  }
+  // Later entries for the same key must stay after earlier ones
+  for (int i = 0; i < SORTED_PUTS; i += 10) {
+    char key[100];
+    char value[100];
+    sorted_key(key, i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_delete(mywriter, strlen(key), (uint8_t*) key));
+    sorted_key(key, i + 5);
+    sprintf(value, "newvalue_%d", i + 5);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, strlen(value), (uint8_t*) value));
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+}
+
+static long file_size(const char *filename) {
+  FILE *fp = fopen(filename, "r");
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fclose(fp);
+  return size;
+}
+
+static const char *sorted_value(char *value, int i) {
+  if (i % 10 == 0) {
+    return NULL;
+  }
+  if (i % 10 == 5) {
+    sprintf(value, "newvalue_%d", i);
+  } else {
+    sprintf(value, "value_%d", i);
+  }
+  return value;
+}
+
+void verify_sorted() {
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", SPARKEY_COMPRESSION_NONE, 0));
+  assert_equals(SPARKEY_INVALID_COMPRESSION_TYPE, sparkey_logwriter_set_sorted(mywriter, 1024));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", SPARKEY_COMPRESSION_SNAPPY, 1024));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, 3, (uint8_t*) "key", 5, (uint8_t*) "value"));
+  assert_equals(SPARKEY_LOG_NOT_EMPTY, sparkey_logwriter_set_sorted(mywriter, 1024));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+
+  write_sorted_log("test2.spl", 0);
+  write_sorted_log("test.spl", 1);
+  if (file_size("test.spl") >= file_size("test2.spl")) {
+    printf("Expected front coded log to be smaller: %ld vs %ld\n", file_size("test.spl"), file_size("test2.spl"));
+    exit(1);
+  }
+  remove("test2.spl");
+
+  // Keys come out in order
+  sparkey_logreader *myreader;
+  sparkey_logiter *myiter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_open(&myreader, "test.spl"));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+  char prev[100] = "";
+  int num_entries = 0;
+  while (1) {
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_next(myiter, myreader));
+    if (sparkey_logiter_state(myiter) != SPARKEY_ITER_ACTIVE) {
+      break;
+    }
+    char key[100] = "";
+    uint64_t keylen;
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_key(myiter, myreader, sizeof(key) - 1, (uint8_t*) key, &keylen));
+    if (strcmp(prev, key) > 0) {
+      printf("Expected '%s' to be sorted after '%s'\n", key, prev);
+      exit(1);
+    }
+    strcpy(prev, key);
+    num_entries++;
+  }
+  assert_equals(SORTED_PUTS + SORTED_PUTS / 5, num_entries);
+  sparkey_logiter_close(&myiter);
+  sparkey_logreader_close(&myreader);
+
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_write("test.spi", "test.spl", 0));
+  sparkey_hashreader *myhashreader;
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_open(&myhashreader, "test.spi", "test.spl"));
+  assert_equals(SORTED_PUTS - SORTED_PUTS / 10, sparkey_hash_numentries(myhashreader));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, sparkey_hash_getreader(myhashreader)));
+  for (int i = 0; i < SORTED_PUTS; i++) {
+    char key[100];
+    char value[100];
+    sorted_key(key, i);
+    assert_lookup(myhashreader, myiter, key, sorted_value(value, i));
+  }
+  sparkey_logiter_close(&myiter);
+  sparkey_hash_close(&myhashreader);
+}
+
+#define RANGE_PUTS 2000
+
+static int read_range_keys(sparkey_logreader *myreader, uint64_t start, uint64_t end, char (*keys)[300], int offset) {
+  sparkey_logiter *myiter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create_range(&myiter, myreader, start, end));
+  int n = offset;
+  while (1) {
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_next(myiter, myreader));
+    if (sparkey_logiter_state(myiter) != SPARKEY_ITER_ACTIVE) {
+      break;
+    }
+    uint64_t keylen;
+    memset(keys[n], 0, sizeof(keys[n]));
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_key(myiter, myreader, sizeof(keys[n]) - 1, (uint8_t*) keys[n], &keylen));
+    n++;
+  }
+  sparkey_logiter_close(&myiter);
+  return n - offset;
+}
+
+void verify_ranges(sparkey_compression_type compression, int blocksize) {
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", compression, blocksize));
+  for (int i = 0; i < RANGE_PUTS; i++) {
+    char key[300];
+    int len = sprintf(key, "key_%d", i);
+    // Some entries are larger than the block size, so they get split
+    if (i % 13 == 0) {
+      memset(key + len, 'x', 250 - len);
+      key[250] = '\0';
+    }
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, 5, (uint8_t*) "value"));
+    if (i % 7 == 0) {
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_delete(mywriter, strlen(key), (uint8_t*) key));
+    }
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+
+  sparkey_logreader *myreader;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_open(&myreader, "test.spl"));
+  sparkey_logiter *myiter;
+  assert_equals(SPARKEY_INVALID_LOG_RANGE, sparkey_logiter_create_range(&myiter, myreader, 0, 100));
+
+  int num_entries = RANGE_PUTS + (RANGE_PUTS + 6) / 7;
+  char (*expected)[300] = malloc(num_entries * sizeof(*expected));
+  char (*actual)[300] = malloc(num_entries * sizeof(*actual));
+  uint64_t boundaries[65];
+  int num_ranges = 0;
+  assert_equals(SPARKEY_INVALID_ARGUMENT, sparkey_logreader_partition(myreader, boundaries, &num_ranges));
+  num_ranges = 1;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_partition(myreader, boundaries, &num_ranges));
+  assert_equals(1, num_ranges);
+  assert_equals(num_entries, read_range_keys(myreader, boundaries[0], boundaries[1], expected, 0));
+
+  // The ranges together must contain every entry exactly once
+  for (int wanted = 2; wanted <= 64; wanted *= 2) {
+    num_ranges = wanted;
+    assert_equals(SPARKEY_SUCCESS, sparkey_logreader_partition(myreader, boundaries, &num_ranges));
+    if (num_ranges < wanted / 2) {
+      printf("Expected about %d ranges but got %d\n", wanted, num_ranges);
+      exit(1);
+    }
+    int n = 0;
+    for (int r = 0; r < num_ranges; r++) {
+      n += read_range_keys(myreader, boundaries[r], boundaries[r + 1], actual, n);
+    }
+    assert_equals(num_entries, n);
+    for (int i = 0; i < n; i++) {
+      assert_str_equals(expected[i], actual[i]);
+    }
+  }
+  free(expected);
+  free(actual);
+  sparkey_logreader_close(&myreader);
+}
+
+#define ACCESS_PUTS 20000
+
+void verify_access_pattern(sparkey_compression_type compression, int blocksize) {
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", compression, blocksize));
+  for (int i = 0; i < ACCESS_PUTS; i++) {
+    char key[100];
+    char value[200];
+    sprintf(key, "key_%d", i);
+    int len = sprintf(value, "value_%d_", i);
+    memset(value + len, 'x', 150 - len);
+    value[150] = '\0';
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, strlen(value), (uint8_t*) value));
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_write("test.spi", "test.spl", 0));
+
+  // A scan that releases what it has passed still sees every entry
+  sparkey_hashreader *myhashreader;
+  sparkey_logiter *myiter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_open(&myhashreader, "test.spi", "test.spl"));
+  sparkey_logreader *myreader = sparkey_hash_getreader(myhashreader);
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+  assert_equals(SPARKEY_INVALID_ARGUMENT, sparkey_logiter_set_access_pattern(myiter, myreader, (sparkey_access_pattern) 42));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_set_access_pattern(myiter, myreader, SPARKEY_ACCESS_SEQUENTIAL));
+  int num_entries = 0;
+  while (1) {
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_next(myiter, myreader));
+    if (sparkey_logiter_state(myiter) != SPARKEY_ITER_ACTIVE) {
+      break;
+    }
+    char expected[100];
+    char key[100] = "";
+    uint64_t keylen;
+    sprintf(expected, "key_%d", num_entries);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_key(myiter, myreader, sizeof(key) - 1, (uint8_t*) key, &keylen));
+    assert_str_equals(expected, key);
+    num_entries++;
+  }
+  assert_equals(ACCESS_PUTS, num_entries);
+  sparkey_logiter_close(&myiter);
+
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_set_access_pattern(myiter, myreader, SPARKEY_ACCESS_RANDOM));
+  for (int i = 0; i < ACCESS_PUTS; i += 97) {
+    char key[100];
+    char value[200];
+    sprintf(key, "key_%d", i);
+    int len = sprintf(value, "value_%d_", i);
+    memset(value + len, 'x', 150 - len);
+    value[150] = '\0';
+    assert_lookup(myhashreader, myiter, key, value);
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_set_access_pattern(myiter, myreader, SPARKEY_ACCESS_NORMAL));
+  sparkey_logiter_close(&myiter);
+  sparkey_hash_close(&myhashreader);
+}
+
+#define BLOCKINDEX_PUTS 3000
+
+static void blockindex_value(char *value, int i) {
+  int len = sprintf(value, "value_%d", i);
+  // Some entries are larger than the smallest block size, so they get split
+  if (i % 13 == 0) {
+    memset(value + len, 'x', 250 - len);
+    value[250] = '\0';
+  }
+}
+
+void verify_blockindex(int blocksize, int sorted) {
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", SPARKEY_COMPRESSION_NONE, 0));
+  assert_equals(SPARKEY_INVALID_COMPRESSION_TYPE, sparkey_logwriter_set_blockindex(mywriter, 1));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", SPARKEY_COMPRESSION_SNAPPY, blocksize));
+  if (sorted) {
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_set_sorted(mywriter, 1024 * 1024));
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_set_blockindex(mywriter, 1));
+  for (int i = 0; i < BLOCKINDEX_PUTS; i++) {
+    char key[100];
+    char value[300];
+    sprintf(key, "key_%05d", i);
+    blockindex_value(value, i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, strlen(value), (uint8_t*) value));
+    if (i % 1000 == 0) {
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_flush(mywriter));
+    }
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+
+  sparkey_logreader *myreader;
+  sparkey_blockindex *myindex;
+  sparkey_logiter *myiter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_open(&myreader, "test.spl"));
+  assert_equals(SPARKEY_SUCCESS, sparkey_blockindex_open(&myindex, "test.spb", myreader));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+
+  // The records describe consecutive blocks and count every entry once
+  uint64_t num_blocks = sparkey_blockindex_numblocks(myindex);
+  uint64_t num_entries = 0;
+  for (uint64_t b = 0; b < num_blocks; b++) {
+    sparkey_block_info info;
+    assert_equals(SPARKEY_SUCCESS, sparkey_blockindex_get(myindex, b, &info));
+    assert_equals(num_entries, info.first_entry);
+    num_entries += info.entry_count;
+  }
+  assert_equals(BLOCKINDEX_PUTS, num_entries);
+
+  for (int i = 0; i < BLOCKINDEX_PUTS; i += 37) {
+    char key[100];
+    char expected[100];
+    uint64_t keylen;
+    memset(key, 0, sizeof(key));
+    sprintf(expected, "key_%05d", i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_seek_entry(myiter, myreader, myindex, i));
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_next(myiter, myreader));
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_key(myiter, myreader, sizeof(key) - 1, (uint8_t*) key, &keylen));
+    assert_str_equals(expected, key);
+  }
+  assert_equals(SPARKEY_INVALID_LOG_RANGE, sparkey_logiter_seek_entry(myiter, myreader, myindex, BLOCKINDEX_PUTS));
+  sparkey_logiter_close(&myiter);
+
+  uint64_t boundaries[9];
+  int num_ranges = 0;
+  assert_equals(SPARKEY_INVALID_ARGUMENT, sparkey_blockindex_partition(myindex, myreader, boundaries, &num_ranges));
+  num_ranges = 8;
+  assert_equals(SPARKEY_SUCCESS, sparkey_blockindex_partition(myindex, myreader, boundaries, &num_ranges));
+  int visited = 0;
+  for (int r = 0; r < num_ranges; r++) {
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create_range(&myiter, myreader, boundaries[r], boundaries[r + 1]));
+    while (1) {
+      assert_equals(SPARKEY_SUCCESS, sparkey_logiter_next(myiter, myreader));
+      if (sparkey_logiter_state(myiter) != SPARKEY_ITER_ACTIVE) {
+        break;
+      }
+      char key[100];
+      char expected[100];
+      uint64_t keylen;
+      memset(key, 0, sizeof(key));
+      sprintf(expected, "key_%05d", visited);
+      assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_key(myiter, myreader, sizeof(key) - 1, (uint8_t*) key, &keylen));
+      assert_str_equals(expected, key);
+      visited++;
+    }
+    sparkey_logiter_close(&myiter);
+  }
+  assert_equals(BLOCKINDEX_PUTS, visited);
+  sparkey_blockindex_close(&myindex);
+  sparkey_logreader_close(&myreader);
+
+  // An index can only be started on an empty log, and disabling it removes it
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", SPARKEY_COMPRESSION_SNAPPY, blocksize));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, 3, (uint8_t*) "key", 5, (uint8_t*) "value"));
+  assert_equals(SPARKEY_LOG_NOT_EMPTY, sparkey_logwriter_set_blockindex(mywriter, 1));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_open(&myreader, "test.spl"));
+  assert_equals(SPARKEY_FILE_IDENTIFIER_MISMATCH, sparkey_blockindex_open(&myindex, "test.spb", myreader));
+  sparkey_logreader_close(&myreader);
+
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", SPARKEY_COMPRESSION_SNAPPY, blocksize));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_set_blockindex(mywriter, 1));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_set_blockindex(mywriter, 0));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_open(&myreader, "test.spl"));
+  assert_equals(SPARKEY_FILE_NOT_FOUND, sparkey_blockindex_open(&myindex, "test.spb", myreader));
+  sparkey_logreader_close(&myreader);
+}
+
+static int read_refreshed(sparkey_logreader *myreader, sparkey_logiter *myiter, int next_id) {
+  while (1) {
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_next(myiter, myreader));
+    if (sparkey_logiter_state(myiter) != SPARKEY_ITER_ACTIVE) {
+      return next_id;
+    }
+    char key[100] = "";
+    char expected[100];
+    uint64_t keylen;
+    sprintf(expected, "key_%d", next_id);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_key(myiter, myreader, sizeof(key) - 1, (uint8_t*) key, &keylen));
+    assert_str_equals(expected, key);
+    next_id++;
+  }
+}
+
+static void put_refreshed(sparkey_logwriter *mywriter, int from, int to) {
+  for (int i = from; i < to; i++) {
+    char key[100];
+    char value[100];
+    sprintf(key, "key_%d", i);
+    sprintf(value, "value_%d", i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, strlen(value), (uint8_t*) value));
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_flush(mywriter));
+}
+
+void verify_refresh(sparkey_compression_type compression, int blocksize) {
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", compression, blocksize));
+
+  sparkey_logreader *myreader;
+  sparkey_logiter *myiter;
+  sparkey_logiter *myrangeiter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_open(&myreader, "test.spl"));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+  assert_equals(0, read_refreshed(myreader, myiter, 0));
+
+  put_refreshed(mywriter, 0, 100);
+  assert_equals(0, read_refreshed(myreader, myiter, 0));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_refresh(myreader));
+  uint64_t range[2];
+  int num_ranges = 1;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_partition(myreader, range, &num_ranges));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create_range(&myrangeiter, myreader, range[0], range[1]));
+  assert_equals(100, read_refreshed(myreader, myiter, 0));
+
+  // Leave the iterator in the middle of the log, with an unread value
+  put_refreshed(mywriter, 100, 5000);
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_refresh(myreader));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_next(myiter, myreader));
+  put_refreshed(mywriter, 5000, 20000);
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_refresh(myreader));
+  char value[100] = "";
+  uint64_t valuelen;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_value(myiter, myreader, sizeof(value) - 1, (uint8_t*) value, &valuelen));
+  assert_str_equals("value_100", value);
+  assert_equals(20000, read_refreshed(myreader, myiter, 101));
+
+  // Range iterators don't follow the log
+  assert_equals(100, read_refreshed(myreader, myrangeiter, 0));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_refresh(myreader));
+
+  sparkey_logiter_close(&myrangeiter);
+  sparkey_logiter_close(&myiter);
+  sparkey_logreader_close(&myreader);
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+}
+
+static void write_header32(const char *filename, off_t offset, uint32_t value) {
+  uint8_t buf[4] = { value, value >> 8, value >> 16, value >> 24 };
+  int fd = open(filename, O_WRONLY);
+  assert_equals(1, fd >= 0);
+  assert_equals(4, pwrite(fd, buf, 4, offset));
+  close(fd);
+}
+
+void verify_refresh_format() {
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", SPARKEY_COMPRESSION_SNAPPY, 100));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_set_checksums(mywriter, 1));
+  put_refreshed(mywriter, 0, 10);
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+
+  sparkey_logreader *myreader;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_open(&myreader, "test.spl"));
+
+  // Format flags and restart interval live at offsets 84 and 88 of a version 1 header
+  write_header32("test.spl", 88, 7);
+  assert_equals(SPARKEY_LOG_HEADER_CORRUPT, sparkey_logreader_refresh(myreader));
+  write_header32("test.spl", 88, 0);
+  write_header32("test.spl", 84, 0);
+  assert_equals(SPARKEY_LOG_HEADER_CORRUPT, sparkey_logreader_refresh(myreader));
+  write_header32("test.spl", 84, 2);
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_refresh(myreader));
+
+  sparkey_logreader_close(&myreader);
+}
+
+static int count_checksummed(sparkey_logreader *myreader, sparkey_verify_mode mode, sparkey_returncode *returncode) {
+  sparkey_logiter *myiter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_set_verify(myreader, mode));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+  uint64_t boundaries[2];
+  int num_ranges = 1;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_partition(myreader, boundaries, &num_ranges));
+  int count = 0;
+  // Iterate twice, so that FIRST_ACCESS sees blocks it already verified
+  for (int pass = 0; pass < 2; pass++) {
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_seek(myiter, myreader, boundaries[0]));
+    while (1) {
+      *returncode = sparkey_logiter_next(myiter, myreader);
+      if (*returncode != SPARKEY_SUCCESS || sparkey_logiter_state(myiter) != SPARKEY_ITER_ACTIVE) {
+        break;
+      }
+      count++;
+    }
+  }
+  sparkey_logiter_close(&myiter);
+  return count;
+}
+
+/**
+ * Reads the length prefix of the block at pos, which is less than 16384 in these tests.
+ */
+static uint64_t checksum_position(FILE *fp, uint64_t pos) {
+  uint8_t vlq[2];
+  fseek(fp, pos, SEEK_SET);
+  assert_equals(2, fread(vlq, 1, 2, fp));
+  if (vlq[0] & 0x80) {
+    return pos + 2 + ((vlq[0] & 0x7f) | (uint64_t) vlq[1] << 7);
+  }
+  return pos + 1 + vlq[0];
+}
+
+static int count_plain_ranges(sparkey_logreader *myreader) {
+  uint64_t boundaries[9];
+  int num_ranges = 8;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_partition(myreader, boundaries, &num_ranges));
+  assert_equals(1, num_ranges > 1);
+  int count = 0;
+  for (int r = 0; r < num_ranges; r++) {
+    sparkey_logiter *myiter;
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create_range(&myiter, myreader, boundaries[r], boundaries[r + 1]));
+    while (1) {
+      assert_equals(SPARKEY_SUCCESS, sparkey_logiter_next(myiter, myreader));
+      if (sparkey_logiter_state(myiter) != SPARKEY_ITER_ACTIVE) {
+        break;
+      }
+      count++;
+    }
+    sparkey_logiter_close(&myiter);
+  }
+  return count;
+}
+
+void verify_plain_checksums() {
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", SPARKEY_COMPRESSION_NONE, 0));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_set_checksums(mywriter, 1));
+  sparkey_logappender *myappender;
+  assert_equals(SPARKEY_INCOMPATIBLE_LOG_MODES, sparkey_logappender_create(&myappender, mywriter));
+  for (int i = 0; i < 2000; i++) {
+    char key[100];
+    char value[100];
+    sprintf(key, "key_%d", i);
+    sprintf(value, "value_%d", i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, strlen(value), (uint8_t*) value));
+    if (i == 1000) {
+      // A flush ends the current checkpoint early
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_flush(mywriter));
+    }
+  }
+  assert_equals(SPARKEY_LOG_NOT_EMPTY, sparkey_logwriter_set_checksums(mywriter, 0));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+
+  // The checkpoints must not get in the way of lookups
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_write("test.spi", "test.spl", 0));
+  sparkey_hashreader *myhashreader;
+  sparkey_logiter *myiter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_open(&myhashreader, "test.spi", "test.spl"));
+  sparkey_logreader *myreader = sparkey_hash_getreader(myhashreader);
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+  for (int i = 0; i < 2000; i += 7) {
+    char key[100];
+    char value[100] = "";
+    char expected[100];
+    uint64_t valuelen;
+    sprintf(key, "key_%d", i);
+    sprintf(expected, "value_%d", i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_get(myhashreader, (uint8_t*) key, strlen(key), myiter));
+    assert_equals(SPARKEY_ITER_ACTIVE, sparkey_logiter_state(myiter));
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_value(myiter, myreader, sizeof(value) - 1, (uint8_t*) value, &valuelen));
+    assert_str_equals(expected, value);
+  }
+  sparkey_logiter_close(&myiter);
+  sparkey_returncode returncode;
+  assert_equals(4000, count_checksummed(myreader, SPARKEY_VERIFY_ALWAYS, &returncode));
+  assert_equals(SPARKEY_SUCCESS, returncode);
+  assert_equals(2000, count_plain_ranges(myreader));
+  sparkey_hash_close(&myhashreader);
+
+  // Damage a value in the middle of the log
+  FILE *fp = fopen("test.spl", "r+b");
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  uint8_t *data = malloc(size);
+  fseek(fp, 0, SEEK_SET);
+  assert_equals(1, fread(data, size, 1, fp));
+  long pos = 0;
+  while (pos + 10 <= size && memcmp(&data[pos], "value_1234", 10) != 0) {
+    pos++;
+  }
+  assert_equals(1, pos + 10 <= size);
+  free(data);
+  fseek(fp, pos + 6, SEEK_SET);
+  assert_equals(1, fwrite("9", 1, 1, fp));
+  fclose(fp);
+
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_open(&myreader, "test.spl"));
+  count_checksummed(myreader, SPARKEY_VERIFY_ALWAYS, &returncode);
+  assert_equals(SPARKEY_CHECKSUM_MISMATCH, returncode);
+  count_checksummed(myreader, SPARKEY_VERIFY_FIRST_ACCESS, &returncode);
+  assert_equals(SPARKEY_CHECKSUM_MISMATCH, returncode);
+  assert_equals(4000, count_checksummed(myreader, SPARKEY_VERIFY_OFF, &returncode));
+  assert_equals(SPARKEY_SUCCESS, returncode);
+  sparkey_logreader_close(&myreader);
+}
+
+void verify_checksums(int sorted) {
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", SPARKEY_COMPRESSION_SNAPPY, 1000));
+  if (sorted) {
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_set_sorted(mywriter, 1024 * 1024));
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_set_checksums(mywriter, 1));
+  for (int i = 0; i < 1000; i++) {
+    char key[100];
+    char value[100];
+    sprintf(key, "key_%d", i);
+    sprintf(value, "value_%d", i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, strlen(value), (uint8_t*) value));
+  }
+  assert_equals(SPARKEY_LOG_NOT_EMPTY, sparkey_logwriter_set_checksums(mywriter, 0));
+  if (!sorted) {
+    sparkey_logappender *myappender;
+    assert_equals(SPARKEY_SUCCESS, sparkey_logappender_create(&myappender, mywriter));
+    for (int i = 1000; i < 2000; i++) {
+      char key[100];
+      char value[100];
+      sprintf(key, "key_%d", i);
+      sprintf(value, "value_%d", i);
+      assert_equals(SPARKEY_SUCCESS, sparkey_logappender_put(myappender, strlen(key), (uint8_t*) key, strlen(value), (uint8_t*) value));
+    }
+    assert_equals(SPARKEY_SUCCESS, sparkey_logappender_close(&myappender));
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+  int expected = sorted ? 1000 : 2000;
+
+  sparkey_logreader *myreader;
+  sparkey_returncode returncode;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_open(&myreader, "test.spl"));
+  assert_equals(SPARKEY_INVALID_ARGUMENT, sparkey_logreader_set_verify(myreader, (sparkey_verify_mode) 42));
+  assert_equals(2 * expected, count_checksummed(myreader, SPARKEY_VERIFY_ALWAYS, &returncode));
+  assert_equals(2 * expected, count_checksummed(myreader, SPARKEY_VERIFY_FIRST_ACCESS, &returncode));
+
+  // Damage the checksum of the second block, which leaves the data itself intact
+  uint64_t boundaries[2];
+  int num_ranges = 1;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_partition(myreader, boundaries, &num_ranges));
+  sparkey_logreader_close(&myreader);
+  FILE *fp = fopen("test.spl", "r+b");
+  uint64_t pos = checksum_position(fp, boundaries[0]) + 4;
+  pos = checksum_position(fp, pos);
+  uint8_t checksum;
+  fseek(fp, pos, SEEK_SET);
+  assert_equals(1, fread(&checksum, 1, 1, fp));
+  checksum ^= 0x5a;
+  fseek(fp, pos, SEEK_SET);
+  assert_equals(1, fwrite(&checksum, 1, 1, fp));
+  fclose(fp);
+
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_open(&myreader, "test.spl"));
+  count_checksummed(myreader, SPARKEY_VERIFY_ALWAYS, &returncode);
+  assert_equals(SPARKEY_CHECKSUM_MISMATCH, returncode);
+  count_checksummed(myreader, SPARKEY_VERIFY_FIRST_ACCESS, &returncode);
+  assert_equals(SPARKEY_CHECKSUM_MISMATCH, returncode);
+  assert_equals(2 * expected, count_checksummed(myreader, SPARKEY_VERIFY_OFF, &returncode));
+  assert_equals(SPARKEY_SUCCESS, returncode);
+  sparkey_logreader_close(&myreader);
+}
+
+typedef struct {
+  sparkey_logreader *reader;
+  sparkey_logiter *iter;
+  int count;
+  int stop_after;
+} batch_state;
+
+static sparkey_returncode check_batch(void *ctx, const sparkey_entry_view *entries, int num_entries) {
+  batch_state *state = ctx;
+  assert_equals(1, num_entries >= 1 && num_entries <= 7);
+  for (int i = 0; i < num_entries; i++) {
+    // Compare with what the regular iterator reads
+    uint8_t key[100];
+    uint8_t value[100];
+    uint64_t keylen, valuelen;
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_next(state->iter, state->reader));
+    assert_equals(SPARKEY_ITER_ACTIVE, sparkey_logiter_state(state->iter));
+    assert_equals(sparkey_logiter_type(state->iter), entries[i].type);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_key(state->iter, state->reader, sizeof(key), key, &keylen));
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_value(state->iter, state->reader, sizeof(value), value, &valuelen));
+    assert_equals(keylen, entries[i].keylen);
+    assert_equals(valuelen, entries[i].valuelen);
+    assert_equals(0, memcmp(key, entries[i].key, keylen));
+    assert_equals(0, valuelen > 0 && memcmp(value, entries[i].value, valuelen));
+    state->count++;
+  }
+  if (state->stop_after > 0 && state->count >= state->stop_after) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+static sparkey_returncode check_batch_in_place(void *ctx, const sparkey_entry_view *entries, int num_entries) {
+  int *count = ctx;
+  for (int i = 1; i < num_entries; i++) {
+    // Entries read from the block follow each other, with only the two byte entry header in between
+    assert_equals(1, entries[i].key == entries[i - 1].value + entries[i - 1].valuelen + 2);
+  }
+  *count += num_entries;
+  return SPARKEY_SUCCESS;
+}
+
+void verify_foreach_batch_in_place() {
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", SPARKEY_COMPRESSION_SNAPPY, 100));
+  // Entries of 18 bytes never continue into the next block
+  for (int i = 0; i < 500; i++) {
+    char key[100];
+    char value[100];
+    sprintf(key, "key_%03d", i);
+    sprintf(value, "value_%03d", i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, strlen(value), (uint8_t*) value));
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+
+  sparkey_logreader *myreader;
+  sparkey_logiter *myiter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_open(&myreader, "test.spl"));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+  int count = 0;
+  assert_equals(SPARKEY_INVALID_ARGUMENT, sparkey_logiter_foreach_batch(myiter, myreader, 0, check_batch_in_place, &count));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_foreach_batch(myiter, myreader, 7, check_batch_in_place, &count));
+  assert_equals(500, count);
+  sparkey_logiter_close(&myiter);
+  sparkey_logreader_close(&myreader);
+}
+
+void verify_foreach_batch(sparkey_compression_type compression, int blocksize, int sorted) {
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", compression, blocksize));
+  if (sorted) {
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_set_sorted(mywriter, 1024 * 1024));
+  }
+  for (int i = 0; i < 2000; i++) {
+    char key[100];
+    char value[100];
+    sprintf(key, "key_%d", i);
+    // Vary the sizes so that entries end up split between blocks
+    sprintf(value, "value_%0*d", i % 50, i);
+    if (i % 10 == 3) {
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_delete(mywriter, strlen(key), (uint8_t*) key));
+    } else {
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, strlen(value), (uint8_t*) value));
+    }
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+
+  batch_state state;
+  sparkey_logiter *myiter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_open(&state.reader, "test.spl"));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, state.reader));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&state.iter, state.reader));
+  state.count = 0;
+  state.stop_after = 0;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_foreach_batch(myiter, state.reader, 7, check_batch, &state));
+  assert_equals(2000, state.count);
+  assert_equals(SPARKEY_ITER_CLOSED, sparkey_logiter_state(myiter));
+  sparkey_logiter_close(&myiter);
+  sparkey_logiter_close(&state.iter);
+
+  // Stopping leaves the iterator after the last entry it handed out, and the scan can be resumed
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, state.reader));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&state.iter, state.reader));
+  state.count = 0;
+  state.stop_after = 500;
+  assert_equals(SPARKEY_INTERNAL_ERROR, sparkey_logiter_foreach_batch(myiter, state.reader, 7, check_batch, &state));
+  assert_equals(SPARKEY_ITER_ACTIVE, sparkey_logiter_state(myiter));
+  int stopped = state.count;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_next(myiter, state.reader));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_next(state.iter, state.reader));
+  char key[100] = "";
+  char expected[100] = "";
+  uint64_t keylen;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_key(myiter, state.reader, sizeof(key) - 1, (uint8_t*) key, &keylen));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_key(state.iter, state.reader, sizeof(expected) - 1, (uint8_t*) expected, &keylen));
+  assert_str_equals(expected, key);
+  state.count++;
+  state.stop_after = 0;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_foreach_batch(myiter, state.reader, 7, check_batch, &state));
+  assert_equals(1, stopped >= 500);
+  assert_equals(2000, state.count);
+  sparkey_logiter_close(&myiter);
+  sparkey_logiter_close(&state.iter);
+  sparkey_logreader_close(&state.reader);
+}
+
+static uint8_t * read_file(const char *filename, uint64_t *len) {
+  FILE *fp = fopen(filename, "rb");
+  fseek(fp, 0, SEEK_END);
+  *len = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  uint8_t *data = malloc(*len);
+  assert_equals(1, fread(data, *len, 1, fp));
+  fclose(fp);
+  return data;
+}
+
+static void verify_lookups(sparkey_hashreader *myhash, int num_puts) {
+  sparkey_logreader *myreader = sparkey_hash_getreader(myhash);
+  sparkey_logiter *myiter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+  for (int i = 0; i < num_puts + 10; i++) {
+    char key[100];
+    char expected[100];
+    char value[100] = "";
+    uint64_t valuelen;
+    sprintf(key, "key_%d", i);
+    sprintf(expected, "value_%d", i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_get(myhash, (uint8_t*) key, strlen(key), myiter));
+    if (i >= num_puts) {
+      assert_equals(SPARKEY_ITER_INVALID, sparkey_logiter_state(myiter));
+      continue;
+    }
+    assert_equals(SPARKEY_ITER_ACTIVE, sparkey_logiter_state(myiter));
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_value(myiter, myreader, sizeof(value) - 1, (uint8_t*) value, &valuelen));
+    assert_str_equals(expected, value);
+  }
+  sparkey_logiter_close(&myiter);
+}
+
+void verify_open_fd_mem(sparkey_compression_type compression, int blocksize) {
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", compression, blocksize));
+  for (int i = 0; i < 1000; i++) {
+    char key[100];
+    char value[100];
+    sprintf(key, "key_%d", i);
+    sprintf(value, "value_%d", i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, strlen(value), (uint8_t*) value));
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_write("test.spi", "test.spl", 0));
+
+  // The reader keeps working after the caller closes its descriptors
+  sparkey_hashreader *myhash;
+  int hash_fd = open("test.spi", O_RDONLY);
+  int log_fd = open("test.spl", O_RDONLY);
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_open_fd(&myhash, hash_fd, log_fd));
+  close(hash_fd);
+  close(log_fd);
+  verify_lookups(myhash, 1000);
+  sparkey_hash_close(&myhash);
+
+  log_fd = open("test.spl", O_RDONLY);
+  sparkey_logreader *myreader;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_open_fd(&myreader, log_fd));
+  close(log_fd);
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_refresh(myreader));
+  sparkey_logreader_close(&myreader);
+
+  uint64_t hash_len, log_len;
+  uint8_t *hash_data = read_file("test.spi", &hash_len);
+  uint8_t *log_data = read_file("test.spl", &log_len);
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_open_mem(&myhash, hash_data, hash_len, log_data, log_len));
+  verify_lookups(myhash, 1000);
+  assert_equals(SPARKEY_INVALID_ARGUMENT, sparkey_logreader_refresh(sparkey_hash_getreader(myhash)));
+  sparkey_hash_close(&myhash);
+
+  assert_equals(SPARKEY_HASH_TOO_SMALL, sparkey_hash_open_mem(&myhash, hash_data, hash_len - 1, log_data, log_len));
+  assert_equals(SPARKEY_LOG_TOO_SMALL, sparkey_hash_open_mem(&myhash, hash_data, hash_len, log_data, log_len - 1));
+  free(hash_data);
+  free(log_data);
+}
+
+static void write_log_and_hash(int num_puts, sparkey_compression_type compression, int blocksize) {
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", compression, blocksize));
+  for (int i = 0; i < num_puts; i++) {
+    char key[100];
+    char value[100];
+    sprintf(key, "key_%d", i);
+    sprintf(value, "value_%d", i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, strlen(value), (uint8_t*) value));
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_write("test.spi", "test.spl", 0));
+}
+
+void verify_pack(sparkey_compression_type compression, int blocksize) {
+  write_log_and_hash(1000, compression, blocksize);
+  assert_equals(SPARKEY_SUCCESS, sparkey_pack("test.spk", "test.spi", "test.spl"));
+  struct stat st;
+  assert_equals(0, stat("test.spk", &st));
+  assert_equals(00644, st.st_mode & 0777);
+
+  sparkey_hashreader *myhash;
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_open_pack(&myhash, "test.spk"));
+  verify_lookups(myhash, 1000);
+
+  // Replacing the pack doesn't affect readers of the previous one
+  write_log_and_hash(2000, compression, blocksize);
+  assert_equals(SPARKEY_SUCCESS, sparkey_pack("test.spk", "test.spi", "test.spl"));
+  verify_lookups(myhash, 1000);
+  sparkey_hash_close(&myhash);
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_open_pack(&myhash, "test.spk"));
+  verify_lookups(myhash, 2000);
+  sparkey_hash_close(&myhash);
+
+  assert_equals(SPARKEY_WRONG_PACK_MAGIC_NUMBER, sparkey_hash_open_pack(&myhash, "test.spi"));
+
+  uint64_t pack_len;
+  uint8_t *pack_data = read_file("test.spk", &pack_len);
+  FILE *fp = fopen("test.spk", "w");
+  assert_equals(pack_len - 1, fwrite(pack_data, 1, pack_len - 1, fp));
+  fclose(fp);
+  assert_equals(SPARKEY_PACK_CORRUPT, sparkey_hash_open_pack(&myhash, "test.spk"));
+  free(pack_data);
+}
+
+typedef struct {
+  sparkey_hash_handle *handle;
+  int stop;
+} handle_args;
+
+// Every version of the pack has key_0 .. key_{n-1}, so the last key must be found in whatever version is pinned.
+static void * handle_reader(void *arg) {
+  handle_args *args = arg;
+  while (!__atomic_load_n(&args->stop, __ATOMIC_ACQUIRE)) {
+    sparkey_hashreader *myhash;
+    int pin;
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_handle_pin(args->handle, &myhash, &pin));
+    sparkey_logreader *myreader = sparkey_hash_getreader(myhash);
+    sparkey_logiter *myiter;
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+    char key[100];
+    sprintf(key, "key_%"PRIu64, sparkey_hash_numentries(myhash) - 1);
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_get(myhash, (uint8_t*) key, strlen(key), myiter));
+    assert_equals(SPARKEY_ITER_ACTIVE, sparkey_logiter_state(myiter));
+    sparkey_logiter_close(&myiter);
+    sparkey_hash_handle_unpin(args->handle, pin);
+  }
+  return NULL;
+}
+
+static void write_pack_version(int num_puts) {
+  write_log_and_hash(num_puts, SPARKEY_COMPRESSION_SNAPPY, 100);
+  assert_equals(SPARKEY_SUCCESS, sparkey_pack("handle.spk", "test.spi", "test.spl"));
+}
+
+static uint64_t pinned_numentries(sparkey_hash_handle *handle) {
+  sparkey_hashreader *myhash;
+  int pin;
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_handle_pin(handle, &myhash, &pin));
+  uint64_t num_entries = sparkey_hash_numentries(myhash);
+  sparkey_hash_handle_unpin(handle, pin);
+  return num_entries;
+}
+
+void verify_hash_handle() {
+  write_log_and_hash(100, SPARKEY_COMPRESSION_NONE, 0);
+  sparkey_hash_handle *handle;
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_handle_open(&handle, "test.spi", "test.spl"));
+
+  // A pinned reader stays usable across reloads
+  sparkey_hashreader *pinned;
+  int pin;
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_handle_pin(handle, &pinned, &pin));
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_handle_reload(handle));
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_handle_reload(handle));
+  verify_lookups(pinned, 100);
+  sparkey_hash_handle_unpin(handle, pin);
+
+  // Pins are limited, running out is an error rather than a wait
+  int pins[1000];
+  int num_pins = 0;
+  sparkey_returncode returncode;
+  while ((returncode = sparkey_hash_handle_pin(handle, &pinned, &pins[num_pins])) == SPARKEY_SUCCESS) {
+    num_pins++;
+    assert_equals(1, num_pins < 1000);
+  }
+  assert_equals(SPARKEY_TOO_MANY_PINS, returncode);
+  for (int i = 0; i < num_pins; i++) {
+    sparkey_hash_handle_unpin(handle, pins[i]);
+  }
+  sparkey_hash_handle_close(&handle);
+  assert_equals(1, handle == NULL);
+
+  // Lookups keep running while new versions are published
+  write_pack_version(1000);
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_handle_open(&handle, "handle.spk", NULL));
+  handle_args args = {handle, 0};
+  pthread_t threads[4];
+  for (int t = 0; t < 4; t++) {
+    assert_equals(0, pthread_create(&threads[t], NULL, handle_reader, &args));
+  }
+  for (int v = 1; v <= 10; v++) {
+    write_pack_version(1000 + v * 10);
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_handle_reload(handle));
+  }
+  __atomic_store_n(&args.stop, 1, __ATOMIC_RELEASE);
+  for (int t = 0; t < 4; t++) {
+    assert_equals(0, pthread_join(threads[t], NULL));
+  }
+  assert_equals(1100, pinned_numentries(handle));
+
+  // The watcher picks up a replaced pack by itself
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_handle_watch(handle));
+  write_pack_version(1200);
+  for (int i = 0; i < 500 && pinned_numentries(handle) != 1200; i++) {
+    usleep(10 * 1000);
+  }
+  assert_equals(1200, pinned_numentries(handle));
+  sparkey_hash_handle_close(&handle);
+  unlink("handle.spk");
+}
+
+static void * lookup_sharded(void *arg) {
+  sparkey_sharded_reader *reader = arg;
+  sparkey_sharded_iter *sharded_iter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_sharded_iter_create(&sharded_iter, reader));
+  for (int i = 0; i < 1000; i++) {
+    char key[100];
+    char value[100];
+    char expected[100];
+    uint64_t valuelen;
+    sparkey_logiter *iter;
+    sparkey_logreader *log;
+    sprintf(key, "key_%d", i);
+    sprintf(expected, "value_%d", i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_sharded_get(reader, (uint8_t*) key, strlen(key), sharded_iter, &iter, &log));
+    if (i % 10 == 0) {
+      assert_equals(SPARKEY_ITER_INVALID, sparkey_logiter_state(iter));
+      continue;
+    }
+    assert_equals(SPARKEY_ITER_ACTIVE, sparkey_logiter_state(iter));
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_value(iter, log, sizeof(value) - 1, (uint8_t*) value, &valuelen));
+    value[valuelen] = 0;
+    assert_str_equals(expected, value);
+  }
+  sparkey_sharded_iter_close(&sharded_iter);
+  return NULL;
+}
+
+void verify_sharded(int num_shards) {
+  sparkey_sharded_writer *writer;
+  assert_equals(SPARKEY_INVALID_ARGUMENT, sparkey_sharded_create(&writer, "sharded.spm", 0, SPARKEY_COMPRESSION_SNAPPY, 100));
+  assert_equals(SPARKEY_SUCCESS, sparkey_sharded_create(&writer, "sharded.spm", num_shards, SPARKEY_COMPRESSION_SNAPPY, 100));
+  for (int i = 0; i < 1000; i++) {
+    char key[100];
+    char value[100];
+    sprintf(key, "key_%d", i);
+    sprintf(value, "value_%d", i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_sharded_put(writer, strlen(key), (uint8_t*) key, strlen(value), (uint8_t*) value));
+  }
+  for (int i = 0; i < 1000; i += 10) {
+    char key[100];
+    sprintf(key, "key_%d", i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_sharded_delete(writer, strlen(key), (uint8_t*) key));
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_sharded_writer_close(&writer));
+  assert_equals(SPARKEY_SUCCESS, sparkey_sharded_hash_write("sharded.spm", 3));
+
+  sparkey_sharded_reader *reader;
+  assert_equals(SPARKEY_SUCCESS, sparkey_sharded_open(&reader, "sharded.spm"));
+  assert_equals(num_shards, sparkey_sharded_numshards(reader));
+  uint64_t num_entries = 0;
+  for (int s = 0; s < num_shards; s++) {
+    sparkey_hashreader *shard = sparkey_sharded_getshard(reader, s);
+    num_entries += sparkey_hash_numentries(shard);
+    // Every shard gets a fair share of the keys
+    assert_equals(1, num_shards == 1 || sparkey_hash_numentries(shard) < (uint64_t) (900 / num_shards * 2));
+  }
+  assert_equals(900, num_entries);
+
+  // Lookups from several threads share the reader, each with its own iterator
+  pthread_t threads[4];
+  for (int t = 0; t < 4; t++) {
+    assert_equals(0, pthread_create(&threads[t], NULL, lookup_sharded, reader));
+  }
+  for (int t = 0; t < 4; t++) {
+    pthread_join(threads[t], NULL);
+  }
+  sparkey_sharded_reader_close(&reader);
+
+  // A shard indexed with its own seed can't be routed to
+  char log_filename[100];
+  char hash_filename[100];
+  sprintf(log_filename, "sharded-%d.spl", num_shards - 1);
+  sprintf(hash_filename, "sharded-%d.spi", num_shards - 1);
+  unlink(hash_filename);
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_write(hash_filename, log_filename, 8));
+  assert_equals(SPARKEY_SHARD_MISMATCH, sparkey_sharded_open(&reader, "sharded.spm"));
+
+  for (int s = 0; s < num_shards; s++) {
+    sprintf(log_filename, "sharded-%d.spl", s);
+    sprintf(hash_filename, "sharded-%d.spi", s);
+    unlink(log_filename);
+    unlink(hash_filename);
+  }
+  unlink("sharded.spm");
+}
+
+void verify_stats() {
+  write_log_and_hash(1000, SPARKEY_COMPRESSION_SNAPPY, 100);
+  sparkey_hashreader *myhash;
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_open(&myhash, "test.spi", "test.spl"));
+  verify_lookups(myhash, 1000);
+
+  sparkey_reader_stats stats;
+#ifdef SPARKEY_STATS
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_stats(myhash, &stats));
+  assert_equals(1010, stats.lookups);
+  assert_equals(1000, stats.hits);
+  assert_equals(10, stats.misses);
+  uint64_t probes = 0;
+  for (int i = 0; i < SPARKEY_PROBE_HISTOGRAM_SIZE; i++) {
+    probes += stats.probe_lengths[i];
+  }
+  assert_equals(1010, probes);
+  assert_equals(1, stats.blocks_decompressed > 0);
+  assert_equals(1, stats.bytes_decompressed > stats.blocks_decompressed);
+  assert_equals(1, stats.entries_skipped > 0);
+#else
+  assert_equals(SPARKEY_STATS_DISABLED, sparkey_hash_stats(myhash, &stats));
+#endif
+  sparkey_hash_close(&myhash);
+}
+
+void verify_analyze() {
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", SPARKEY_COMPRESSION_SNAPPY, 100));
+  char value[300];
+  memset(value, 'v', sizeof(value));
+  for (int i = 0; i < 1000; i++) {
+    char key[100];
+    sprintf(key, "key_%d", i);
+    // Every tenth value is larger than a block
+    int valuelen = i % 10 == 0 ? 300 : 10;
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, valuelen, (uint8_t*) value));
+  }
+  for (int i = 0; i < 100; i++) {
+    char key[100];
+    sprintf(key, "key_%d", i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_delete(mywriter, strlen(key), (uint8_t*) key));
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_write("test.spi", "test.spl", 0));
+
+  sparkey_analysis single;
+  sparkey_analysis parallel;
+  assert_equals(SPARKEY_SUCCESS, sparkey_analyze(&single, "test.spi", "test.spl", 1));
+  assert_equals(SPARKEY_SUCCESS, sparkey_analyze(&parallel, "test.spi", "test.spl", 4));
+  assert_equals(1000, single.puts);
+  assert_equals(100, single.deletes);
+  assert_equals(900, single.displacement.count);
+  assert_equals(1100, single.key_size.count);
+  assert_equals(1000, single.value_size.count);
+  assert_equals(300, single.value_size.max);
+  assert_equals(1, single.split_entries >= 100);
+  assert_equals(1, single.garbage_size > 0);
+  assert_equals(1100, single.block_entries.sum);
+
+  // Splitting the scan doesn't change the results
+  assert_equals(single.split_entries, parallel.split_entries);
+  assert_equals(single.block_stored_size.count, parallel.block_stored_size.count);
+  assert_equals(single.block_stored_size.sum, parallel.block_stored_size.sum);
+  assert_equals(single.block_entries.sum, parallel.block_entries.sum);
+  assert_equals(single.value_size.sum, parallel.value_size.sum);
+}
+
 int main() {
   verify(SPARKEY_COMPRESSION_NONE, 0, 0, 0, 0, 0);
   verify(SPARKEY_COMPRESSION_NONE, 0, 0, 1, 0, 0);
@@ -249,6 +1716,68 @@ int main() {
   verify(SPARKEY_COMPRESSION_SNAPPY, 100, 4, 1000, 0, 0);
   verify(SPARKEY_COMPRESSION_SNAPPY, 100, 8, 1000, 0, 0);
 
+  verify_direct_io(SPARKEY_COMPRESSION_NONE, 0, 100);
+  verify_direct_io(SPARKEY_COMPRESSION_NONE, 0, 200000);
+  verify_direct_io(SPARKEY_COMPRESSION_SNAPPY, 1000, 200000);
+
+  verify_packing();
+
+  verify_durability(SPARKEY_DURABILITY_NONE, SPARKEY_COMPRESSION_NONE, 0, 0);
+  verify_durability(SPARKEY_DURABILITY_FDATASYNC, SPARKEY_COMPRESSION_NONE, 0, 0);
+  verify_durability(SPARKEY_DURABILITY_FDATASYNC, SPARKEY_COMPRESSION_SNAPPY, 100, 1);
+  verify_durability(SPARKEY_DURABILITY_GROUP_COMMIT, SPARKEY_COMPRESSION_NONE, 0, 0);
+  verify_durability(SPARKEY_DURABILITY_GROUP_COMMIT, SPARKEY_COMPRESSION_SNAPPY, 100, 0);
+  verify_durability(SPARKEY_DURABILITY_GROUP_COMMIT, SPARKEY_COMPRESSION_SNAPPY, 100, 1);
+
+  verify_appenders(SPARKEY_COMPRESSION_NONE, 0);
+  verify_appenders(SPARKEY_COMPRESSION_SNAPPY, 100);
+  verify_appenders(SPARKEY_COMPRESSION_SNAPPY, 4096);
+  verify_appender_flush_failure(SPARKEY_COMPRESSION_NONE, 0);
+  verify_appender_flush_failure(SPARKEY_COMPRESSION_SNAPPY, 4096);
+
+  verify_sorted();
+
+  verify_ranges(SPARKEY_COMPRESSION_NONE, 0);
+  verify_ranges(SPARKEY_COMPRESSION_SNAPPY, 100);
+  verify_ranges(SPARKEY_COMPRESSION_SNAPPY, 1000);
+
+  verify_access_pattern(SPARKEY_COMPRESSION_NONE, 0);
+  verify_access_pattern(SPARKEY_COMPRESSION_SNAPPY, 4096);
+
+  verify_blockindex(100, 0);
+  verify_blockindex(1000, 0);
+  verify_blockindex(1000, 1);
+
+  verify_refresh(SPARKEY_COMPRESSION_NONE, 0);
+  verify_refresh(SPARKEY_COMPRESSION_SNAPPY, 100);
+  verify_refresh(SPARKEY_COMPRESSION_SNAPPY, 4096);
+  verify_refresh_format();
+
+  verify_checksums(0);
+  verify_checksums(1);
+  verify_plain_checksums();
+
+  verify_foreach_batch(SPARKEY_COMPRESSION_NONE, 0, 0);
+  verify_foreach_batch(SPARKEY_COMPRESSION_SNAPPY, 100, 0);
+  verify_foreach_batch(SPARKEY_COMPRESSION_SNAPPY, 4096, 0);
+  verify_foreach_batch(SPARKEY_COMPRESSION_SNAPPY, 100, 1);
+  verify_foreach_batch_in_place();
+
+  verify_open_fd_mem(SPARKEY_COMPRESSION_NONE, 0);
+  verify_open_fd_mem(SPARKEY_COMPRESSION_SNAPPY, 100);
+
+  verify_pack(SPARKEY_COMPRESSION_NONE, 0);
+  verify_pack(SPARKEY_COMPRESSION_SNAPPY, 100);
+
+  verify_hash_handle();
+
+  verify_sharded(1);
+  verify_sharded(4);
+
+  verify_stats();
+
+  verify_analyze();
+
   printf("Success!\n");
 }
 
@@ -41,6 +41,18 @@ int main() {
   assert_equals(NULL, sparkey_create_log_filename(".spx"));
   assert_equals("foo.spl", sparkey_create_log_filename("foo.spi"));
 
+  assert_equals(NULL, sparkey_create_blockindex_filename(NULL));
+  assert_equals(NULL, sparkey_create_blockindex_filename("spl"));
+  assert_equals(".spb", sparkey_create_blockindex_filename(".spl"));
+  assert_equals(NULL, sparkey_create_blockindex_filename("foo.spi"));
+  assert_equals("foo.spb", sparkey_create_blockindex_filename("foo.spl"));
+
+  assert_equals(NULL, sparkey_create_pack_filename(NULL));
+  assert_equals(NULL, sparkey_create_pack_filename("spi"));
+  assert_equals(".spk", sparkey_create_pack_filename(".spi"));
+  assert_equals(NULL, sparkey_create_pack_filename("foo.spl"));
+  assert_equals("foo.spk", sparkey_create_pack_filename("foo.spi"));
+
   printf("Success!\n");
 }
 
@@ -26,6 +26,42 @@ void assert_equals(int64_t expected, int64_t actual) {
   }
 }
 
+static uint64_t test_value(int i) {
+  // Cover every encoded length from 1 to 10 bytes, including the edges between them
+  int bits = i % 65;
+  uint64_t base = bits == 64 ? UINT64_MAX : (((uint64_t) 1) << bits) - 1;
+  switch ((i / 65) % 3) {
+  case 0: return base;
+  case 1: return base + 1;
+  default: return base ^ (base >> 3);
+  }
+}
+
+static void verify_pair(uint64_t a, uint64_t b, int padding) {
+  uint8_t buf[40];
+  memset(buf, 0xff, sizeof(buf));
+  uint64_t len = write_vlq(buf, a);
+  len += write_vlq(buf + len, b);
+
+  // Data ending right after the values forces the fallback, trailing data allows the fast path
+  uint64_t pos = 0;
+  uint64_t a2, b2;
+  read_vlq_pair(buf, &pos, len + padding, &a2, &b2);
+  assert_equals(len, pos);
+  assert_equals(a, a2);
+  assert_equals(b, b2);
+
+  // Offset reads must decode the same values
+  uint8_t buf2[48];
+  memset(buf2, 0, sizeof(buf2));
+  memcpy(buf2 + 3, buf, len);
+  pos = 3;
+  read_vlq_pair(buf2, &pos, 3 + len + padding, &a2, &b2);
+  assert_equals(3 + len, pos);
+  assert_equals(a, a2);
+  assert_equals(b, b2);
+}
+
 int main() {
   uint8_t buf[20];
   for (int64_t i = 0; i < 60; i++) {
@@ -48,6 +84,19 @@ int main() {
   assert_equals(3, write_vlq(buf, 16384));
   assert_equals(3, write_vlq(buf, 2097151));
   assert_equals(4, write_vlq(buf, 2097152));
+
+  for (int i = 0; i < 195; i++) {
+    for (int j = 0; j < 195; j++) {
+      for (int padding = 0; padding <= 8; padding += 4) {
+        verify_pair(test_value(i), test_value(j), padding);
+      }
+    }
+  }
+  for (int i = 0; i < 100000; i++) {
+    uint64_t a = (((uint64_t) rand()) << 33) ^ (((uint64_t) rand()) << 11) ^ rand();
+    uint64_t b = ((uint64_t) rand()) >> (rand() % 31);
+    verify_pair(a >> (rand() % 64), b, rand() % 9);
+  }
   printf("Success!\n");
 }
 
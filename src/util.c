@@ -64,6 +64,17 @@ sparkey_returncode sparkey_remove_returncode(int e) {
   }
 }
 
+sparkey_returncode sparkey_write_returncode(int e) {
+  switch (e) {
+  case ENOSPC: return SPARKEY_OUT_OF_DISK;
+  case EFBIG: return SPARKEY_FILE_SIZE_EXCEEDED;
+  case EBADF: return SPARKEY_FILE_CLOSED;
+  default:
+    printf("_sparkey_write_returncode():%d error: errno = %d\n", __LINE__, e);
+    return SPARKEY_INTERNAL_ERROR;
+  }
+}
+
 char * sparkey_create_log_filename(const char *index_filename) {
   if (index_filename == NULL) return NULL;
   size_t l = strlen(index_filename);
@@ -83,3 +94,41 @@ char * sparkey_create_log_filename(const char *index_filename) {
   return log_filename;
 }
 
+char * sparkey_create_blockindex_filename(const char *log_filename) {
+  if (log_filename == NULL) return NULL;
+  size_t l = strlen(log_filename);
+
+  // Paranoia - avoid ridiculously long filenames.
+  if (l > 10000) return NULL;
+
+  // Too short to contain .spl
+  if (l < 4) return NULL;
+
+  if (memcmp(&log_filename[l - 4], ".spl", 4)) return NULL;
+
+  char *index_filename = strdup(log_filename);
+  if (index_filename == NULL) return NULL;
+
+  index_filename[l - 1] = 'b';
+  return index_filename;
+}
+
+
+char * sparkey_create_pack_filename(const char *index_filename) {
+  if (index_filename == NULL) return NULL;
+  size_t l = strlen(index_filename);
+
+  // Paranoia - avoid ridiculously long filenames.
+  if (l > 10000) return NULL;
+
+  // Too short to contain .spi
+  if (l < 4) return NULL;
+
+  if (memcmp(&index_filename[l - 4], ".spi", 4)) return NULL;
+
+  char *pack_filename = strdup(index_filename);
+  if (pack_filename == NULL) return NULL;
+
+  pack_filename[l - 1] = 'k';
+  return pack_filename;
+}
@@ -61,6 +61,13 @@ sparkey_returncode sparkey_create_returncode(int e);
  */
 sparkey_returncode sparkey_remove_returncode(int e);
 
+/**
+ * Convert error codes generated by write, pwrite and ftruncate into sparkey return codes.
+ * @param e an error code
+ * @returns a sparkey_returncode corresponding to the error, or SPARKEY_INTERNAL_ERROR
+ */
+sparkey_returncode sparkey_write_returncode(int e);
+
 /**
  * Fetches a 32 bit unsigned value from a pseudorandom source.
  *
@@ -0,0 +1,137 @@
+/*
+* Copyright (c) 2012-2013 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#ifndef SPARKEY_VLQ_H_INCLUDED
+#define SPARKEY_VLQ_H_INCLUDED
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Writes value as a variable length quantity, 7 bits per byte with the lowest bits first.
+ * @param buf destination, must have room for at least 10 bytes.
+ * @returns the number of bytes written.
+ */
+static inline int write_vlq(uint8_t *buf, uint64_t value) {
+  int count = 1;
+  while (value >= 1 << 7) {
+    *buf = (value & 0x7f) | 0x80;
+    value >>= 7;
+    count++;
+    buf++;
+  }
+  *buf = value;
+  return count;
+}
+
+/**
+ * Reads a variable length quantity written by write_vlq.
+ * @param array the data to read from.
+ * @param position offset in array, is moved past the value.
+ * @returns the value.
+ */
+static inline uint64_t read_vlq(uint8_t * array, uint64_t *position) {
+  uint64_t res = 0;
+  uint64_t shift = 0;
+  uint64_t tmp, tmp2;
+  while (1) {
+    tmp = array[(*position)++];
+    tmp2 = tmp & 0x7f;
+    if (tmp == tmp2) {
+      return res | tmp << shift;
+    }
+    res |= tmp2 << shift;
+    shift += 7;
+  }
+  return res;
+}
+
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define VLQ_FAST_PATH 1
+
+#define VLQ_STOP_BITS 0x8080808080808080ULL
+#define VLQ_DATA_BITS 0x7f7f7f7f7f7f7f7fULL
+
+/**
+ * Packs the low 7 bits of each byte in x into a single value, with the first byte lowest.
+ */
+static inline uint64_t vlq_compact(uint64_t x) {
+#if defined(__BMI2__)
+  return _pext_u64(x, VLQ_DATA_BITS);
+#else
+  x &= VLQ_DATA_BITS;
+  x = ((x & 0x7f007f007f007f00ULL) >> 1) | (x & 0x007f007f007f007fULL);
+  x = ((x & 0x3fff00003fff0000ULL) >> 2) | (x & 0x00003fff00003fffULL);
+  x = ((x & 0x0fffffff00000000ULL) >> 4) | (x & 0x000000000fffffffULL);
+  return x;
+#endif
+}
+
+/**
+ * Decodes the first value in the little endian word w, if it is complete.
+ * @returns the number of bytes used, or 0 if the value does not end within w.
+ */
+static inline int vlq_decode_word(uint64_t w, int avail, uint64_t *value) {
+  uint64_t stops = ~w & VLQ_STOP_BITS;
+  if (avail < 8) {
+    stops &= (1ULL << (8 * avail)) - 1;
+  }
+  if (stops == 0) {
+    return 0;
+  }
+  int len = (__builtin_ctzll(stops) >> 3) + 1;
+  *value = vlq_compact(len == 8 ? w : w & ((1ULL << (8 * len)) - 1));
+  return len;
+}
+#endif
+
+/**
+ * Reads two consecutive variable length quantities, such as the header of a log entry.
+ * Equivalent to calling read_vlq twice, but decodes both from a single 8 byte load when possible.
+ * @param array the data to read from.
+ * @param position offset in array, is moved past both values.
+ * @param end the end of the valid data in array. No bytes past it are loaded on the fast path.
+ * @param a set to the first value.
+ * @param b set to the second value.
+ */
+static inline void read_vlq_pair(uint8_t * array, uint64_t *position, uint64_t end, uint64_t *a, uint64_t *b) {
+#ifdef VLQ_FAST_PATH
+  if (*position + 8 <= end) {
+    uint64_t w;
+    memcpy(&w, &array[*position], 8);
+    int len1 = vlq_decode_word(w, 8, a);
+    if (len1 > 0) {
+      int len2 = len1 < 8 ? vlq_decode_word(w >> (8 * len1), 8 - len1, b) : 0;
+      if (len2 > 0) {
+        *position += len1 + len2;
+        return;
+      }
+      *position += len1;
+      *b = read_vlq(array, position);
+      return;
+    }
+  }
+#else
+  (void) end;
+#endif
+  *a = read_vlq(array, position);
+  *b = read_vlq(array, position);
+}
+
+#endif